@@ -0,0 +1,541 @@
+/*
+ * Copyright (c) 2026, Matroska (non-profit organisation)
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#define _POSIX_C_SOURCE 200809L // clock_gettime and posix_spawn
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mkvgen.h"
+#include <corec/helpers/file/streams.h>
+#include <corec/str/str.h>
+#include <corec/helpers/parser/parser.h>
+
+#ifdef TARGET_WIN
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+extern char **environ;
+#endif
+
+void DebugMessage(const tchar_t* Msg,...)
+{
+    va_list Args;
+    tchar_t Buffer[1024];
+
+    va_start(Args,Msg);
+    vstprintf_s(Buffer,TSIZEOF(Buffer), Msg, Args);
+    va_end(Args);
+    tcscat_s(Buffer,TSIZEOF(Buffer),T("\r\n"));
+
+#ifdef UNICODE
+    fprintf(stderr, "%ls", Buffer);
+#else
+    fprintf(stderr, "%s", Buffer);
+#endif
+}
+
+#define VIDEO(size,jitter,comp,strip)   {MATROSKA_TRACK_TYPE_VIDEO, "V_MPEG4/ISO/ASP", 40000000, size, jitter, 1, 50, comp, strip, MKVGEN_SIZE_UNIFORM, 0}
+#define AUDIO(codec,dur,size,jitter,lace,comp,strip)  {MATROSKA_TRACK_TYPE_AUDIO, codec, dur, size, jitter, lace, 0, comp, strip, MKVGEN_SIZE_UNIFORM, 0}
+#define SUBTITLE(comp)                  {MATROSKA_TRACK_TYPE_SUBTITLE, "S_TEXT/UTF8", 2000000000, 40, 20, 1, 0, comp, 0, MKVGEN_SIZE_UNIFORM, 0}
+
+static const mkvgen_track TracksAV[] = {
+    VIDEO(12000, 4000, MATROSKA_TRACK_ENCODING_COMP_NONE, 0),
+    AUDIO("A_MPEG/L3", 24000000, 400, 100, 1, MATROSKA_TRACK_ENCODING_COMP_NONE, 0),
+};
+static const mkvgen_track TracksFixedLacing[] = {
+    AUDIO("A_AC3", 32000000, 768, 0, 8, MATROSKA_TRACK_ENCODING_COMP_NONE, 0),
+};
+static const mkvgen_track TracksXiphLacing[] = {
+    AUDIO("A_MPEG/L3", 24000000, 150, 100, 8, MATROSKA_TRACK_ENCODING_COMP_NONE, 0),
+};
+static const mkvgen_track TracksEbmlLacing[] = {
+    AUDIO("A_DTS", 10666666, 3000, 500, 4, MATROSKA_TRACK_ENCODING_COMP_NONE, 0),
+};
+static const mkvgen_track TracksMulti[] = {
+    VIDEO(12000, 4000, MATROSKA_TRACK_ENCODING_COMP_NONE, 0),
+    AUDIO("A_MPEG/L3", 24000000, 400, 100, 1, MATROSKA_TRACK_ENCODING_COMP_NONE, 0),
+    AUDIO("A_AC3", 32000000, 768, 0, 1, MATROSKA_TRACK_ENCODING_COMP_NONE, 0),
+    AUDIO("A_AC3", 32000000, 768, 0, 1, MATROSKA_TRACK_ENCODING_COMP_NONE, 0),
+    AUDIO("A_MPEG/L3", 24000000, 150, 100, 4, MATROSKA_TRACK_ENCODING_COMP_NONE, 0),
+    SUBTITLE(MATROSKA_TRACK_ENCODING_COMP_NONE),
+    SUBTITLE(MATROSKA_TRACK_ENCODING_COMP_NONE),
+};
+static const mkvgen_track TracksZlib[] = {
+    VIDEO(12000, 4000, MATROSKA_TRACK_ENCODING_COMP_NONE, 0),
+    AUDIO("A_MPEG/L3", 24000000, 400, 100, 1, MATROSKA_TRACK_ENCODING_COMP_ZLIB, 0),
+    SUBTITLE(MATROSKA_TRACK_ENCODING_COMP_ZLIB),
+};
+static const mkvgen_track TracksHeaderStrip[] = {
+    VIDEO(12000, 4000, MATROSKA_TRACK_ENCODING_COMP_HEADERSTRIP, 4),
+    AUDIO("A_MPEG/L3", 24000000, 400, 100, 1, MATROSKA_TRACK_ENCODING_COMP_HEADERSTRIP, 2),
+};
+static const mkvgen_track TracksBlockGroups[] = {
+    {MATROSKA_TRACK_TYPE_VIDEO, "V_MPEG4/ISO/ASP", 40000000, 12000, 4000, 1, 50, MATROSKA_TRACK_ENCODING_COMP_NONE, 0, MKVGEN_SIZE_UNIFORM, 1},
+    {MATROSKA_TRACK_TYPE_AUDIO, "A_MPEG/L3", 24000000, 400, 100, 1, 0, MATROSKA_TRACK_ENCODING_COMP_NONE, 0, MKVGEN_SIZE_UNIFORM, 1},
+};
+
+typedef struct bench_file
+{
+    const char *Name;
+    const mkvgen_track *Tracks;
+    size_t TrackCount;
+    mkv_timestamp_t ClusterDuration;
+    bool_t UseCRC;
+    bool_t Live;
+
+} bench_file;
+
+#define BENCH_FILE(name,tracks,cluster,crc,live)  {name, tracks, sizeof(tracks)/sizeof(tracks[0]), cluster, crc, live}
+
+static const bench_file Corpus[] = {
+    BENCH_FILE("av",             TracksAV,          1000000000, 0, 0),
+    BENCH_FILE("av_crc",         TracksAV,          1000000000, 1, 0),
+    BENCH_FILE("small_clusters", TracksAV,           100000000, 0, 0),
+    BENCH_FILE("large_clusters", TracksAV,         10000000000, 0, 0),
+    BENCH_FILE("lacing_fixed",   TracksFixedLacing, 1000000000, 0, 0),
+    BENCH_FILE("lacing_xiph",    TracksXiphLacing,  1000000000, 0, 0),
+    BENCH_FILE("lacing_ebml",    TracksEbmlLacing,  1000000000, 0, 0),
+    BENCH_FILE("multi_track",    TracksMulti,       2000000000, 0, 0),
+    BENCH_FILE("zlib",           TracksZlib,        1000000000, 0, 0),
+    BENCH_FILE("header_strip",   TracksHeaderStrip, 1000000000, 0, 0),
+    BENCH_FILE("block_groups",   TracksBlockGroups, 1000000000, 0, 0),
+    BENCH_FILE("live",           TracksAV,          1000000000, 0, 1),
+};
+
+typedef enum
+{
+    BENCH_SCAN,   // EBML_FindNextElement on all the elements, skipping the data
+    BENCH_READ,   // EBML_ElementReadData of each level 1 element
+    BENCH_BLOCKS, // MATROSKA_BlockReadData of all the Blocks
+
+} bench_mode;
+
+static const char *BenchName[] = {"scan", "read", "blocks"};
+
+typedef struct bench_result
+{
+    size_t Runs;
+    double Seconds; // per run
+    size_t Elements; // per run
+    bool_t Ok;
+
+} bench_result;
+
+static size_t CountElements(const ebml_element *Element)
+{
+    size_t Count = 1;
+    const ebml_element *i;
+    if (Node_IsPartOf(Element,EBML_MASTER_CLASS))
+        for (i=EBML_MasterChildren(Element);i;i=EBML_MasterNext(i))
+            Count += CountElements(i);
+    return Count;
+}
+
+static ebml_element *ScanMaster(ebml_element *Element, const ebml_parser_context *Context, struct stream *Input, size_t *Elements)
+{
+    int UpperElement = 0;
+    ebml_element *SubElement, *NewElement;
+    ebml_parser_context SubContext;
+
+    SubContext.UpContext = Context;
+    SubContext.Context = EBML_ElementContext(Element);
+    SubContext.EndPosition = EBML_ElementPositionEnd(Element);
+    SubContext.Profile = Context ? Context->Profile : PROFILE_MATROSKA_ANY;
+    SubElement = EBML_FindNextElement(Input, &SubContext, &UpperElement, 1);
+    while (SubElement != NULL && UpperElement<=0 && (!EBML_ElementIsFiniteSize(Element) || EBML_ElementPosition(SubElement) <= EBML_ElementPositionEnd(Element)))
+    {
+        ++*Elements;
+        NewElement = NULL;
+        if (Node_IsPartOf(SubElement,EBML_MASTER_CLASS))
+            NewElement = ScanMaster(SubElement, &SubContext, Input, Elements);
+        else
+            EBML_ElementSkipData(SubElement, Input, &SubContext, NULL, 0);
+        NodeDelete((node*)SubElement);
+        if (NewElement)
+            SubElement = NewElement;
+        else
+            SubElement = EBML_FindNextElement(Input, &SubContext, &UpperElement, 1);
+    }
+    return SubElement;
+}
+
+static size_t ReadClusterBlocks(ebml_master *Cluster, struct stream *Input, ebml_master *Info, ebml_master *Tracks)
+{
+    ebml_element *Elt, *Block;
+    size_t Count = 0;
+    MATROSKA_LinkClusterBlocks((matroska_cluster*)Cluster, Info, Tracks, 0, PROFILE_MATROSKA_ANY);
+    for (Elt=EBML_MasterChildren(Cluster);Elt;Elt=EBML_MasterNext(Elt))
+    {
+        if (EBML_ElementIsType(Elt, MATROSKA_getContextBlockGroup()))
+            Block = EBML_MasterFindChild(Elt, MATROSKA_getContextBlock());
+        else if (EBML_ElementIsType(Elt, MATROSKA_getContextSimpleBlock()))
+            Block = Elt;
+        else
+            continue;
+        if (Block && MATROSKA_BlockReadData((matroska_block*)Block, Input, PROFILE_MATROSKA_ANY)==ERR_NONE)
+        {
+            MATROSKA_BlockReleaseData((matroska_block*)Block, 1);
+            ++Count;
+        }
+    }
+    return Count;
+}
+
+static bool_t ParseFile(parsercontext *p, const tchar_t *Path, bench_mode Mode, size_t *Elements)
+{
+    struct stream *Input;
+    ebml_element *Head, *Segment, *Level1, *Next;
+    ebml_master *Info = NULL, *Tracks = NULL;
+    ebml_parser_context Context, SegmentContext;
+    int UpperElement = 0;
+    bool_t Ok = 0;
+
+    *Elements = 0;
+    Input = StreamOpen(p,Path,SFLAG_RDONLY|SFLAG_BUFFERED|SFLAG_MAPPED);
+    if (!Input)
+        return 0;
+
+    if (Mode == BENCH_SCAN)
+    {
+        ebml_element *Root = EBML_ElementCreate(Input,MATROSKA_getContextStream(),0,PROFILE_MATROSKA_ANY);
+        if (Root)
+        {
+            EBML_ElementSetInfiniteSize(Root,1);
+            Next = ScanMaster(Root, NULL, Input, Elements);
+            if (Next)
+                NodeDelete((node*)Next);
+            NodeDelete((node*)Root);
+            Ok = *Elements != 0;
+        }
+        StreamClose(Input);
+        return Ok;
+    }
+
+    Context.Context = MATROSKA_getContextStream();
+    Context.EndPosition = INVALID_FILEPOS_T;
+    Context.UpContext = NULL;
+    Context.Profile = PROFILE_MATROSKA_ANY;
+    Head = EBML_FindNextElement(Input, &Context, &UpperElement, 0);
+    if (Head && EBML_ElementReadData(Head,Input,&Context,0,SCOPE_ALL_DATA,0)==ERR_NONE)
+    {
+        *Elements += CountElements(Head);
+        Segment = EBML_FindNextElement(Input, &Context, &UpperElement, 1);
+        if (Segment && EBML_ElementIsType(Segment, MATROSKA_getContextSegment()))
+        {
+            ++*Elements;
+            SegmentContext.Context = MATROSKA_getContextSegment();
+            SegmentContext.EndPosition = EBML_ElementPositionEnd(Segment);
+            SegmentContext.UpContext = &Context;
+            SegmentContext.Profile = PROFILE_MATROSKA_ANY;
+            Ok = 1;
+            Level1 = EBML_FindNextElement(Input, &SegmentContext, &UpperElement, 1);
+            while (Level1 && Ok)
+            {
+                bool_t IsCluster = EBML_ElementIsType(Level1, MATROSKA_getContextCluster());
+                // like the tools, the Block payloads are only read once linked to their track
+                if (EBML_ElementReadData(Level1,Input,&SegmentContext,1,IsCluster ? SCOPE_PARTIAL_DATA : SCOPE_ALL_DATA,0)!=ERR_NONE)
+                    Ok = 0;
+                else if (Mode==BENCH_BLOCKS && IsCluster)
+                {
+                    if (!Info || !Tracks)
+                        Ok = 0;
+                    else
+                        *Elements += ReadClusterBlocks((ebml_master*)Level1, Input, Info, Tracks);
+                }
+                else if (Mode==BENCH_READ)
+                    *Elements += CountElements(Level1);
+
+                Next = EBML_ElementSkipData(Level1, Input, &SegmentContext, NULL, 1);
+                if (!Info && EBML_ElementIsType(Level1, MATROSKA_getContextInfo()))
+                    Info = (ebml_master*)Level1;
+                else if (!Tracks && EBML_ElementIsType(Level1, MATROSKA_getContextTracks()))
+                    Tracks = (ebml_master*)Level1;
+                else
+                    NodeDelete((node*)Level1);
+                Level1 = Next ? Next : EBML_FindNextElement(Input, &SegmentContext, &UpperElement, 1);
+            }
+            if (Level1)
+                NodeDelete((node*)Level1);
+        }
+        if (Segment)
+            NodeDelete((node*)Segment);
+    }
+    if (Head)
+        NodeDelete((node*)Head);
+    if (Info)
+        NodeDelete((node*)Info);
+    if (Tracks)
+        NodeDelete((node*)Tracks);
+    StreamClose(Input);
+    return Ok;
+}
+
+// seconds on a monotonic clock with a sub-microsecond resolution
+static double Now(void)
+{
+#ifdef TARGET_WIN
+    LARGE_INTEGER Counter, Freq;
+    QueryPerformanceCounter(&Counter);
+    QueryPerformanceFrequency(&Freq);
+    return (double)Counter.QuadPart / Freq.QuadPart;
+#else
+    struct timespec Time;
+    clock_gettime(CLOCK_MONOTONIC, &Time);
+    return Time.tv_sec + Time.tv_nsec / 1e9;
+#endif
+}
+
+static double Elapsed(double Start)
+{
+    return Now() - Start;
+}
+
+// run the program with its output discarded, without a shell in between
+static bool_t RunTool(const char *const Args[])
+{
+#ifdef TARGET_WIN
+    char Command[4*MAXPATHFULL];
+    STARTUPINFOA Startup;
+    PROCESS_INFORMATION Process;
+    SECURITY_ATTRIBUTES Inherit = {sizeof(SECURITY_ATTRIBUTES), NULL, TRUE};
+    HANDLE Null;
+    DWORD ExitCode = 1;
+    size_t i, Len = 0;
+
+    Command[0] = 0;
+    for (i=0;Args[i];++i)
+        Len += snprintf(Command+Len, Len < sizeof(Command) ? sizeof(Command)-Len : 0, i ? " \"%s\"" : "\"%s\"", Args[i]);
+    if (Len >= sizeof(Command))
+        return 0;
+
+    Null = CreateFileA("NUL", GENERIC_WRITE, FILE_SHARE_READ|FILE_SHARE_WRITE, &Inherit, OPEN_EXISTING, 0, NULL);
+    if (Null == INVALID_HANDLE_VALUE)
+        return 0;
+    memset(&Startup, 0, sizeof(Startup));
+    Startup.cb = sizeof(Startup);
+    Startup.dwFlags = STARTF_USESTDHANDLES;
+    Startup.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+    Startup.hStdOutput = Null;
+    Startup.hStdError = Null;
+    if (CreateProcessA(Args[0], Command, NULL, NULL, TRUE, 0, NULL, NULL, &Startup, &Process))
+    {
+        WaitForSingleObject(Process.hProcess, INFINITE);
+        GetExitCodeProcess(Process.hProcess, &ExitCode);
+        CloseHandle(Process.hThread);
+        CloseHandle(Process.hProcess);
+    }
+    CloseHandle(Null);
+    return ExitCode == 0;
+#else
+    posix_spawn_file_actions_t Actions;
+    pid_t Pid;
+    int Status = 1;
+
+    if (posix_spawn_file_actions_init(&Actions)!=0)
+        return 0;
+    if (posix_spawn_file_actions_addopen(&Actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0)==0 &&
+        posix_spawn_file_actions_adddup2(&Actions, STDOUT_FILENO, STDERR_FILENO)==0 &&
+        posix_spawn(&Pid, Args[0], &Actions, NULL, (char *const *)Args, environ)==0)
+    {
+        while (waitpid(Pid, &Status, 0) < 0)
+            if (errno != EINTR)
+                break;
+    }
+    posix_spawn_file_actions_destroy(&Actions);
+    return WIFEXITED(Status) && WEXITSTATUS(Status)==0;
+#endif
+}
+
+// repeat until MinTime seconds are spent, to smooth the timer resolution
+static void BenchParse(parsercontext *p, const tchar_t *Path, bench_mode Mode, double MinTime, bench_result *Result)
+{
+    double Start = Now();
+    memset(Result, 0, sizeof(*Result));
+    Result->Ok = 1;
+    do
+    {
+        Result->Ok = ParseFile(p, Path, Mode, &Result->Elements) && Result->Ok;
+        Result->Runs++;
+    } while (Result->Ok && Elapsed(Start) < MinTime);
+    Result->Seconds = Elapsed(Start) / Result->Runs;
+}
+
+static void BenchTool(const char *const Args[], double MinTime, bench_result *Result)
+{
+    double Start = Now();
+    memset(Result, 0, sizeof(*Result));
+    Result->Ok = 1;
+    do
+    {
+        Result->Ok = RunTool(Args) && Result->Ok;
+        Result->Runs++;
+    } while (Result->Ok && Elapsed(Start) < MinTime);
+    Result->Seconds = Elapsed(Start) / Result->Runs;
+
+    if (!Result->Ok)
+    {
+        const char *const *Arg;
+        fprintf(stderr, "mkvbench failed to run:");
+        for (Arg=Args; *Arg; ++Arg)
+            fprintf(stderr, " \"%s\"", *Arg);
+        fprintf(stderr, "\r\n");
+    }
+}
+
+static void OutputResult(FILE *Output, const char *Bench, const char *File, filepos_t Size, const bench_result *Result, bool_t WithElements)
+{
+    double Seconds = Result->Seconds > 0 ? Result->Seconds : 1e-9;
+    fprintf(Output, "{\"bench\":\"%s\",\"file\":\"%s\",\"ok\":%s,\"size\":%" PRId64 ",\"runs\":%u,\"seconds\":%.6f,\"mb_per_s\":%.2f",
+        Bench, File, Result->Ok ? "true" : "false", (int64_t)Size, (unsigned)Result->Runs, Result->Seconds, Size / Seconds / (1024*1024));
+    if (WithElements)
+        fprintf(Output, ",\"elements\":%u,\"elements_per_s\":%.0f", (unsigned)Result->Elements, Result->Elements / Seconds);
+    fprintf(Output, "}\n");
+    fflush(Output);
+}
+
+static int Usage(void)
+{
+    fprintf(stderr, "Usage: mkvbench [options] <work_folder>\r\n");
+    fprintf(stderr, "Generates synthetic Matroska files in work_folder and outputs the speed of each benchmark as JSON lines.\r\n");
+    fprintf(stderr, "Options:\r\n");
+    fprintf(stderr, "  --mkvalidator <path>  also time this mkvalidator on each file\r\n");
+    fprintf(stderr, "  --mkclean <path>      also time this mkclean on each file\r\n");
+    fprintf(stderr, "  --output <path>       write the results in this file rather than stdout\r\n");
+    fprintf(stderr, "  --duration <s>        duration of each generated file (default 60)\r\n");
+    fprintf(stderr, "  --min-time <s>        minimum time spent measuring each benchmark (default 0.5)\r\n");
+    fprintf(stderr, "  --generate-only       only generate the files\r\n");
+    return 1;
+}
+
+int main(int argc, const char *argv[])
+{
+    parsercontext p;
+    const char *Folder = NULL, *Validator = NULL, *Cleaner = NULL, *OutputPath = NULL;
+    double Duration = 60, MinTime = 0.5;
+    bool_t GenerateOnly = 0;
+    FILE *Output = stdout;
+    const bench_file *File;
+    char Path[MAXPATHFULL];
+    tchar_t TPath[MAXPATHFULL];
+    int i, Result = 0;
+
+    for (i=1;i<argc;++i)
+    {
+        if (strcmp(argv[i],"--mkvalidator")==0 && i+1<argc)
+            Validator = argv[++i];
+        else if (strcmp(argv[i],"--mkclean")==0 && i+1<argc)
+            Cleaner = argv[++i];
+        else if (strcmp(argv[i],"--output")==0 && i+1<argc)
+            OutputPath = argv[++i];
+        else if (strcmp(argv[i],"--duration")==0 && i+1<argc)
+            Duration = atof(argv[++i]);
+        else if (strcmp(argv[i],"--min-time")==0 && i+1<argc)
+            MinTime = atof(argv[++i]);
+        else if (strcmp(argv[i],"--generate-only")==0)
+            GenerateOnly = 1;
+        else if (argv[i][0]=='-' || Folder)
+            return Usage();
+        else
+            Folder = argv[i];
+    }
+    if (!Folder || Duration <= 0)
+        return Usage();
+
+    if (OutputPath)
+    {
+        Output = fopen(OutputPath, "w");
+        if (!Output)
+        {
+            fprintf(stderr, "mkvbench cannot write to \"%s\"\r\n", OutputPath);
+            return 2;
+        }
+    }
+
+    // Core-C init phase
+    ParserContext_Init(&p,NULL,NULL,NULL);
+    // EBML & Matroska Init
+    MATROSKA_Init(&p);
+
+    for (File=Corpus; File!=Corpus+sizeof(Corpus)/sizeof(Corpus[0]); ++File)
+    {
+        mkvgen_config Config;
+        mkvgen_stats Stats;
+        bench_result Bench;
+        struct stream *Stream;
+        double Start;
+        int Mode;
+
+        snprintf(Path, sizeof(Path), "%s/%s.mkv", Folder, File->Name);
+        Node_FromStr(&p,TPath,TSIZEOF(TPath),Path);
+
+        memset(&Config, 0, sizeof(Config));
+        Config.Tracks = File->Tracks;
+        Config.TrackCount = File->TrackCount;
+        Config.Duration = (mkv_timestamp_t)(Duration * 1000000000);
+        Config.ClusterDuration = File->ClusterDuration;
+        Config.UseCRC = File->UseCRC;
+        Config.Live = File->Live;
+        Config.Seed = (uint32_t)(File - Corpus) + 1;
+
+        Start = Now();
+        memset(&Bench, 0, sizeof(Bench));
+        memset(&Stats, 0, sizeof(Stats));
+        Stream = StreamOpen(&p,TPath,SFLAG_WRONLY|SFLAG_CREATE|SFLAG_BUFFERED);
+        if (Stream)
+        {
+            Bench.Ok = MKVGEN_Write(&p, Stream, &Config, &Stats)==ERR_NONE;
+            StreamClose(Stream);
+        }
+        Bench.Runs = 1;
+        Bench.Seconds = Elapsed(Start);
+        Bench.Elements = Stats.Blocks;
+        OutputResult(Output, "generate", File->Name, Bench.Ok ? Stats.Size : 0, &Bench, 1);
+        if (!Bench.Ok)
+        {
+            Result = 3;
+            continue;
+        }
+        if (GenerateOnly)
+            continue;
+
+        for (Mode=BENCH_SCAN; Mode<=BENCH_BLOCKS; ++Mode)
+        {
+            BenchParse(&p, TPath, (bench_mode)Mode, MinTime, &Bench);
+            OutputResult(Output, BenchName[Mode], File->Name, Stats.Size, &Bench, 1);
+        }
+
+        if (Validator)
+        {
+            const char *Args[] = {Validator, "--quiet", Path, NULL};
+            BenchTool(Args, MinTime, &Bench);
+            OutputResult(Output, "mkvalidator", File->Name, Stats.Size, &Bench, 0);
+        }
+
+        if (Cleaner)
+        {
+            char CleanPath[MAXPATHFULL];
+            const char *Args[] = {Cleaner, "--quiet", Path, CleanPath, NULL};
+            snprintf(CleanPath, sizeof(CleanPath), "%s/%s.clean.mkv", Folder, File->Name);
+            BenchTool(Args, MinTime, &Bench);
+            OutputResult(Output, "mkclean", File->Name, Stats.Size, &Bench, 0);
+            remove(CleanPath);
+        }
+    }
+
+    // EBML & Matroska ending
+    MATROSKA_Done(&p);
+
+    // Core-C ending
+    ParserContext_Done(&p);
+
+    if (Output != stdout)
+        fclose(Output);
+    return Result;
+}
@@ -12,9 +12,11 @@
 #define DATA_FLAG_HEAP              (((size_t)1)<<(sizeof(size_t)*8-2))
 #define DATA_FLAG_MEMHEAP           (((size_t)1)<<(sizeof(size_t)*8-1))
 
+// same layout as dataheaphead so the Size is found at the same offset
+// from the data for both kinds of allocation
 typedef struct
 {
-    ARRAY_POINTER_HOLDER;
+    MEMHEAD_POINTER_HOLDER;
 } datahead;
 
 typedef struct
@@ -589,3 +591,222 @@ const cc_memheap *MemHeap_GetDefault(void)
 {
     return &MemHeap_Default;
 }
+
+// small blocks are carved from large chunks and kept in a free list per size
+// once released, bigger blocks use the regular allocator
+#define SLAB_GRANULE     alignof(max_align_t)
+#define SLAB_MAX_SIZE    512
+#define SLAB_CLASSES     (SLAB_MAX_SIZE/SLAB_GRANULE)
+#define SLAB_CHUNK_SIZE  (64*1024)
+
+typedef struct slabchunk
+{
+    struct slabchunk* Next;
+    alignas(max_align_t) char data[];
+} slabchunk;
+
+// each thread carves from its own chunks and free lists, no locking needed
+typedef struct slabcache
+{
+    struct slabcache* Next;
+    const void* Owner;
+    void* FreeList[SLAB_CLASSES];
+    slabchunk* Chunks;
+    uint8_t* ChunkPos;
+    size_t ChunkLeft;
+} slabcache;
+
+// stored right after its cc_memheap
+typedef struct slabheap
+{
+    slabcache* Caches;
+    cc_spinlock Lock; // guards Caches
+    size_t Serial; // tells apart heaps reusing the same address
+} slabheap;
+
+static size_t SlabSerial = 0;
+static THREAD_LOCAL char SlabThread; // its address identifies the thread
+static THREAD_LOCAL const slabheap* SlabLastHeap = NULL;
+static THREAD_LOCAL size_t SlabLastSerial = 0;
+static THREAD_LOCAL slabcache* SlabLast = NULL;
+
+static INLINE slabheap* SlabHeap(const void* p)
+{
+    return (slabheap*)((uint8_t*)p + sizeof(cc_memheap));
+}
+
+static NOINLINE slabcache* SlabFindCache(slabheap* Slab)
+{
+    slabcache* Cache;
+    SpinLock(&Slab->Lock);
+    for (Cache=Slab->Caches;Cache;Cache=Cache->Next)
+        if (Cache->Owner == &SlabThread)
+            break;
+    if (!Cache)
+    {
+        // reuse the cache left by a finished thread
+        for (Cache=Slab->Caches;Cache;Cache=Cache->Next)
+            if (!Cache->Owner)
+            {
+                Cache->Owner = &SlabThread;
+                break;
+            }
+    }
+    if (!Cache)
+    {
+        Cache = calloc(1,sizeof(slabcache));
+        if (Cache)
+        {
+            Cache->Owner = &SlabThread;
+            Cache->Next = Slab->Caches;
+            Slab->Caches = Cache;
+        }
+    }
+    SpinUnlock(&Slab->Lock);
+    if (Cache)
+    {
+        SlabLastHeap = Slab;
+        SlabLastSerial = Slab->Serial;
+        SlabLast = Cache;
+    }
+    return Cache;
+}
+
+static INLINE slabcache* SlabCache(const void* p)
+{
+    slabheap* Slab = SlabHeap(p);
+    if (SlabLastHeap == Slab && SlabLastSerial == Slab->Serial)
+        return SlabLast;
+    return SlabFindCache(Slab);
+}
+
+static void* __SAlloc(const void* p,size_t Size)
+{
+    slabcache* Slab;
+    size_t Class;
+    void* Ptr;
+
+    if (!Size || Size > SLAB_MAX_SIZE)
+        return malloc(Size);
+
+    Slab = SlabCache(p);
+    if (!Slab)
+        return NULL;
+
+    Class = (Size-1)/SLAB_GRANULE;
+    Ptr = Slab->FreeList[Class];
+    if (Ptr)
+    {
+        Slab->FreeList[Class] = *(void**)Ptr;
+        return Ptr;
+    }
+
+    Size = (Class+1)*SLAB_GRANULE;
+    if (Slab->ChunkLeft < Size)
+    {
+        slabchunk* Chunk = malloc(sizeof(slabchunk)+SLAB_CHUNK_SIZE);
+        if (!Chunk)
+            return NULL;
+        Chunk->Next = Slab->Chunks;
+        Slab->Chunks = Chunk;
+        Slab->ChunkPos = (uint8_t*)Chunk->data;
+        Slab->ChunkLeft = SLAB_CHUNK_SIZE;
+    }
+    Ptr = Slab->ChunkPos;
+    Slab->ChunkPos += Size;
+    Slab->ChunkLeft -= Size;
+    return Ptr;
+}
+
+// a block released by another thread goes to the free list of that thread
+static void __SFree(const void* p,void* Ptr,size_t Size)
+{
+    slabcache* Slab;
+    if (!Size || Size > SLAB_MAX_SIZE)
+    {
+        free(Ptr);
+        return;
+    }
+    if (!Ptr)
+        return;
+    Slab = SlabCache(p);
+    if (!Slab)
+        return; // kept until the heap is destroyed
+    *(void**)Ptr = Slab->FreeList[(Size-1)/SLAB_GRANULE];
+    Slab->FreeList[(Size-1)/SLAB_GRANULE] = Ptr;
+}
+
+static void* __SReAlloc(const void* p,void* Ptr,size_t OldSize,size_t Size)
+{
+    void* New;
+    if (!Ptr)
+        return __SAlloc(p,Size);
+    if (OldSize > SLAB_MAX_SIZE && Size > SLAB_MAX_SIZE)
+        return realloc(Ptr,Size);
+    if (OldSize && Size && OldSize <= SLAB_MAX_SIZE && Size <= SLAB_MAX_SIZE && (OldSize-1)/SLAB_GRANULE == (Size-1)/SLAB_GRANULE)
+        return Ptr; // same block size
+
+    New = __SAlloc(p,Size);
+    if (New)
+    {
+        memcpy(New,Ptr,MIN(OldSize,Size));
+        __SFree(p,Ptr,OldSize);
+    }
+    return New;
+}
+
+cc_memheap *MemHeap_CreateSlab(void)
+{
+    cc_memheap* p = malloc(sizeof(cc_memheap)+sizeof(slabheap));
+    if (p)
+    {
+        p->Alloc = __SAlloc;
+        p->Free = __SFree;
+        p->ReAlloc = __SReAlloc;
+        p->Write = __HWrite;
+        p->Heap = p;
+        p->Size = DATA_FLAG_MEMHEAP;
+        memset(SlabHeap(p),0,sizeof(slabheap));
+        SlabHeap(p)->Serial = AtomicIncSize(&SlabSerial);
+    }
+    return p;
+}
+
+void MemHeap_ReleaseThread(const cc_memheap *p)
+{
+    if (p && p->Alloc == __SAlloc)
+    {
+        slabheap* Slab = SlabHeap(p);
+        slabcache* Cache;
+        SpinLock(&Slab->Lock);
+        for (Cache=Slab->Caches;Cache;Cache=Cache->Next)
+            if (Cache->Owner == &SlabThread)
+                Cache->Owner = NULL;
+        SpinUnlock(&Slab->Lock);
+        if (SlabLastHeap == Slab)
+            SlabLastHeap = NULL;
+    }
+}
+
+void MemHeap_DestroySlab(cc_memheap *p)
+{
+    if (p)
+    {
+        slabheap* Slab = SlabHeap(p);
+        while (Slab->Caches)
+        {
+            slabcache* Cache = Slab->Caches;
+            while (Cache->Chunks)
+            {
+                slabchunk* Next = Cache->Chunks->Next;
+                free(Cache->Chunks);
+                Cache->Chunks = Next;
+            }
+            Slab->Caches = Cache->Next;
+            free(Cache);
+        }
+        if (SlabLastHeap == Slab)
+            SlabLastHeap = NULL;
+        free(p);
+    }
+}
@@ -7,32 +7,84 @@
 
 #include "file.h"
 #include "streams.h"
+#include <stdlib.h>
 
-#define BUFSTREAM_SIZE      4096
-
+// The buffer either holds data read from the stream (ReadPos/ReadSize) or
+// data waiting to be written (WritePos/WriteSize), never both. BufferPos is the
+// position of Buffer[0] in the underlying stream, so the logical position
+// is always known without asking the underlying stream. Seeking inside the
+// data waiting to be written only moves WritePos, so patching what was just
+// written doesn't reach the underlying stream either.
 typedef struct bufstream
 {
     stream Base;
     stream* Stream;
+    filepos_t BufferPos;
     size_t ReadPos;
     size_t ReadSize;
     size_t WritePos;
-    uint8_t Buffer[BUFSTREAM_SIZE];
+    size_t WriteSize;
+    size_t BufferSize;
+    uint8_t* Buffer;
 
 } bufstream;
 
 static NOINLINE err_t BufFlush(bufstream* p)
 {
     err_t Err = ERR_NONE;
-    if (p->Stream && p->WritePos>0)
+    if (p->Stream && p->WriteSize>0)
     {
-        Err = Stream_Write(p->Stream,p->Buffer,p->WritePos,NULL);
+        Err = Stream_Write(p->Stream,p->Buffer,p->WriteSize,NULL);
         if (Err == ERR_NONE)
+        {
+            if (p->WritePos != p->WriteSize)
+            {
+                // the logical position is before the end of the data written
+                assert(p->BufferPos != INVALID_FILEPOS_T);
+                p->BufferPos = Stream_Seek(p->Stream,p->BufferPos + p->WritePos,SEEK_SET);
+                if (p->BufferPos == INVALID_FILEPOS_T)
+                    Err = ERR_WRITE;
+            }
+            else if (p->BufferPos != INVALID_FILEPOS_T)
+                p->BufferPos += p->WriteSize;
             p->WritePos = 0;
+            p->WriteSize = 0;
+        }
     }
     return Err;
 }
 
+static filepos_t BufPosition(const bufstream* p)
+{
+    if (p->BufferPos == INVALID_FILEPOS_T)
+        return INVALID_FILEPOS_T;
+    return p->BufferPos + (p->WriteSize ? p->WritePos : p->ReadPos);
+}
+
+// drop the read-ahead data and put the underlying stream at the logical position
+static err_t BufDropRead(bufstream* p)
+{
+    if (p->ReadPos < p->ReadSize)
+    {
+        if (p->BufferPos == INVALID_FILEPOS_T)
+            return ERR_NOT_SUPPORTED;
+        if (Stream_Seek(p->Stream,p->BufferPos + p->ReadPos,SEEK_SET) == INVALID_FILEPOS_T)
+            return ERR_READ;
+    }
+    if (p->BufferPos != INVALID_FILEPOS_T)
+        p->BufferPos += p->ReadPos;
+    p->ReadPos = 0;
+    p->ReadSize = 0;
+    return ERR_NONE;
+}
+
+static bool_t BufAlloc(bufstream* p)
+{
+    if (!p->Buffer)
+        p->Buffer = malloc(p->BufferSize);
+    return p->Buffer != NULL;
+}
+
 static err_t BufStream(bufstream* p,dataid UNUSED_PARAM(Id),stream** Data,size_t UNUSED_PARAM(Size))
 {
     BufFlush(p);
@@ -40,14 +92,44 @@ static err_t BufStream(bufstream* p,dataid UNUSED_PARAM(Id),stream** Data,size_t
     p->ReadPos = 0;
     p->ReadSize = 0;
     p->WritePos = 0;
+    p->WriteSize = 0;
+    p->BufferPos = p->Stream ? Stream_Seek(p->Stream,0,SEEK_CUR) : INVALID_FILEPOS_T;
+    return ERR_NONE;
+}
+
+static err_t BufSetSize(bufstream* p,dataid UNUSED_PARAM(Id),const size_t* Data,size_t Size)
+{
+    err_t Err;
+    if (Size != sizeof(size_t))
+        return ERR_INVALID_DATA;
+
+    Err = BufFlush(p);
+    if (Err == ERR_NONE && p->Stream)
+        Err = BufDropRead(p);
+    if (Err != ERR_NONE)
+        return Err;
+
+    free(p->Buffer);
+    p->Buffer = NULL;
+    p->BufferSize = MIN(MAX(*Data,BUFSTREAM_MIN_SIZE),BUFSTREAM_MAX_SIZE);
     return ERR_NONE;
 }
 
+static err_t BufGetParam(bufstream* p,dataid Id,void* Data,size_t Size)
+{
+    if (!p->Stream)
+        return ERR_INVALID_PARAM;
+    if (Id == STREAM_LENGTH)
+        BufFlush(p); // the pending data may extend the stream
+    return Node_Get(p->Stream,Id,Data,Size);
+}
+
 static void BufDelete(bufstream* p)
 {
     BufFlush(p);
     if (p->Stream)
         NodeDelete((node*)p->Stream);
+    free(p->Buffer);
 }
 
 static err_t BufRead(bufstream* p,uint8_t* Data,size_t Size,size_t* Readed)
@@ -56,20 +138,33 @@ static err_t BufRead(bufstream* p,uint8_t* Data,size_t Size,size_t* Readed)
     size_t Pos = 0;
     size_t Left;
 
+    if (p->WriteSize && (Err = BufFlush(p)) != ERR_NONE)
+    {
+        if (Readed)
+            *Readed = 0;
+        return Err;
+    }
+
     while ((Left = (Size - Pos)) > 0)
     {
         if (p->ReadSize <= p->ReadPos)
         {
-            if (Left > BUFSTREAM_SIZE)
+            if (p->BufferPos != INVALID_FILEPOS_T)
+                p->BufferPos += p->ReadSize;
+            p->ReadPos = 0;
+            p->ReadSize = 0;
+
+            if (Left >= p->BufferSize || !BufAlloc(p))
             {
                 Err = Stream_Read(p->Stream,Data+Pos,Left,&Left);
+                if (p->BufferPos != INVALID_FILEPOS_T)
+                    p->BufferPos += Left;
                 if (Readed)
                     *Readed = Pos+Left;
                 return Err;
             }
 
-            p->ReadPos = 0;
-            Err = Stream_Read(p->Stream,p->Buffer,BUFSTREAM_SIZE,&p->ReadSize);
+            Err = Stream_Read(p->Stream,p->Buffer,p->BufferSize,&p->ReadSize);
             if (p->ReadSize <= 0)
                 break;
         }
@@ -96,24 +191,35 @@ static err_t BufWrite(bufstream* p,const uint8_t* Data,size_t Size,size_t* Writt
     size_t Pos = 0;
     size_t Left;
 
+    if (p->ReadSize && (Err = BufDropRead(p)) != ERR_NONE)
+    {
+        if (Written)
+            *Written = 0;
+        return Err;
+    }
+
     while ((Left = (Size - Pos)) > 0)
     {
-        if (p->WritePos >= BUFSTREAM_SIZE && (Err = BufFlush(p)) != ERR_NONE)
+        if (p->WritePos >= p->BufferSize && (Err = BufFlush(p)) != ERR_NONE)
             break;
 
-        if (!p->WritePos && Left > BUFSTREAM_SIZE)
+        if (!p->WriteSize && (Left > p->BufferSize || !BufAlloc(p)))
         {
             Err = Stream_Write(p->Stream,Data+Pos,Left,&Left);
+            if (p->BufferPos != INVALID_FILEPOS_T)
+                p->BufferPos += Left;
             Pos += Left;
             break;
         }
 
-        if (Left > BUFSTREAM_SIZE - p->WritePos)
-            Left = BUFSTREAM_SIZE - p->WritePos;
+        if (Left > p->BufferSize - p->WritePos)
+            Left = p->BufferSize - p->WritePos;
 
         memcpy(p->Buffer+p->WritePos,Data+Pos,Left);
         Pos += Left;
         p->WritePos += Left;
+        if (p->WriteSize < p->WritePos)
+            p->WriteSize = p->WritePos;
     }
 
     if (Written)
@@ -121,10 +227,65 @@ static err_t BufWrite(bufstream* p,const uint8_t* Data,size_t Size,size_t* Writt
     return Err;
 }
 
+static filepos_t BufSeek(bufstream* p,filepos_t Pos,int SeekMode)
+{
+    filepos_t Current = BufPosition(p);
+
+    if (Current != INVALID_FILEPOS_T && SeekMode != SEEK_END)
+    {
+        if (SeekMode == SEEK_CUR)
+            Pos += Current;
+        if (Pos == Current)
+            return Current;
+
+        // seeking inside the data already read
+        if (!p->WriteSize && Pos >= p->BufferPos && Pos <= p->BufferPos + (filepos_t)p->ReadSize)
+        {
+            p->ReadPos = (size_t)(Pos - p->BufferPos);
+            return Pos;
+        }
+        // seeking inside the data not written yet
+        if (p->WriteSize && Pos >= p->BufferPos && Pos <= p->BufferPos + (filepos_t)p->WriteSize)
+        {
+            p->WritePos = (size_t)(Pos - p->BufferPos);
+            return Pos;
+        }
+        SeekMode = SEEK_SET;
+    }
+
+    if (BufFlush(p) != ERR_NONE)
+        return INVALID_FILEPOS_T;
+
+    if (SeekMode == SEEK_CUR && p->ReadPos < p->ReadSize)
+    {
+        // the underlying stream is ahead of us
+        Pos -= (filepos_t)(p->ReadSize - p->ReadPos);
+    }
+    p->ReadPos = 0;
+    p->ReadSize = 0;
+
+    p->BufferPos = Stream_Seek(p->Stream,Pos,SeekMode);
+    return p->BufferPos;
+}
+
+static err_t BufStreamFlush(bufstream* p)
+{
+    return BufFlush(p);
+}
+
 META_START(BufStream_Class,BUFSTREAM_CLASS)
 META_CLASS(SIZE,sizeof(bufstream))
 META_CLASS(DELETE,BufDelete)
 META_VMT(TYPE_FUNC,stream_vmt,Read,BufRead)
 META_VMT(TYPE_FUNC,stream_vmt,Write,BufWrite)
+META_VMT(TYPE_FUNC,stream_vmt,Seek,BufSeek)
+META_VMT(TYPE_FUNC,stream_vmt,Flush,BufStreamFlush)
+META_CONST(TYPE_SIZE,bufstream,BufferSize,BUFSTREAM_DEFAULT_SIZE)
 META_PARAM(SET,BUFSTREAM_STREAM,BufStream)
+META_PARAM(TYPE,BUFSTREAM_SIZE,TYPE_SIZE)
+META_PARAM(SET,BUFSTREAM_SIZE,BufSetSize)
+META_DATA(TYPE_SIZE,BUFSTREAM_SIZE,bufstream,BufferSize)
+META_PARAM(GET,STREAM_URL,BufGetParam)
+META_PARAM(GET,STREAM_LENGTH,BufGetParam)
+META_PARAM(GET,STREAM_FLAGS,BufGetParam)
 META_END(STREAM_CLASS)
@@ -31,6 +31,8 @@ FILE_DLL bool_t PathIsFolder(const tchar_t*);
 // \param Force erase even if the file is read-only
 // \param Safe put in the OS trash rather than a permanent erase
 FILE_DLL bool_t FileErase(const tchar_t*, bool_t Force, bool_t Safe);
+// last modification date of the file, INVALID_DATETIME_T if it doesn't exist
+FILE_DLL datetime_t FileDateTime(const tchar_t*);
 
 FILE_DLL void RemovePathDelimiter(tchar_t* Path);
 FILE_DLL void AddPathDelimiter(tchar_t* Path,size_t PathLen);
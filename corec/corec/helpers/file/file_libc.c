@@ -276,6 +276,14 @@ bool_t FileErase(const tchar_t* Path, bool_t Force, bool_t UNUSED_PARAM(Safe))
     return unlink(Path) == 0;
 }
 
+datetime_t FileDateTime(const tchar_t* Path)
+{
+    struct stat file_stats;
+    if (stat(Path, &file_stats) != 0)
+        return INVALID_DATETIME_T;
+    return LinuxToDateTime(file_stats.st_mtime);
+}
+
 bool_t PathIsFolder(const tchar_t* Path)
 {
     struct stat file_stats;
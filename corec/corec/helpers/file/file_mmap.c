@@ -0,0 +1,252 @@
+/*****************************************************************************
+ *
+ * Copyright (c) 2008-2010, CoreCodec, Inc.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ ****************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE // madvise()
+
+#include "file.h"
+#include "streams.h"
+#include <corec/str/str.h>
+#include <limits.h>
+#include <stdlib.h>
+
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// the data read are released from memory and the file size checked every MMAP_WINDOW bytes,
+// the data accessed directly in memory behind the position are released every MMAP_SWEEP bytes
+//
+// the pointers given by MEMSTREAM_PTR point in the file itself: if the file is truncated while
+// it's mapped, touching the pages past its new end raises SIGBUS, only Read() is safe there.
+// Files that can shrink while they are read must use the buffered stream (no SFLAG_MAPPED).
+#define MMAP_WINDOW  (1024*1024)
+#define MMAP_SWEEP   (64*1024*1024)
+
+typedef struct mmapstream
+{
+    memstream Base;
+    void* Map;
+    size_t MapSize;
+    size_t Page;
+    size_t Released; // the pages before are not kept in memory
+    size_t Swept;    // all the pages before were released
+    size_t Checked;  // the file size was checked before reading up to there
+    tchar_t* URL;
+    int fd;
+    int Flags;
+
+} mmapstream;
+
+static void Unmap(mmapstream* p)
+{
+    if (p->Map)
+    {
+        munmap(p->Map,p->MapSize);
+        close(p->fd);
+        p->Map = NULL;
+        p->MapSize = 0;
+        Node_Set(p,MEMSTREAM_DATA,NULL,0);
+    }
+    free(p->URL);
+    p->URL = NULL;
+}
+
+// drop the pages far behind the position, they are read again from the file if they're used
+static void Release(mmapstream* p)
+{
+    size_t Pos = p->Base.Pos;
+    size_t Start, End;
+
+    if (Pos > p->MapSize)
+        Pos = p->MapSize;
+    if (Pos < p->Released)
+    {
+        p->Released = Pos - Pos % p->Page;
+        if (p->Swept > p->Released)
+            p->Swept = p->Released;
+    }
+    else if (Pos - p->Released >= 2*MMAP_WINDOW)
+    {
+        End = Pos - MMAP_WINDOW;
+        End -= End % p->Page;
+        Start = p->Released;
+        if (End - p->Swept >= MMAP_SWEEP)
+        {
+            // also the pages used again after they were released
+            Start = 0;
+            p->Swept = End;
+        }
+#if defined(MADV_DONTNEED)
+        madvise((uint8_t*)p->Map + Start, End - Start, MADV_DONTNEED);
+#else
+        posix_madvise((uint8_t*)p->Map + Start, End - Start, POSIX_MADV_DONTNEED);
+#endif
+        p->Released = End;
+    }
+}
+
+// a truncated file can't be read past its new end in memory, only the reads check it, not the direct accesses
+static void CheckSize(mmapstream* p, size_t End)
+{
+    struct stat file_stats;
+    if (fstat(p->fd, &file_stats) == 0 && (uintmax_t)file_stats.st_size < (uintmax_t)p->Base.Size)
+        p->Base.Size = (size_t)file_stats.st_size;
+    p->Checked = End + MMAP_WINDOW;
+}
+
+static err_t Open(mmapstream* p, const tchar_t* URL, int Flags)
+{
+    struct stat file_stats;
+    void* Map;
+    size_t Len;
+    int fd;
+
+    Unmap(p);
+
+    if (!URL || !URL[0])
+        return ERR_NONE;
+
+    if (Flags & (SFLAG_WRONLY|SFLAG_CREATE))
+        return ERR_NOT_SUPPORTED;
+
+    fd = open(URL, O_RDONLY);
+    if (fd == -1)
+    {
+        if ((Flags & (SFLAG_REOPEN|SFLAG_SILENT))==0)
+            NodeReportError(p,NULL,ERR_ID,ERR_FILE_NOT_FOUND,URL);
+        return ERR_FILE_NOT_FOUND;
+    }
+
+    // only regular files that fit in the address space can be mapped
+    if (fstat(fd, &file_stats) != 0 || !S_ISREG(file_stats.st_mode) || file_stats.st_size <= 0 ||
+        (uintmax_t)file_stats.st_size > (uintmax_t)SIZE_MAX)
+    {
+        close(fd);
+        return ERR_NOT_SUPPORTED;
+    }
+
+    Map = mmap(NULL, (size_t)file_stats.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (Map == MAP_FAILED)
+    {
+        close(fd);
+        return ERR_NOT_SUPPORTED;
+    }
+
+    // the file stays open to check its size and read what's added after it was mapped
+    p->Map = Map;
+    p->MapSize = (size_t)file_stats.st_size;
+    p->Page = (size_t)sysconf(_SC_PAGESIZE);
+    p->fd = fd;
+    p->Released = 0;
+    p->Swept = 0;
+    p->Checked = 0;
+    p->Flags = Flags;
+
+    Len = tcslen(URL)+1;
+    p->URL = malloc(Len*sizeof(tchar_t));
+    if (!p->URL)
+    {
+        Unmap(p);
+        return ERR_OUT_OF_MEMORY;
+    }
+    tcscpy_s(p->URL,Len,URL);
+    return Node_Set(p,MEMSTREAM_DATA,p->Map,p->MapSize);
+}
+
+// same as the memory stream but the position may go past the end like a regular file
+static err_t Read(mmapstream* p,void* Data,size_t Size,size_t* Readed)
+{
+    err_t Err = ERR_NONE;
+    size_t Pos = p->Base.Pos;
+    size_t Done = 0;
+
+    if (Pos >= p->Checked || Size > p->Checked - Pos)
+        CheckSize(p, Pos + Size);
+
+    if (Pos < p->Base.Size)
+    {
+        Done = Size;
+        if (Done > p->Base.Size - Pos)
+            Done = p->Base.Size - Pos;
+        memcpy(Data,p->Base.Ptr+Pos,Done);
+    }
+
+    if (Done < Size)
+    {
+        // not in memory, the file may have grown since it was mapped
+        ssize_t n = -1;
+        if (Size - Done <= SSIZE_MAX)
+            n = pread(p->fd, (uint8_t*)Data + Done, Size - Done, (off_t)(Pos + Done));
+        if (n < 0)
+            Err = ERR_READ;
+        else
+        {
+            if ((size_t)n != Size - Done)
+                Err = ERR_END_OF_FILE;
+            Done += (size_t)n;
+        }
+    }
+
+    p->Base.Pos = Pos+Done;
+    Release(p);
+
+    if (Readed)
+        *Readed = Done;
+    return Err;
+}
+
+static filepos_t Seek(mmapstream* p,filepos_t Pos,int SeekMode)
+{
+    switch (SeekMode)
+    {
+    default:
+    case SEEK_SET: break;
+    case SEEK_CUR: Pos += p->Base.Pos; break;
+    case SEEK_END: Pos += p->Base.Size; break;
+    }
+
+    if (Pos<0 || (uintmax_t)Pos > (uintmax_t)SIZE_MAX)
+        return INVALID_FILEPOS_T;
+
+    p->Base.Pos = (size_t)Pos;
+    Release(p);
+    return Pos;
+}
+
+static err_t Write(mmapstream* UNUSED_PARAM(p),const void* UNUSED_PARAM(Data),size_t UNUSED_PARAM(Size),size_t* Written)
+{
+    if (Written)
+        *Written = 0;
+    return ERR_NOT_SUPPORTED;
+}
+
+static err_t GetURL(mmapstream* p, dataid UNUSED_PARAM(Id), tchar_t* Data, size_t Size)
+{
+    if (!p->URL)
+        return ERR_INVALID_DATA;
+    tcscpy_s(Data,Size/sizeof(tchar_t),p->URL);
+    return ERR_NONE;
+}
+
+static void Delete(mmapstream* p)
+{
+    Unmap(p);
+}
+
+META_START(MMapStream_Class,MMAPSTREAM_CLASS)
+META_CLASS(SIZE,sizeof(mmapstream))
+META_CLASS(DELETE,Delete)
+META_VMT(TYPE_FUNC,stream_vmt,Open,Open)
+META_VMT(TYPE_FUNC,stream_vmt,Read,Read)
+META_VMT(TYPE_FUNC,stream_vmt,Seek,Seek)
+META_VMT(TYPE_FUNC,stream_vmt,Write,Write)
+META_DATA_RDONLY(TYPE_INT,STREAM_FLAGS,mmapstream,Flags)
+META_PARAM(GET,STREAM_URL,GetURL)
+META_END(MEMSTREAM_CLASS)
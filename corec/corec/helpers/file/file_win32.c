@@ -422,6 +422,14 @@ bool_t FileErase(const tchar_t* Path, bool_t Force, bool_t Safe)
         return FileRecycle(Path);
 }
 
+datetime_t FileDateTime(const tchar_t* Path)
+{
+    WIN32_FILE_ATTRIBUTE_DATA Data;
+    if (!GetFileAttributesEx(Path,GetFileExInfoStandard,&Data))
+        return INVALID_DATETIME_T;
+    return FileTimeToRel(&Data.ftLastWriteTime);
+}
+
 bool_t PathIsFolder(const tchar_t* Path)
 {
     DWORD attr = GetFileAttributes(Path);
@@ -196,9 +196,39 @@ META_END(STREAM_CLASS)
 
 static stream* GetStream(anynode*, const tchar_t* URL, int Flags);
 
+static stream* GetMappedStream(anynode *AnyNode, const tchar_t* URL, int Flags)
+{
+    tchar_t Protocol[MAXPROTOCOL];
+    stream* Stream;
+
+    GetProtocol(URL,Protocol,TSIZEOF(Protocol),NULL);
+    if (!tcsisame_ascii(Protocol,T("file")))
+        return NULL;
+
+    Stream = (stream*)NodeCreate(AnyNode,MMAPSTREAM_CLASS);
+    if (Stream && Stream_Open(Stream,URL,Flags|SFLAG_SILENT) != ERR_NONE)
+    {
+        // let the regular file stream handle it
+        NodeDelete((node*)Stream);
+        Stream = NULL;
+    }
+#if defined(CONFIG_DEBUGCHECKS)
+    if (Stream)
+        tcscpy_s(Stream->URL,TSIZEOF(Stream->URL),URL);
+#endif
+    return Stream;
+}
+
 stream* StreamOpen(anynode *AnyNode, const tchar_t* Path, int Flags)
 {
-    stream* File = GetStream(AnyNode,Path,Flags);
+    stream* File;
+
+    // local read-only files accessed directly in memory, no need for buffering
+    if ((Flags & (SFLAG_MAPPED|SFLAG_RDONLY|SFLAG_WRONLY|SFLAG_CREATE|SFLAG_NON_BLOCKING))==(SFLAG_MAPPED|SFLAG_RDONLY) &&
+        (File = GetMappedStream(AnyNode,Path,Flags)) != NULL)
+        return File;
+
+    File = GetStream(AnyNode,Path,Flags);
     if (File)
     {
         err_t Err = Stream_Open(File,Path,Flags);
@@ -36,6 +36,7 @@
 #define SFLAG_REOPEN              0x20   // private inside stream
 #define SFLAG_NO_CACHING         0x800
 #define SFLAG_NON_BLOCKING      0x1000   // used only by StreamOpen helper function
+#define SFLAG_MAPPED            0x2000   // used only by StreamOpen helper function, map read-only local files in memory, SFLAG_BUFFERED applies when it's not possible, the file must not be truncated while it's open (SIGBUS)
 
 #define MAX_NETWORK_PACKET      2048
 
@@ -130,10 +131,31 @@ typedef struct stream_vmt
 #define MEMSTREAM_PTR		0x101
 #define MEMSTREAM_OFFSET    0x102
 
+typedef struct memstream
+{
+    stream Base;
+    filepos_t VirtualOffset;
+    const uint8_t* Ptr;
+    size_t Pos;
+    size_t Size;
+
+} memstream;
+
+//---------------------------------------------------------------------------
+
+// read-only file mapped in memory, behaves like a MEMSTREAM_CLASS
+// the data added to the file after it's opened are read from the file, STREAM_LENGTH is the size in memory
+#define MMAPSTREAM_CLASS	FOURCC('M','M','A','P')
+
 //---------------------------------------------------------------------------
 
 #define BUFSTREAM_CLASS		FOURCC('B','U','F','S')
 #define BUFSTREAM_STREAM	0x100
+#define BUFSTREAM_SIZE		0x101 // size_t
+
+#define BUFSTREAM_MIN_SIZE      (64*1024)
+#define BUFSTREAM_MAX_SIZE      (8*1024*1024)
+#define BUFSTREAM_DEFAULT_SIZE  (256*1024)
 
 //---------------------------------------------------------------------------
 
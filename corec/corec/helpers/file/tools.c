@@ -374,6 +374,9 @@ extern const nodemeta BufStream_Class[];
 extern const nodemeta MemStream_Class[];
 extern const nodemeta Streams_Class[];
 extern const nodemeta File_Class[];
+#if defined(HAVE_SYS_MMAN_H)
+extern const nodemeta MMapStream_Class[];
+#endif
 #if defined(CONFIG_STDIO)
 extern const nodemeta Stdio_Class[];
 #endif
@@ -384,6 +387,9 @@ void CoreC_FileInit(nodemodule* Module)
     NodeRegisterClassEx(Module,MemStream_Class);
     NodeRegisterClassEx(Module,Streams_Class);
     NodeRegisterClassEx(Module,File_Class);
+#if defined(HAVE_SYS_MMAN_H)
+    NodeRegisterClassEx(Module,MMapStream_Class);
+#endif
 #if defined(CONFIG_STDIO)
     NodeRegisterClassEx(Module,Stdio_Class);
 #endif
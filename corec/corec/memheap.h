@@ -44,6 +44,15 @@ struct cc_memheap
 
 const cc_memheap *MemHeap_GetDefault(void);
 
+// heap for many small allocations of the same sizes, like the nodes of a parsed file,
+// each thread allocates from its own chunks, the memory is given back to the system
+// when the heap is destroyed
+cc_memheap *MemHeap_CreateSlab(void);
+void MemHeap_DestroySlab(cc_memheap *);
+// a thread about to exit gives its chunks and free lists to the next thread using the heap,
+// does nothing on other heaps
+void MemHeap_ReleaseThread(const cc_memheap *);
+
 static INLINE void *MemHeap_Alloc(const cc_memheap *p, size_t s)
 {
     return p->Alloc(p, s);
@@ -0,0 +1,65 @@
+/*****************************************************************************
+ *
+ * Copyright (c) 2008-2010, CoreCodec, Inc.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ ****************************************************************************/
+
+#ifndef __MULTITHREAD_H
+#define __MULTITHREAD_H
+
+#include "portab.h"
+
+// the worker threads and the lock they share, on top of Win32 or pthreads
+#if defined(TARGET_WIN)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+
+typedef HANDLE cc_thread;
+typedef DWORD cc_thread_return;
+typedef CRITICAL_SECTION cc_lock;
+#define THREAD_CALL WINAPI
+
+#define LockInit(l)         InitializeCriticalSection(l)
+#define LockDone(l)         DeleteCriticalSection(l)
+#define LockEnter(l)        EnterCriticalSection(l)
+#define LockLeave(l)        LeaveCriticalSection(l)
+#define ThreadStart(t,f,p)  ((*(t) = CreateThread(NULL,0,f,p,0,NULL)) != NULL)
+#define ThreadWait(t)       (WaitForSingleObject(t,INFINITE),CloseHandle(t))
+
+static INLINE int ThreadCPUCount(void)
+{
+    SYSTEM_INFO Info;
+    GetSystemInfo(&Info);
+    return (int)Info.dwNumberOfProcessors;
+}
+#else
+#include <pthread.h>
+#include <unistd.h>
+
+typedef pthread_t cc_thread;
+typedef void *cc_thread_return;
+typedef pthread_mutex_t cc_lock;
+#define THREAD_CALL
+
+#define LockInit(l)         pthread_mutex_init(l,NULL)
+#define LockDone(l)         pthread_mutex_destroy(l)
+#define LockEnter(l)        pthread_mutex_lock(l)
+#define LockLeave(l)        pthread_mutex_unlock(l)
+#define ThreadStart(t,f,p)  (pthread_create(t,NULL,f,p) == 0)
+#define ThreadWait(t)       pthread_join(t,NULL)
+
+static INLINE int ThreadCPUCount(void)
+{
+#if defined(_SC_NPROCESSORS_ONLN)
+    long Count = sysconf(_SC_NPROCESSORS_ONLN);
+    return Count > 0 ? (int)Count : 1;
+#else
+    return 1;
+#endif
+}
+#endif
+
+#endif
@@ -236,7 +236,7 @@ NOINLINE const nodeclass* NodeContext_FindClass(anynode* Any,fourcc_t ClassId)
     if (ClassId == 0)
         return NULL;
 
-    Ptr = (const nodeclass*)p->NodeCache;
+    Ptr = (const nodeclass*)AtomicLoadPtr(&p->NodeCache);
     if (Ptr && NodeClass_ClassId(Ptr) == ClassId)
         return Ptr;
 
@@ -265,7 +265,7 @@ NOINLINE const nodeclass* NodeContext_FindClass(anynode* Any,fourcc_t ClassId)
         else
             Ptr = ARRAYBEGIN(p->NodeClass,const nodeclass*)[Pos];
 
-        p->NodeCache = Ptr;
+        AtomicStorePtr(&p->NodeCache,Ptr);
     }
     else
     {
@@ -325,6 +325,7 @@ static void AddClassRef(const nodeclass* Class)
 
     Item.Class = Class;
     Item.Count = 1;
+    SpinLock(&Class->Module->ClassRefsLock);
     Pos = ArrayFind(Refs,class_ref_t,&Item,CmpClassRef,NULL,&Found);
     if (Found)
     {
@@ -334,6 +335,7 @@ static void AddClassRef(const nodeclass* Class)
     {
         DebugMessage(T("AddClassRef %p class %r/%p could not be added !"),Refs,Class->FourCC,Class);
     }
+    SpinUnlock(&Class->Module->ClassRefsLock);
 }
 
 static void DelClassRef(const nodeclass* Class)
@@ -344,6 +346,7 @@ static void DelClassRef(const nodeclass* Class)
     class_ref_t Item;
 
     Item.Class = Class;
+    SpinLock(&Class->Module->ClassRefsLock);
     Pos = ArrayFind(Refs,class_ref_t,&Item,CmpClassRef,NULL,&Found);
     if (Found)
     {
@@ -363,6 +366,7 @@ static void DelClassRef(const nodeclass* Class)
         }
         Pos = ArrayFind(Refs,class_ref_t,&Item,CmpClassRef,NULL,&Found);
     }
+    SpinUnlock(&Class->Module->ClassRefsLock);
 }
 #else
 #define AddClassRef(c)
@@ -426,9 +430,11 @@ static NOINLINE void UnlockModules(const nodeclass* Class)
 {
     for (;Class;Class=Class->ParentClass)
     {
+        size_t RefCount;
         DelClassRef(Class);
-        --Class->Module->Base.RefCount;
-        assert(Class->Module->Base.RefCount>=1);
+        RefCount = AtomicDecSize(&Class->Module->Base.RefCount);
+        assert(RefCount>=1);
+        (void)RefCount;
     }
 }
 
@@ -743,7 +749,7 @@ static NOINLINE const nodeclass* LockModules(nodecontext* p, const nodeclass* Cl
     }
 
     AddClassRef(Class);
-    ++Module->Base.RefCount;
+    AtomicIncSize(&Module->Base.RefCount);
 
     if (CheckLoadModule(p,Module))
     {
@@ -853,7 +859,11 @@ void Node_Destructor(node* Node)
 
 static bool_t AddSingleton(nodecontext* p, node* Node)
 {
-    return ArrayAdd(&p->NodeSingleton,node*,&Node,CmpNode,NULL,64)>=0;
+    bool_t Result;
+    SpinLock(&p->SingletonLock);
+    Result = ArrayAdd(&p->NodeSingleton,node*,&Node,CmpNode,NULL,64)>=0;
+    SpinUnlock(&p->SingletonLock);
+    return Result;
 }
 
 err_t Node_Constructor(anynode* AnyNode, node* Node, size_t Size, fourcc_t ClassId)
@@ -1279,7 +1289,11 @@ static node* NodeCreateFromClass(nodecontext* p, const nodeclass* Class, bool_t
         if (CallCreate(p,Node,Class) != ERR_NONE)
         {
             if (Singleton)
+            {
+                SpinLock(&p->SingletonLock);
                 ArrayRemove(&p->NodeSingleton,node*,&Node,NULL,NULL); // can't use CmpNode, because Node->VMT is NULL
+                SpinUnlock(&p->SingletonLock);
+            }
             UnlockModules(Class);
 
             MemHeap_Free(p->NodeHeap,Node,Size);
@@ -1412,7 +1426,7 @@ void Node_AddRef(thisnode p)
 {
     assert(p); // we may switch to virtual reference functions later
     Node_ValidatePtr(p);
-    ++((node*)p)->RefCount;
+    AtomicIncSize(&((node*)p)->RefCount);
 }
 
 void Node_Release(thisnode p)
@@ -1422,7 +1436,7 @@ void Node_Release(thisnode p)
     Node_ValidatePtr(p);
 
     Context = Node_Context(p);
-    if (--((node*)p)->RefCount == 0)
+    if (AtomicDecSize(&((node*)p)->RefCount) == 0)
     {
         const nodeclass* Class = NodeGetClass(p);
         Node_Notify((node*)p,NODE_DELETING);
@@ -1491,9 +1505,11 @@ node* NodeSingleton(anynode* Any, fourcc_t Class)
         size_t Pos;
         bool_t Found;
 
+        SpinLock(&p->SingletonLock);
         Pos = ArrayFind(&p->NodeSingleton,node*,&Class,CmpNodeClass,NULL,&Found);
         if (Found)
             Node = ARRAYBEGIN(p->NodeSingleton,node*)[Pos];
+        SpinUnlock(&p->SingletonLock);
     }
     return Node;
 }
@@ -440,17 +440,22 @@ struct nodemodule
 	datetime_t Stamp;
 #if defined(CONFIG_DEBUG_LEAKS)
     array ClassRefs;
+    cc_spinlock ClassRefsLock; // guards ClassRefs, nodes of the module can be created by several threads
 #endif
 	uint8_t Found;
     uint8_t Config;
     uint8_t Changed;
 };
 
+// Nodes can be created, referenced and released from several threads sharing
+// one context, as long as each node is only modified by one thread at a time.
+// Registering classes and loading modules must still happen on a single thread.
 struct nodecontext
 {
     nodemodule Base;
-    const void* NodeCache;
+    const void* NodeCache; // last class found, read/written atomically
 	array NodeSingleton;
+    cc_spinlock SingletonLock; // guards NodeSingleton
 	array NodeClass; // ordered by id
     const cc_memheap* NodeHeap;
     const cc_memheap* NodeConstHeap;
@@ -289,6 +289,46 @@ typedef uint16_t utf16_t;
 #define UNUSED_PARAM(x) (x)
 #endif
 
+// thread local storage and the few atomic operations shared nodes need
+typedef long cc_spinlock;
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define THREAD_LOCAL __declspec(thread)
+#if defined(_WIN64)
+#define AtomicIncSize(p)  ((size_t)_InterlockedIncrement64((volatile __int64*)(p)))
+#define AtomicDecSize(p)  ((size_t)_InterlockedDecrement64((volatile __int64*)(p)))
+#else
+#define AtomicIncSize(p)  ((size_t)_InterlockedIncrement((volatile long*)(p)))
+#define AtomicDecSize(p)  ((size_t)_InterlockedDecrement((volatile long*)(p)))
+#endif
+#define AtomicLoadPtr(p)  (*(void* const volatile*)(p))
+#define AtomicStorePtr(p,v) _InterlockedExchangePointer((void* volatile*)(p),(void*)(v))
+#if defined(_M_ARM) || defined(_M_ARM64)
+#define SpinPause()       __yield() // what YieldProcessor() gives, without windows.h
+#else
+#define SpinPause()       _mm_pause()
+#endif
+#define SpinLock(p)       while (_InterlockedExchange((volatile long*)(p),1)) SpinPause()
+#define SpinUnlock(p)     _InterlockedExchange((volatile long*)(p),0)
+#elif defined(COMPILER_GCC) || defined(__clang__)
+#define THREAD_LOCAL __thread
+#define AtomicIncSize(p)  __atomic_add_fetch((size_t*)(p),1,__ATOMIC_RELAXED)
+#define AtomicDecSize(p)  __atomic_sub_fetch((size_t*)(p),1,__ATOMIC_ACQ_REL)
+#define AtomicLoadPtr(p)  __atomic_load_n((p),__ATOMIC_ACQUIRE)
+#define AtomicStorePtr(p,v) __atomic_store_n((p),(v),__ATOMIC_RELEASE)
+#define SpinLock(p)       while (__atomic_exchange_n((cc_spinlock*)(p),1,__ATOMIC_ACQUIRE)) {}
+#define SpinUnlock(p)     __atomic_store_n((cc_spinlock*)(p),0,__ATOMIC_RELEASE)
+#else // no threading support, plain operations
+#define THREAD_LOCAL
+#define AtomicIncSize(p)  (++*(size_t*)(p))
+#define AtomicDecSize(p)  (--*(size_t*)(p))
+#define AtomicLoadPtr(p)  (*(p))
+#define AtomicStorePtr(p,v) (*(p) = (v))
+#define SpinLock(p)       ((void)(p))
+#define SpinUnlock(p)     ((void)(p))
+#endif
+
 #ifdef CONFIG_FILEPOS_64
 typedef int_fast64_t filepos_t;
 #define MAX_FILEPOS INT_FAST64_MAX
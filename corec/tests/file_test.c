@@ -1,4 +1,6 @@
 #include <corec/helpers/file/file.h>
+#include <corec/helpers/file/streams.h>
+#include <corec/helpers/parser/parser.h>
 #include <corec/str/str.h>
 
 #include <stdio.h>
@@ -19,11 +21,213 @@ void DebugMessage(const tchar_t* Msg,...)
 #endif
 }
 
-int main(int UNUSED_PARAM(argc),char** UNUSED_PARAM(argv))
+#define TEST_FILE_SIZE  (BUFSTREAM_MIN_SIZE*3 + 123)
+
+static int TestBufStream(nodecontext *p, const tchar_t *Path)
+{
+    static uint8_t Data[TEST_FILE_SIZE];
+    uint8_t Read[64];
+    size_t i, Readed;
+    int Result = 1;
+    stream *File;
+
+    for (i=0;i<sizeof(Data);++i)
+        Data[i] = (uint8_t)(i*7);
+
+    File = StreamOpen(p,Path,SFLAG_WRONLY|SFLAG_CREATE|SFLAG_BUFFERED);
+    if (!File)
+        return 1;
+    if (Stream_Write(File,Data,sizeof(Data),NULL) != ERR_NONE)
+        goto failed;
+    if (Stream_Seek(File,0,SEEK_CUR) != (filepos_t)sizeof(Data))
+        goto failed;
+    // patch data already written
+    if (Stream_Seek(File,10,SEEK_SET) != 10)
+        goto failed;
+    Data[10] = 0xAB;
+    if (Stream_Write(File,&Data[10],1,NULL) != ERR_NONE)
+        goto failed;
+    StreamClose(File);
+
+    // patch data already flushed and data still pending with a small buffer
+    File = StreamOpen(p,Path,SFLAG_WRONLY|SFLAG_CREATE|SFLAG_BUFFERED);
+    if (!File)
+        return 1;
+    i = BUFSTREAM_MIN_SIZE;
+    if (Node_SET(File,BUFSTREAM_SIZE,&i) != ERR_NONE)
+        goto failed;
+    if (Stream_Write(File,Data,sizeof(Data)-100,NULL) != ERR_NONE)
+        goto failed;
+    if (Stream_Seek(File,20,SEEK_SET) != 20)
+        goto failed;
+    Data[20] = 0xCD;
+    if (Stream_Write(File,&Data[20],1,NULL) != ERR_NONE || Stream_Seek(File,0,SEEK_CUR) != 21)
+        goto failed;
+    if (Stream_Seek(File,sizeof(Data)-200,SEEK_SET) != (filepos_t)sizeof(Data)-200)
+        goto failed;
+    Data[sizeof(Data)-200] = 0xEF;
+    if (Stream_Write(File,&Data[sizeof(Data)-200],1,NULL) != ERR_NONE)
+        goto failed;
+    if (Stream_Seek(File,sizeof(Data)-100,SEEK_SET) != (filepos_t)sizeof(Data)-100)
+        goto failed;
+    if (Stream_Write(File,Data+sizeof(Data)-100,100,NULL) != ERR_NONE)
+        goto failed;
+    StreamClose(File);
+
+    File = StreamOpen(p,Path,SFLAG_RDONLY|SFLAG_BUFFERED);
+    if (!File)
+        return 1;
+    if (Stream_Read(File,Read,32,&Readed) != ERR_NONE || Readed != 32 || memcmp(Read,Data,32)!=0)
+        goto failed;
+    // backward inside the buffer
+    if (Stream_Seek(File,3,SEEK_SET) != 3 || Stream_Read(File,Read,8,NULL) != ERR_NONE || memcmp(Read,Data+3,8)!=0)
+        goto failed;
+    if (Stream_Seek(File,0,SEEK_CUR) != 11)
+        goto failed;
+    // outside the buffer
+    if (Stream_Seek(File,BUFSTREAM_MIN_SIZE*2+5,SEEK_SET) != BUFSTREAM_MIN_SIZE*2+5)
+        goto failed;
+    if (Stream_Read(File,Read,sizeof(Read),NULL) != ERR_NONE || memcmp(Read,Data+BUFSTREAM_MIN_SIZE*2+5,sizeof(Read))!=0)
+        goto failed;
+    if (Stream_Seek(File,-10,SEEK_END) != (filepos_t)sizeof(Data)-10)
+        goto failed;
+    if (Stream_Read(File,Read,sizeof(Read),&Readed) != ERR_END_OF_FILE || Readed != 10 || memcmp(Read,Data+sizeof(Data)-10,10)!=0)
+        goto failed;
+    if (Stream_Seek(File,sizeof(Data)-200,SEEK_SET) != (filepos_t)sizeof(Data)-200)
+        goto failed;
+    if (Stream_Read(File,Read,sizeof(Read),NULL) != ERR_NONE || memcmp(Read,Data+sizeof(Data)-200,sizeof(Read))!=0)
+        goto failed;
+    Result = 0;
+
+failed:
+    StreamClose(File);
+    FileErase(Path,1,0);
+    return Result;
+}
+
+static int TestReadOnlyStream(nodecontext *p, const tchar_t *Path)
+{
+    static const uint8_t Data[] = "0123456789abcdef";
+    uint8_t Read[sizeof(Data)];
+    size_t Readed;
+    int Result = 1;
+    stream *File;
+
+    File = StreamOpen(p,Path,SFLAG_WRONLY|SFLAG_CREATE);
+    if (!File)
+        return 1;
+    Stream_Write(File,Data,sizeof(Data),NULL);
+    StreamClose(File);
+
+    // may be a mapped file, it must behave like a regular file
+    File = StreamOpen(p,Path,SFLAG_RDONLY|SFLAG_MAPPED);
+    if (!File)
+        return 1;
+    if (Stream_Seek(File,4,SEEK_SET) != 4 || Stream_Read(File,Read,4,NULL) != ERR_NONE || memcmp(Read,Data+4,4)!=0)
+        goto failed;
+    if (Stream_Read(File,Read,sizeof(Read),&Readed) != ERR_END_OF_FILE || Readed != sizeof(Data)-8)
+        goto failed;
+    // past the end of the file
+    if (Stream_Seek(File,100,SEEK_SET) != 100 || Stream_Read(File,Read,1,&Readed) != ERR_END_OF_FILE || Readed != 0)
+        goto failed;
+    if (Stream_Write(File,Data,1,NULL) == ERR_NONE)
+        goto failed;
+    Result = 0;
+
+failed:
+    StreamClose(File);
+    FileErase(Path,1,0);
+    return Result;
+}
+
+#define TEST_MAPPED_SIZE  (4*1024*1024)
+
+static bool_t WriteFile(nodecontext *p, const tchar_t *Path, const uint8_t *Data, size_t Size)
+{
+    stream *File = StreamOpen(p,Path,SFLAG_WRONLY|SFLAG_CREATE|SFLAG_BUFFERED);
+    bool_t Written;
+    if (!File)
+        return 0;
+    Written = Stream_Write(File,Data,Size,NULL) == ERR_NONE;
+    StreamClose(File);
+    return Written;
+}
+
+// a mapped file read far past the memory it releases, then modified while it's open
+static int TestMappedStream(nodecontext *p, const tchar_t *Path)
+{
+    static uint8_t Data[TEST_MAPPED_SIZE + 1000];
+    uint8_t Read[64];
+    size_t i, Readed;
+    filepos_t Length;
+    int Result = 1;
+    stream *File;
+
+    for (i=0;i<sizeof(Data);++i)
+        Data[i] = (uint8_t)(i*13 + (i>>12));
+
+    if (!WriteFile(p,Path,Data,TEST_MAPPED_SIZE))
+        return 1;
+    File = StreamOpen(p,Path,SFLAG_RDONLY|SFLAG_MAPPED);
+    if (!File)
+        return 1;
+    for (i=0;i<TEST_MAPPED_SIZE;i+=100000)
+        if (Stream_Seek(File,i,SEEK_SET) != (filepos_t)i || Stream_Read(File,Read,sizeof(Read),NULL) != ERR_NONE || memcmp(Read,Data+i,sizeof(Read))!=0)
+            goto failed;
+    // the data released from memory are still there
+    if (Stream_Seek(File,5,SEEK_SET) != 5 || Stream_Read(File,Read,sizeof(Read),NULL) != ERR_NONE || memcmp(Read,Data+5,sizeof(Read))!=0)
+        goto failed;
+
+    // data added after the file was opened
+    if (!WriteFile(p,Path,Data,sizeof(Data)))
+        goto failed;
+    if (Stream_Seek(File,TEST_MAPPED_SIZE-10,SEEK_SET) != TEST_MAPPED_SIZE-10)
+        goto failed;
+    if (Stream_Read(File,Read,sizeof(Read),&Readed) != ERR_NONE || Readed != sizeof(Read) || memcmp(Read,Data+TEST_MAPPED_SIZE-10,sizeof(Read))!=0)
+        goto failed;
+    StreamClose(File);
+
+    // the file is truncated after it was opened
+    File = StreamOpen(p,Path,SFLAG_RDONLY|SFLAG_MAPPED);
+    if (!File)
+        return 1;
+    if (Stream_Read(File,Read,sizeof(Read),NULL) != ERR_NONE || memcmp(Read,Data,sizeof(Read))!=0)
+        goto failed;
+    if (!WriteFile(p,Path,Data,1000))
+        goto failed;
+    if (Stream_Seek(File,TEST_MAPPED_SIZE/2,SEEK_SET) != TEST_MAPPED_SIZE/2)
+        goto failed;
+    if (Stream_Read(File,Read,sizeof(Read),&Readed) != ERR_END_OF_FILE || Readed != 0)
+        goto failed;
+    if (Node_GET(File,STREAM_LENGTH,&Length) != ERR_NONE || Length != 1000)
+        goto failed;
+    Result = 0;
+
+failed:
+    StreamClose(File);
+    FileErase(Path,1,0);
+    return Result;
+}
+
+int main(int argc,char** argv)
 {
-    nodecontext Context;
-    NodeContext_Init(&Context,NULL,NULL,NULL);
+    int Result = 0;
+    parsercontext Context;
+    ParserContext_Init(&Context,NULL,NULL,NULL);
+
+    if (argc > 1)
+    {
+        tchar_t Path[MAXPATHFULL];
+        Node_FromStr(&Context,Path,TSIZEOF(Path),argv[1]);
+        Result = TestBufStream((nodecontext*)&Context,Path);
+        if (Result)
+            fprintf(stderr,"buffered stream test failed\n");
+        else if ((Result = TestReadOnlyStream((nodecontext*)&Context,Path)) != 0)
+            fprintf(stderr,"read-only stream test failed\n");
+        else if ((Result = TestMappedStream((nodecontext*)&Context,Path)) != 0)
+            fprintf(stderr,"mapped stream test failed\n");
+    }
 
-    NodeContext_Done(&Context);
-    return 0;
+    ParserContext_Done(&Context);
+    return Result;
 }
@@ -1,7 +1,12 @@
 #include <corec/node/node.h>
 #include <corec/str/str.h>
+#include <corec/memheap.h>
 
 #include <stdio.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
 void DebugMessage(const tchar_t* Msg,...)
 {
     va_list Args;
@@ -19,12 +24,12 @@ void DebugMessage(const tchar_t* Msg,...)
 #endif
 }
 
-int main(int UNUSED_PARAM(argc),char** UNUSED_PARAM(argv))
+static void TestNodes(const cc_memheap* Heap)
 {
     node* p[10000];
     int i;
     nodecontext Context;
-    NodeContext_Init(&Context,NULL,NULL,NULL);
+    NodeContext_Init(&Context,NULL,Heap,NULL);
 
     for (i=0;i<10000;++i)
         p[i] = NodeCreate(&Context,NODE_CLASS);
@@ -36,5 +41,75 @@ int main(int UNUSED_PARAM(argc),char** UNUSED_PARAM(argv))
         NodeDelete(p[i]);
 
     NodeContext_Done(&Context);
-    return 0;
+}
+
+#ifdef HAVE_PTHREAD
+#define TEST_THREADS 4
+
+typedef struct thread_test
+{
+    nodecontext* Context;
+    node* Shared;
+} thread_test;
+
+static void* NodesThread(void* Param)
+{
+    thread_test* Test = Param;
+    int i;
+    for (i=0;i<100000;++i)
+    {
+        Node_AddRef(Test->Shared);
+        NodeDelete(NodeCreate(Test->Context,NODE_CLASS));
+        Node_Release(Test->Shared);
+    }
+    MemHeap_ReleaseThread(Test->Context->NodeHeap);
+    return NULL;
+}
+
+// several threads creating and releasing nodes of the same context
+static int TestThreads(const cc_memheap* Heap)
+{
+    pthread_t Threads[TEST_THREADS];
+    thread_test Test;
+    nodecontext Context;
+    int i, Started, Result = 0;
+    NodeContext_Init(&Context,NULL,Heap,NULL);
+
+    Test.Context = &Context;
+    Test.Shared = NodeCreate(&Context,NODE_CLASS);
+    for (Started=0;Started<TEST_THREADS;++Started)
+        if (pthread_create(&Threads[Started],NULL,NodesThread,&Test)!=0)
+        {
+            Result = 1;
+            break;
+        }
+    for (i=0;i<Started;++i)
+        pthread_join(Threads[i],NULL);
+    if (Test.Shared->RefCount != 1)
+        Result = 1;
+    NodeDelete(Test.Shared);
+
+    NodeContext_Done(&Context);
+    return Result;
+}
+#endif
+
+int main(int UNUSED_PARAM(argc),char** UNUSED_PARAM(argv))
+{
+    cc_memheap* Heap;
+    int Result = 0;
+
+    TestNodes(NULL);
+
+    Heap = MemHeap_CreateSlab();
+    if (!Heap)
+        return 1;
+    TestNodes(Heap);
+#ifdef HAVE_PTHREAD
+    Result |= TestThreads(NULL);
+    Result |= TestThreads(Heap);
+    Result |= TestThreads(Heap); // with the caches left by the previous threads
+#endif
+    MemHeap_DestroySlab(Heap);
+    return Result;
 }
@@ -118,8 +118,13 @@ typedef struct ebml_element_vmt
 #define EBML_ElementCopy(p)                  VMT_FUNC(p,ebml_element_vmt)->Copy(p)
 
 EBML_DLL err_t EBML_Init(parsercontext *p);
+// each EBML_Init() needs a matching EBML_Done()
+EBML_DLL void EBML_Done(parsercontext *p);
 
 EBML_DLL ebml_element *EBML_ElementCreate(anynode *Any, const ebml_context *Context, bool_t SetDefault, int ForProfile);
+// build the ID lookup of the context and all its sub-contexts, otherwise their IDs are searched one by one,
+// it can be called while other threads are parsing
+EBML_DLL void EBML_ContextIndexSemantic(const ebml_context *Context);
 
 EBML_DLL ebml_element *EBML_FindNextId(struct stream *Input, const ebml_context *Context, size_t MaxDataSize);
 EBML_DLL ebml_element *EBML_FindNextElement(struct stream *Input, const ebml_parser_context *Context, int *UpperLevels, bool_t AllowDummy);
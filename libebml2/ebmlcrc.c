@@ -15,61 +15,7 @@ struct ebml_crc
 /* Compute the CRC 32 IEEE Little Endian */
 
 const uint32_t CRC32_NEGL = 0xffffffffL;
-const uint32_t m_tab[] = {
-#ifdef IS_BIG_ENDIAN
-	0x00000000L, 0x96300777L, 0x2c610eeeL, 0xba510999L, 0x19c46d07L,
-	0x8ff46a70L, 0x35a563e9L, 0xa395649eL, 0x3288db0eL, 0xa4b8dc79L,
-	0x1ee9d5e0L, 0x88d9d297L, 0x2b4cb609L, 0xbd7cb17eL, 0x072db8e7L,
-	0x911dbf90L, 0x6410b71dL, 0xf220b06aL, 0x4871b9f3L, 0xde41be84L,
-	0x7dd4da1aL, 0xebe4dd6dL, 0x51b5d4f4L, 0xc785d383L, 0x56986c13L,
-	0xc0a86b64L, 0x7af962fdL, 0xecc9658aL, 0x4f5c0114L, 0xd96c0663L,
-	0x633d0ffaL, 0xf50d088dL, 0xc8206e3bL, 0x5e10694cL, 0xe44160d5L,
-	0x727167a2L, 0xd1e4033cL, 0x47d4044bL, 0xfd850dd2L, 0x6bb50aa5L,
-	0xfaa8b535L, 0x6c98b242L, 0xd6c9bbdbL, 0x40f9bcacL, 0xe36cd832L,
-	0x755cdf45L, 0xcf0dd6dcL, 0x593dd1abL, 0xac30d926L, 0x3a00de51L,
-	0x8051d7c8L, 0x1661d0bfL, 0xb5f4b421L, 0x23c4b356L, 0x9995bacfL,
-	0x0fa5bdb8L, 0x9eb80228L, 0x0888055fL, 0xb2d90cc6L, 0x24e90bb1L,
-	0x877c6f2fL, 0x114c6858L, 0xab1d61c1L, 0x3d2d66b6L, 0x9041dc76L,
-	0x0671db01L, 0xbc20d298L, 0x2a10d5efL, 0x8985b171L, 0x1fb5b606L,
-	0xa5e4bf9fL, 0x33d4b8e8L, 0xa2c90778L, 0x34f9000fL, 0x8ea80996L,
-	0x18980ee1L, 0xbb0d6a7fL, 0x2d3d6d08L, 0x976c6491L, 0x015c63e6L,
-	0xf4516b6bL, 0x62616c1cL, 0xd8306585L, 0x4e0062f2L, 0xed95066cL,
-	0x7ba5011bL, 0xc1f40882L, 0x57c40ff5L, 0xc6d9b065L, 0x50e9b712L,
-	0xeab8be8bL, 0x7c88b9fcL, 0xdf1ddd62L, 0x492dda15L, 0xf37cd38cL,
-	0x654cd4fbL, 0x5861b24dL, 0xce51b53aL, 0x7400bca3L, 0xe230bbd4L,
-	0x41a5df4aL, 0xd795d83dL, 0x6dc4d1a4L, 0xfbf4d6d3L, 0x6ae96943L,
-	0xfcd96e34L, 0x468867adL, 0xd0b860daL, 0x732d0444L, 0xe51d0333L,
-	0x5f4c0aaaL, 0xc97c0dddL, 0x3c710550L, 0xaa410227L, 0x10100bbeL,
-	0x86200cc9L, 0x25b56857L, 0xb3856f20L, 0x09d466b9L, 0x9fe461ceL,
-	0x0ef9de5eL, 0x98c9d929L, 0x2298d0b0L, 0xb4a8d7c7L, 0x173db359L,
-	0x810db42eL, 0x3b5cbdb7L, 0xad6cbac0L, 0x2083b8edL, 0xb6b3bf9aL,
-	0x0ce2b603L, 0x9ad2b174L, 0x3947d5eaL, 0xaf77d29dL, 0x1526db04L,
-	0x8316dc73L, 0x120b63e3L, 0x843b6494L, 0x3e6a6d0dL, 0xa85a6a7aL,
-	0x0bcf0ee4L, 0x9dff0993L, 0x27ae000aL, 0xb19e077dL, 0x44930ff0L,
-	0xd2a30887L, 0x68f2011eL, 0xfec20669L, 0x5d5762f7L, 0xcb676580L,
-	0x71366c19L, 0xe7066b6eL, 0x761bd4feL, 0xe02bd389L, 0x5a7ada10L,
-	0xcc4add67L, 0x6fdfb9f9L, 0xf9efbe8eL, 0x43beb717L, 0xd58eb060L,
-	0xe8a3d6d6L, 0x7e93d1a1L, 0xc4c2d838L, 0x52f2df4fL, 0xf167bbd1L,
-	0x6757bca6L, 0xdd06b53fL, 0x4b36b248L, 0xda2b0dd8L, 0x4c1b0aafL,
-	0xf64a0336L, 0x607a0441L, 0xc3ef60dfL, 0x55df67a8L, 0xef8e6e31L,
-	0x79be6946L, 0x8cb361cbL, 0x1a8366bcL, 0xa0d26f25L, 0x36e26852L,
-	0x95770cccL, 0x03470bbbL, 0xb9160222L, 0x2f260555L, 0xbe3bbac5L,
-	0x280bbdb2L, 0x925ab42bL, 0x046ab35cL, 0xa7ffd7c2L, 0x31cfd0b5L,
-	0x8b9ed92cL, 0x1daede5bL, 0xb0c2649bL, 0x26f263ecL, 0x9ca36a75L,
-	0x0a936d02L, 0xa906099cL, 0x3f360eebL, 0x85670772L, 0x13570005L,
-	0x824abf95L, 0x147ab8e2L, 0xae2bb17bL, 0x381bb60cL, 0x9b8ed292L,
-	0x0dbed5e5L, 0xb7efdc7cL, 0x21dfdb0bL, 0xd4d2d386L, 0x42e2d4f1L,
-	0xf8b3dd68L, 0x6e83da1fL, 0xcd16be81L, 0x5b26b9f6L, 0xe177b06fL,
-	0x7747b718L, 0xe65a0888L, 0x706a0fffL, 0xca3b0666L, 0x5c0b0111L,
-	0xff9e658fL, 0x69ae62f8L, 0xd3ff6b61L, 0x45cf6c16L, 0x78e20aa0L,
-	0xeed20dd7L, 0x5483044eL, 0xc2b30339L, 0x612667a7L, 0xf71660d0L,
-	0x4d476949L, 0xdb776e3eL, 0x4a6ad1aeL, 0xdc5ad6d9L, 0x660bdf40L,
-	0xf03bd837L, 0x53aebca9L, 0xc59ebbdeL, 0x7fcfb247L, 0xe9ffb530L,
-	0x1cf2bdbdL, 0x8ac2bacaL, 0x3093b353L, 0xa6a3b424L, 0x0536d0baL,
-	0x9306d7cdL, 0x2957de54L, 0xbf67d923L, 0x2e7a66b3L, 0xb84a61c4L,
-	0x021b685dL, 0x942b6f2aL, 0x37be0bb4L, 0xa18e0cc3L, 0x1bdf055aL,
-	0x8def022dL
-#else
+static const uint32_t m_tab[] = {
 	0x00000000L, 0x77073096L, 0xee0e612cL, 0x990951baL, 0x076dc419L,
 	0x706af48fL, 0xe963a535L, 0x9e6495a3L, 0x0edb8832L, 0x79dcb8a4L,
 	0xe0d5e91eL, 0x97d2d988L, 0x09b64c2bL, 0x7eb17cbdL, 0xe7b82d07L,
@@ -122,17 +68,221 @@ const uint32_t m_tab[] = {
 	0xcdd70693L, 0x54de5729L, 0x23d967bfL, 0xb3667a2eL, 0xc4614ab8L,
 	0x5d681b02L, 0x2a6f2b94L, 0xb40bbe37L, 0xc30c8ea1L, 0x5a05df1bL,
 	0x2d02ef8dL
-#endif
 };
 
-#ifdef IS_BIG_ENDIAN
-# define CRC32_INDEX(c) (c >> 24)
-# define CRC32_SHIFTED(c) (c << 8)
+#define CRC32_BYTE(c,b) (m_tab[((c) ^ (b)) & 0xff] ^ ((c) >> 8))
+
+typedef uint32_t (*crc_update)(uint32_t CRC, const uint8_t *Buf, size_t Size);
+
+// CRCSliced[k][i] is the CRC of the byte i followed by k zero bytes, CRCSliced[0] is m_tab
+static uint32_t CRCSliced[8][256];
+static crc_update CRCUpdate = NULL; // only read once CRCReady is set
+static void *CRCReady = NULL;
+static cc_spinlock CRCLock = 0;
+
+// slicing-by-8, 8 bytes per step
+static uint32_t UpdateSliced(uint32_t CRC, const uint8_t *Buf, size_t Size)
+{
+    uint32_t Low, High;
+    while (Size >= 8)
+    {
+        // the bytes are loaded one by one so the CRC register is the same on all CPUs
+        Low = ((uint32_t)Buf[3] << 24 | (uint32_t)Buf[2] << 16 | (uint32_t)Buf[1] << 8 | Buf[0]) ^ CRC;
+        High = (uint32_t)Buf[7] << 24 | (uint32_t)Buf[6] << 16 | (uint32_t)Buf[5] << 8 | Buf[4];
+        CRC = CRCSliced[7][Low & 0xff] ^ CRCSliced[6][(Low >> 8) & 0xff] ^ CRCSliced[5][(Low >> 16) & 0xff] ^ CRCSliced[4][Low >> 24] ^
+              CRCSliced[3][High & 0xff] ^ CRCSliced[2][(High >> 8) & 0xff] ^ CRCSliced[1][(High >> 16) & 0xff] ^ CRCSliced[0][High >> 24];
+        Buf += 8;
+        Size -= 8;
+    }
+    while (Size--)
+        CRC = CRC32_BYTE(CRC, *Buf++);
+    return CRC;
+}
+
+#if (defined(IX86_64) || defined(IX86)) && (defined(COMPILER_GCC) || defined(_MSC_VER))
+#define CRC_PCLMUL
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define CRC_TARGET_PCLMUL
 #else
-# define CRC32_INDEX(c) (c & 0xff)
-# define CRC32_SHIFTED(c) (c >> 8)
+#include <immintrin.h>
+#define CRC_TARGET_PCLMUL __attribute__((target("pclmul,sse4.1")))
 #endif
 
+// carry-less multiplication folding of 4 x 128 bits, from "Fast CRC Computation for Generic
+// Polynomials Using PCLMULQDQ Instruction" (Intel), with the bit-reflected CRC-32 constants
+CRC_TARGET_PCLMUL static uint32_t FoldPCLMUL(uint32_t CRC, const uint8_t *Buf, size_t Size)
+{
+    static const uint64_t K1K2[2] = { 0x0154442bd4, 0x01c6e41596 };
+    static const uint64_t K3K4[2] = { 0x01751997d0, 0x00ccaa009e };
+    static const uint64_t K5K0[2] = { 0x0163cd6124, 0x0000000000 };
+    static const uint64_t Poly[2] = { 0x01db710641, 0x01f7011641 }; // P(x) and the Barrett constant
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, Mask;
+
+    assert(Size >= 64 && (Size & 15) == 0);
+    x1 = _mm_loadu_si128((const __m128i*)(Buf + 0x00));
+    x2 = _mm_loadu_si128((const __m128i*)(Buf + 0x10));
+    x3 = _mm_loadu_si128((const __m128i*)(Buf + 0x20));
+    x4 = _mm_loadu_si128((const __m128i*)(Buf + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)CRC));
+    x0 = _mm_loadu_si128((const __m128i*)K1K2);
+    Buf += 64;
+    Size -= 64;
+
+    while (Size >= 64)
+    {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i*)(Buf + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i*)(Buf + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i*)(Buf + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i*)(Buf + 0x30)));
+        Buf += 64;
+        Size -= 64;
+    }
+
+    // fold the 4 x 128 bits into 128 bits
+    x0 = _mm_loadu_si128((const __m128i*)K3K4);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    while (Size >= 16)
+    {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((const __m128i*)Buf)), x5);
+        Buf += 16;
+        Size -= 16;
+    }
+
+    // 128 bits to 64 bits
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    Mask = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+    x0 = _mm_loadl_epi64((const __m128i*)K5K0);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, Mask), x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // Barrett reduction to 32 bits
+    x0 = _mm_loadu_si128((const __m128i*)Poly);
+    x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, Mask), x0, 0x10);
+    x2 = _mm_clmulepi64_si128(_mm_and_si128(x2, Mask), x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    return (uint32_t)_mm_extract_epi32(x1, 1);
+}
+
+static uint32_t UpdatePCLMUL(uint32_t CRC, const uint8_t *Buf, size_t Size)
+{
+    if (Size >= 64)
+    {
+        size_t Folded = Size & ~(size_t)15;
+        CRC = FoldPCLMUL(CRC, Buf, Folded);
+        Buf += Folded;
+        Size -= Folded;
+    }
+    return UpdateSliced(CRC, Buf, Size);
+}
+
+static bool_t HasPCLMUL(void)
+{
+#if defined(_MSC_VER)
+    int Info[4];
+    __cpuid(Info, 1);
+    return (Info[2] & (1<<1)) && (Info[2] & (1<<19)); // PCLMULQDQ and SSE4.1
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+#endif
+}
+#endif // x86
+
+#if defined(__aarch64__) && defined(COMPILER_GCC) && (defined(TARGET_LINUX) || defined(TARGET_ANDROID) || defined(TARGET_OSX))
+#define CRC_ARMV8
+#include <arm_acle.h>
+#if defined(TARGET_LINUX) || defined(TARGET_ANDROID)
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#endif
+#if defined(__clang__)
+#define CRC_TARGET_ARMV8 __attribute__((target("crc")))
+#else
+#define CRC_TARGET_ARMV8 __attribute__((target("+crc")))
+#endif
+
+// the ARMv8 CRC32 instructions use the same polynomial as EBML
+CRC_TARGET_ARMV8 static uint32_t UpdateARMv8(uint32_t CRC, const uint8_t *Buf, size_t Size)
+{
+    uint64_t Value;
+    while (Size >= 8)
+    {
+        memcpy(&Value, Buf, 8); // little endian
+        CRC = __crc32d(CRC, Value);
+        Buf += 8;
+        Size -= 8;
+    }
+    while (Size--)
+        CRC = __crc32b(CRC, *Buf++);
+    return CRC;
+}
+
+static bool_t HasARMv8CRC(void)
+{
+#if defined(TARGET_OSX)
+    return 1; // all the 64 bits Apple CPUs have it
+#else
+    return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#endif
+}
+#endif // ARMv8
+
+static crc_update GetCRCUpdate(void)
+{
+    if (!AtomicLoadPtr(&CRCReady))
+    {
+        crc_update Update;
+        size_t i, k;
+        SpinLock(&CRCLock);
+        if (!CRCReady)
+        {
+            for (i=0;i<256;++i)
+            {
+                CRCSliced[0][i] = m_tab[i];
+                for (k=1;k<8;++k)
+                    CRCSliced[k][i] = CRC32_BYTE(CRCSliced[k-1][i], 0);
+            }
+            Update = UpdateSliced;
+#if defined(CRC_PCLMUL)
+            if (HasPCLMUL())
+                Update = UpdatePCLMUL;
+#endif
+#if defined(CRC_ARMV8)
+            if (HasARMv8CRC())
+                Update = UpdateARMv8;
+#endif
+            CRCUpdate = Update;
+            AtomicStorePtr(&CRCReady, CRCSliced);
+        }
+        SpinUnlock(&CRCLock);
+    }
+    return CRCUpdate;
+}
+
 static bool_t ValidateSize(const ebml_element *p)
 {
     return EBML_ElementIsFiniteSize(p) && (p->DataSize == 4);
@@ -209,52 +359,16 @@ META_END(EBML_ELEMENT_CLASS)
 
 bool_t EBML_CRCMatches(ebml_crc *CRC, const void *Buf, size_t Size)
 {
-    uint32_t testCRC = CRC32_NEGL;
+    uint32_t testCRC;
 
     assert(CRC->Base.bValueIsSet);
-
-/* TODO: needed for non aligned memory ?
-	for(; !aligned(Buf) && Size > 0; Size--)
-		testCRC = m_tab[CRC32_INDEX(testCRC) ^ *Buf++] ^ CRC32_SHIFTED(testCRC);
-*/
-	const uint32_t *Buf32 = Buf;
-	while (Size >= 4)
-	{
-		testCRC ^= *Buf32;
-		testCRC = m_tab[CRC32_INDEX(testCRC)] ^ CRC32_SHIFTED(testCRC);
-		testCRC = m_tab[CRC32_INDEX(testCRC)] ^ CRC32_SHIFTED(testCRC);
-		testCRC = m_tab[CRC32_INDEX(testCRC)] ^ CRC32_SHIFTED(testCRC);
-		testCRC = m_tab[CRC32_INDEX(testCRC)] ^ CRC32_SHIFTED(testCRC);
-		Size -= 4;
-		Buf32++;
-	}
-
-	const uint8_t *Buf8 = (const uint8_t *)Buf32;
-	while (Size--)
-		testCRC = m_tab[CRC32_INDEX(testCRC) ^ *Buf8++] ^ CRC32_SHIFTED(testCRC);
-
-	testCRC ^= CRC32_NEGL;
-
+    testCRC = GetCRCUpdate()(CRC32_NEGL, Buf, Size) ^ CRC32_NEGL;
     return (CRC->CRC == testCRC);
 }
 
 void EBML_CRCAddBuffer(ebml_crc *CRC, const void *Buf, size_t Size)
 {
-	const uint32_t *Buf32 = Buf;
-	while (Size >= 4)
-	{
-		CRC->CRC ^= *Buf32;
-		CRC->CRC = m_tab[CRC32_INDEX(CRC->CRC)] ^ CRC32_SHIFTED(CRC->CRC);
-		CRC->CRC = m_tab[CRC32_INDEX(CRC->CRC)] ^ CRC32_SHIFTED(CRC->CRC);
-		CRC->CRC = m_tab[CRC32_INDEX(CRC->CRC)] ^ CRC32_SHIFTED(CRC->CRC);
-		CRC->CRC = m_tab[CRC32_INDEX(CRC->CRC)] ^ CRC32_SHIFTED(CRC->CRC);
-		Size -= 4;
-		Buf32++;
-	}
-
-	const uint8_t *Buf8 = (const uint8_t *)Buf32;
-	while (Size--)
-		CRC->CRC = m_tab[CRC32_INDEX(CRC->CRC) ^ *Buf8++] ^ CRC32_SHIFTED(CRC->CRC);
+    CRC->CRC = GetCRCUpdate()(CRC->CRC, Buf, Size);
 }
 
 void EBML_CRCFinalize(ebml_crc *CRC)
@@ -263,3 +377,43 @@ void EBML_CRCFinalize(ebml_crc *CRC)
     CRC->Base.DataSize = 4;
     CRC->Base.bValueIsSet = 1;
 }
+
+#if defined(CONFIG_EBML_WRITING)
+// stream that passes the data to another stream and adds it to a CRC element
+typedef struct crcstream
+{
+    stream Base;
+    stream *Stream;
+    ebml_crc *CRC;
+
+} crcstream;
+
+static err_t CRCStreamWrite(crcstream *p, const void *Data, size_t Size, size_t *Written)
+{
+    size_t _Written;
+    err_t Err;
+    if (!Written)
+        Written = &_Written;
+    *Written = 0;
+    Err = Stream_Write(p->Stream, Data, Size, Written);
+    if (*Written)
+        EBML_CRCAddBuffer(p->CRC, Data, *Written);
+    return Err;
+}
+
+static filepos_t CRCStreamSeek(crcstream *p, filepos_t Pos, int SeekMode)
+{
+    // only the position can be queried, moving would leave holes in the CRC
+    if (Pos!=0 || SeekMode!=SEEK_CUR)
+        return INVALID_FILEPOS_T;
+    return Stream_Seek(p->Stream, 0, SEEK_CUR);
+}
+
+META_START(EBMLCRCStream_Class,EBML_CRCSTREAM_CLASS)
+META_CLASS(SIZE,sizeof(crcstream))
+META_VMT(TYPE_FUNC,stream_vmt,Write,CRCStreamWrite)
+META_VMT(TYPE_FUNC,stream_vmt,Seek,CRCStreamSeek)
+META_DATA(TYPE_PTR,EBML_CRCSTREAM_STREAM,crcstream,Stream)
+META_DATA(TYPE_PTR,EBML_CRCSTREAM_CRC,crcstream,CRC)
+META_END(STREAM_CLASS)
+#endif
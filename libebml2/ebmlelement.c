@@ -305,7 +305,7 @@ err_t EBML_ElementRenderHead(ebml_element *Element, struct stream *Output, bool_
     uint8_t FinalHead[4+8]; // Class D + 64 bits coded size
     size_t i,FinalHeadSize;
     int CodedSize;
-    filepos_t PosAfter,PosBefore = Stream_Seek(Output,0,SEEK_CUR);
+    filepos_t PosAfter;
 
     FinalHeadSize = EBML_FillBufferID(FinalHead,sizeof(FinalHead),Element->Context->Id);
 
@@ -321,7 +321,7 @@ err_t EBML_ElementRenderHead(ebml_element *Element, struct stream *Output, bool_
         Element->EndPosition = Element->SizePosition + CodedSize + Element->DataSize;
     }
     if (Rendered)
-        *Rendered = PosAfter - PosBefore;
+        *Rendered = i; // the positions are not known on non seekable streams
     return Err;
 }
 #endif
@@ -6,9 +6,16 @@
 #include "internal.h"
 #include <corec/helpers/file/streams.h>
 #include <corec/helpers/parser/parser.h>
+#include <stdlib.h>
+
+static size_t SemanticUsers = 0;
+static void SemanticSlotsFree(void);
 
 err_t EBML_Init(parsercontext *p)
 {
+    AtomicIncSize(&SemanticUsers);
+    EBML_ContextIndexSemantic(EBML_getContextHead());
+
     Node_SetData(p,CONTEXT_LIBEBML_VERSION,TYPE_STRING,T("libebml2 v") LIBEBML2_PROJECT_VERSION);
 
     NodeRegisterClassEx(&p->Base.Base,EBMLElement_Class);
@@ -19,6 +26,9 @@ err_t EBML_Init(parsercontext *p)
     NodeRegisterClassEx(&p->Base.Base,EBMLDate_Class);
     NodeRegisterClassEx(&p->Base.Base,EBMLCRC_Class);
     NodeRegisterClassEx(&p->Base.Base,EBMLVoid_Class);
+#if defined(CONFIG_EBML_WRITING)
+    NodeRegisterClassEx(&p->Base.Base,EBMLCRCStream_Class);
+#endif
 
     return ERR_NONE;
 }
@@ -231,25 +241,195 @@ static ebml_element *CreateElement(anynode *Any, const uint8_t *PossibleId, int8
     return Result;
 }
 
-static ebml_element *EBML_ElementCreateUsingContext(void *AnyNode, const uint8_t *PossibleId, int8_t IdLength, const ebml_parser_context *Context,
-                                                    int *LowLevel, bool_t IsGlobalContext, bool_t bAllowDummy)
+void EBML_Done(parsercontext *UNUSED_PARAM(p))
 {
-//	unsigned int ContextIndex;
-    ebml_element *Result = NULL;
+    if (AtomicDecSize(&SemanticUsers) == 0)
+        SemanticSlotsFree();
+}
+
+// lookup of the semantic entries by (semantic table, ID), shared by all contexts
+// an index is never modified once published, indexing more tables publishes a new copy,
+// the entry with an ID of 0 marks an indexed table
+typedef struct ebml_semantic_slot
+{
+    const ebml_semantic *Table;
     const ebml_semantic *Semantic;
+    fourcc_t Id;
+} ebml_semantic_slot;
 
-    if (!Context || !Context->Context || !Context->Context->Semantic)
+typedef struct ebml_semantic_index
+{
+    struct ebml_semantic_index *Replaced; // freed with this one, lookups may still be using it
+    size_t Size; // always a power of 2
+    size_t Used;
+    ebml_semantic_slot Slots[1];
+} ebml_semantic_index;
+
+static ebml_semantic_index *SemanticIndex = NULL;
+static cc_spinlock SemanticLock = 0; // guards the index replacement
+
+static void SemanticSlotsFree(void)
+{
+    ebml_semantic_index *Index, *Replaced;
+    SpinLock(&SemanticLock);
+    for (Index = SemanticIndex;Index;Index = Replaced)
+    {
+        Replaced = Index->Replaced;
+        free(Index);
+    }
+    SemanticIndex = NULL;
+    SpinUnlock(&SemanticLock);
+}
+
+static size_t SemanticSlotHash(const ebml_semantic *Table, fourcc_t Id)
+{
+    uintptr_t Hash = ((uintptr_t)Table >> 4) ^ ((uintptr_t)Id * 0x9E3779B1U);
+    return (size_t)(Hash ^ (Hash >> 16));
+}
+
+static const ebml_semantic_slot *SemanticSlotFind(const ebml_semantic_index *Index, const ebml_semantic *Table, fourcc_t Id)
+{
+    size_t i;
+    if (!Index)
         return NULL;
+    for (i = SemanticSlotHash(Table,Id) & (Index->Size-1);Index->Slots[i].Table;i = (i+1) & (Index->Size-1))
+    {
+        if (Index->Slots[i].Table == Table && Index->Slots[i].Id == Id)
+            return &Index->Slots[i];
+    }
+    return NULL;
+}
 
-    // elements at the current level
-    for (Semantic=Context->Context->Semantic;Semantic->eClass;Semantic++)
+static ebml_semantic_index *SemanticIndexAlloc(size_t Size)
+{
+    ebml_semantic_index *Index = calloc(1,sizeof(ebml_semantic_index) + (Size-1)*sizeof(ebml_semantic_slot));
+    if (Index)
+        Index->Size = Size;
+    return Index;
+}
+
+static void SemanticSlotSet(ebml_semantic_index *Index, const ebml_semantic *Table, fourcc_t Id, const ebml_semantic *Semantic)
+{
+    size_t i;
+    for (i = SemanticSlotHash(Table,Id) & (Index->Size-1);Index->Slots[i].Table;i = (i+1) & (Index->Size-1))
+    {
+        if (Index->Slots[i].Table == Table && Index->Slots[i].Id == Id)
+            return; // keep the first entry with this ID, as a linear search would
+    }
+    Index->Slots[i].Table = Table;
+    Index->Slots[i].Id = Id;
+    Index->Slots[i].Semantic = Semantic;
+    ++Index->Used;
+}
+
+// add to an index that is not published yet, it may be replaced by a bigger one
+static bool_t SemanticSlotAdd(ebml_semantic_index **Index, const ebml_semantic *Table, fourcc_t Id, const ebml_semantic *Semantic)
+{
+    size_t i;
+    ebml_semantic_index *Old = *Index;
+    if ((Old->Used+1)*2 > Old->Size)
+    {
+        // keep the table at most half full
+        ebml_semantic_index *New = SemanticIndexAlloc(Old->Size*2);
+        if (!New)
+            return 0;
+        New->Replaced = Old->Replaced;
+        for (i=0;i<Old->Size;++i)
+            if (Old->Slots[i].Table)
+                SemanticSlotSet(New,Old->Slots[i].Table,Old->Slots[i].Id,Old->Slots[i].Semantic);
+        free(Old);
+        *Index = New;
+    }
+    SemanticSlotSet(*Index,Table,Id,Semantic);
+    return 1;
+}
+
+static bool_t SemanticIndexTable(ebml_semantic_index **Index, const ebml_semantic *Table)
+{
+    const ebml_semantic *Semantic;
+    if (SemanticSlotFind(*Index,Table,0))
+        return 1;
+    for (Semantic=Table;Semantic->eClass;Semantic++)
+        if (!SemanticSlotAdd(Index,Table,Semantic->eClass->Id,Semantic))
+            return 0;
+    return SemanticSlotAdd(Index,Table,0,NULL);
+}
+
+static bool_t SemanticIndexContext(ebml_semantic_index **Index, const ebml_context *Context)
+{
+    const ebml_semantic *Semantic;
+    if (!Context->Semantic || SemanticSlotFind(*Index,Context->Semantic,0))
+        return 1;
+    if (!SemanticIndexTable(Index,Context->Semantic))
+        return 0;
+    if (Context->GlobalContext && !SemanticIndexTable(Index,Context->GlobalContext))
+        return 0;
+    for (Semantic=Context->Semantic;Semantic->eClass;Semantic++)
+        if (!SemanticIndexContext(Index,Semantic->eClass))
+            return 0;
+    return 1;
+}
+
+static const ebml_semantic *SemanticFind(const ebml_semantic *Table, fourcc_t Id)
+{
+    const ebml_semantic *Semantic;
+    const ebml_semantic_index *Index = (const ebml_semantic_index*)AtomicLoadPtr(&SemanticIndex);
+    const ebml_semantic_slot *Slot = SemanticSlotFind(Index,Table,Id);
+    if (Slot)
+        return Slot->Semantic;
+    if (SemanticSlotFind(Index,Table,0))
+        return NULL;
+
+    // not indexed, the lookup doesn't modify the index
+    for (Semantic=Table;Semantic->eClass;Semantic++)
+        if (Semantic->eClass->Id == Id)
+            return Semantic;
+    return NULL;
+}
+
+void EBML_ContextIndexSemantic(const ebml_context *Context)
+{
+    ebml_semantic_index *Current, *New;
+    size_t i;
+
+    if (!Context->Semantic || SemanticSlotFind((const ebml_semantic_index*)AtomicLoadPtr(&SemanticIndex),Context->Semantic,0))
+        return;
+
+    SpinLock(&SemanticLock);
+    Current = SemanticIndex;
+    if (!SemanticSlotFind(Current,Context->Semantic,0))
     {
-        if (EBML_IdMatch(PossibleId, IdLength, Semantic->eClass->Id)) // && (bAllowDummy || bAllowOutOfProfile || !(Context->Profile & Semantic->DisabledProfile)))
+        // build a copy with the new tables, the current index stays valid for the lookups using it
+        New = SemanticIndexAlloc(Current ? Current->Size : 512);
+        if (New)
         {
-            Result = EBML_ElementCreate(AnyNode,Semantic->eClass,0, Context->Profile);
-            return Result;
+            New->Replaced = Current;
+            if (Current)
+                for (i=0;i<Current->Size;++i)
+                    if (Current->Slots[i].Table)
+                        SemanticSlotSet(New,Current->Slots[i].Table,Current->Slots[i].Id,Current->Slots[i].Semantic);
+            if (SemanticIndexContext(&New,Context))
+                AtomicStorePtr(&SemanticIndex, New);
+            else
+                free(New); // the lookups of these tables stay linear
         }
     }
+    SpinUnlock(&SemanticLock);
+}
+
+static ebml_element *EBML_ElementCreateUsingContext(void *AnyNode, const uint8_t *PossibleId, int8_t IdLength, fourcc_t Id, const ebml_parser_context *Context,
+                                                    int *LowLevel, bool_t IsGlobalContext, bool_t bAllowDummy)
+{
+    ebml_element *Result = NULL;
+    const ebml_semantic *Semantic;
+
+    if (!Context || !Context->Context || !Context->Context->Semantic)
+        return NULL;
+
+    // elements at the current level
+    Semantic = SemanticFind(Context->Context->Semantic, Id);
+    if (Semantic) // && (bAllowDummy || bAllowOutOfProfile || !(Context->Profile & Semantic->DisabledProfile)))
+        return EBML_ElementCreate(AnyNode,Semantic->eClass,0, Context->Profile);
 
     // global elements
     assert(Context->Context->GlobalContext != NULL); // global should always exist, at least the EBML ones
@@ -269,7 +449,7 @@ static ebml_element *EBML_ElementCreateUsingContext(void *AnyNode, const uint8_t
         GlobalContext.Profile = Context->Profile;
         (*LowLevel)--;
         // recursive is good, but be carefull...
-        Result = EBML_ElementCreateUsingContext(AnyNode,PossibleId,IdLength,&GlobalContext,LowLevel,1,bAllowDummy);
+        Result = EBML_ElementCreateUsingContext(AnyNode,PossibleId,IdLength,Id,&GlobalContext,LowLevel,1,bAllowDummy);
         if (Result)
             return Result;
         (*LowLevel)++;
@@ -286,7 +466,7 @@ static ebml_element *EBML_ElementCreateUsingContext(void *AnyNode, const uint8_t
     // check wether it's not part of an upper context
     if (Context->UpContext != NULL) {
         (*LowLevel)++;
-        return EBML_ElementCreateUsingContext(AnyNode, PossibleId, IdLength, Context->UpContext, LowLevel, IsGlobalContext, bAllowDummy);
+        return EBML_ElementCreateUsingContext(AnyNode, PossibleId, IdLength, Id, Context->UpContext, LowLevel, IsGlobalContext, bAllowDummy);
     }
 
     // dummy fallback
@@ -298,6 +478,48 @@ static ebml_element *EBML_ElementCreateUsingContext(void *AnyNode, const uint8_t
     return Result;
 }
 
+// the largest header we may need: 4 octets of ID and 8 octets of coded size
+#define EBML_HEADER_LOOKAHEAD  (EBML_MAX_ID + EBML_MAX_SIZE)
+
+// read-ahead window used to decode element headers without one stream call per octet
+typedef struct ebml_lookahead
+{
+    struct stream *Input;
+    size_t Pos;
+    size_t Size;
+    uint8_t Buffer[EBML_HEADER_LOOKAHEAD];
+} ebml_lookahead;
+
+static void LookaheadInit(ebml_lookahead *p, struct stream *Input)
+{
+    p->Input = Input;
+    p->Pos = 0;
+    p->Size = 0;
+}
+
+static err_t LookaheadReadByte(ebml_lookahead *p, uint8_t *Out)
+{
+    if (p->Pos >= p->Size)
+    {
+        size_t Readed = 0;
+        Stream_ReadOneOrMore(p->Input, p->Buffer, sizeof(p->Buffer), &Readed);
+        p->Pos = 0;
+        p->Size = Readed;
+        if (Readed == 0)
+            return ERR_END_OF_FILE;
+    }
+    *Out = p->Buffer[p->Pos++];
+    return ERR_NONE;
+}
+
+// put the stream back to the logical position if we read too far
+static void LookaheadRelease(ebml_lookahead *p, filepos_t LogicalPos)
+{
+    if (p->Pos < p->Size)
+        Stream_Seek(p->Input, LogicalPos, SEEK_SET);
+    p->Pos = p->Size = 0;
+}
+
 ebml_element *EBML_FindNextId(struct stream *Input, const ebml_context *Context, size_t MaxDataSize)
 {
     filepos_t aElementPosition, aSizePosition;
@@ -311,21 +533,26 @@ ebml_element *EBML_FindNextId(struct stream *Input, const ebml_context *Context,
     size_t _SizeLength=0;
     uint8_t PossibleSizeLength = 0;
     ebml_element *Result = NULL;
+    ebml_lookahead Lookahead;
+    filepos_t StartPos = Stream_Seek(Input,0,SEEK_CUR);
+    size_t Consumed = 0;
 
+    LookaheadInit(&Lookahead, Input);
     while (!bElementFound)
     {
-        aElementPosition = Stream_Seek(Input,0,SEEK_CUR);
+        aElementPosition = StartPos + Consumed;
         ReadSize = 0;
         BitMask = 1 << 7;
         for (;;)
         {
-            if (Stream_ReadOneOrMore(Input,&PossibleId[PossibleID_Length], 1, NULL)!=ERR_NONE)
+            if (LookaheadReadByte(&Lookahead,&PossibleId[PossibleID_Length])!=ERR_NONE)
                 break;
+            Consumed++;
             ReadSize++;
             if (ReadSize == PossibleID_Length)
-                return NULL; // No more data ?
+                goto failed; // No more data ?
             if (++PossibleID_Length > 4)
-                return NULL; // we don't support element IDs over class D
+                goto failed; // we don't support element IDs over class D
             if (PossibleId[0] & BitMask)
             {
                 bElementFound = 1;
@@ -335,19 +562,22 @@ ebml_element *EBML_FindNextId(struct stream *Input, const ebml_context *Context,
         }
 
         // read the data size
-        aSizePosition = Stream_Seek(Input,0,SEEK_CUR);
+        aSizePosition = StartPos + Consumed;
         do {
             if (PossibleSizeLength >= 8)
                 // Size is larger than 8 bytes
-                return NULL;
+                goto failed;
 
-            if (Stream_ReadOneOrMore(Input,&PossibleSize[PossibleSizeLength++], 1, NULL)!=ERR_NONE)
+            if (LookaheadReadByte(&Lookahead,&PossibleSize[PossibleSizeLength++])!=ERR_NONE)
                 break;
+            Consumed++;
             ReadSize++;
             _SizeLength = PossibleSizeLength;
             SizeFound = EBML_ReadCodedSizeValue(&PossibleSize[0], &_SizeLength, &SizeUnknown);
         } while (_SizeLength == 0);
     }
+    // leave the stream at the beginning of the data
+    LookaheadRelease(&Lookahead, StartPos + Consumed);
 
     // look for the ID in the provided context
     Result = CreateElement(Input, PossibleId, PossibleID_Length, Context,NULL, EBML_ANY_PROFILE);
@@ -374,6 +604,10 @@ printf("Elt: size %d id %d %02X\n",SizeFound,PossibleID_Length,PossibleId[0]);
     Result->EndPosition = aSizePosition + _SizeLength + SizeFound;
 
     return Result;
+
+failed:
+    LookaheadRelease(&Lookahead, StartPos + Consumed);
+    return NULL;
 }
 
 uint8_t EBML_CodedSizeLength(filepos_t Length, uint8_t SizeLength, bool_t bSizeIsFinite)
@@ -482,10 +716,13 @@ ebml_element *EBML_FindNextElement(struct stream *Input, const ebml_parser_conte
     filepos_t StartPos = Stream_Seek(Input,0,SEEK_CUR);
     ebml_parser_context OrigContext;
     const ebml_parser_context *Context = &OrigContext;
+    ebml_lookahead Lookahead;
 
     if (StartPos == INVALID_FILEPOS_T)
         return NULL;
 
+    LookaheadInit(&Lookahead, Input);
+
     assert(Context != NULL);
     OrigContext = *pContext;
 
@@ -528,8 +765,8 @@ ebml_element *EBML_FindNextElement(struct stream *Input, const ebml_parser_conte
                 memmove(&PossibleIdNSize[0],&PossibleIdNSize[1], --ReadIndex);
             }
 
-            if (Stream_ReadOneOrMore(Input,&PossibleIdNSize[ReadIndex++], 1, NULL)!=ERR_NONE)
-                return NULL; // no more data ?
+            if (LookaheadReadByte(&Lookahead,&PossibleIdNSize[ReadIndex++])!=ERR_NONE)
+                goto failed; // no more data ?
             ReadSize++;
 
         } while (!bFound);
@@ -554,13 +791,13 @@ ebml_element *EBML_FindNextElement(struct stream *Input, const ebml_parser_conte
                 break; // invalid all zero size
             if (Context->EndPosition == StartPos+ReadSize)
                 break; // we should not read further than our limit
-            if (Stream_ReadOneOrMore(Input,&PossibleIdNSize[SizeIdx++], 1, NULL)!=ERR_NONE)
-                return NULL;
+            if (LookaheadReadByte(&Lookahead,&PossibleIdNSize[SizeIdx++])!=ERR_NONE)
+                goto failed;
             ReadSize++;
             PossibleSizeLength++;
         }
 
-        CurrentPos = Stream_Seek(Input,0,SEEK_CUR);
+        CurrentPos = StartPos + ReadSize;
         if (bFound)
         {
             // make sure the element we found is contained in the Context
@@ -583,7 +820,7 @@ ebml_element *EBML_FindNextElement(struct stream *Input, const ebml_parser_conte
         {
             // find the element in the context and use the correct creator
             int LevelChange = 0;
-            ebml_element *Result = EBML_ElementCreateUsingContext(Input, PossibleIdNSize, PossibleID_Length, Context, &LevelChange, 0, AllowDummyElt);
+            ebml_element *Result = EBML_ElementCreateUsingContext(Input, PossibleIdNSize, PossibleID_Length, EBML_IdFromBuffer(PossibleIdNSize,PossibleID_Length), Context, &LevelChange, 0, AllowDummyElt);
             if (Result != NULL)
             {
                 if (AllowDummyElt || !EBML_ElementIsDummy(Result)) {
@@ -661,5 +898,7 @@ ebml_element *EBML_FindNextElement(struct stream *Input, const ebml_parser_conte
         Context = &OrigContext;
     } while (Context->EndPosition==INVALID_FILEPOS_T || (Context->EndPosition > CurrentPos - SizeIdx + PossibleID_Length));
 
+failed:
+    LookaheadRelease(&Lookahead, StartPos + ReadSize);
     return NULL;
 }
@@ -317,12 +317,16 @@ static err_t ReadData(ebml_master *Element, struct stream *Input, const ebml_par
                             if (Node_IsPartOf(Input, MEMSTREAM_CLASS))
                             {
                                 filepos_t DataPos = Stream_Seek(Input,EBML_ElementPositionEnd(SubElement),SEEK_SET);
-                                filepos_t OffSet;
+                                filepos_t OffSet, Length;
                                 Node_GET(Input,MEMSTREAM_OFFSET,&OffSet);
                                 Node_GET(Input,MEMSTREAM_PTR,&CRCData);
-                                CRCData += (DataPos - OffSet);
+                                Node_GET(Input,STREAM_LENGTH,&Length);
+                                // the data are already in memory (possibly read-only), use them directly
                                 CRCDataSize = (size_t)(EBML_ElementDataSize((ebml_element*)Element,1) - EBML_ElementFullSize(SubElement,1));
-                                Stream_Read(Input, CRCData, CRCDataSize, NULL);
+                                if (DataPos - OffSet + (filepos_t)CRCDataSize > Length)
+                                    CRCData = NULL; // truncated element, the CRC can't match
+                                else
+                                    CRCData += (DataPos - OffSet);
                             }
                             else
                             {
@@ -343,6 +347,8 @@ static err_t ReadData(ebml_master *Element, struct stream *Input, const ebml_par
                                     {
                                         ReadStream=Input; // revert back to normal reading
                                         ArrayClear(&CrcBuffer);
+                                        CRCData = NULL;
+                                        CRCElement = NULL; // kept unchecked
                                     }
                                     else
                                     {
@@ -355,11 +361,12 @@ static err_t ReadData(ebml_master *Element, struct stream *Input, const ebml_par
                                             StreamClose(ReadStream);
                                             ReadStream=Input; // revert back to normal reading
                                             ArrayClear(&CrcBuffer);
-                                            CRCData = NULL;
-                                            CRCElement = NULL;
+                                            CRCData = NULL; // truncated element, the CRC can't match
                                         }
                                     }
                                 }
+                                else
+                                    CRCElement = NULL; // kept unchecked
                             }
                         }
                         bFirst = 0;
@@ -399,11 +406,14 @@ static err_t ReadData(ebml_master *Element, struct stream *Input, const ebml_par
 		}
 	}
 processCrc:
-    if (CRCData!=NULL)
+    if (CRCElement!=NULL)
     {
-        Element->CheckSumStatus = EBML_CRCMatches(CRCElement, CRCData, CRCDataSize)?2:1;
+        if (CRCData!=NULL)
+            Element->CheckSumStatus = EBML_CRCMatches(CRCElement, CRCData, CRCDataSize)?2:1;
+        else
+            Element->CheckSumStatus = 1;
         NodeDelete((node*)CRCElement);
-        if (CRCData == ARRAYBEGIN(CrcBuffer,uint8_t))
+        if (ReadStream != Input)
         {
             StreamClose(ReadStream);
             ArrayClear(&CrcBuffer);
@@ -473,12 +483,51 @@ static err_t RenderData(ebml_master *Element, struct stream *Output, bool_t bFor
 		assert(CheckMandatory((ebml_master*)Element, bWithDefault, ForProfile));
 	}
 
+#define CRC_EBML_SIZE  6
 	if (!Element->CheckSumStatus)
         Err = InternalRender(Element, Output, bForceWithoutMandatory, bWithDefault, ForProfile, Rendered);
+	else if (!Node_IsPartOf(Output,MEMSTREAM_CLASS) && !Node_IsPartOf(Output,EBML_CRCSTREAM_CLASS) && Stream_Seek(Output,0,SEEK_CUR)!=INVALID_FILEPOS_T)
+    {
+        // leave room for the CRC, compute it while the children are written and go back to write it
+        filepos_t CrcPos = Stream_Seek(Output,0,SEEK_CUR);
+        ebml_crc *CrcElt = (ebml_crc*)EBML_ElementCreate(Element, EBML_getContextEbmlCrc32(), 0, ForProfile);
+        stream *VOutput = (struct stream*)NodeCreate(Element, EBML_CRCSTREAM_CLASS);
+        if (!CrcElt || !VOutput)
+            Err = ERR_OUT_OF_MEMORY;
+        else
+        {
+            filepos_t CrcSize;
+            Node_SET(VOutput, EBML_CRCSTREAM_STREAM, &Output);
+            Node_SET(VOutput, EBML_CRCSTREAM_CRC, &CrcElt);
+            ((ebml_element*)CrcElt)->bValueIsSet = 1; // placeholder until the real value is known
+            Err = EBML_ElementRender((ebml_element*)CrcElt, Output, bWithDefault, 0, bForceWithoutMandatory, ForProfile, &CrcSize);
+            if (Err==ERR_NONE)
+                Err = InternalRender(Element, VOutput, bForceWithoutMandatory, bWithDefault, ForProfile, Rendered);
+            if (Err==ERR_NONE)
+            {
+                EBML_CRCFinalize(CrcElt);
+                if (Stream_Seek(Output,CrcPos,SEEK_SET)!=CrcPos)
+                    Err = ERR_WRITE;
+                else
+                {
+                    Err = EBML_ElementRender((ebml_element*)CrcElt, Output, bWithDefault, 0, bForceWithoutMandatory, ForProfile, &CrcSize);
+                    if (Err==ERR_NONE)
+                    {
+                        *Rendered += CrcSize;
+                        if (Stream_Seek(Output,CrcPos + *Rendered,SEEK_SET)!=CrcPos + *Rendered)
+                            Err = ERR_WRITE;
+                    }
+                }
+            }
+        }
+        if (VOutput)
+            StreamClose(VOutput);
+        if (CrcElt)
+            NodeDelete((node*)CrcElt);
+    }
 	else
     {
         // render to memory, compute the CRC, write the CRC and then the virtual data
-#define CRC_EBML_SIZE  6
         array TmpBuf;
         bool_t IsMemory = Node_IsPartOf(Output,MEMSTREAM_CLASS);
         ArrayInit(&TmpBuf);
@@ -22,6 +22,14 @@ extern const nodemeta EBMLInteger_Class[];
 extern const nodemeta EBMLCRC_Class[];
 extern const nodemeta EBMLDate_Class[];
 extern const nodemeta EBMLVoid_Class[];
+#if defined(CONFIG_EBML_WRITING)
+extern const nodemeta EBMLCRCStream_Class[];
+
+// write-only stream adding everything written to Stream to the CRC element
+#define EBML_CRCSTREAM_CLASS   FOURCC('E','B','C','S')
+#define EBML_CRCSTREAM_STREAM  0x100 // stream*
+#define EBML_CRCSTREAM_CRC     0x101 // ebml_crc*
+#endif
 
 #ifdef __cplusplus
 }
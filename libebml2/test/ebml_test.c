@@ -0,0 +1,275 @@
+/*
+ * Copyright (c) 2026, Matroska (non-profit organisation)
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include "ebml2/ebml.h"
+#include "ebmlcrc.h"
+#include <corec/helpers/file/file.h>
+#include <corec/helpers/file/streams.h>
+#include <corec/helpers/parser/parser.h>
+#include <corec/str/str.h>
+
+#include <stdio.h>
+void DebugMessage(const tchar_t* Msg,...)
+{
+    va_list Args;
+    tchar_t Buffer[1024];
+
+    va_start(Args,Msg);
+    vstprintf_s(Buffer,TSIZEOF(Buffer), Msg, Args);
+    va_end(Args);
+    tcscat_s(Buffer,TSIZEOF(Buffer),T("\r\n"));
+
+#ifdef UNICODE
+    fprintf(stderr, "%ls", Buffer);
+#else
+    fprintf(stderr, "%s", Buffer);
+#endif
+}
+
+#define TEST_CRC_SIZE  4096
+
+// CRC-32 IEEE, one bit at a time
+static uint32_t ReferenceCRC(const uint8_t *Buf, size_t Size)
+{
+    uint32_t CRC = 0xFFFFFFFF;
+    int Bit;
+    while (Size--)
+    {
+        CRC ^= *Buf++;
+        for (Bit=0;Bit<8;++Bit)
+            CRC = (CRC >> 1) ^ (0xEDB88320 & (0 - (CRC & 1)));
+    }
+    return CRC ^ 0xFFFFFFFF;
+}
+
+// a CRC element holding the value read from its 4 little endian bytes
+static ebml_crc *ReadCRC(parsercontext *p, uint32_t Value)
+{
+    uint8_t Data[4];
+    ebml_crc *CRC;
+    stream *Input;
+    err_t Err = ERR_OUT_OF_MEMORY;
+
+    Data[0] = (uint8_t)Value;
+    Data[1] = (uint8_t)(Value >> 8);
+    Data[2] = (uint8_t)(Value >> 16);
+    Data[3] = (uint8_t)(Value >> 24);
+    CRC = (ebml_crc*)EBML_ElementCreate(p, EBML_getContextEbmlCrc32(), 0, EBML_ANY_PROFILE);
+    Input = (stream*)NodeCreate(p, MEMSTREAM_CLASS);
+    if (CRC && Input)
+    {
+        Node_Set(Input, MEMSTREAM_DATA, Data, sizeof(Data));
+        Err = EBML_ElementReadData(CRC, Input, NULL, 0, SCOPE_ALL_DATA, 0);
+    }
+    if (Input)
+        StreamClose(Input);
+    if (Err!=ERR_NONE && CRC)
+    {
+        NodeDelete((node*)CRC);
+        CRC = NULL;
+    }
+    return CRC;
+}
+
+// the table and hardware versions give the bitwise CRC for all the sizes and alignments
+static int TestCRC(parsercontext *p)
+{
+    static const size_t Sizes[] = {0, 1, 2, 3, 4, 7, 8, 9, 15, 16, 17, 31, 32, 33, 63, 64, 65, 127, 128, 129, 255, 256, 1000, 4000};
+    static uint8_t Data[TEST_CRC_SIZE];
+    ebml_crc *CRC, *Chunked;
+    size_t i, Offset, Split;
+    uint32_t Random = 1;
+    int Result = 0;
+
+    for (i=0;i<sizeof(Data);++i)
+    {
+        Random = Random * 1103515245 + 12345;
+        Data[i] = (uint8_t)(Random >> 16);
+    }
+
+    for (Offset=0;Offset<16;++Offset)
+    {
+        for (i=0;i<sizeof(Sizes)/sizeof(Sizes[0]);++i)
+        {
+            const uint8_t *Buf = Data + Offset;
+            CRC = ReadCRC(p, ReferenceCRC(Buf, Sizes[i]));
+            if (!CRC)
+                return 1;
+            if (!EBML_CRCMatches(CRC, Buf, Sizes[i]))
+            {
+                fprintf(stderr, "CRC of %u bytes at offset %u doesn't match\r\n", (unsigned)Sizes[i], (unsigned)Offset);
+                Result = 1;
+            }
+            NodeDelete((node*)CRC);
+
+            // the same CRC when it's computed in several parts
+            Chunked = (ebml_crc*)EBML_ElementCreate(p, EBML_getContextEbmlCrc32(), 0, EBML_ANY_PROFILE);
+            if (!Chunked)
+                return 1;
+            Split = Sizes[i] / 3;
+            EBML_CRCAddBuffer(Chunked, Buf, Split);
+            EBML_CRCAddBuffer(Chunked, Buf + Split, Sizes[i] - Split);
+            EBML_CRCFinalize(Chunked);
+            if (!EBML_CRCMatches(Chunked, Buf, Sizes[i]))
+            {
+                fprintf(stderr, "chunked CRC of %u bytes at offset %u doesn't match\r\n", (unsigned)Sizes[i], (unsigned)Offset);
+                Result = 1;
+            }
+            NodeDelete((node*)Chunked);
+        }
+    }
+    return Result;
+}
+
+#define TEST_RENDER_SIZE  256
+
+// the CRC of the master matches its data, the ID and size of the master are followed by the CRC element
+static bool_t RenderedCRCMatches(const uint8_t *Buf, size_t Size)
+{
+    size_t Pos = 4, SizeLen = 1;
+    uint32_t CRC;
+    while (SizeLen<8 && !(Buf[Pos] & (0x80 >> (SizeLen-1))))
+        ++SizeLen;
+    Pos += SizeLen;
+    if (Pos + 6 > Size || Buf[Pos]!=0xBF || Buf[Pos+1]!=0x84)
+        return 0;
+    CRC = Buf[Pos+2] | ((uint32_t)Buf[Pos+3] << 8) | ((uint32_t)Buf[Pos+4] << 16) | ((uint32_t)Buf[Pos+5] << 24);
+    return CRC == ReferenceCRC(Buf + Pos + 6, Size - Pos - 6);
+}
+
+// a master with a CRC is rendered the same way in a file, with and without buffering, and in memory
+static int TestRenderCRC(parsercontext *p, const tchar_t *Path)
+{
+    static const int Flags[] = {SFLAG_WRONLY|SFLAG_CREATE, SFLAG_WRONLY|SFLAG_CREATE|SFLAG_BUFFERED};
+    uint8_t Memory[TEST_RENDER_SIZE], File[TEST_RENDER_SIZE];
+    ebml_master *Head;
+    stream *Output;
+    filepos_t MemSize, FileSize;
+    size_t i, Readed;
+    int Result = 1;
+
+    Head = (ebml_master*)EBML_ElementCreate(p, EBML_getContextHead(), 1, EBML_ANY_PROFILE);
+    Output = (stream*)NodeCreate(p, MEMSTREAM_CLASS);
+    if (!Head || !Output)
+        goto exit;
+    EBML_MasterUseChecksum(Head, 1);
+    EBML_StringSetValue((ebml_string*)EBML_MasterGetChild(Head, EBML_getContextDocType(), EBML_ANY_PROFILE), "crc test");
+    EBML_IntegerSetValue((ebml_integer*)EBML_MasterGetChild(Head, EBML_getContextDocTypeVersion(), EBML_ANY_PROFILE), 3);
+
+    Node_Set(Output, MEMSTREAM_DATA, Memory, sizeof(Memory));
+    if (EBML_ElementRender((ebml_element*)Head, Output, 1, 0, 1, EBML_ANY_PROFILE, &MemSize)!=ERR_NONE)
+        goto exit;
+    StreamClose(Output);
+    Output = NULL;
+    if (!RenderedCRCMatches(Memory, (size_t)MemSize))
+    {
+        fprintf(stderr, "CRC of the master rendered in memory doesn't match\r\n");
+        goto exit;
+    }
+
+    for (i=0;i<sizeof(Flags)/sizeof(Flags[0]);++i)
+    {
+        Output = StreamOpen(p, Path, Flags[i]);
+        if (!Output || EBML_ElementRender((ebml_element*)Head, Output, 1, 0, 1, EBML_ANY_PROFILE, &FileSize)!=ERR_NONE ||
+            Stream_Seek(Output, 0, SEEK_CUR)!=FileSize)
+            goto exit;
+        StreamClose(Output);
+        Output = StreamOpen(p, Path, SFLAG_RDONLY);
+        if (!Output || Stream_Read(Output, File, sizeof(File), &Readed)!=ERR_END_OF_FILE)
+            goto exit;
+        StreamClose(Output);
+        Output = NULL;
+        if (FileSize!=MemSize || (filepos_t)Readed!=FileSize || memcmp(File, Memory, Readed)!=0)
+        {
+            fprintf(stderr, "master with a CRC rendered in a file (flags %x) differs from memory\r\n", Flags[i]);
+            goto exit;
+        }
+    }
+    Result = 0;
+
+exit:
+    if (Output)
+        StreamClose(Output);
+    if (Head)
+        NodeDelete((node*)Head);
+    FileErase(Path,1,0);
+    return Result;
+}
+
+// the CRC of a master read from memory fails when the master is truncated
+static int TestTruncatedCRC(parsercontext *p)
+{
+    uint8_t Memory[TEST_RENDER_SIZE];
+    ebml_master *Head, *Read;
+    ebml_parser_context Context;
+    stream *Stream;
+    filepos_t Size;
+    int Truncated;
+    int Result = 1;
+
+    Head = (ebml_master*)EBML_ElementCreate(p, EBML_getContextHead(), 1, EBML_ANY_PROFILE);
+    Stream = (stream*)NodeCreate(p, MEMSTREAM_CLASS);
+    if (!Head || !Stream)
+        goto exit;
+    EBML_MasterUseChecksum(Head, 1);
+    EBML_StringSetValue((ebml_string*)EBML_MasterGetChild(Head, EBML_getContextDocType(), EBML_ANY_PROFILE), "crc test");
+    Node_Set(Stream, MEMSTREAM_DATA, Memory, sizeof(Memory));
+    if (EBML_ElementRender((ebml_element*)Head, Stream, 1, 0, 1, EBML_ANY_PROFILE, &Size)!=ERR_NONE)
+        goto exit;
+
+    Context.Context = EBML_getContextHead();
+    Context.EndPosition = INVALID_FILEPOS_T;
+    Context.UpContext = NULL;
+    Context.Profile = EBML_ANY_PROFILE;
+    for (Truncated=0;Truncated<2;++Truncated)
+    {
+        Node_Set(Stream, MEMSTREAM_DATA, Memory, (size_t)Size - Truncated);
+        Stream_Seek(Stream, 0, SEEK_SET);
+        Read = (ebml_master*)EBML_FindNextId(Stream, EBML_getContextHead(), (size_t)Size);
+        if (!Read || EBML_ElementReadData(Read, Stream, &Context, 0, SCOPE_ALL_DATA, 1)!=ERR_NONE)
+        {
+            fprintf(stderr, "master with a CRC not read back (truncated %d)\r\n", Truncated);
+            if (Read)
+                NodeDelete((node*)Read);
+            goto exit;
+        }
+        if (EBML_MasterIsChecksumValid(Read) == Truncated)
+        {
+            fprintf(stderr, "CRC of the master read in memory %s (truncated %d)\r\n", Truncated?"matches":"doesn't match", Truncated);
+            NodeDelete((node*)Read);
+            goto exit;
+        }
+        NodeDelete((node*)Read);
+    }
+    Result = 0;
+
+exit:
+    if (Stream)
+        StreamClose(Stream);
+    if (Head)
+        NodeDelete((node*)Head);
+    return Result;
+}
+
+int main(int argc,char** argv)
+{
+    parsercontext p;
+    int Result = 0;
+
+    ParserContext_Init(&p,NULL,NULL,NULL);
+    EBML_Init(&p);
+
+    Result |= TestCRC(&p);
+    Result |= TestTruncatedCRC(&p);
+    if (argc > 1)
+    {
+        tchar_t Path[MAXPATHFULL];
+        Node_FromStr(&p,Path,TSIZEOF(Path),argv[1]);
+        Result |= TestRenderCRC(&p,Path);
+    }
+
+    EBML_Done(&p);
+    ParserContext_Done(&p);
+    return Result;
+}
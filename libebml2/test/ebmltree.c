@@ -196,6 +196,9 @@ int main(int argc, const char *argv[])
         StreamClose(Input);
     }
 
+    // EBML ending
+    EBML_Done(&p);
+
     // Core-C ending
     ParserContext_Done(&p);
 
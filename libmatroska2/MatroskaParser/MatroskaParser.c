@@ -1237,6 +1237,8 @@ void mkv_Close(MatroskaFile *File)
 	if (File->SegmentInfo) NodeDelete((node*)File->SegmentInfo);
 	if (File->Segment) NodeDelete((node*)File->Segment);
 
+	MATROSKA_Done(&File->p);
+
 	// Core-C Done
 	ParserContext_Done(&File->p);
 
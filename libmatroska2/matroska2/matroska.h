@@ -34,6 +34,8 @@
 #include "matroska2/matroska_sem.h"
 
 MATROSKA_DLL err_t MATROSKA_Init(parsercontext *p);
+// each MATROSKA_Init() needs a matching MATROSKA_Done()
+MATROSKA_DLL void MATROSKA_Done(parsercontext *p);
 
 #define INVALID_TIMESTAMP_T      INT64_MAX
 typedef int64_t    mkv_timestamp_t; // in nanoseconds
@@ -70,6 +72,11 @@ MATROSKA_DLL err_t MATROSKA_LinkCueSegmentInfo(matroska_cuepoint *Cue, ebml_mast
 MATROSKA_DLL err_t MATROSKA_LinkCuePointBlock(matroska_cuepoint *Cue, matroska_block *Block);
 MATROSKA_DLL err_t MATROSKA_CuePointUpdate(matroska_cuepoint *Cue, ebml_element *Segment, int ForProfile);
 MATROSKA_DLL double MATROSKA_TrackTimestampScale(const ebml_master *Track);
+MATROSKA_DLL err_t MATROSKA_TrackSetTimestampScale(matroska_trackentry *TrackEntry, double Scale, int ForProfile);
+MATROSKA_DLL err_t MATROSKA_TrackSetDefaultDuration(matroska_trackentry *TrackEntry, mkv_timestamp_t Duration, int ForProfile);
+// the blocks keep the values of their track found when it was last edited with the MATROSKA_Track functions,
+// call it after other values of the track or its ContentEncodings are set in place
+MATROSKA_DLL void MATROSKA_TrackEdited(matroska_trackentry *TrackEntry);
 MATROSKA_DLL mkv_timestamp_t MATROSKA_SegmentInfoTimestampScale(const ebml_master *SegmentInfo);
 MATROSKA_DLL void MATROSKA_ClusterSetTimestamp(matroska_cluster *Cluster, mkv_timestamp_t Timestamp);
 MATROSKA_DLL err_t MATROSKA_BlockSetTimestamp(matroska_block *Block, mkv_timestamp_t Timestamp, mkv_timestamp_t ClusterTimestamp);
@@ -79,10 +86,14 @@ MATROSKA_DLL mkv_timestamp_t MATROSKA_BlockTimestamp(matroska_block *Block);
 MATROSKA_DLL mkv_timestamp_t MATROSKA_CueTimestamp(const matroska_cuepoint *Cue);
 MATROSKA_DLL filepos_t MATROSKA_CuePosInSegment(const matroska_cuepoint *Cue);
 MATROSKA_DLL uint16_t MATROSKA_BlockTrackNum(const matroska_block *Block);
+MATROSKA_DLL mkv_timestamp_t MATROSKA_BlockDefaultDuration(const matroska_block *Block);
 MATROSKA_DLL bool_t MATROSKA_BlockKeyframe(const matroska_block *Block);
 MATROSKA_DLL bool_t MATROSKA_BlockDiscardable(const matroska_block *Block);
 MATROSKA_DLL bool_t MATROSKA_BlockLaced(const matroska_block *Block);
 MATROSKA_DLL err_t MATROSKA_BlockReadData(matroska_block *Block, struct stream *Input, int ForProfile);
+// same as MATROSKA_BlockReadData() but the frames of a memory stream are not copied when they don't need decoding,
+// the frame data are then only valid as long as the Input stream is
+MATROSKA_DLL err_t MATROSKA_BlockMapData(matroska_block *Block, struct stream *Input, int ForProfile);
 MATROSKA_DLL err_t MATROSKA_BlockReleaseData(matroska_block *Block, bool_t IncludingNotRead);
 MATROSKA_DLL uint16_t MATROSKA_CueTrackNum(const matroska_cuepoint *Cue);
 MATROSKA_DLL void MATROSKA_CuesSort(ebml_master *Cues);
@@ -92,13 +103,109 @@ MATROSKA_DLL bool_t MATROSKA_MetaSeekIsClass(const matroska_seekpoint *MetaSeek,
 MATROSKA_DLL filepos_t MATROSKA_MetaSeekPosInSegment(const matroska_seekpoint *MetaSeek);
 MATROSKA_DLL filepos_t MATROSKA_MetaSeekAbsolutePos(const matroska_seekpoint *MetaSeek);
 
+// not a ContentCompAlgo of the specifications, only understood by libmatroska2
+#define MATROSKA_TRACK_ENCODING_COMP_ZSTD  ((MatroskaTrackEncodingCompAlgo)4)
+
+// (de)compression library used for the ContentCompAlgo of a track
+typedef struct matroska_codec
+{
+    MatroskaTrackEncodingCompAlgo Algo;
+    // decoding state kept by a track between its frames, Open is NULL when the codec doesn't need one
+    void *(*Open)(void);
+    err_t (*Reset)(void *State); // before each frame
+    void (*Close)(void *State);
+    // decode a frame at *ArrayOffset in OutBuf starting with OutSize bytes, *ArrayOffset ends after the frame
+    err_t (*Decode)(void *State, const uint8_t *In, size_t InSize, array *OutBuf, size_t OutSize, size_t *FrameSize, size_t *ArrayOffset);
+    // largest encoded size of InSize bytes, NULL when the codec can't encode
+    size_t (*Bound)(size_t InSize);
+    // *OutSize is the room in Out on input and the encoded size on output
+    err_t (*Encode)(const uint8_t *In, size_t InSize, uint8_t *Out, size_t *OutSize);
+
+} matroska_codec;
+
+// a registered codec replaces the built-in one with the same Algo, to be done before any track is used
+MATROSKA_DLL err_t MATROSKA_RegisterCodec(const matroska_codec *Codec);
+MATROSKA_DLL const matroska_codec *MATROSKA_GetCodec(MatroskaTrackEncodingCompAlgo Algo);
+
 MATROSKA_DLL matroska_cuepoint *MATROSKA_CuesGetTimestampStart(const ebml_element *Cues, mkv_timestamp_t Timestamp);
 
+// Cluster index built by scanning the Segment, usable when the Cues are missing or sparse
+typedef struct matroska_index_cluster
+{
+    filepos_t Pos; // relative to the Segment data
+    mkv_timestamp_t Timestamp;
+    size_t FirstKey; // first keyframe of the Cluster in the index Keys
+
+} matroska_index_cluster;
+
+typedef struct matroska_index_key
+{
+    filepos_t Offset; // first keyframe of the track in the Cluster, from the Cluster start
+    uint16_t TrackNum;
+
+} matroska_index_key;
+
+typedef struct matroska_index
+{
+    array Clusters; // matroska_index_cluster, in file order
+    array Keys; // matroska_index_key
+    // what the index was built for, FileSize and FileDate are set by the caller
+    uint8_t SegmentUUID[16];
+    filepos_t FileSize;
+    datetime_t FileDate;
+
+} matroska_index;
+
+MATROSKA_DLL void MATROSKA_IndexInit(matroska_index *Index);
+MATROSKA_DLL void MATROSKA_IndexClear(matroska_index *Index);
+MATROSKA_DLL err_t MATROSKA_IndexBuild(matroska_index *Index, struct stream *Input, const ebml_element *Segment, ebml_master *SegmentInfo, int ForProfile);
+MATROSKA_DLL err_t MATROSKA_IndexAddCluster(matroska_index *Index, matroska_cluster *Cluster, const ebml_element *Segment);
+// last Cluster starting before Timestamp, with a keyframe of TrackNum if not 0
+MATROSKA_DLL const matroska_index_cluster *MATROSKA_IndexFind(const matroska_index *Index, mkv_timestamp_t Timestamp, uint16_t TrackNum);
+MATROSKA_DLL const matroska_index_key *MATROSKA_IndexKeyframe(const matroska_index *Index, const matroska_index_cluster *Cluster, uint16_t TrackNum);
+// sidecar file, only valid for the same Segment and file size/date
+MATROSKA_DLL err_t MATROSKA_IndexWrite(const matroska_index *Index, struct stream *Output);
+MATROSKA_DLL err_t MATROSKA_IndexRead(matroska_index *Index, struct stream *Input);
+MATROSKA_DLL bool_t MATROSKA_IndexIsFor(const matroska_index *Index, const uint8_t SegmentUUID[16], filepos_t FileSize, datetime_t FileDate);
+
+// Cues loaded in a sorted array for seeking, one entry per CueTrackPositions
+typedef struct matroska_cue_entry
+{
+    mkv_timestamp_t Timestamp;
+    filepos_t ClusterPos; // relative to the Segment data
+    filepos_t RelativePos; // of the Block in the Cluster data, INVALID_FILEPOS_T when unknown
+    uint32_t BlockNum; // of the Block in the Cluster starting at 1, 0 when unknown
+    uint16_t TrackNum;
+
+} matroska_cue_entry;
+
+typedef struct matroska_cue_index
+{
+    array Entries; // matroska_cue_entry, sorted by track then timestamp
+
+} matroska_cue_index;
+
+MATROSKA_DLL void MATROSKA_CueIndexInit(matroska_cue_index *Index);
+MATROSKA_DLL void MATROSKA_CueIndexClear(matroska_cue_index *Index);
+// the CuePoints need to be linked with their SegmentInfo
+MATROSKA_DLL err_t MATROSKA_CueIndexBuild(matroska_cue_index *Index, const ebml_master *Cues);
+// last entry at or before Timestamp for TrackNum, or for any track if 0 with the first entry when none is before
+MATROSKA_DLL const matroska_cue_entry *MATROSKA_CueIndexFind(const matroska_cue_index *Index, mkv_timestamp_t Timestamp, uint16_t TrackNum);
+
 #if defined(CONFIG_EBML_WRITING)
 MATROSKA_DLL MatroskaTrackEncodingCompAlgo MATROSKA_TrackGetBlockCompression(const matroska_trackentry *TrackEntry, int ForProfile);
 MATROSKA_DLL bool_t MATROSKA_TrackSetCompressionAlgo(matroska_trackentry *TrackEntry, MatroskaContentEncodingScope Scope, int ForProfile, MatroskaTrackEncodingCompAlgo algo);
 MATROSKA_DLL bool_t MATROSKA_TrackSetCompressionHeader(matroska_trackentry *TrackEntry, const uint8_t *Header, size_t HeaderSize, int ForProfile);
 MATROSKA_DLL bool_t MATROSKA_TrackSetCompressionNone(matroska_trackentry *TrackEntry);
+// encode the frames read for the write track once, before the size update and the rendering
+// different blocks can be encoded by different threads, the write tracks have to be read or have their compression set
+MATROSKA_DLL err_t MATROSKA_BlockEncodeFrames(matroska_block *Block);
+// whether the rendered size of the block depends on its frame data, otherwise it can be computed without reading it
+MATROSKA_DLL bool_t MATROSKA_BlockSizeNeedsData(matroska_block *Block);
+// write the lacing and frames as they are in the input when the write track stores them like the read track,
+// to call before the block is rendered, returns whether they are copied, the frames read can then only be
+// accessed when the track is not compressed, adding a frame builds the lacing again
+MATROSKA_DLL bool_t MATROSKA_BlockCopyData(matroska_block *Block);
 #if defined(CONFIG_ZLIB)
 MATROSKA_DLL err_t CompressFrameZLib(const uint8_t *Cursor, size_t CursorSize, uint8_t **OutBuf, size_t *OutSize);
 #else // !CONFIG_ZLIB
@@ -27,12 +27,18 @@ struct matroska_block
     array SizeList; // int32_t
     array SizeListIn; // int32_t
     array Data; // uint8_t
+    const uint8_t *MappedData; // used instead of Data when the frames are read directly from the input memory
+    size_t MappedSize;
     array Durations; // mkv_timestamp_t
     ebml_master *ReadTrack;
     ebml_master *ReadSegInfo;
 #if defined(CONFIG_EBML_WRITING)
     ebml_master *WriteTrack;
     ebml_master *WriteSegInfo;
+    array Compressed; // uint8_t, the frames as written when the write track compresses them
+    array CompressedSizeList; // int32_t
+    filepos_t CopyLocation; // where the lacing and frames written as-is are read, INVALID_FILEPOS_T when they are rebuilt
+    size_t CopySize;
 #endif
     bool_t IsKeyframe;
     bool_t IsDiscardable;
@@ -40,6 +46,7 @@ struct matroska_block
     bool_t LocalTimestampUsed;
     int16_t LocalTimestamp;
     uint16_t TrackNumber;
+    uint8_t ReadHeadSize; // of the track number, timestamp and flags in the input
     char Lacing;
 };
 
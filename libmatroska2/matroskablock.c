@@ -44,6 +44,13 @@ static const int A_DTS_freq[16] = {
    0, 8000, 16000, 32000, 0, 0, 11025, 22050, 44100, 0, 0, 12000, 24000, 48000, 0, 0
 };
 
+static const uint8_t *GetBlockFrames(const matroska_block *Block)
+{
+    matroska_frame Frame;
+    if (MATROSKA_BlockGetFrame(Block,0,&Frame,1)!=ERR_NONE)
+        return NULL;
+    return Frame.Data;
+}
 
 err_t MATROSKA_BlockProcessFrameDurations(matroska_block *Block, struct stream *Input, int ForProfile)
 {
@@ -52,7 +59,7 @@ err_t MATROSKA_BlockProcessFrameDurations(matroska_block *Block, struct stream *
     tchar_t CodecID[MAXPATH];
     err_t Err;
     bool_t ReadData;
-    uint8_t *Cursor;
+    const uint8_t *Cursor;
     size_t Frame;
     int Version, Layer, SampleRate, Samples, fscod, fscod2;
 
@@ -76,9 +83,9 @@ err_t MATROSKA_BlockProcessFrameDurations(matroska_block *Block, struct stream *
                 {
                     EBML_StringGet((ebml_string*)Elt,CodecID,TSIZEOF(CodecID));
                     ReadData = 0;
-                    if (!ARRAYCOUNT(Block->Data,uint8_t))
+                    if (!Block->Base.Base.bValueIsSet)
                     {
-                        Err = MATROSKA_BlockReadData(Block,Input,ForProfile);
+                        Err = MATROSKA_BlockMapData(Block,Input,ForProfile);
                         if (Err!=ERR_NONE)
                             goto exit;
                         ReadData = 1;
@@ -88,7 +95,7 @@ err_t MATROSKA_BlockProcessFrameDurations(matroska_block *Block, struct stream *
                     {
                         Block->IsKeyframe = 1; // safety
                         ArrayResize(&Block->Durations,sizeof(mkv_timestamp_t)*ARRAYCOUNT(Block->SizeList,int32_t),0);
-                        Cursor = ARRAYBEGIN(Block->Data,uint8_t);
+                        Cursor = GetBlockFrames(Block);
                         for (Frame=0;Frame<ARRAYCOUNT(Block->SizeList,int32_t);++Frame)
                         {
                             Version = (Cursor[1] >> 3) & 3;
@@ -113,7 +120,7 @@ err_t MATROSKA_BlockProcessFrameDurations(matroska_block *Block, struct stream *
                     {
                         Block->IsKeyframe = 1; // safety
                         ArrayResize(&Block->Durations,sizeof(mkv_timestamp_t)*ARRAYCOUNT(Block->SizeList,int32_t),0);
-                        Cursor = ARRAYBEGIN(Block->Data,uint8_t);
+                        Cursor = GetBlockFrames(Block);
                         for (Frame=0;Frame<ARRAYCOUNT(Block->SizeList,int32_t);++Frame)
                         {
                             fscod =  Cursor[5] >> 3;
@@ -136,7 +143,7 @@ err_t MATROSKA_BlockProcessFrameDurations(matroska_block *Block, struct stream *
                     {
                         Block->IsKeyframe = 1; // safety
                         ArrayResize(&Block->Durations,sizeof(mkv_timestamp_t)*ARRAYCOUNT(Block->SizeList,int32_t),0);
-                        Cursor = ARRAYBEGIN(Block->Data,uint8_t);
+                        Cursor = GetBlockFrames(Block);
                         for (Frame=0;Frame<ARRAYCOUNT(Block->SizeList,int32_t);++Frame)
                         {
                             fscod =  Cursor[4] >> 6;
@@ -160,7 +167,7 @@ err_t MATROSKA_BlockProcessFrameDurations(matroska_block *Block, struct stream *
                     {
                         Block->IsKeyframe = 1; // safety
                         ArrayResize(&Block->Durations,sizeof(mkv_timestamp_t)*ARRAYCOUNT(Block->SizeList,int32_t),0);
-                        Cursor = ARRAYBEGIN(Block->Data,uint8_t);
+                        Cursor = GetBlockFrames(Block);
                         for (Frame=0;Frame<ARRAYCOUNT(Block->SizeList,int32_t);++Frame)
                         {
                             Samples = (((Cursor[4] & 1) << 7) + (Cursor[5] >> 2) + 1) * 32;
@@ -264,7 +271,7 @@ err_t MATROSKA_BlockProcessFrameDurations(matroska_block *Block, struct stream *
 
                             SampleRate = vi.rate;
                             ArrayResize(&Block->Durations,sizeof(mkv_timestamp_t)*ARRAYCOUNT(Block->SizeList,int32_t),0);
-                            Cursor = ARRAYBEGIN(Block->Data,uint8_t);
+                            Cursor = GetBlockFrames(Block);
                             ci = vi.codec_setup;
                             for (Frame=0;Frame<ARRAYCOUNT(Block->SizeList,int32_t);++Frame)
                             {
@@ -290,10 +297,7 @@ err_t MATROSKA_BlockProcessFrameDurations(matroska_block *Block, struct stream *
 #endif
 
                     if (ReadData)
-                    {
-                        ArrayClear(&Block->Data);
-                        Block->Base.Base.bValueIsSet = 0;
-                    }
+                        MATROSKA_BlockReleaseData(Block,1);
                 }
             }
         }
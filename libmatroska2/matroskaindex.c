@@ -0,0 +1,454 @@
+/*
+ * Copyright (c) 2008-2010, Matroska (non-profit organisation)
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include "matroska2/matroska.h"
+#include "matroska2/matroska_sem.h"
+#include "matroska2/matroska_classes.h"
+
+#include <corec/helpers/file/streams.h>
+#include <stdlib.h>
+
+// sidecar file layout, all values little endian:
+// "MKIX", version, 3 reserved bytes, SegmentUUID[16], FileSize(8), FileDate(8), Clusters count(4), Keys count(4)
+// then Pos(8), Timestamp(8), FirstKey(4) per Cluster and Offset(8), TrackNum(2) per keyframe
+#define INDEX_MAGIC          "MKIX"
+#define INDEX_VERSION        2
+#define INDEX_HEADER_SIZE    48
+#define INDEX_CLUSTER_SIZE   20
+#define INDEX_KEY_SIZE       10
+
+static void PutLE(uint8_t *Out, uint64_t Value, size_t Size)
+{
+    size_t i;
+    for (i=0;i<Size;++i, Value>>=8)
+        Out[i] = (uint8_t)(Value & 0xFF);
+}
+
+static uint64_t GetLE(const uint8_t *In, size_t Size)
+{
+    uint64_t Value = 0;
+    while (Size--)
+        Value = (Value << 8) | In[Size];
+    return Value;
+}
+
+void MATROSKA_IndexInit(matroska_index *Index)
+{
+    memset(Index,0,sizeof(*Index));
+    ArrayInit(&Index->Clusters);
+    ArrayInit(&Index->Keys);
+    Index->FileSize = INVALID_FILEPOS_T;
+    Index->FileDate = INVALID_DATETIME_T;
+}
+
+void MATROSKA_IndexClear(matroska_index *Index)
+{
+    ArrayClear(&Index->Clusters);
+    ArrayClear(&Index->Keys);
+}
+
+static const matroska_index_key *FindClusterKey(const matroska_index *Index, const matroska_index_cluster *Cluster, uint16_t TrackNum)
+{
+    const matroska_index_key *Key, *End;
+    if (Cluster+1 < ARRAYEND(Index->Clusters,matroska_index_cluster))
+        End = ARRAYBEGIN(Index->Keys,matroska_index_key) + Cluster[1].FirstKey;
+    else
+        End = ARRAYEND(Index->Keys,matroska_index_key);
+    for (Key=ARRAYBEGIN(Index->Keys,matroska_index_key) + Cluster->FirstKey; Key<End; ++Key)
+        if (Key->TrackNum == TrackNum)
+            return Key;
+    return NULL;
+}
+
+err_t MATROSKA_IndexAddCluster(matroska_index *Index, matroska_cluster *Cluster, const ebml_element *Segment)
+{
+    matroska_index_cluster Entry;
+    matroska_index_key Key;
+    ebml_element *Elt;
+    matroska_block *Block;
+    filepos_t ClusterPos = EBML_ElementPosition((ebml_element*)Cluster);
+
+    Entry.Pos = ClusterPos - EBML_ElementPositionData(Segment);
+    Entry.Timestamp = MATROSKA_ClusterTimestamp(Cluster);
+    Entry.FirstKey = ARRAYCOUNT(Index->Keys,matroska_index_key);
+    if (Entry.Timestamp == INVALID_TIMESTAMP_T)
+        return ERR_INVALID_DATA;
+    if (!ARRAYEMPTY(Index->Clusters) && ARRAYEND(Index->Clusters,matroska_index_cluster)[-1].Pos >= Entry.Pos)
+        return ERR_INVALID_PARAM;
+    if (!ArrayAppend(&Index->Clusters,&Entry,sizeof(Entry),4096))
+        return ERR_OUT_OF_MEMORY;
+
+    for (Elt = EBML_MasterChildren(Cluster);Elt;Elt = EBML_MasterNext(Elt))
+    {
+        if (EBML_ElementIsType(Elt, MATROSKA_getContextSimpleBlock()))
+            Block = (matroska_block*)Elt;
+        else if (EBML_ElementIsType(Elt, MATROSKA_getContextBlockGroup()))
+            Block = (matroska_block*)EBML_MasterFindChild(Elt, MATROSKA_getContextBlock());
+        else
+            continue;
+        if (!Block || !MATROSKA_BlockKeyframe(Block))
+            continue;
+        Key.TrackNum = MATROSKA_BlockTrackNum(Block);
+        if (FindClusterKey(Index, ARRAYEND(Index->Clusters,matroska_index_cluster)-1, Key.TrackNum))
+            continue;
+        Key.Offset = EBML_ElementPosition(Elt) - ClusterPos;
+        if (!ArrayAppend(&Index->Keys,&Key,sizeof(Key),4096))
+            return ERR_OUT_OF_MEMORY;
+    }
+    return ERR_NONE;
+}
+
+err_t MATROSKA_IndexBuild(matroska_index *Index, struct stream *Input, const ebml_element *Segment, ebml_master *SegmentInfo, int ForProfile)
+{
+    ebml_parser_context StreamContext, SegmentContext;
+    ebml_element *Elt, *EltNext;
+    ebml_binary *UUID;
+    int UpperElement = 0;
+    err_t Err = ERR_NONE;
+
+    ArrayDrop(&Index->Clusters);
+    ArrayDrop(&Index->Keys);
+    memset(Index->SegmentUUID,0,sizeof(Index->SegmentUUID));
+    UUID = SegmentInfo ? (ebml_binary*)EBML_MasterFindChild(SegmentInfo, MATROSKA_getContextSegmentUUID()) : NULL;
+    if (UUID && EBML_ElementDataSize((ebml_element*)UUID,0) == sizeof(Index->SegmentUUID))
+        memcpy(Index->SegmentUUID, EBML_BinaryGetData(UUID), sizeof(Index->SegmentUUID));
+
+    StreamContext.Context = MATROSKA_getContextStream();
+    StreamContext.EndPosition = EBML_ElementPositionEnd(Segment);
+    StreamContext.UpContext = NULL;
+    StreamContext.Profile = ForProfile;
+    SegmentContext.Context = MATROSKA_getContextSegment();
+    SegmentContext.EndPosition = EBML_ElementPositionEnd(Segment);
+    SegmentContext.UpContext = &StreamContext;
+    SegmentContext.Profile = ForProfile;
+
+    if (Stream_Seek(Input, EBML_ElementPositionData(Segment), SEEK_SET) != EBML_ElementPositionData(Segment))
+        return ERR_READ;
+
+    Elt = EBML_FindNextElement(Input, &SegmentContext, &UpperElement, 1);
+    while (Elt && Err == ERR_NONE)
+    {
+        EltNext = NULL;
+        if (EBML_ElementIsType(Elt, MATROSKA_getContextCluster()))
+        {
+            // only the Block headers are needed
+            Err = EBML_ElementReadData(Elt, Input, &SegmentContext, 0, SCOPE_PARTIAL_DATA, 0);
+            if (Err == ERR_NONE)
+            {
+                MATROSKA_LinkClusterReadSegmentInfo((matroska_cluster*)Elt, SegmentInfo, 0);
+                Err = MATROSKA_IndexAddCluster(Index, (matroska_cluster*)Elt, Segment);
+                if (Err == ERR_INVALID_DATA)
+                    Err = ERR_NONE; // Clusters without a timestamp are not indexed
+            }
+        }
+        else
+            EltNext = EBML_ElementSkipData(Elt, Input, &SegmentContext, NULL, 1);
+        NodeDelete((node*)Elt);
+        if (EltNext)
+            Elt = EltNext;
+        else
+            Elt = EBML_FindNextElement(Input, &SegmentContext, &UpperElement, 1);
+    }
+    if (Elt)
+        NodeDelete((node*)Elt);
+    return Err;
+}
+
+const matroska_index_cluster *MATROSKA_IndexFind(const matroska_index *Index, mkv_timestamp_t Timestamp, uint16_t TrackNum)
+{
+    const matroska_index_cluster *Begin = ARRAYBEGIN(Index->Clusters,matroska_index_cluster);
+    size_t Low = 0, High = ARRAYCOUNT(Index->Clusters,matroska_index_cluster), Mid;
+
+    if (!High)
+        return NULL;
+
+    // last Cluster starting at or before Timestamp
+    while (High - Low > 1)
+    {
+        Mid = (Low + High) / 2;
+        if (Begin[Mid].Timestamp <= Timestamp)
+            Low = Mid;
+        else
+            High = Mid;
+    }
+
+    if (TrackNum)
+    {
+        for (Mid=Low+1;Mid-- > 0;)
+            if (FindClusterKey(Index, Begin + Mid, TrackNum))
+                return Begin + Mid;
+        return NULL;
+    }
+    return Begin + Low;
+}
+
+const matroska_index_key *MATROSKA_IndexKeyframe(const matroska_index *Index, const matroska_index_cluster *Cluster, uint16_t TrackNum)
+{
+    return FindClusterKey(Index, Cluster, TrackNum);
+}
+
+bool_t MATROSKA_IndexIsFor(const matroska_index *Index, const uint8_t SegmentUUID[16], filepos_t FileSize, datetime_t FileDate)
+{
+    return memcmp(Index->SegmentUUID, SegmentUUID, sizeof(Index->SegmentUUID))==0 &&
+           Index->FileSize == FileSize && Index->FileDate == FileDate;
+}
+
+err_t MATROSKA_IndexWrite(const matroska_index *Index, struct stream *Output)
+{
+    const matroska_index_cluster *Cluster;
+    const matroska_index_key *Key;
+    array Buffer;
+    uint8_t *Out;
+    size_t ClusterCount = ARRAYCOUNT(Index->Clusters,matroska_index_cluster);
+    size_t KeyCount = ARRAYCOUNT(Index->Keys,matroska_index_key);
+    err_t Err;
+
+    ArrayInit(&Buffer);
+    if (!ArrayResize(&Buffer, INDEX_HEADER_SIZE + ClusterCount*INDEX_CLUSTER_SIZE + KeyCount*INDEX_KEY_SIZE, 0))
+        return ERR_OUT_OF_MEMORY;
+    ArrayZero(&Buffer);
+
+    Out = ARRAYBEGIN(Buffer,uint8_t);
+    memcpy(Out, INDEX_MAGIC, 4);
+    Out[4] = INDEX_VERSION;
+    memcpy(Out+8, Index->SegmentUUID, sizeof(Index->SegmentUUID));
+    PutLE(Out+24, (uint64_t)Index->FileSize, 8);
+    PutLE(Out+32, (uint64_t)(int64_t)Index->FileDate, 8);
+    PutLE(Out+40, ClusterCount, 4);
+    PutLE(Out+44, KeyCount, 4);
+    Out += INDEX_HEADER_SIZE;
+    for (Cluster=ARRAYBEGIN(Index->Clusters,matroska_index_cluster);Cluster!=ARRAYEND(Index->Clusters,matroska_index_cluster);++Cluster, Out+=INDEX_CLUSTER_SIZE)
+    {
+        PutLE(Out, (uint64_t)Cluster->Pos, 8);
+        PutLE(Out+8, (uint64_t)Cluster->Timestamp, 8);
+        PutLE(Out+16, Cluster->FirstKey, 4);
+    }
+    for (Key=ARRAYBEGIN(Index->Keys,matroska_index_key);Key!=ARRAYEND(Index->Keys,matroska_index_key);++Key, Out+=INDEX_KEY_SIZE)
+    {
+        PutLE(Out, (uint64_t)Key->Offset, 8);
+        PutLE(Out+8, Key->TrackNum, 2);
+    }
+
+    Err = Stream_Write(Output, ARRAYBEGIN(Buffer,uint8_t), ARRAYCOUNT(Buffer,uint8_t), NULL);
+    ArrayClear(&Buffer);
+    return Err;
+}
+
+err_t MATROSKA_IndexRead(matroska_index *Index, struct stream *Input)
+{
+    uint8_t Header[INDEX_HEADER_SIZE], Item[INDEX_CLUSTER_SIZE];
+    matroska_index_cluster *Cluster;
+    matroska_index_key *Key;
+    size_t ClusterCount, KeyCount, PrevKey = 0;
+    filepos_t PrevPos = -1, DataPos, DataEnd;
+    err_t Err;
+
+    ArrayDrop(&Index->Clusters);
+    ArrayDrop(&Index->Keys);
+    Err = Stream_Read(Input, Header, sizeof(Header), NULL);
+    if (Err != ERR_NONE)
+        return Err;
+    if (memcmp(Header, INDEX_MAGIC, 4)!=0 || Header[4] != INDEX_VERSION)
+        return ERR_INVALID_DATA;
+
+    memcpy(Index->SegmentUUID, Header+8, sizeof(Index->SegmentUUID));
+    Index->FileSize = (filepos_t)GetLE(Header+24, 8);
+    Index->FileDate = (datetime_t)(int64_t)GetLE(Header+32, 8);
+    ClusterCount = (size_t)GetLE(Header+40, 4);
+    KeyCount = (size_t)GetLE(Header+44, 4);
+
+    // the counts can't ask for more entries than the sidecar holds
+    DataPos = Stream_Seek(Input, 0, SEEK_CUR);
+    DataEnd = Stream_Seek(Input, 0, SEEK_END);
+    if (DataPos == INVALID_FILEPOS_T || DataEnd == INVALID_FILEPOS_T || Stream_Seek(Input, DataPos, SEEK_SET) != DataPos)
+        return ERR_READ;
+    if ((uint64_t)ClusterCount*INDEX_CLUSTER_SIZE + (uint64_t)KeyCount*INDEX_KEY_SIZE > (uint64_t)(DataEnd - DataPos))
+        return ERR_INVALID_DATA;
+
+    if (!ArrayResize(&Index->Clusters, ClusterCount*sizeof(matroska_index_cluster), 0) ||
+        !ArrayResize(&Index->Keys, KeyCount*sizeof(matroska_index_key), 0))
+        Err = ERR_OUT_OF_MEMORY;
+
+    for (Cluster=ARRAYBEGIN(Index->Clusters,matroska_index_cluster);Err==ERR_NONE && Cluster!=ARRAYEND(Index->Clusters,matroska_index_cluster);++Cluster)
+    {
+        Err = Stream_Read(Input, Item, INDEX_CLUSTER_SIZE, NULL);
+        Cluster->Pos = (filepos_t)GetLE(Item, 8);
+        Cluster->Timestamp = (mkv_timestamp_t)GetLE(Item+8, 8);
+        Cluster->FirstKey = (size_t)GetLE(Item+16, 4);
+        if (Err == ERR_NONE && (Cluster->Pos <= PrevPos || Cluster->FirstKey < PrevKey || Cluster->FirstKey > KeyCount))
+            Err = ERR_INVALID_DATA;
+        PrevPos = Cluster->Pos;
+        PrevKey = Cluster->FirstKey;
+    }
+    for (Key=ARRAYBEGIN(Index->Keys,matroska_index_key);Err==ERR_NONE && Key!=ARRAYEND(Index->Keys,matroska_index_key);++Key)
+    {
+        Err = Stream_Read(Input, Item, INDEX_KEY_SIZE, NULL);
+        Key->Offset = (filepos_t)GetLE(Item, 8);
+        Key->TrackNum = (uint16_t)GetLE(Item+8, 2);
+    }
+
+    if (Err != ERR_NONE)
+    {
+        ArrayDrop(&Index->Clusters);
+        ArrayDrop(&Index->Keys);
+    }
+    return Err;
+}
+
+void MATROSKA_CueIndexInit(matroska_cue_index *Index)
+{
+    ArrayInit(&Index->Entries);
+}
+
+void MATROSKA_CueIndexClear(matroska_cue_index *Index)
+{
+    ArrayClear(&Index->Entries);
+}
+
+static int CueEntryCmp(const void* UNUSED_PARAM(Param), const void *va, const void *vb)
+{
+    const matroska_cue_entry *a = va;
+    const matroska_cue_entry *b = vb;
+    if (a->TrackNum != b->TrackNum)
+        return a->TrackNum > b->TrackNum ? 1 : -1;
+    if (a->Timestamp != b->Timestamp)
+        return a->Timestamp > b->Timestamp ? 1 : -1;
+    if (a->ClusterPos != b->ClusterPos)
+        return a->ClusterPos > b->ClusterPos ? 1 : -1;
+    return 0;
+}
+
+// qsort() order, the entries of the same Cluster by position in the Cluster
+static int CueEntrySort(const void *va, const void *vb)
+{
+    const matroska_cue_entry *a = va;
+    const matroska_cue_entry *b = vb;
+    int Cmp = CueEntryCmp(NULL, a, b);
+    if (Cmp)
+        return Cmp;
+    if (a->RelativePos != b->RelativePos)
+        return a->RelativePos > b->RelativePos ? 1 : -1;
+    if (a->BlockNum != b->BlockNum)
+        return a->BlockNum > b->BlockNum ? 1 : -1;
+    return 0;
+}
+
+err_t MATROSKA_CueIndexBuild(matroska_cue_index *Index, const ebml_master *Cues)
+{
+    const ebml_element *Cue, *Position, *Elt;
+    matroska_cue_entry Entry;
+    err_t Err = ERR_NONE;
+
+    assert(EBML_ElementIsType((const ebml_element*)Cues, MATROSKA_getContextCues()));
+    ArrayClear(&Index->Entries);
+
+    for (Cue=EBML_MasterChildren(Cues);Err==ERR_NONE && Cue;Cue=EBML_MasterNext(Cue))
+    {
+        if (!EBML_ElementIsType(Cue, MATROSKA_getContextCuePoint()))
+            continue;
+        Entry.Timestamp = MATROSKA_CueTimestamp((const matroska_cuepoint*)Cue);
+        if (Entry.Timestamp == INVALID_TIMESTAMP_T)
+            continue;
+        for (Position=EBML_MasterChildren(Cue);Position;Position=EBML_MasterNext(Position))
+        {
+            if (!EBML_ElementIsType(Position, MATROSKA_getContextCueTrackPositions()))
+                continue;
+            Elt = EBML_MasterFindChild(Position, MATROSKA_getContextCueClusterPosition());
+            if (!Elt)
+                continue;
+            Entry.ClusterPos = EBML_IntegerValue((const ebml_integer*)Elt);
+            Elt = EBML_MasterFindChild(Position, MATROSKA_getContextCueTrack());
+            if (!Elt)
+                continue;
+            Entry.TrackNum = (uint16_t)EBML_IntegerValue((const ebml_integer*)Elt);
+            Elt = EBML_MasterFindChild(Position, MATROSKA_getContextCueRelativePosition());
+            Entry.RelativePos = Elt ? EBML_IntegerValue((const ebml_integer*)Elt) : INVALID_FILEPOS_T;
+            Elt = EBML_MasterFindChild(Position, MATROSKA_getContextCueBlockNumber());
+            Entry.BlockNum = Elt ? (uint32_t)EBML_IntegerValue((const ebml_integer*)Elt) : 0;
+
+            if (!ArrayAppend(&Index->Entries,&Entry,sizeof(Entry),4096))
+            {
+                Err = ERR_OUT_OF_MEMORY;
+                break;
+            }
+        }
+    }
+
+    // the entries of the tracks are interleaved, too many moves for an insertion sort
+    if (Err==ERR_NONE && !ARRAYEMPTY(Index->Entries))
+        qsort(ARRAYBEGIN(Index->Entries,matroska_cue_entry), ARRAYCOUNT(Index->Entries,matroska_cue_entry), sizeof(matroska_cue_entry), CueEntrySort);
+    else if (Err!=ERR_NONE)
+        ArrayClear(&Index->Entries);
+    return Err;
+}
+
+// last entry of the track at or before Timestamp, the first one with that timestamp
+static const matroska_cue_entry *FindTrackCue(const matroska_cue_entry *Begin, const matroska_cue_entry *End, mkv_timestamp_t Timestamp)
+{
+    size_t Low = 0, High = End - Begin, Mid;
+
+    // first entry after Timestamp
+    while (Low < High)
+    {
+        Mid = (Low + High) / 2;
+        if (Begin[Mid].Timestamp <= Timestamp)
+            Low = Mid + 1;
+        else
+            High = Mid;
+    }
+    if (!Low)
+        return NULL;
+    for (--Low;Low && Begin[Low-1].Timestamp == Begin[Low].Timestamp;--Low) {}
+    return Begin + Low;
+}
+
+// first entry after the ones of the track starting at Begin
+static const matroska_cue_entry *TrackCueEnd(const matroska_cue_entry *Begin, const matroska_cue_entry *End)
+{
+    size_t Low = 0, High = End - Begin, Mid;
+    while (Low < High)
+    {
+        Mid = (Low + High) / 2;
+        if (Begin[Mid].TrackNum == Begin->TrackNum)
+            Low = Mid + 1;
+        else
+            High = Mid;
+    }
+    return Begin + Low;
+}
+
+const matroska_cue_entry *MATROSKA_CueIndexFind(const matroska_cue_index *Index, mkv_timestamp_t Timestamp, uint16_t TrackNum)
+{
+    const matroska_cue_entry *Begin = ARRAYBEGIN(Index->Entries,matroska_cue_entry);
+    const matroska_cue_entry *End = ARRAYEND(Index->Entries,matroska_cue_entry);
+    const matroska_cue_entry *TrackEnd, *Entry, *Found = NULL, *First = NULL;
+    matroska_cue_entry Key;
+    bool_t Exists;
+
+    if (Begin == End || Timestamp == INVALID_TIMESTAMP_T)
+        return NULL;
+
+    if (TrackNum)
+    {
+        Key.TrackNum = TrackNum;
+        Key.Timestamp = INT64_MIN;
+        Key.ClusterPos = MIN_FILEPOS;
+        Begin += ArrayFind(&Index->Entries,matroska_cue_entry,&Key,CueEntryCmp,NULL,&Exists);
+        if (Begin == End || Begin->TrackNum != TrackNum)
+            return NULL;
+        return FindTrackCue(Begin, TrackCueEnd(Begin, End), Timestamp);
+    }
+
+    // the closest entry of all the tracks
+    for (;Begin != End;Begin = TrackEnd)
+    {
+        TrackEnd = TrackCueEnd(Begin, End);
+        if (!First || Begin->Timestamp < First->Timestamp || (Begin->Timestamp == First->Timestamp && Begin->ClusterPos < First->ClusterPos))
+            First = Begin;
+        Entry = FindTrackCue(Begin, TrackEnd, Timestamp);
+        if (Entry && (!Found || Entry->Timestamp > Found->Timestamp || (Entry->Timestamp == Found->Timestamp && Entry->ClusterPos < Found->ClusterPos)))
+            Found = Entry;
+    }
+    return Found ? Found : First;
+}
@@ -15,6 +15,9 @@
 #if defined(CONFIG_LZO1X)
 #include "minilzo.h"
 #endif
+#if defined(CONFIG_ZSTD)
+#include <zstd.h>
+#endif
 #include <corec/helpers/file/streams.h>
 #include <corec/str/str.h>
 #include <corec/helpers/parser/parser.h>
@@ -24,6 +27,9 @@ extern const nodemeta Matroska_Class[];
 ebml_context MATROSKA_ContextStream;
 ebml_semantic EBML_SemanticMatroska[3];
 static int MATROSKA_init_once = 0;
+#if defined(CONFIG_LZO1X)
+static bool_t LzoReady = 0;
+#endif
 
 const ebml_context *MATROSKA_getContextStream(void)
 {
@@ -45,16 +51,26 @@ err_t MATROSKA_Init(parsercontext *p)
             MATROSKA_init_once = 1;
 
             MATROSKA_InitSemantic();
+#if defined(CONFIG_LZO1X)
+            LzoReady = lzo_init() == LZO_E_OK;
+#endif
 
             EBML_SemanticMatroska[0] = (ebml_semantic){1, 0, EBML_getContextHead()        ,0};
             EBML_SemanticMatroska[1] = (ebml_semantic){1, 0, MATROSKA_getContextSegment() ,0};
             EBML_SemanticMatroska[2] = (ebml_semantic){0, 0, NULL                         ,0}; // end of the table
             MATROSKA_ContextStream = (ebml_context){FOURCC('M','K','X','_'), EBML_MASTER_CLASS, 0, 0, "Matroska Stream", EBML_SemanticMatroska, EBML_getSemanticGlobals()};
         }
+        // again after the index is freed by the last MATROSKA_Done()
+        EBML_ContextIndexSemantic(&MATROSKA_ContextStream);
     }
     return Err;
 }
 
+void MATROSKA_Done(parsercontext *p)
+{
+    EBML_Done(p);
+}
+
 
 #define MATROSKA_CUE_SEGMENTINFO     0x100
 #define MATROSKA_CUE_BLOCK           0x101
@@ -91,18 +107,159 @@ struct matroska_seekpoint
     ebml_element *Link;
 };
 
+// how the frames of a track are stored, resolved once and shared by all the blocks linked to the track
+typedef struct matroska_track_encoding
+{
+    err_t ReadErr;  // ERR_NONE when the frames can be decoded
+    err_t WriteErr; // ERR_NONE when the frames can be encoded
+    MatroskaTrackEncodingCompAlgo Algo; // MATROSKA_TRACK_ENCODING_COMP_NONE when the frames are stored as-is
+    const matroska_codec *Codec; // NULL when the frames are not compressed
+    MatroskaContentEncodingScope Scope;
+    const uint8_t *Strip; // the bytes removed from each frame with header stripping
+    size_t StripSize;
+    mkv_timestamp_t DefaultDuration;
+    double TimestampScale;
+    boolmem_t HasEncodings;
+    const void *ResolvedFor; // the track the values were resolved for, NULL when the track is edited
+} matroska_track_encoding;
+
+// decompression state kept by a track between its frames
+typedef struct matroska_track_decoder
+{
+    cc_spinlock Lock;
+    size_t Ratio; // running average of the decoded/encoded size ratio of the blocks, in 1/16th
+    void *State; // idle codec state, reset for each frame
+    const matroska_codec *StateCodec;
+} matroska_track_decoder;
+
 struct matroska_trackentry
 {
     ebml_master Base;
     MatroskaTrackEncodingCompAlgo CodecPrivateCompressionAlgo;
+    matroska_track_encoding Encoding;
+    matroska_track_decoder Decoder;
 };
 
+static void ResolveTrackEncoding(matroska_trackentry *Track)
+{
+    matroska_track_encoding *Encoding = &Track->Encoding;
+    ebml_element *Elt, *Elt2;
+
+    Encoding->ReadErr = ERR_NONE;
+    Encoding->WriteErr = ERR_NONE;
+    Encoding->Algo = MATROSKA_TRACK_ENCODING_COMP_NONE;
+    Encoding->Codec = NULL;
+    Encoding->Scope = MATROSKA_CONTENTENCODINGSCOPE_BLOCK;
+    Encoding->Strip = NULL;
+    Encoding->StripSize = 0;
+    Encoding->TimestampScale = MATROSKA_TrackTimestampScale((ebml_master*)Track);
+    Elt = EBML_MasterFindChild(Track, MATROSKA_getContextDefaultDuration());
+    Encoding->DefaultDuration = Elt ? EBML_IntegerValue((ebml_integer*)Elt) : INVALID_TIMESTAMP_T;
+
+    Elt = EBML_MasterFindChild(Track, MATROSKA_getContextContentEncodings());
+    Encoding->HasEncodings = Elt!=NULL;
+    if (Elt)
+        Elt = EBML_MasterFindChild((ebml_master*)Elt, MATROSKA_getContextContentEncoding());
+    if (Elt && EBML_MasterChildren(Elt))
+    {
+        if (EBML_MasterNext(Elt))
+        {
+            // TODO support cascaded compression/encryption
+            Encoding->ReadErr = ERR_NOT_SUPPORTED;
+            Encoding->WriteErr = ERR_INVALID_DATA;
+        }
+        else
+        {
+            Elt2 = EBML_MasterFindChild((ebml_master*)Elt, MATROSKA_getContextContentEncodingScope());
+            if (Elt2)
+                Encoding->Scope = (MatroskaContentEncodingScope)EBML_IntegerValue((ebml_integer*)Elt2);
+
+            Elt = EBML_MasterFindChild((ebml_master*)Elt, MATROSKA_getContextContentCompression());
+            if (!Elt)
+            {
+                // TODO: support encryption
+                Encoding->ReadErr = ERR_NOT_SUPPORTED;
+                Encoding->WriteErr = ERR_INVALID_DATA;
+            }
+            else
+            {
+                Elt2 = EBML_MasterFindChild((ebml_master*)Elt, MATROSKA_getContextContentCompAlgo());
+                Encoding->Algo = (MatroskaTrackEncodingCompAlgo)(Elt2 ? EBML_IntegerValue((ebml_integer*)Elt2) : MATROSKA_getContextContentCompAlgo()->DefaultValue);
+                if (Encoding->Algo == MATROSKA_TRACK_ENCODING_COMP_HEADERSTRIP)
+                {
+                    Elt2 = EBML_MasterFindChild((ebml_master*)Elt, MATROSKA_getContextContentCompSettings());
+                    if (!Elt2)
+                        Encoding->Algo = MATROSKA_TRACK_ENCODING_COMP_NONE; // nothing to strip
+                    else
+                    {
+                        Encoding->Strip = EBML_BinaryGetData((ebml_binary*)Elt2);
+                        Encoding->StripSize = (size_t)EBML_ElementDataSize(Elt2, 1);
+                    }
+                }
+                else if ((Encoding->Codec = MATROSKA_GetCodec(Encoding->Algo)) == NULL)
+                {
+                    Encoding->ReadErr = ERR_INVALID_DATA;
+                    Encoding->WriteErr = ERR_NOT_SUPPORTED;
+                }
+                else if (!Encoding->Codec->Encode)
+                    Encoding->WriteErr = ERR_NOT_SUPPORTED;
+            }
+        }
+    }
+    AtomicStorePtr(&Encoding->ResolvedFor, Track); // after all the values
+}
+
+static const matroska_track_encoding *TrackEncoding(ebml_master *Track)
+{
+    matroska_trackentry *Entry = (matroska_trackentry*)Track;
+    assert(Node_IsPartOf(Track, MATROSKA_TRACKENTRY_CLASS));
+    if (AtomicLoadPtr(&Entry->Encoding.ResolvedFor) != Entry)
+    {
+        // the blocks of the track may be used by several threads
+        SpinLock(&Entry->Decoder.Lock);
+        if (Entry->Encoding.ResolvedFor != Entry)
+            ResolveTrackEncoding(Entry);
+        SpinUnlock(&Entry->Decoder.Lock);
+    }
+    return &Entry->Encoding;
+}
+
+void MATROSKA_TrackEdited(matroska_trackentry *TrackEntry)
+{
+    assert(Node_IsPartOf(TrackEntry, MATROSKA_TRACKENTRY_CLASS));
+    AtomicStorePtr(&TrackEntry->Encoding.ResolvedFor, NULL);
+}
+
+// the encoding to undo when reading the frames of a block, MATROSKA_TRACK_ENCODING_COMP_NONE if they are stored as-is
+static MatroskaTrackEncodingCompAlgo BlockReadAlgo(const matroska_track_encoding *Encoding)
+{
+    if (Encoding->Algo != MATROSKA_TRACK_ENCODING_COMP_HEADERSTRIP && !(Encoding->Scope & MATROSKA_CONTENTENCODINGSCOPE_BLOCK))
+        return MATROSKA_TRACK_ENCODING_COMP_NONE;
+    return Encoding->Algo;
+}
+
+static void ReleaseCompressed(matroska_block *Block)
+{
+#if defined(CONFIG_EBML_WRITING)
+    ArrayClear(&Block->Compressed);
+    ArrayClear(&Block->CompressedSizeList);
+#endif
+}
+
 static err_t BlockTrackChanged(matroska_block *Block)
 {
     Block->Base.Base.bNeedDataSizeUpdate = 1;
     return ERR_NONE;
 }
 
+#if defined(CONFIG_EBML_WRITING)
+static err_t BlockWriteTrackChanged(matroska_block *Block)
+{
+    ReleaseCompressed(Block); // the encoding may be different
+    return BlockTrackChanged(Block);
+}
+#endif
+
 static err_t ClusterTimeChanged(matroska_cluster *Cluster)
 {
     mkv_timestamp_t ClusterTimestamp;
@@ -141,146 +298,479 @@ static err_t ClusterTimeChanged(matroska_cluster *Cluster)
     return ERR_NONE;
 }
 
+// expected size of the decoded frames of a block, a bit larger than usual so most blocks fit in one allocation
+static size_t DecodedSizeHint(matroska_track_decoder *Decoder, size_t InSize)
+{
+    size_t Ratio;
+    SpinLock(&Decoder->Lock);
+    Ratio = Decoder->Ratio;
+    SpinUnlock(&Decoder->Lock);
+    if (!Ratio)
+        Ratio = 4*16;
+    return InSize * Ratio / 16 + InSize / 8 + 256;
+}
+
+static void LearnDecodedSize(matroska_track_decoder *Decoder, size_t InSize, size_t OutSize)
+{
+    size_t Ratio;
+    if (!InSize)
+        return;
+    Ratio = OutSize * 16 / InSize;
+    SpinLock(&Decoder->Lock);
+    if (!Decoder->Ratio)
+        Decoder->Ratio = Ratio;
+    else
+        Decoder->Ratio = (Decoder->Ratio * 7 + Ratio) / 8;
+    SpinUnlock(&Decoder->Lock);
+}
+
 #if defined(CONFIG_ZLIB)
-err_t UnCompressFrameZLib(const uint8_t *Cursor, size_t CursorSize, array *OutBuf, size_t *FrameSize, size_t *ArrayOffset)
+// inflate a frame at ArrayOffset in OutBuf, the buffer grows from OutSize by doubling
+static err_t InflateFrame(void *State, const uint8_t *Cursor, size_t CursorSize, array *OutBuf, size_t OutSize, size_t *FrameSize, size_t *ArrayOffset)
 {
-    z_stream stream;
+    z_stream *Stream = State;
+    size_t Count = *ArrayOffset;
     int Res;
-    err_t Err = ERR_NONE;
 
-    memset(&stream,0,sizeof(stream));
-    Res = inflateInit(&stream);
-    if (Res != Z_OK)
-        Err = ERR_INVALID_DATA;
-    else
+    Stream->next_in = (Bytef*)Cursor;
+    Stream->avail_in = (uInt)CursorSize;
+    if (OutSize < 1024)
+        OutSize = 1024;
+    do {
+        if (!ArrayResize(OutBuf, Count + OutSize, 0))
+            return ERR_OUT_OF_MEMORY;
+        Stream->next_out = ARRAYBEGIN(*OutBuf,uint8_t) + Count;
+        Stream->avail_out = (uInt)OutSize;
+        Res = inflate(Stream, Z_NO_FLUSH);
+        Count = Stream->next_out - ARRAYBEGIN(*OutBuf,uint8_t);
+        OutSize = MAX(1024, Count - *ArrayOffset);
+    } while (Res==Z_OK && !Stream->avail_out);
+    *FrameSize = Stream->total_out;
+    *ArrayOffset = *ArrayOffset + Stream->total_out;
+    if (Res != Z_STREAM_END)
+        return ERR_INVALID_DATA;
+    return ERR_NONE;
+}
+
+static void *OpenInflate(void)
+{
+    z_stream *Stream = calloc(1,sizeof(z_stream));
+    if (Stream && inflateInit(Stream) != Z_OK)
     {
-        size_t Count;
-        stream.next_in = (Bytef*)Cursor;
-        stream.avail_in = CursorSize;
-        stream.next_out = ARRAYBEGIN(*OutBuf,uint8_t) + *ArrayOffset;
-        do {
-            Count = stream.next_out - ARRAYBEGIN(*OutBuf,uint8_t);
-            if (!ArrayResize(OutBuf, Count + 1024, 0))
-            {
-                Res = Z_MEM_ERROR;
-                break;
-            }
-            stream.avail_out = ARRAYCOUNT(*OutBuf,uint8_t) - Count;
-            stream.next_out = ARRAYBEGIN(*OutBuf,uint8_t) + Count;
-            Res = inflate(&stream, Z_NO_FLUSH);
-            if (Res!=Z_STREAM_END && Res!=Z_OK)
-                break;
-        } while (Res!=Z_STREAM_END && stream.avail_in && !stream.avail_out);
-        *FrameSize = stream.total_out;
-        *ArrayOffset = *ArrayOffset + stream.total_out;
-        inflateEnd(&stream);
-        if (Res != Z_STREAM_END)
-            Err = ERR_INVALID_DATA;
+        free(Stream);
+        Stream = NULL;
     }
-    return Err;
+    return Stream;
 }
 
-#if defined(CONFIG_EBML_WRITING)
-err_t CompressFrameZLib(const uint8_t *Cursor, size_t CursorSize, uint8_t **OutBuf, size_t *OutSize)
+static err_t ResetInflate(void *State)
+{
+    return inflateReset((z_stream*)State) == Z_OK ? ERR_NONE : ERR_INVALID_DATA;
+}
+
+static void CloseInflate(void *State)
+{
+    inflateEnd((z_stream*)State);
+    free(State);
+}
+
+static size_t BoundZLib(size_t InSize)
+{
+    return compressBound((uLong)InSize);
+}
+
+static err_t DeflateFrame(const uint8_t *In, size_t InSize, uint8_t *Out, size_t *OutSize)
+{
+    uLongf Size = (uLongf)*OutSize;
+    if (compress2(Out, &Size, In, (uLong)InSize, Z_BEST_COMPRESSION) != Z_OK)
+        return ERR_INVALID_DATA;
+    *OutSize = Size;
+    return ERR_NONE;
+}
+
+err_t UnCompressFrameZLib(const uint8_t *Cursor, size_t CursorSize, array *OutBuf, size_t *FrameSize, size_t *ArrayOffset)
 {
-    err_t Err = ERR_NONE;
     z_stream stream;
-    size_t Count;
-    array TmpBuf;
+    err_t Err;
+
+    memset(&stream,0,sizeof(stream));
+    if (inflateInit(&stream) != Z_OK)
+        return ERR_INVALID_DATA;
+    Err = InflateFrame(&stream, Cursor, CursorSize, OutBuf, 0, FrameSize, ArrayOffset);
+    inflateEnd(&stream);
+    return Err;
+}
+#endif // CONFIG_ZLIB
+
+#if defined(CONFIG_BZLIB)
+// bunzip a frame at ArrayOffset in OutBuf, bzip2 can't reset a stream so each frame gets a new one
+static err_t BunzipFrame(void *UNUSED_PARAM(State), const uint8_t *Cursor, size_t CursorSize, array *OutBuf, size_t OutSize, size_t *FrameSize, size_t *ArrayOffset)
+{
+    size_t Count = *ArrayOffset;
+    bz_stream stream;
     int Res;
 
     memset(&stream,0,sizeof(stream));
-    if (deflateInit(&stream, Z_BEST_COMPRESSION)!=Z_OK)
+    if (BZ2_bzDecompressInit(&stream, 0, 1) != BZ_OK)
         return ERR_INVALID_DATA;
-    stream.next_in = (Bytef*)Cursor;
-    stream.avail_in = CursorSize;
-    Count = 0;
-    ArrayInit(&TmpBuf);
-    stream.next_out = ARRAYBEGIN(TmpBuf,uint8_t);
+    stream.next_in = (char*)Cursor;
+    stream.avail_in = (unsigned int)CursorSize;
+    if (OutSize < 1024)
+        OutSize = 1024;
     do {
-        Count = stream.next_out - ARRAYBEGIN(TmpBuf,uint8_t);
-        if (!ArrayResize(&TmpBuf,CursorSize + Count,0))
+        if (!ArrayResize(OutBuf, Count + OutSize, 0))
         {
-            ArrayClear(&TmpBuf);
-            Err = ERR_OUT_OF_MEMORY;
+            Res = BZ_MEM_ERROR;
             break;
         }
-        stream.avail_out = ARRAYCOUNT(TmpBuf,uint8_t) - Count;
-        stream.next_out = ARRAYBEGIN(TmpBuf,uint8_t) + Count;
-        Res = deflate(&stream, Z_FINISH);
-    } while (stream.avail_out==0 && Res!=Z_STREAM_END);
-
-    if (OutBuf && OutSize)
-        // TODO: write directly in the output buffer
-        memcpy(*OutBuf, ARRAYBEGIN(TmpBuf,uint8_t), MIN(*OutSize, stream.total_out));
-    ArrayClear(&TmpBuf);
+        stream.next_out = ARRAYBEGIN(*OutBuf,char) + Count;
+        stream.avail_out = (unsigned int)OutSize;
+        Res = BZ2_bzDecompress(&stream);
+        Count = stream.next_out - ARRAYBEGIN(*OutBuf,char);
+        OutSize = MAX(1024, Count - *ArrayOffset);
+    } while (Res==BZ_OK && !stream.avail_out);
+    *FrameSize = stream.total_out_lo32;
+    *ArrayOffset = *ArrayOffset + stream.total_out_lo32;
+    BZ2_bzDecompressEnd(&stream);
+    if (Res == BZ_MEM_ERROR)
+        return ERR_OUT_OF_MEMORY;
+    if (Res != BZ_STREAM_END)
+        return ERR_INVALID_DATA;
+    return ERR_NONE;
+}
+#endif
 
-    if (OutSize)
-        *OutSize = stream.total_out;
+#if defined(CONFIG_LZO1X)
+// decode an LZO frame at ArrayOffset in OutBuf, the buffer doubles until the frame fits
+static err_t UnLzoFrame(void *UNUSED_PARAM(State), const uint8_t *Cursor, size_t CursorSize, array *OutBuf, size_t OutSize, size_t *FrameSize, size_t *ArrayOffset)
+{
+    lzo_uint Size;
+    int Res;
 
-    deflateEnd(&stream);
+    if (!LzoReady)
+        return ERR_INVALID_DATA;
+    if (OutSize < 2048)
+        OutSize = 2048;
+    for (;;)
+    {
+        if (!ArrayResize(OutBuf, *ArrayOffset + OutSize, 0))
+            return ERR_OUT_OF_MEMORY;
+        Size = OutSize;
+        Res = lzo1x_decompress_safe(Cursor, CursorSize, ARRAYBEGIN(*OutBuf,uint8_t) + *ArrayOffset, &Size, NULL);
+        if (Res != LZO_E_OUTPUT_OVERRUN || OutSize > CursorSize * 256)
+            break;
+        OutSize <<= 1;
+    }
+    if (Res != LZO_E_OK)
+        return ERR_INVALID_DATA;
+    *FrameSize = Size;
+    *ArrayOffset = *ArrayOffset + Size;
+    return ERR_NONE;
+}
+#endif
 
-    return Err;
+#if defined(CONFIG_ZSTD)
+#define ZSTD_FRAME_LEVEL 19 // the frames are decoded many more times than they are encoded
+
+// decode a zstd frame at ArrayOffset in OutBuf, the buffer grows by doubling when the frame doesn't tell its size
+static err_t UnZstdFrame(void *State, const uint8_t *Cursor, size_t CursorSize, array *OutBuf, size_t OutSize, size_t *FrameSize, size_t *ArrayOffset)
+{
+    unsigned long long ContentSize = ZSTD_getFrameContentSize(Cursor, CursorSize);
+    ZSTD_inBuffer In;
+    ZSTD_outBuffer Out;
+    size_t Count = 0, Res;
+
+    if (ContentSize == ZSTD_CONTENTSIZE_ERROR)
+        return ERR_INVALID_DATA;
+    if (ContentSize != ZSTD_CONTENTSIZE_UNKNOWN && ContentSize <= (unsigned long long)CursorSize * 1024)
+        OutSize = (size_t)ContentSize;
+    else if (OutSize < 1024)
+        OutSize = 1024;
+    In.src = Cursor;
+    In.size = CursorSize;
+    In.pos = 0;
+    do {
+        if (!ArrayResize(OutBuf, *ArrayOffset + Count + OutSize, 0))
+            return ERR_OUT_OF_MEMORY;
+        Out.dst = ARRAYBEGIN(*OutBuf,uint8_t) + *ArrayOffset;
+        Out.size = Count + OutSize;
+        Out.pos = Count;
+        Res = ZSTD_decompressStream((ZSTD_DCtx*)State, &Out, &In);
+        Count = Out.pos;
+        OutSize = MAX(1024, Count);
+    } while (!ZSTD_isError(Res) && Res != 0 && Out.pos == Out.size);
+    *FrameSize = Count;
+    *ArrayOffset = *ArrayOffset + Count;
+    if (Res != 0)
+        return ERR_INVALID_DATA; // error or truncated frame
+    return ERR_NONE;
 }
-#endif // CONFIG_EBML_WRITING
-#endif // CONFIG_ZLIB
 
-static err_t CheckCompression(matroska_block *Block, int ForProfile)
+static void *OpenZstd(void)
 {
-    ebml_master *Elt, *Header;
-    assert(Block->ReadTrack!=NULL);
-    Elt = (ebml_master*)EBML_MasterFindChild(Block->ReadTrack, MATROSKA_getContextContentEncodings());
-    if (Elt)
-    {
-        if (ARRAYCOUNT(Block->Data,uint8_t))
-            return ERR_INVALID_PARAM; // we cannot adjust sizes if the data are already read
+    return ZSTD_createDCtx();
+}
 
-        Elt = (ebml_master*)EBML_MasterFindChild(Elt, MATROSKA_getContextContentEncoding());
-        if (EBML_MasterChildren(Elt))
-        {
-            if (EBML_MasterNext(Elt))
-                return ERR_INVALID_DATA; // TODO support cascaded compression/encryption
+static err_t ResetZstd(void *State)
+{
+    return ZSTD_isError(ZSTD_DCtx_reset((ZSTD_DCtx*)State, ZSTD_reset_session_only)) ? ERR_INVALID_DATA : ERR_NONE;
+}
 
-            Elt = (ebml_master*)EBML_MasterFindChild(Elt, MATROSKA_getContextContentCompression());
-            if (!Elt)
-                return ERR_INVALID_DATA; // TODO: support encryption
+static void CloseZstd(void *State)
+{
+    ZSTD_freeDCtx((ZSTD_DCtx*)State);
+}
+
+static size_t BoundZstd(size_t InSize)
+{
+    return ZSTD_compressBound(InSize);
+}
 
-            Header = (ebml_master*)EBML_MasterGetChild(Elt, MATROSKA_getContextContentCompAlgo(), ForProfile);
-            MatroskaTrackEncodingCompAlgo CompressionAlgo = Header ? EBML_IntegerValue((ebml_integer*)Header) : MATROSKA_TRACK_ENCODING_COMP_NONE;
-            bool_t CanDecompress = 0;
-            if (CompressionAlgo == MATROSKA_TRACK_ENCODING_COMP_HEADERSTRIP)
-                CanDecompress = 1;
+static err_t ZstdFrame(const uint8_t *In, size_t InSize, uint8_t *Out, size_t *OutSize)
+{
+    size_t Res = ZSTD_compress(Out, *OutSize, In, InSize, ZSTD_FRAME_LEVEL);
+    if (ZSTD_isError(Res))
+        return ERR_INVALID_DATA;
+    *OutSize = Res;
+    return ERR_NONE;
+}
+#endif
+
+static const matroska_codec BuiltinCodecs[] = {
 #if defined(CONFIG_ZLIB)
-            else if (CompressionAlgo == MATROSKA_TRACK_ENCODING_COMP_ZLIB)
-                CanDecompress = 1;
+    {MATROSKA_TRACK_ENCODING_COMP_ZLIB,  OpenInflate, ResetInflate, CloseInflate, InflateFrame, BoundZLib, DeflateFrame},
+#endif
+#if defined(CONFIG_BZLIB)
+    {MATROSKA_TRACK_ENCODING_COMP_BZLIB, NULL, NULL, NULL, BunzipFrame, NULL, NULL},
 #endif
 #if defined(CONFIG_LZO1X)
-            else if (CompressionAlgo == MATROSKA_TRACK_ENCODING_COMP_LZO1X)
-                CanDecompress = 1;
+    {MATROSKA_TRACK_ENCODING_COMP_LZO1X, NULL, NULL, NULL, UnLzoFrame, NULL, NULL},
 #endif
-#if defined(CONFIG_BZLIB)
-            else if (CompressionAlgo == MATROSKA_TRACK_ENCODING_COMP_BZLIB)
-                CanDecompress = 1;
+#if defined(CONFIG_ZSTD)
+    {MATROSKA_TRACK_ENCODING_COMP_ZSTD,  OpenZstd, ResetZstd, CloseZstd, UnZstdFrame, BoundZstd, ZstdFrame},
 #endif
-            if (!CanDecompress)
-                return ERR_INVALID_DATA;
+    {MATROSKA_TRACK_ENCODING_COMP_NONE,  NULL, NULL, NULL, NULL, NULL, NULL}, // keeps the array non empty without any codec
+};
 
-            if (EBML_IntegerValue((ebml_integer*)Header)==MATROSKA_TRACK_ENCODING_COMP_HEADERSTRIP)
-            {
-                Header = (ebml_master*)EBML_MasterFindChild(Elt, MATROSKA_getContextContentCompSettings());
-                if (Header)
-                {
-                    uint32_t *i;
-                    for (i=ARRAYBEGIN(Block->SizeList,uint32_t);i!=ARRAYEND(Block->SizeList,uint32_t);++i)
-                        *i += (uint32_t)Header->Base.DataSize;
-                }
-            }
+#define MAX_REGISTERED_CODECS 8
+static const matroska_codec *RegisteredCodecs[MAX_REGISTERED_CODECS];
+static size_t RegisteredCodecCount = 0;
+
+err_t MATROSKA_RegisterCodec(const matroska_codec *Codec)
+{
+    size_t i;
+    if (!Codec || !Codec->Decode || (Codec->Open && !Codec->Close) || (Codec->Encode && !Codec->Bound) ||
+        Codec->Algo == MATROSKA_TRACK_ENCODING_COMP_NONE || Codec->Algo == MATROSKA_TRACK_ENCODING_COMP_HEADERSTRIP)
+        return ERR_INVALID_PARAM;
+    for (i=0;i<RegisteredCodecCount;++i)
+        if (RegisteredCodecs[i]->Algo == Codec->Algo)
+            break;
+    if (i == MAX_REGISTERED_CODECS)
+        return ERR_OUT_OF_MEMORY;
+    RegisteredCodecs[i] = Codec;
+    if (i == RegisteredCodecCount)
+        ++RegisteredCodecCount;
+    return ERR_NONE;
+}
+
+const matroska_codec *MATROSKA_GetCodec(MatroskaTrackEncodingCompAlgo Algo)
+{
+    const matroska_codec *Codec;
+    size_t i;
+    for (i=0;i<RegisteredCodecCount;++i)
+        if (RegisteredCodecs[i]->Algo == Algo)
+            return RegisteredCodecs[i];
+    for (Codec=BuiltinCodecs;Codec->Algo!=MATROSKA_TRACK_ENCODING_COMP_NONE;++Codec)
+        if (Codec->Algo == Algo)
+            return Codec;
+    return NULL;
+}
+
+// the idle state of the track if it's for the same codec, or a new one
+static err_t TakeCodecState(matroska_track_decoder *Decoder, const matroska_codec *Codec, void **State)
+{
+    *State = NULL;
+    if (!Codec->Open)
+        return ERR_NONE;
+    SpinLock(&Decoder->Lock);
+    if (Decoder->StateCodec == Codec)
+    {
+        *State = Decoder->State;
+        Decoder->State = NULL;
+    }
+    SpinUnlock(&Decoder->Lock);
+    if (!*State && (*State = Codec->Open()) == NULL)
+        return ERR_OUT_OF_MEMORY;
+    return ERR_NONE;
+}
+
+// keep the state for the next block, unless another thread already gave one back
+static void GiveCodecState(matroska_track_decoder *Decoder, const matroska_codec *Codec, void *State)
+{
+    const matroska_codec *OldCodec = NULL;
+    void *Old = NULL;
+    if (!State)
+        return;
+    SpinLock(&Decoder->Lock);
+    if (!Decoder->State || Decoder->StateCodec != Codec)
+    {
+        Old = Decoder->State;
+        OldCodec = Decoder->StateCodec;
+        Decoder->State = State;
+        Decoder->StateCodec = Codec;
+        State = NULL;
+    }
+    SpinUnlock(&Decoder->Lock);
+    if (State)
+        Codec->Close(State);
+    if (Old)
+        OldCodec->Close(Old);
+}
+
+// decode a single frame at ArrayOffset in OutBuf with a state of its own
+static err_t DecodeFrame(const matroska_codec *Codec, const uint8_t *Cursor, size_t CursorSize, array *OutBuf, size_t *FrameSize, size_t *ArrayOffset)
+{
+    void *State = NULL;
+    err_t Err;
+    if (Codec->Open && (State = Codec->Open()) == NULL)
+        return ERR_OUT_OF_MEMORY;
+    Err = Codec->Decode(State, Cursor, CursorSize, OutBuf, 0, FrameSize, ArrayOffset);
+    if (State)
+        Codec->Close(State);
+    return Err;
+}
+
+// encode a frame at the end of OutBuf
+static err_t AppendEncodedFrame(const matroska_codec *Codec, const uint8_t *Cursor, size_t CursorSize, array *OutBuf, size_t *OutSize)
+{
+    size_t Start = ARRAYCOUNT(*OutBuf,uint8_t), Size;
+    err_t Err;
+
+    if (OutSize)
+        *OutSize = 0;
+    if (!Codec->Encode)
+        return ERR_NOT_SUPPORTED;
+    Size = Codec->Bound(CursorSize);
+    if (!ArrayResize(OutBuf, Start + Size, 0))
+        return ERR_OUT_OF_MEMORY;
+    Err = Codec->Encode(Cursor, CursorSize, ARRAYBEGIN(*OutBuf,uint8_t) + Start, &Size);
+    if (Err != ERR_NONE)
+        Size = 0;
+    ArrayResize(OutBuf, Start + Size, 0);
+    if (OutSize)
+        *OutSize = Size;
+    return Err;
+}
+
+#if defined(CONFIG_EBML_WRITING) && defined(CONFIG_ZLIB)
+err_t CompressFrameZLib(const uint8_t *Cursor, size_t CursorSize, uint8_t **OutBuf, size_t *OutSize)
+{
+    err_t Err;
+    size_t Size = 0;
+    array TmpBuf;
+
+    ArrayInit(&TmpBuf);
+    Err = AppendEncodedFrame(MATROSKA_GetCodec(MATROSKA_TRACK_ENCODING_COMP_ZLIB), Cursor, CursorSize, &TmpBuf, &Size);
+    if (Err == ERR_NONE && OutBuf && OutSize)
+        memcpy(*OutBuf, ARRAYBEGIN(TmpBuf,uint8_t), MIN(*OutSize, Size));
+    ArrayClear(&TmpBuf);
+
+    if (OutSize)
+        *OutSize = Size;
+    return Err;
+}
+#endif
+
+// the frames are either read in Data or found directly in the input memory
+static const uint8_t *GetBlockData(const matroska_block *Block)
+{
+    return Block->MappedData ? Block->MappedData : ARRAYBEGIN(Block->Data,uint8_t);
+}
+
+static size_t GetBlockDataSize(const matroska_block *Block)
+{
+    return Block->MappedData ? Block->MappedSize : ARRAYCOUNT(Block->Data,uint8_t);
+}
+
+#if defined(CONFIG_EBML_WRITING)
+// encode the frames once, the result is used to compute the size and to render
+static err_t CompressBlockFrames(matroska_block *Block, const matroska_codec *Codec)
+{
+    const uint8_t *Data;
+    const int32_t *i;
+    int32_t Size;
+    size_t OutSize = 0;
+    err_t Err = ERR_NONE;
+
+    if (ARRAYCOUNT(Block->CompressedSizeList,int32_t) == ARRAYCOUNT(Block->SizeList,int32_t) && !ARRAYEMPTY(Block->SizeList))
+        return ERR_NONE;
+
+    ReleaseCompressed(Block);
+    Data = GetBlockData(Block);
+    for (i=ARRAYBEGIN(Block->SizeList,int32_t);Err==ERR_NONE && i!=ARRAYEND(Block->SizeList,int32_t);++i)
+    {
+        Err = AppendEncodedFrame(Codec, Data, *i, &Block->Compressed, &OutSize);
+        Size = (int32_t)OutSize;
+        if (Err==ERR_NONE && !ArrayAppend(&Block->CompressedSizeList,&Size,sizeof(Size),0))
+            Err = ERR_OUT_OF_MEMORY;
+        Data += *i;
+    }
+    if (Err != ERR_NONE)
+        ReleaseCompressed(Block);
+    return Err;
+}
+
+err_t MATROSKA_BlockEncodeFrames(matroska_block *Block)
+{
+    const matroska_track_encoding *Encoding;
+    if (!Block->WriteTrack || !Block->Base.Base.bValueIsSet || Block->CopyLocation != INVALID_FILEPOS_T)
+        return ERR_NONE;
+    Encoding = TrackEncoding(Block->WriteTrack);
+    if (Encoding->WriteErr != ERR_NONE || !Encoding->Codec || (Encoding->Scope & MATROSKA_CONTENTENCODINGSCOPE_BLOCK)==0)
+        return ERR_NONE;
+    return CompressBlockFrames(Block, Encoding->Codec);
+}
+
+bool_t MATROSKA_BlockSizeNeedsData(matroska_block *Block)
+{
+    const matroska_track_encoding *Encoding;
+    if (Block->CopyLocation != INVALID_FILEPOS_T)
+        return 0;
+    assert(Block->ReadTrack!=NULL);
+    Encoding = TrackEncoding(Block->ReadTrack);
+    if (Encoding->ReadErr != ERR_NONE || BlockReadAlgo(Encoding) != MATROSKA_TRACK_ENCODING_COMP_NONE)
+        return 1; // the stored sizes are not the frame sizes, or the block may not be readable
+    if (!Block->WriteTrack)
+        return 0;
+    Encoding = TrackEncoding(Block->WriteTrack);
+    return Encoding->WriteErr == ERR_NONE && Encoding->Codec && (Encoding->Scope & MATROSKA_CONTENTENCODINGSCOPE_BLOCK);
+}
+#endif
+
+static err_t CheckCompression(matroska_block *Block)
+{
+    const matroska_track_encoding *Encoding;
+    assert(Block->ReadTrack!=NULL);
+    Encoding = TrackEncoding(Block->ReadTrack);
+    if (Encoding->HasEncodings)
+    {
+        if (GetBlockDataSize(Block))
+            return ERR_INVALID_PARAM; // we cannot adjust sizes if the data are already read
+
+        if (Encoding->ReadErr != ERR_NONE)
+            return ERR_INVALID_DATA;
+
+        if (Encoding->Algo == MATROSKA_TRACK_ENCODING_COMP_HEADERSTRIP)
+        {
+            uint32_t *i;
+            for (i=ARRAYBEGIN(Block->SizeList,uint32_t);i!=ARRAYEND(Block->SizeList,uint32_t);++i)
+                *i += (uint32_t)Encoding->StripSize;
         }
     }
     return ERR_NONE;
 }
 
-err_t MATROSKA_LinkBlockWithReadTracks(matroska_block *Block, ebml_master *Tracks, bool_t UseForWriteToo, int ForProfile)
+err_t MATROSKA_LinkBlockWithReadTracks(matroska_block *Block, ebml_master *Tracks, bool_t UseForWriteToo, int UNUSED_PARAM(ForProfile))
 {
     ebml_element *Track;
     ebml_integer *TrackNum;
@@ -300,13 +790,13 @@ err_t MATROSKA_LinkBlockWithReadTracks(matroska_block *Block, ebml_master *Track
 #endif
             if (WasLinked)
                 return ERR_NONE;
-            return CheckCompression(Block, ForProfile);
+            return CheckCompression(Block);
         }
     }
     return ERR_INVALID_DATA;
 }
 
-err_t MATROSKA_LinkBlockReadTrack(matroska_block *Block, ebml_master *Track, bool_t UseForWriteToo, int ForProfile)
+err_t MATROSKA_LinkBlockReadTrack(matroska_block *Block, ebml_master *Track, bool_t UseForWriteToo, int UNUSED_PARAM(ForProfile))
 {
     ebml_integer *TrackNum;
     bool_t WasLinked = Block->ReadTrack!=NULL;
@@ -324,13 +814,13 @@ err_t MATROSKA_LinkBlockReadTrack(matroska_block *Block, ebml_master *Track, boo
 #endif
         if (WasLinked)
             return ERR_NONE;
-        return CheckCompression(Block, ForProfile);
+        return CheckCompression(Block);
     }
     return ERR_INVALID_DATA;
 }
 
 #if defined(CONFIG_EBML_WRITING)
-err_t MATROSKA_LinkBlockWithWriteTracks(matroska_block *Block, ebml_master *Tracks, int ForProfile)
+err_t MATROSKA_LinkBlockWithWriteTracks(matroska_block *Block, ebml_master *Tracks, int UNUSED_PARAM(ForProfile))
 {
     ebml_master *Track;
     ebml_integer *TrackNum;
@@ -346,13 +836,13 @@ err_t MATROSKA_LinkBlockWithWriteTracks(matroska_block *Block, ebml_master *Trac
             Node_SET(Block,MATROSKA_BLOCK_WRITE_TRACK,&Track);
             if (WasLinked)
                 return ERR_NONE;
-            return CheckCompression(Block, ForProfile);
+            return CheckCompression(Block);
         }
     }
     return ERR_INVALID_DATA;
 }
 
-err_t MATROSKA_LinkBlockWriteTrack(matroska_block *Block, ebml_master *Track, int ForProfile)
+err_t MATROSKA_LinkBlockWriteTrack(matroska_block *Block, ebml_master *Track, int UNUSED_PARAM(ForProfile))
 {
     ebml_integer *TrackNum;
     bool_t WasLinked = Block->WriteTrack!=NULL;
@@ -366,7 +856,7 @@ err_t MATROSKA_LinkBlockWriteTrack(matroska_block *Block, ebml_master *Track, in
         Node_SET(Block,MATROSKA_BLOCK_WRITE_TRACK,&Track);
         if (WasLinked)
             return ERR_NONE;
-        return CheckCompression(Block, ForProfile);
+        return CheckCompression(Block);
     }
     return ERR_INVALID_DATA;
 }
@@ -546,7 +1036,7 @@ err_t MATROSKA_LinkCueSegmentInfo(matroska_cuepoint *Cue, ebml_master *SegmentIn
 err_t MATROSKA_LinkCuePointBlock(matroska_cuepoint *CuePoint, matroska_block *Block)
 {
     assert(EBML_ElementIsType((ebml_element*)CuePoint, MATROSKA_getContextCuePoint()));
-    assert(Node_IsPartOf(Block,MATROSKA_BLOCK_CLASS));
+    assert(Block==NULL || Node_IsPartOf(Block,MATROSKA_BLOCK_CLASS)); // NULL releases the Block
     Node_SET(CuePoint,MATROSKA_CUE_BLOCK,&Block);
     return ERR_NONE;
 }
@@ -660,9 +1150,9 @@ err_t MATROSKA_BlockSetTimestamp(matroska_block *Block, mkv_timestamp_t Timestam
     assert(Node_IsPartOf(Block,MATROSKA_BLOCK_CLASS));
     assert(Timestamp!=INVALID_TIMESTAMP_T);
 #if defined(CONFIG_EBML_WRITING)
-    InternalTimestamp = Scale64(Timestamp - ClusterTimestamp,1,(int64_t)(MATROSKA_SegmentInfoTimestampScale(Block->WriteSegInfo) * MATROSKA_TrackTimestampScale(Block->WriteTrack)));
+    InternalTimestamp = Scale64(Timestamp - ClusterTimestamp,1,(int64_t)(MATROSKA_SegmentInfoTimestampScale(Block->WriteSegInfo) * TrackEncoding(Block->WriteTrack)->TimestampScale));
 #else
-    InternalTimestamp = Scale64(Timestamp - ClusterTimestamp,1,(int64_t)(MATROSKA_SegmentInfoTimestampScale(Block->ReadSegInfo) * MATROSKA_TrackTimestampScale(Block->ReadTrack)));
+    InternalTimestamp = Scale64(Timestamp - ClusterTimestamp,1,(int64_t)(MATROSKA_SegmentInfoTimestampScale(Block->ReadSegInfo) * TrackEncoding(Block->ReadTrack)->TimestampScale));
 #endif
     if (InternalTimestamp > 32767 || InternalTimestamp < -32768)
         return ERR_INVALID_DATA;
@@ -685,7 +1175,7 @@ mkv_timestamp_t MATROSKA_BlockTimestamp(matroska_block *Block)
         Cluster = EBML_ElementParent(Cluster);
     if (!Cluster)
         return INVALID_TIMESTAMP_T;
-    Block->GlobalTimestamp = MATROSKA_ClusterTimestamp((matroska_cluster*)Cluster) + (mkv_timestamp_t)(Block->LocalTimestamp * MATROSKA_SegmentInfoTimestampScale(Block->ReadSegInfo) * MATROSKA_TrackTimestampScale(Block->ReadTrack));
+    Block->GlobalTimestamp = MATROSKA_ClusterTimestamp((matroska_cluster*)Cluster) + (mkv_timestamp_t)(Block->LocalTimestamp * MATROSKA_SegmentInfoTimestampScale(Block->ReadSegInfo) * TrackEncoding(Block->ReadTrack)->TimestampScale);
     MATROSKA_BlockSetTimestamp(Block, Block->GlobalTimestamp, MATROSKA_ClusterTimestamp((matroska_cluster*)Cluster));
     return Block->GlobalTimestamp;
 }
@@ -697,6 +1187,14 @@ uint16_t MATROSKA_BlockTrackNum(const matroska_block *Block)
     return Block->TrackNumber;
 }
 
+mkv_timestamp_t MATROSKA_BlockDefaultDuration(const matroska_block *Block)
+{
+    assert(Node_IsPartOf(Block,MATROSKA_BLOCK_CLASS));
+    if (Block->ReadTrack==NULL)
+        return INVALID_TIMESTAMP_T;
+    return TrackEncoding(Block->ReadTrack)->DefaultDuration;
+}
+
 bool_t MATROSKA_BlockKeyframe(const matroska_block *Block)
 {
     ebml_master *BlockGroup;
@@ -792,6 +1290,30 @@ double MATROSKA_TrackTimestampScale(const ebml_master *Track)
     return ((ebml_float*)TimestampScale)->Value;
 }
 
+err_t MATROSKA_TrackSetTimestampScale(matroska_trackentry *TrackEntry, double Scale, int ForProfile)
+{
+    ebml_element *Elt;
+    assert(Node_IsPartOf(TrackEntry, MATROSKA_TRACKENTRY_CLASS));
+    Elt = EBML_MasterGetChild((ebml_master*)TrackEntry, MATROSKA_getContextTrackTimestampScale(), ForProfile);
+    if (!Elt)
+        return ERR_OUT_OF_MEMORY;
+    EBML_FloatSetValue((ebml_float*)Elt, Scale);
+    MATROSKA_TrackEdited(TrackEntry);
+    return ERR_NONE;
+}
+
+err_t MATROSKA_TrackSetDefaultDuration(matroska_trackentry *TrackEntry, mkv_timestamp_t Duration, int ForProfile)
+{
+    ebml_element *Elt;
+    assert(Node_IsPartOf(TrackEntry, MATROSKA_TRACKENTRY_CLASS));
+    Elt = EBML_MasterGetChild((ebml_master*)TrackEntry, MATROSKA_getContextDefaultDuration(), ForProfile);
+    if (!Elt)
+        return ERR_OUT_OF_MEMORY;
+    EBML_IntegerSetValue((ebml_integer*)Elt, Duration);
+    MATROSKA_TrackEdited(TrackEntry);
+    return ERR_NONE;
+}
+
 mkv_timestamp_t MATROSKA_CueTimestamp(const matroska_cuepoint *Cue)
 {
     ebml_integer *Timestamp;
@@ -937,6 +1459,9 @@ err_t MATROSKA_BlockReleaseData(matroska_block *Block, bool_t IncludingNotRead)
     if (!IncludingNotRead && Block->GlobalTimestamp==INVALID_TIMESTAMP_T)
         return ERR_NONE;
     ArrayClear(&Block->Data);
+    ReleaseCompressed(Block);
+    Block->MappedData = NULL;
+    Block->MappedSize = 0;
     Block->Base.Base.bValueIsSet = 0;
     if (ARRAYCOUNT(Block->SizeListIn,int32_t))
     {
@@ -953,197 +1478,110 @@ err_t MATROSKA_BlockReleaseData(matroska_block *Block, bool_t IncludingNotRead)
 err_t MATROSKA_BlockSkipToFrame(const matroska_block *Block, struct stream *Input, size_t FrameNum)
 {
     uint32_t *i;
-    filepos_t SeekPos = EBML_ElementPositionData((ebml_element*)Block);
+    filepos_t SeekPos = Block->FirstFrameLocation;
     if (FrameNum >= ARRAYCOUNT(Block->SizeList,uint32_t))
         return ERR_INVALID_PARAM;
-    if (Block->Lacing == LACING_NONE)
-        SeekPos += GetBlockHeadSize(Block);
-    else
-    {
-        SeekPos = Block->FirstFrameLocation;
-        for (i=ARRAYBEGIN(Block->SizeList,uint32_t);FrameNum;--FrameNum,++i)
-            SeekPos += *i;
-    }
+    for (i=ARRAYBEGIN(Block->SizeList,uint32_t);FrameNum;--FrameNum,++i)
+        SeekPos += *i;
     if (Stream_Seek(Input,SeekPos,SEEK_SET) != SeekPos)
         return ERR_READ;
     return ERR_NONE;
 }
 
-// TODO: support zero copy reading (read the frames directly into a buffer with a callback per frame)
-//       pass the Input stream and the amount to read per frame, give the timestamp of the frame and get the end timestamp in return, get an error code if reading failed
-err_t MATROSKA_BlockReadData(matroska_block *Element, struct stream *Input, int ForProfile)
+// decode the frames found in InBuf into Element->Data and set their decoded sizes
+static err_t DecodeBlockFrames(matroska_block *Element, const matroska_codec *Codec, const uint8_t *InBuf, size_t InSize)
+{
+    matroska_track_decoder *Decoder = &((matroska_trackentry*)Element->ReadTrack)->Decoder;
+    size_t FrameSize, OutSize = 0, Hint = DecodedSizeHint(Decoder, InSize);
+    int32_t *Size;
+    void *State;
+    err_t Err = TakeCodecState(Decoder, Codec, &State);
+
+    for (Size=ARRAYBEGIN(Element->SizeList,int32_t);Err==ERR_NONE && Size!=ARRAYEND(Element->SizeList,int32_t);++Size)
+    {
+        // what is left of the expected block size is reserved for the remaining frames
+        size_t FrameHint = OutSize < Hint ? Hint - OutSize : 0;
+        if (State && Codec->Reset)
+            Err = Codec->Reset(State);
+        if (Err == ERR_NONE)
+            Err = Codec->Decode(State, InBuf, *Size, &Element->Data, FrameHint, &FrameSize, &OutSize);
+        InBuf += *Size;
+        if (Err == ERR_NONE)
+            *Size = (int32_t)FrameSize;
+    }
+
+    GiveCodecState(Decoder, Codec, State);
+    ArrayResize(&Element->Data, OutSize, 0); // shrink the buffer
+    if (Err == ERR_NONE)
+        LearnDecodedSize(Decoder, InSize, OutSize);
+    return Err;
+}
+
+err_t MATROSKA_BlockReadData(matroska_block *Element, struct stream *Input, int UNUSED_PARAM(ForProfile))
 {
     size_t Read,BufSize;
     size_t NumFrame;
     err_t Err = ERR_NONE;
-    ebml_element *Elt, *Elt2, *Header = NULL;
+    const matroska_track_encoding *Encoding;
+    MatroskaTrackEncodingCompAlgo Algo;
+    const matroska_codec *Codec;
     uint8_t *InBuf;
-    MatroskaContentEncodingScope CompressionScope = MATROSKA_CONTENTENCODINGSCOPE_BLOCK;
+
+#if defined(CONFIG_EBML_WRITING)
+    if (!Element->Base.Base.bValueIsSet && Element->CopyLocation != INVALID_FILEPOS_T)
+    {
+        // the lacing and frames are written back untouched
+        if (!ArrayResize(&Element->Data,Element->CopySize,0))
+            return ERR_OUT_OF_MEMORY;
+        if (Stream_Seek(Input,Element->CopyLocation,SEEK_SET) != Element->CopyLocation)
+            return ERR_READ;
+        Err = Stream_Read(Input,ARRAYBEGIN(Element->Data,uint8_t),Element->CopySize,&Read);
+        if (Err == ERR_NONE && Read != Element->CopySize)
+            Err = ERR_READ;
+        if (Err == ERR_NONE)
+            Element->Base.Base.bValueIsSet = 1;
+        return Err;
+    }
+#endif
 
     if (!Element->Base.Base.bValueIsSet)
     {
         // find out if compressed headers are used
         assert(Element->ReadTrack!=NULL);
-        Elt = EBML_MasterFindChild(Element->ReadTrack, MATROSKA_getContextContentEncodings());
-        if (Elt)
-        {
-            Elt = EBML_MasterFindChild((ebml_master*)Elt, MATROSKA_getContextContentEncoding());
-            if (EBML_MasterChildren(Elt))
-            {
-                if (EBML_MasterNext(Elt))
-                    return ERR_NOT_SUPPORTED; // TODO support cascaded compression/encryption
-
-                Elt2 = EBML_MasterFindChild((ebml_master*)Elt, MATROSKA_getContextContentEncodingScope());
-                if (Elt2)
-                    CompressionScope = (int)EBML_IntegerValue((ebml_integer*)Elt2);
-
-                Elt = EBML_MasterFindChild((ebml_master*)Elt, MATROSKA_getContextContentCompression());
-                if (!Elt)
-                    return ERR_NOT_SUPPORTED; // TODO: support encryption
-
-                Header = EBML_MasterGetChild((ebml_master*)Elt, MATROSKA_getContextContentCompAlgo(),ForProfile);
-                MatroskaTrackEncodingCompAlgo CompressionAlgo = Header ? EBML_IntegerValue((ebml_integer*)Header) : MATROSKA_TRACK_ENCODING_COMP_NONE;
-                bool_t CanDecompress = 0;
-                if (CompressionAlgo == MATROSKA_TRACK_ENCODING_COMP_HEADERSTRIP)
-                    CanDecompress = 1;
-#if defined(CONFIG_ZLIB)
-                else if (CompressionAlgo == MATROSKA_TRACK_ENCODING_COMP_ZLIB)
-                    CanDecompress = 1;
-#endif
-#if defined(CONFIG_LZO1X)
-                else if (CompressionAlgo == MATROSKA_TRACK_ENCODING_COMP_LZO1X)
-                    CanDecompress = 1;
-#endif
-#if defined(CONFIG_BZLIB)
-                else if (CompressionAlgo == MATROSKA_TRACK_ENCODING_COMP_BZLIB)
-                    CanDecompress = 1;
-#endif
-                if (!CanDecompress)
-                    return ERR_INVALID_DATA;
-
-                if (EBML_IntegerValue((ebml_integer*)Header)==MATROSKA_TRACK_ENCODING_COMP_HEADERSTRIP)
-                    Header = EBML_MasterFindChild((ebml_master*)Elt, MATROSKA_getContextContentCompSettings());
-            }
-        }
-
-#if !defined(CONFIG_ZLIB) && !defined(CONFIG_LZO1X) && !defined(CONFIG_BZLIB)
-        if (Header && Header->Context==MATROSKA_getContextContentCompAlgo())
-            return ERR_NOT_SUPPORTED;
-#endif
-
-        if (Header && Header->Context==MATROSKA_getContextContentCompAlgo() && !(CompressionScope & MATROSKA_CONTENTENCODINGSCOPE_BLOCK))
-            Header = NULL;
+        Encoding = TrackEncoding(Element->ReadTrack);
+        if (Encoding->ReadErr != ERR_NONE)
+            return Encoding->ReadErr;
+        Algo = BlockReadAlgo(Encoding);
+        Codec = Algo != MATROSKA_TRACK_ENCODING_COMP_NONE ? Encoding->Codec : NULL;
 
         Stream_Seek(Input,Element->FirstFrameLocation,SEEK_SET);
-        if (Header)
+        if (Algo != MATROSKA_TRACK_ENCODING_COMP_NONE)
             ArrayCopy(&Element->SizeListIn, &Element->SizeList);
         switch (Element->Lacing)
         {
         case LACING_NONE:
-#if defined(CONFIG_ZLIB) || defined(CONFIG_LZO1X) || defined(CONFIG_BZLIB)
-            if (Header && Header->Context==MATROSKA_getContextContentCompAlgo())
+            if (Codec)
             {
-                // zlib handling, read the buffer in temp memory
+                // compressed frame, read the buffer in temp memory
                 array TmpBuf;
                 ArrayInit(&TmpBuf);
                 if (!ArrayResize(&TmpBuf,(size_t)ARRAYBEGIN(Element->SizeList,int32_t)[0],0))
                     Err = ERR_OUT_OF_MEMORY;
-                InBuf = ARRAYBEGIN(TmpBuf,uint8_t);
-                Err = Stream_Read(Input,InBuf,(size_t)ARRAYBEGIN(Element->SizeList,int32_t)[0],&Read);
-                if (Err==ERR_NONE)
+                else
                 {
-                    if (Read!=(size_t)ARRAYBEGIN(Element->SizeList,int32_t)[0])
-                        Err = ERR_READ;
-                    else
+                    InBuf = ARRAYBEGIN(TmpBuf,uint8_t);
+                    Err = Stream_Read(Input,InBuf,(size_t)ARRAYBEGIN(Element->SizeList,int32_t)[0],&Read);
+                    if (Err==ERR_NONE)
                     {
-#if defined(CONFIG_ZLIB)
-                        if (EBML_IntegerValue((ebml_integer*)Header)==MATROSKA_TRACK_ENCODING_COMP_ZLIB)
-                        {
-                            size_t UncompressedSize;
-                            size_t Offset = 0;
-                            Err = UnCompressFrameZLib(InBuf, ARRAYBEGIN(Element->SizeList,int32_t)[0], &Element->Data, &UncompressedSize, &Offset);
-                            if (Err == ERR_NONE)
-                            {
-                                ArrayResize(&Element->Data, UncompressedSize, 0);
-                                ARRAYBEGIN(Element->SizeList,int32_t)[0] = UncompressedSize;
-                            }
-                        }
-#endif
-#if defined(CONFIG_LZO1X)
-                        if (EBML_IntegerValue((ebml_integer*)Header)==MATROSKA_TRACK_ENCODING_COMP_LZO1X)
-                        {
-                            if (lzo_init() != LZO_E_OK)
-                                Err = ERR_INVALID_DATA;
-                            else
-                            {
-                                lzo_uint outSize = MAX(2048, ARRAYBEGIN(Element->SizeList,int32_t)[0] << 2);
-                                if (!ArrayResize(&Element->Data, outSize, 0))
-                                    Err = ERR_OUT_OF_MEMORY;
-                                else
-                                {
-                                    if (lzo1x_decompress_safe(InBuf, ARRAYBEGIN(Element->SizeList,int32_t)[0], ARRAYBEGIN(Element->Data,uint8_t), &outSize, NULL) != LZO_E_OK)
-                                        Err = ERR_INVALID_DATA;
-                                    else
-                                    {
-                                        ARRAYBEGIN(Element->SizeList,int32_t)[0] = outSize;
-                                        ArrayResize(&Element->Data,outSize,0);
-                                    }
-                                }
-                            }
-                        }
-#endif
-#if defined(CONFIG_BZLIB)
-                        if (EBML_IntegerValue((ebml_integer*)Header)==MATROSKA_TRACK_ENCODING_COMP_BZLIB)
-                        {
-                            unsigned int outSize = ARRAYBEGIN(Element->SizeList,int32_t)[0] << 2;
-                            bz_stream strm;
-                            int Res;
-
-                            if (!ArrayResize(&Element->Data, outSize, 0))
-                                Err = ERR_OUT_OF_MEMORY;
-                            else
-                            {
-                               strm.bzalloc = NULL;
-                               strm.bzfree = NULL;
-                               strm.opaque = NULL;
-                               if (BZ2_bzDecompressInit (&strm, 0, 1) != BZ_OK)
-                                   Err = ERR_INVALID_DATA;
-                               else
-                               {
-                                    size_t Count = 0;
-                                    strm.next_in = (char*)InBuf;
-                                    strm.avail_in = ARRAYBEGIN(Element->SizeList,int32_t)[0];
-                                    strm.next_out = ARRAYBEGIN(Element->Data,char);
-                                    strm.avail_out = 0;
-
-                                    do {
-                                        Count = strm.next_out - ARRAYBEGIN(Element->Data,char);
-                                        strm.avail_out = 1024;
-                                        if (!ArrayResize(&Element->Data, Count + strm.avail_out, 0))
-                                        {
-                                            Res = BZ_MEM_ERROR;
-                                            break;
-                                        }
-                                        strm.next_out = ARRAYBEGIN(Element->Data,char) + Count;
-                                        Res = BZ2_bzDecompress(&strm);
-                                        if (Res!=BZ_STREAM_END && Res!=BZ_OK)
-                                            break;
-                                    } while (Res!=BZ_STREAM_END && strm.avail_in && !strm.avail_out);
-                                    ArrayResize(&Element->Data, strm.total_out_lo32, 0);
-                                    ARRAYBEGIN(Element->SizeList,int32_t)[0] = strm.total_out_lo32;
-                                    BZ2_bzDecompressEnd(&strm);
-                                    if (Res != BZ_STREAM_END)
-                                        Err = ERR_INVALID_DATA;
-                                }
-                            }
-                        }
-#endif
+                        if (Read!=(size_t)ARRAYBEGIN(Element->SizeList,int32_t)[0])
+                            Err = ERR_READ;
+                        else
+                            Err = DecodeBlockFrames(Element, Codec, InBuf, Read);
                     }
                 }
                 ArrayClear(&TmpBuf);
             }
             else
-#endif
             {
                 if (!ArrayResize(&Element->Data,(size_t)ARRAYBEGIN(Element->SizeList,int32_t)[0],0))
                 {
@@ -1151,15 +1589,15 @@ err_t MATROSKA_BlockReadData(matroska_block *Element, struct stream *Input, int
                     goto failed;
                 }
                 InBuf = ARRAYBEGIN(Element->Data,uint8_t);
-                if (Header)
+                if (Algo == MATROSKA_TRACK_ENCODING_COMP_HEADERSTRIP)
                 {
-                    memcpy(InBuf,ARRAYBEGIN(((ebml_binary*)Header)->Data,uint8_t),(size_t)EBML_ElementDataSize(Header, 1));
-                    InBuf += (size_t)EBML_ElementDataSize(Header, 1);
+                    memcpy(InBuf,Encoding->Strip,Encoding->StripSize);
+                    InBuf += Encoding->StripSize;
                 }
-                Err = Stream_Read(Input,InBuf,(size_t)(ARRAYBEGIN(Element->SizeList,int32_t)[0] - (Header?EBML_ElementDataSize(Header, 1):0)),&Read);
+                Err = Stream_Read(Input,InBuf,(size_t)(ARRAYBEGIN(Element->SizeList,int32_t)[0] - Encoding->StripSize),&Read);
                 if (Err != ERR_NONE)
                     goto failed;
-                if (Read + (Header?EBML_ElementDataSize(Header, 1):0) != (size_t)ARRAYBEGIN(Element->SizeList,int32_t)[0])
+                if (Read + Encoding->StripSize != (size_t)ARRAYBEGIN(Element->SizeList,int32_t)[0])
                 {
                     Err = ERR_READ;
                     goto failed;
@@ -1173,14 +1611,11 @@ err_t MATROSKA_BlockReadData(matroska_block *Element, struct stream *Input, int
             BufSize = 0;
             for (NumFrame=0;NumFrame<ARRAYCOUNT(Element->SizeList,int32_t);++NumFrame)
                 BufSize += ARRAYBEGIN(Element->SizeList,int32_t)[NumFrame];
-#if defined(CONFIG_ZLIB) || defined(CONFIG_LZO1X) || defined(CONFIG_BZLIB)
-            if (Header && Header->Context==MATROSKA_getContextContentCompAlgo())
+            if (Codec)
             {
-                // zlib handling, read the buffer in temp memory
+                // compressed frames, read the buffer in temp memory
                 // get the ouput size, adjust the Element->SizeList value, write in Element->Data
                 array TmpBuf;
-                int32_t FrameSize;
-                size_t OutSize = 0;
 
                 ArrayInit(&TmpBuf);
                 if (!ArrayResize(&TmpBuf,BufSize,0))
@@ -1197,96 +1632,17 @@ err_t MATROSKA_BlockReadData(matroska_block *Element, struct stream *Input, int
                     ArrayClear(&TmpBuf);
                     goto failed;
                 }
-                size_t Offset = 0;
-                for (NumFrame=0;Err==ERR_NONE && NumFrame<ARRAYCOUNT(Element->SizeList,int32_t);++NumFrame)
-                {
-                    FrameSize = ARRAYBEGIN(Element->SizeList,int32_t)[NumFrame];
-#if defined(CONFIG_ZLIB)
-                    if (EBML_IntegerValue((ebml_integer*)Header)==MATROSKA_TRACK_ENCODING_COMP_ZLIB)
-                    {
-                        size_t UncompressedSize;
-                        Err = UnCompressFrameZLib(InBuf, FrameSize, &Element->Data, &UncompressedSize, &Offset);
-                        if (Err == ERR_NONE)
-                        {
-                            OutSize += UncompressedSize;
-                            ARRAYBEGIN(Element->SizeList,int32_t)[NumFrame] = UncompressedSize;
-                        }
-                    }
-#endif
-#if defined(CONFIG_LZO1X)
-                    if (EBML_IntegerValue((ebml_integer*)Header)==MATROSKA_TRACK_ENCODING_COMP_LZO1X)
-                    {
-                        if (lzo_init() != LZO_E_OK)
-                            Err = ERR_INVALID_DATA;
-                        else
-                        {
-                            lzo_uint outSize = MAX(2048, ARRAYBEGIN(Element->SizeList,int32_t)[NumFrame] << 2);
-                            if (!ArrayResize(&Element->Data, OutSize + outSize, 0))
-                                Err = ERR_OUT_OF_MEMORY;
-                            else
-                            {
-                                if (lzo1x_decompress_safe(InBuf, FrameSize, ARRAYBEGIN(Element->Data,uint8_t) + OutSize, &outSize, NULL) != LZO_E_OK)
-                                    Err = ERR_INVALID_DATA;
-                                else
-                                {
-                                    OutSize += outSize;
-                                    ARRAYBEGIN(Element->SizeList,int32_t)[NumFrame] = outSize;
-                                    ArrayResize(&Element->Data,OutSize,0);
-                                }
-                            }
-                        }
-                    }
-#endif
-#if defined(CONFIG_BZLIB)
-                    if (EBML_IntegerValue((ebml_integer*)Header)==MATROSKA_TRACK_ENCODING_COMP_BZLIB)
-                    {
-                        bz_stream stream;
-                        int Res;
-                        memset(&stream,0,sizeof(stream));
-                        Res = BZ2_bzDecompressInit (&stream, 0, 1);
-                        if (Res != BZ_OK)
-                            Err = ERR_INVALID_DATA;
-                        else
-                        {
-                            size_t Count;
-                            stream.next_in = (char*)InBuf;
-                            stream.avail_in = FrameSize;
-                            stream.next_out = ARRAYBEGIN(Element->Data,char) + OutSize;
-                            do {
-                                Count = stream.next_out - ARRAYBEGIN(Element->Data,char);
-                                if (!ArrayResize(&Element->Data, Count + 1024, 0))
-                                {
-                                    Res = BZ_MEM_ERROR;
-                                    break;
-                                }
-                                stream.avail_out = ARRAYCOUNT(Element->Data,uint8_t) - Count;
-                                stream.next_out = ARRAYBEGIN(Element->Data,char) + Count;
-                                Res = BZ2_bzDecompress(&stream);
-                                if (Res!=BZ_STREAM_END && Res!=BZ_OK)
-                                    break;
-                            } while (Res!=BZ_STREAM_END && stream.avail_in && !stream.avail_out);
-                            ARRAYBEGIN(Element->SizeList,int32_t)[NumFrame] = stream.total_out_lo32;
-                            OutSize += stream.total_out_lo32;
-                            BZ2_bzDecompressEnd(&stream);
-                            if (Res != BZ_STREAM_END)
-                                Err = ERR_INVALID_DATA;
-                        }
-                    }
-#endif
-                    InBuf += FrameSize;
-                }
-                ArrayResize(&Element->Data, OutSize, 0); // shrink the buffer
+                Err = DecodeBlockFrames(Element, Codec, InBuf, BufSize);
                 ArrayClear(&TmpBuf);
             }
             else
-#endif
             {
                 if (!ArrayResize(&Element->Data,BufSize,0))
                 {
                     Err = ERR_OUT_OF_MEMORY;
                     goto failed;
                 }
-                if (!Header)
+                if (Algo != MATROSKA_TRACK_ENCODING_COMP_HEADERSTRIP)
                 {
                     //assert(BufSize + Element->FirstFrameLocation == Element->Base.Base.DataSize);
                     Err = Stream_Read(Input,ARRAYBEGIN(Element->Data,uint8_t),BufSize,&BufSize);
@@ -1296,9 +1652,9 @@ err_t MATROSKA_BlockReadData(matroska_block *Element, struct stream *Input, int
                     InBuf = ARRAYBEGIN(Element->Data,uint8_t);
                     for (NumFrame=0;NumFrame<ARRAYCOUNT(Element->SizeList,int32_t);++NumFrame)
                     {
-                        memcpy(InBuf,ARRAYBEGIN(((ebml_binary*)Header)->Data,uint8_t),(size_t)EBML_ElementDataSize(Header, 1));
-                        InBuf += (size_t)EBML_ElementDataSize(Header, 1);
-                        Read = ARRAYBEGIN(Element->SizeList,int32_t)[NumFrame] - (int32_t)EBML_ElementDataSize(Header, 1);
+                        memcpy(InBuf,Encoding->Strip,Encoding->StripSize);
+                        InBuf += Encoding->StripSize;
+                        Read = ARRAYBEGIN(Element->SizeList,int32_t)[NumFrame] - (int32_t)Encoding->StripSize;
                         BufSize = Read;
                         assert(InBuf + Read <= ARRAYEND(Element->Data,uint8_t));
                         Err = Stream_Read(Input,InBuf,BufSize,&Read);
@@ -1329,6 +1685,89 @@ failed:
     return Err;
 }
 
+err_t MATROSKA_BlockMapData(matroska_block *Element, struct stream *Input, int ForProfile)
+{
+    const matroska_track_encoding *Encoding;
+    filepos_t Offset, Length;
+    const uint8_t *Ptr;
+    size_t NumFrame, BufSize = 0;
+
+    if (Element->Base.Base.bValueIsSet || !Node_IsPartOf(Input,MEMSTREAM_CLASS))
+        return MATROSKA_BlockReadData(Element, Input, ForProfile);
+
+    Node_GET(Input,MEMSTREAM_OFFSET,&Offset);
+    Node_GET(Input,MEMSTREAM_PTR,&Ptr);
+    Node_GET(Input,STREAM_LENGTH,&Length);
+
+#if defined(CONFIG_EBML_WRITING)
+    if (Element->CopyLocation != INVALID_FILEPOS_T)
+    {
+        if (Element->CopyLocation < Offset || Element->CopyLocation - Offset + (filepos_t)Element->CopySize > Length)
+            return ERR_READ;
+        Element->MappedData = Ptr + (size_t)(Element->CopyLocation - Offset);
+        Element->MappedSize = Element->CopySize;
+        Stream_Seek(Input,Element->CopyLocation + Element->CopySize,SEEK_SET);
+        Element->Base.Base.bValueIsSet = 1;
+        return ERR_NONE;
+    }
+#endif
+
+    assert(Element->ReadTrack!=NULL);
+    Encoding = TrackEncoding(Element->ReadTrack);
+    if (Encoding->ReadErr != ERR_NONE)
+        return Encoding->ReadErr;
+    if (BlockReadAlgo(Encoding) != MATROSKA_TRACK_ENCODING_COMP_NONE)
+        return MATROSKA_BlockReadData(Element, Input, ForProfile); // the frames need to be rebuilt in memory
+
+    for (NumFrame=0;NumFrame<ARRAYCOUNT(Element->SizeList,int32_t);++NumFrame)
+        BufSize += ARRAYBEGIN(Element->SizeList,int32_t)[NumFrame];
+
+    if (Element->FirstFrameLocation < Offset || Element->FirstFrameLocation - Offset + (filepos_t)BufSize > Length)
+        return ERR_READ;
+
+    Element->MappedData = Ptr + (size_t)(Element->FirstFrameLocation - Offset);
+    Element->MappedSize = BufSize;
+    Stream_Seek(Input,Element->FirstFrameLocation + BufSize,SEEK_SET);
+    Element->Base.Base.bValueIsSet = 1;
+
+#if defined(CONFIG_EBML_WRITING)
+    if (Element->ReadTrack != Element->WriteTrack || Element->ReadSegInfo != Element->WriteSegInfo)
+        // TODO: only if the track compression/timestamp scale is different
+        Element->Base.Base.bNeedDataSizeUpdate = 1;
+#endif
+    return ERR_NONE;
+}
+
+#if defined(CONFIG_EBML_WRITING)
+bool_t MATROSKA_BlockCopyData(matroska_block *Block)
+{
+    const matroska_track_encoding *ReadEncoding, *WriteEncoding;
+    MatroskaTrackEncodingCompAlgo Algo;
+
+    if (Block->CopyLocation != INVALID_FILEPOS_T)
+        return 1;
+    if (Block->Base.Base.bValueIsSet || Block->Lacing == LACING_AUTO || !Block->ReadHeadSize || !Block->ReadTrack || !Block->WriteTrack)
+        return 0; // the frames are already decoded or not read from a file
+
+    ReadEncoding = TrackEncoding(Block->ReadTrack);
+    WriteEncoding = TrackEncoding(Block->WriteTrack);
+    if (ReadEncoding->ReadErr != ERR_NONE || WriteEncoding->WriteErr != ERR_NONE)
+        return 0;
+    Algo = BlockReadAlgo(ReadEncoding);
+    if (Algo != BlockReadAlgo(WriteEncoding))
+        return 0;
+    if (Algo == MATROSKA_TRACK_ENCODING_COMP_HEADERSTRIP &&
+        (ReadEncoding->StripSize != WriteEncoding->StripSize || memcmp(ReadEncoding->Strip,WriteEncoding->Strip,ReadEncoding->StripSize)!=0))
+        return 0;
+
+    // only the block head is written again, the track number and timestamp may change,
+    // the track number of the input may not have the same size
+    Block->CopyLocation = EBML_ElementPositionData((ebml_element*)Block) + Block->ReadHeadSize;
+    Block->CopySize = (size_t)(EBML_ElementDataSize((ebml_element*)Block, 1) - Block->ReadHeadSize);
+    return 1;
+}
+#endif
+
 static err_t SetBlockParent(matroska_block *Block, void* Parent, void* Before)
 {
     // update the timestamp
@@ -1428,6 +1867,7 @@ static err_t ReadBlockData(matroska_block *Element, struct stream *Input, const
     Element->Lacing = (*cursor++ & 0x06) >> 1;
 
     Element->FirstFrameLocation = EBML_ElementPositionData((ebml_element*)Element) + BlockHeadSize;
+    Element->ReadHeadSize = BlockHeadSize;
 
     if (cursor == &_TempHead[4])
         _TempHead[0] = _TempHead[4];
@@ -1523,6 +1963,31 @@ failed:
     return Result;
 }
 
+// size of the lacing at the start of the data copied as-is, the frames follow it
+static size_t CopiedLaceSize(const matroska_block *Block)
+{
+#if defined(CONFIG_EBML_WRITING)
+    if (Block->CopyLocation != INVALID_FILEPOS_T)
+        return (size_t)(Block->FirstFrameLocation - Block->CopyLocation);
+#endif
+    return 0;
+}
+
+// the data copied as-is hold the frames as stored, not usable as frames when they are encoded
+static bool_t CopiedFramesEncoded(const matroska_block *Block)
+{
+#if defined(CONFIG_EBML_WRITING)
+    const matroska_track_encoding *Encoding;
+    if (Block->CopyLocation != INVALID_FILEPOS_T)
+    {
+        assert(Block->ReadTrack!=NULL);
+        Encoding = TrackEncoding(Block->ReadTrack);
+        return Encoding->ReadErr != ERR_NONE || BlockReadAlgo(Encoding) != MATROSKA_TRACK_ENCODING_COMP_NONE;
+    }
+#endif
+    return 0;
+}
+
 bool_t MATROSKA_BlockIsKeyframe(const matroska_block *Block)
 {
     return Block->IsKeyframe;
@@ -1533,12 +1998,14 @@ err_t MATROSKA_BlockGetFrame(const matroska_block *Block, size_t FrameNum, matro
     size_t i;
 
     assert(!WithData || Block->Base.Base.bValueIsSet);
-    if (WithData && !ARRAYCOUNT(Block->Data,uint8_t))
+    if (WithData && !GetBlockDataSize(Block))
         return ERR_READ;
     if (FrameNum >= ARRAYCOUNT(Block->SizeList,uint32_t))
         return ERR_INVALID_PARAM;
+    if (WithData && CopiedFramesEncoded(Block))
+        return ERR_NOT_SUPPORTED;
 
-    Frame->Data = WithData ? ARRAYBEGIN(Block->Data,uint8_t) : NULL;
+    Frame->Data = WithData ? (uint8_t*)GetBlockData(Block) + CopiedLaceSize(Block) : NULL;
     Frame->Timestamp = MATROSKA_BlockTimestamp((matroska_block*)Block);
     for (i=0;i<FrameNum;++i)
     {
@@ -1562,8 +2029,28 @@ err_t MATROSKA_BlockGetFrame(const matroska_block *Block, size_t FrameNum, matro
 
 err_t MATROSKA_BlockAppendFrame(matroska_block *Block, const matroska_frame *Frame, mkv_timestamp_t ClusterTimestamp)
 {
+    if (Block->Base.Base.bValueIsSet && CopiedFramesEncoded(Block))
+        return ERR_NOT_SUPPORTED; // the frames read can't be mixed with the new one
     if (!Block->Base.Base.bValueIsSet && Frame->Timestamp!=INVALID_TIMESTAMP_T)
         MATROSKA_BlockSetTimestamp(Block,Frame->Timestamp,ClusterTimestamp);
+    if (Block->MappedData)
+    {
+        // the data are modified, they can't stay in the input memory
+        if (!ArrayAppend(&Block->Data,Block->MappedData,Block->MappedSize,0))
+            return ERR_OUT_OF_MEMORY;
+        Block->MappedData = NULL;
+        Block->MappedSize = 0;
+    }
+#if defined(CONFIG_EBML_WRITING)
+    if (Block->CopyLocation != INVALID_FILEPOS_T)
+    {
+        // the lacing is built again with the new frame
+        if (Block->Base.Base.bValueIsSet)
+            ArrayDelete(&Block->Data,0,CopiedLaceSize(Block));
+        Block->CopyLocation = INVALID_FILEPOS_T;
+    }
+#endif
+    ReleaseCompressed(Block);
     ArrayAppend(&Block->Data,Frame->Data,Frame->Size,0);
     ArrayAppend(&Block->Durations,&Frame->Duration,sizeof(Frame->Duration),0);
     ArrayAppend(&Block->SizeList,&Frame->Size,sizeof(Frame->Size),0);
@@ -1574,49 +2061,35 @@ err_t MATROSKA_BlockAppendFrame(matroska_block *Block, const matroska_frame *Fra
 }
 
 
-static filepos_t GetBlockFrameSize(const matroska_block *Element, size_t Frame, const ebml_element *Header,
-                                   MatroskaTrackEncodingCompAlgo CompAlgo, MatroskaContentEncodingScope CompScope)
+static filepos_t GetBlockFrameSize(matroska_block *Element, size_t Frame, const matroska_track_encoding *Encoding)
 {
     if (Frame >= ARRAYCOUNT(Element->SizeList,int32_t))
         return 0;
 
-    if (!Header || (CompScope & MATROSKA_CONTENTENCODINGSCOPE_BLOCK)==0)
+    if (!Encoding || Encoding->Algo==MATROSKA_TRACK_ENCODING_COMP_NONE || (Encoding->Scope & MATROSKA_CONTENTENCODINGSCOPE_BLOCK)==0)
         return ARRAYBEGIN(Element->SizeList,int32_t)[Frame];
-    if (Header->Context==MATROSKA_getContextContentCompAlgo())
+    if (Encoding->Algo!=MATROSKA_TRACK_ENCODING_COMP_HEADERSTRIP)
     {
         assert(Element->Base.Base.bValueIsSet);
         if (!Element->Base.Base.bValueIsSet)
             return ARRAYBEGIN(Element->SizeList,int32_t)[Frame]; // we can't tell the final size without decoding the data
 
-        // skip previous frames data
-        size_t PrevFramesSize = 0;
-        for (size_t FrameNum=0; FrameNum<Frame; FrameNum++)
-            PrevFramesSize += ARRAYBEGIN(Element->SizeList,int32_t)[FrameNum];
-
-        // handle zlib
-        size_t OutSize = ARRAYBEGIN(Element->SizeList,int32_t)[Frame];
-        assert((PrevFramesSize + OutSize) <= ARRAYCOUNT(Element->Data,uint8_t));
-        const uint8_t *Data = ARRAYBEGIN(Element->Data,uint8_t) + PrevFramesSize;
 #if defined(CONFIG_EBML_WRITING)
-#if defined(CONFIG_ZLIB)
-        if (CompAlgo == MATROSKA_TRACK_ENCODING_COMP_ZLIB && CompressFrameZLib(Data,ARRAYBEGIN(Element->SizeList,int32_t)[Frame],NULL,&OutSize)!=ERR_NONE)
-            return ARRAYBEGIN(Element->SizeList,int32_t)[Frame]; // we can't tell the final size without decoding the data
+        if (Encoding->WriteErr == ERR_NONE && Encoding->Codec && CompressBlockFrames(Element, Encoding->Codec)==ERR_NONE)
+            return ARRAYBEGIN(Element->CompressedSizeList,int32_t)[Frame];
 #endif
-#endif
-        return OutSize;
+        return ARRAYBEGIN(Element->SizeList,int32_t)[Frame]; // we can't tell the final size without encoding the data
     }
-    return ARRAYBEGIN(Element->SizeList,int32_t)[Frame] - EBML_ElementDataSize(Header, 1); // header stripping
+    return ARRAYBEGIN(Element->SizeList,int32_t)[Frame] - Encoding->StripSize; // header stripping
 }
 
 #if defined(CONFIG_EBML_WRITING)
-static char GetBestLacingType(const matroska_block *Element, int ForProfile)
+static char GetBestLacingType(matroska_block *Element)
 {
     int XiphLacingSize, EbmlLacingSize;
     size_t i;
     int32_t DataSize;
-    ebml_element *Elt, *Elt2, *Header = NULL;
-    MatroskaTrackEncodingCompAlgo CompressionAlgo = MATROSKA_TRACK_ENCODING_COMP_NONE;
-    MatroskaContentEncodingScope CompressionScope = MATROSKA_CONTENTENCODINGSCOPE_BLOCK;
+    const matroska_track_encoding *Encoding;
 
     if (ARRAYCOUNT(Element->SizeList,int32_t) <= 1)
         return LACING_NONE;
@@ -1632,45 +2105,14 @@ static char GetBestLacingType(const matroska_block *Element, int ForProfile)
 
     // find out if compressed headers are used
     assert(Element->WriteTrack!=NULL);
-    Elt = EBML_MasterFindChild(Element->WriteTrack, MATROSKA_getContextContentEncodings());
-    if (Elt)
-    {
-        Elt = EBML_MasterFindChild((ebml_master*)Elt, MATROSKA_getContextContentEncoding());
-        if (EBML_MasterChildren(Elt))
-        {
-            if (EBML_MasterNext(Elt))
-                return 0; // TODO support cascaded compression/encryption
-
-            Elt2 = EBML_MasterFindChild((ebml_master*)Elt, MATROSKA_getContextContentEncodingScope());
-            if (Elt2)
-                CompressionScope = EBML_IntegerValue((ebml_integer*)Elt2);
-
-            Elt = EBML_MasterFindChild((ebml_master*)Elt, MATROSKA_getContextContentCompression());
-            if (!Elt)
-                return 0; // TODO: support encryption
-
-            Header = EBML_MasterGetChild((ebml_master*)Elt, MATROSKA_getContextContentCompAlgo(),ForProfile);
-            if (Header)
-                CompressionAlgo = EBML_IntegerValue((ebml_integer*)Header);
-            bool_t CanCompress = 0;
-            if (CompressionAlgo == MATROSKA_TRACK_ENCODING_COMP_HEADERSTRIP)
-                CanCompress = 1;
-#if defined(CONFIG_ZLIB)
-            else if (CompressionAlgo == MATROSKA_TRACK_ENCODING_COMP_ZLIB)
-                CanCompress = 1;
-#endif
-            if (!CanCompress)
-                return 0;
-
-            if (EBML_IntegerValue((ebml_integer*)Header)==MATROSKA_TRACK_ENCODING_COMP_HEADERSTRIP)
-                Header = EBML_MasterFindChild((ebml_master*)Elt, MATROSKA_getContextContentCompSettings());
-        }
-    }
+    Encoding = TrackEncoding(Element->WriteTrack);
+    if (Encoding->WriteErr != ERR_NONE)
+        return 0;
 
     XiphLacingSize = 0;
     for (i=0;i<ARRAYCOUNT(Element->SizeList,int32_t)-1;++i)
     {
-        DataSize = (int32_t)GetBlockFrameSize(Element, i, Header, CompressionAlgo, CompressionScope);
+        DataSize = (int32_t)GetBlockFrameSize(Element, i, Encoding);
         while (DataSize >= 0xFF)
         {
             XiphLacingSize++;
@@ -1679,10 +2121,10 @@ static char GetBestLacingType(const matroska_block *Element, int ForProfile)
         XiphLacingSize++;
     }
 
-    EbmlLacingSize = EBML_CodedSizeLength(GetBlockFrameSize(Element, 0, Header, CompressionAlgo, CompressionScope),0,1);
+    EbmlLacingSize = EBML_CodedSizeLength(GetBlockFrameSize(Element, 0, Encoding),0,1);
     for (i=1;i<ARRAYCOUNT(Element->SizeList,int32_t)-1;++i)
     {
-        DataSize = (int32_t)GetBlockFrameSize(Element, i, Header, CompressionAlgo, CompressionScope) - DataSize;
+        DataSize = (int32_t)GetBlockFrameSize(Element, i, Encoding) - DataSize;
         EbmlLacingSize += EBML_CodedSizeLengthSigned(DataSize,0);
     }
 
@@ -1692,14 +2134,13 @@ static char GetBestLacingType(const matroska_block *Element, int ForProfile)
         return LACING_EBML;
 }
 
-static err_t RenderBlockData(matroska_block *Element, struct stream *Output, bool_t UNUSED_PARAM(bForceWithoutMandatory), bool_t UNUSED_PARAM(bWithDefault), int ForProfile, filepos_t *Rendered)
+static err_t RenderBlockData(matroska_block *Element, struct stream *Output, bool_t UNUSED_PARAM(bForceWithoutMandatory), bool_t UNUSED_PARAM(bWithDefault), int UNUSED_PARAM(ForProfile), filepos_t *Rendered)
 {
     err_t Err = ERR_NONE;
     uint8_t BlockHead[5], *Cursor;
+    const uint8_t *Data;
     size_t ToWrite, Written, BlockHeadSize = 4;
-    ebml_element *Elt, *Elt2, *Header = NULL;
-    MatroskaTrackEncodingCompAlgo CompressionAlgo = MATROSKA_TRACK_ENCODING_COMP_NONE;
-    MatroskaContentEncodingScope CompressionScope = MATROSKA_CONTENTENCODINGSCOPE_BLOCK;
+    const matroska_track_encoding *Encoding;
     assert(Element->Lacing != LACING_AUTO);
 
     if (Element->TrackNumber < 0x80)
@@ -1744,54 +2185,24 @@ static err_t RenderBlockData(matroska_block *Element, struct stream *Output, boo
         *Rendered = Written;
 
     assert(Element->WriteTrack!=NULL);
-    Elt = EBML_MasterFindChild(Element->WriteTrack, MATROSKA_getContextContentEncodings());
-    if (Elt)
+    Encoding = TrackEncoding(Element->WriteTrack);
+    if (Encoding->WriteErr != ERR_NONE)
     {
-        Elt = EBML_MasterFindChild((ebml_master*)Elt, MATROSKA_getContextContentEncoding());
-        if (EBML_MasterChildren(Elt))
-        {
-            if (EBML_MasterNext(Elt))
-                return ERR_INVALID_DATA; // TODO support cascaded compression/encryption
-
-            Elt2 = EBML_MasterFindChild((ebml_master*)Elt, MATROSKA_getContextContentEncodingScope());
-            if (Elt2)
-                CompressionScope = EBML_IntegerValue((ebml_integer*)Elt2);
-
-            Elt = EBML_MasterFindChild((ebml_master*)Elt, MATROSKA_getContextContentCompression());
-            if (!Elt)
-                return ERR_INVALID_DATA; // TODO: support encryption
-
-            Header = EBML_MasterGetChild((ebml_master*)Elt, MATROSKA_getContextContentCompAlgo(),ForProfile);
-            if (Header)
-                CompressionAlgo = EBML_IntegerValue((ebml_integer*)Header);
-            bool_t CanCompress = 0;
-            if (CompressionAlgo == MATROSKA_TRACK_ENCODING_COMP_HEADERSTRIP)
-                CanCompress = 1;
-#if defined(CONFIG_ZLIB)
-            else if (CompressionAlgo == MATROSKA_TRACK_ENCODING_COMP_ZLIB)
-                CanCompress = 1;
-#endif
-            if (!CanCompress)
-            {
-                Err = ERR_NOT_SUPPORTED;
-                goto failed;
-            }
-
-            if (CompressionAlgo == MATROSKA_TRACK_ENCODING_COMP_HEADERSTRIP)
-                Header = EBML_MasterFindChild((ebml_master*)Elt, MATROSKA_getContextContentCompSettings());
-        }
+        Err = Encoding->WriteErr;
+        goto failed;
     }
 
-#if !defined(CONFIG_ZLIB)
-    if (Header && Header->Context==MATROSKA_getContextContentCompAlgo())
+    if (Element->CopyLocation != INVALID_FILEPOS_T)
     {
-        Err = ERR_NOT_SUPPORTED;
+        Err = Stream_Write(Output,GetBlockData(Element),GetBlockDataSize(Element),&Written);
+        if (Rendered)
+            *Rendered += Written;
+        Node_SET(Element,MATROSKA_BLOCK_READ_TRACK,&Element->WriteTrack);
         goto failed;
     }
-#endif
 
     if (Element->Lacing == LACING_AUTO)
-        Element->Lacing = GetBestLacingType(Element, ForProfile);
+        Element->Lacing = GetBestLacingType(Element);
     if (Element->Lacing != LACING_NONE)
     {
         uint8_t *LaceHead = malloc(1 + ARRAYCOUNT(Element->SizeList,int32_t)*4);
@@ -1805,12 +2216,12 @@ static err_t RenderBlockData(matroska_block *Element, struct stream *Output, boo
         LaceHead[0] = (ARRAYCOUNT(Element->SizeList,int32_t)-1) & 0xFF; // number of elements in the lace
         if (Element->Lacing == LACING_EBML)
         {
-            DataSize = (int32_t)GetBlockFrameSize(Element, 0, Header, CompressionAlgo, CompressionScope);
+            DataSize = (int32_t)GetBlockFrameSize(Element, 0, Encoding);
             LaceSize += EBML_CodedValueLength(DataSize,EBML_CodedSizeLength(DataSize,0,1),LaceHead+LaceSize, 1);
             for (i=1;i<ARRAYCOUNT(Element->SizeList,int32_t)-1;++i)
             {
                 PrevSize = DataSize;
-                DataSize = (int32_t)GetBlockFrameSize(Element, i, Header, CompressionAlgo, CompressionScope);
+                DataSize = (int32_t)GetBlockFrameSize(Element, i, Encoding);
                 LaceSize += EBML_CodedValueLengthSigned(DataSize-PrevSize,EBML_CodedSizeLengthSigned(DataSize-PrevSize,0),LaceHead+LaceSize);
             }
         }
@@ -1818,7 +2229,7 @@ static err_t RenderBlockData(matroska_block *Element, struct stream *Output, boo
         {
             for (i=0;i<ARRAYCOUNT(Element->SizeList,int32_t)-1;++i)
             {
-                DataSize = (int32_t)GetBlockFrameSize(Element, i, Header, CompressionAlgo, CompressionScope);
+                DataSize = (int32_t)GetBlockFrameSize(Element, i, Encoding);
                 while (DataSize >= 0xFF)
                 {
                     LaceHead[LaceSize++] = 0xFF;
@@ -1841,70 +2252,44 @@ static err_t RenderBlockData(matroska_block *Element, struct stream *Output, boo
     }
     Node_SET(Element,MATROSKA_BLOCK_READ_TRACK,&Element->WriteTrack); // now use the write track for consecutive read of the same element
 
-    Cursor = ARRAYBEGIN(Element->Data,uint8_t);
-    if (Header && (CompressionScope & MATROSKA_CONTENTENCODINGSCOPE_BLOCK))
+    Data = GetBlockData(Element);
+    if (Encoding->Algo != MATROSKA_TRACK_ENCODING_COMP_NONE && (Encoding->Scope & MATROSKA_CONTENTENCODINGSCOPE_BLOCK))
     {
         int32_t* i;
-        if (Header && Header->Context==MATROSKA_getContextContentCompAlgo())
+        if (Encoding->Algo != MATROSKA_TRACK_ENCODING_COMP_HEADERSTRIP)
         {
-#if defined(CONFIG_ZLIB)
-            if (CompressionAlgo == MATROSKA_TRACK_ENCODING_COMP_ZLIB)
+            Err = CompressBlockFrames(Element, Encoding->Codec);
+            if (Err == ERR_NONE)
             {
-                uint8_t *OutBuf;
-                array TmpBuf;
-                ArrayInit(&TmpBuf);
-                for (i=ARRAYBEGIN(Element->SizeList,int32_t);i!=ARRAYEND(Element->SizeList,int32_t);++i)
-                {
-                    if (!ArrayResize(&TmpBuf,*i + 100,0))
-                    {
-                        ArrayClear(&TmpBuf);
-                        Err = ERR_OUT_OF_MEMORY;
-                        break;
-                    }
-                    OutBuf = ARRAYBEGIN(TmpBuf,uint8_t);
-                    ToWrite = ARRAYCOUNT(TmpBuf,uint8_t);
-                    if (CompressFrameZLib(Cursor, *i, &OutBuf, &ToWrite) != ERR_NONE)
-                    {
-                        ArrayClear(&TmpBuf);
-                        Err = ERR_OUT_OF_MEMORY;
-                        break;
-                    }
-
-                    Err = Stream_Write(Output,OutBuf,ToWrite,&Written);
-                    ArrayClear(&TmpBuf);
-                    if (Rendered)
-                        *Rendered += Written;
-                    Cursor += *i;
-                    if (Err!=ERR_NONE)
-                        break;
-                }
+                Err = Stream_Write(Output,ARRAYBEGIN(Element->Compressed,uint8_t),ARRAYCOUNT(Element->Compressed,uint8_t),&Written);
+                if (Rendered)
+                    *Rendered += Written;
             }
-#endif
         }
         else
         {
             // header compression
             for (i=ARRAYBEGIN(Element->SizeList,int32_t);i!=ARRAYEND(Element->SizeList,int32_t);++i)
             {
-                assert(memcmp(Cursor,ARRAYBEGIN(((ebml_binary*)Header)->Data,uint8_t),(size_t)EBML_ElementDataSize(Header, 1))==0);
-                if (memcmp(Cursor,ARRAYBEGIN(((ebml_binary*)Header)->Data,uint8_t),(size_t)EBML_ElementDataSize(Header, 1))!=0)
+                assert(memcmp(Data,Encoding->Strip,Encoding->StripSize)==0);
+                if (memcmp(Data,Encoding->Strip,Encoding->StripSize)!=0)
                 {
                     Err = ERR_INVALID_DATA;
                     goto failed;
                 }
-                Cursor += EBML_ElementDataSize(Header, 1);
-                ToWrite = *i - (size_t)EBML_ElementDataSize(Header, 1);
-                Err = Stream_Write(Output,Cursor,ToWrite,&Written);
+                Data += Encoding->StripSize;
+                ToWrite = *i - Encoding->StripSize;
+                Err = Stream_Write(Output,Data,ToWrite,&Written);
                 if (Rendered)
                     *Rendered += Written;
-                Cursor += Written;
+                Data += Written;
             }
         }
     }
     else
     {
-        ToWrite = ARRAYCOUNT(Element->Data,uint8_t);
-        Err = Stream_Write(Output,Cursor,ToWrite,&Written);
+        ToWrite = GetBlockDataSize(Element);
+        Err = Stream_Write(Output,Data,ToWrite,&Written);
         if (Rendered)
             *Rendered += Written;
     }
@@ -1947,51 +2332,23 @@ static matroska_block *CopyBlockInfo(const matroska_block *Element)
 
 static filepos_t UpdateBlockSize(matroska_block *Element, bool_t bWithDefault, bool_t bForceWithoutMandatory, int ForProfile)
 {
-    MatroskaContentEncodingScope CompressionScope = MATROSKA_CONTENTENCODINGSCOPE_BLOCK;
     if (EBML_ElementNeedsDataSizeUpdate(Element, bWithDefault))
     {
-        ebml_element *Header = NULL;
+        const matroska_track_encoding *Encoding = NULL;
 #if defined(CONFIG_EBML_WRITING)
-        MatroskaTrackEncodingCompAlgo CompressionAlgo = MATROSKA_TRACK_ENCODING_COMP_NONE;
-        ebml_element *Elt, *Elt2;
-        if (Element->Lacing == LACING_AUTO)
-            Element->Lacing = GetBestLacingType(Element,ForProfile);
-
-        assert(Element->WriteTrack!=NULL);
-        Elt = EBML_MasterFindChild(Element->WriteTrack, MATROSKA_getContextContentEncodings());
-        if (Elt)
+        if (Element->CopyLocation != INVALID_FILEPOS_T)
         {
-            Elt = EBML_MasterFindChild((ebml_master*)Elt, MATROSKA_getContextContentEncoding());
-            if (EBML_MasterChildren(Elt))
-            {
-                if (EBML_MasterNext(Elt))
-                    return ERR_INVALID_DATA; // TODO support cascaded compression/encryption
-
-                Elt2 = EBML_MasterFindChild((ebml_master*)Elt, MATROSKA_getContextContentEncodingScope());
-                if (Elt2)
-                    CompressionScope = EBML_IntegerValue((ebml_integer*)Elt2);
-
-                Elt = EBML_MasterFindChild((ebml_master*)Elt, MATROSKA_getContextContentCompression());
-                if (!Elt)
-                    return ERR_INVALID_DATA; // TODO: support encryption
+            Element->Base.Base.DataSize = GetBlockHeadSize(Element) + Element->CopySize;
+            return INHERITED(Element,ebml_element_vmt,EBML_BINARY_CLASS)->UpdateDataSize(Element, bWithDefault, bForceWithoutMandatory, ForProfile);
+        }
 
-                Header = EBML_MasterGetChild((ebml_master*)Elt, MATROSKA_getContextContentCompAlgo(),ForProfile);
-                if (Header)
-                    CompressionAlgo = EBML_IntegerValue((ebml_integer*)Header);
-                bool_t CanCompress = 0;
-                if (CompressionAlgo == MATROSKA_TRACK_ENCODING_COMP_HEADERSTRIP)
-                    CanCompress = 1;
-#if defined(CONFIG_ZLIB)
-                else if (CompressionAlgo == MATROSKA_TRACK_ENCODING_COMP_ZLIB)
-                    CanCompress = 1;
-#endif
-                if (!CanCompress)
-                    return ERR_INVALID_DATA;
+        if (Element->Lacing == LACING_AUTO)
+            Element->Lacing = GetBestLacingType(Element);
 
-                if (CompressionAlgo == MATROSKA_TRACK_ENCODING_COMP_HEADERSTRIP)
-                    Header = EBML_MasterFindChild((ebml_master*)Elt, MATROSKA_getContextContentCompSettings());
-            }
-        }
+        assert(Element->WriteTrack!=NULL);
+        Encoding = TrackEncoding(Element->WriteTrack);
+        if (Encoding->WriteErr != ERR_NONE)
+            return ERR_INVALID_DATA;
 #else
         assert(Element->Lacing!=LACING_AUTO);
 #endif
@@ -1999,22 +2356,22 @@ static filepos_t UpdateBlockSize(matroska_block *Element, bool_t bWithDefault, b
         if (Element->Lacing == LACING_NONE)
         {
             assert(ARRAYCOUNT(Element->SizeList,int32_t) == 1);
-            Element->Base.Base.DataSize = GetBlockHeadSize(Element) + GetBlockFrameSize(Element,0,Header, CompressionAlgo, CompressionScope);
+            Element->Base.Base.DataSize = GetBlockHeadSize(Element) + GetBlockFrameSize(Element,0,Encoding);
         }
         else if (Element->Lacing == LACING_EBML)
         {
             size_t i;
             filepos_t PrevSize, Size;
             filepos_t Result = GetBlockHeadSize(Element) + 1; // 1 for the number of frames
-            Size = GetBlockFrameSize(Element,0,Header, CompressionAlgo, CompressionScope);
+            Size = GetBlockFrameSize(Element,0,Encoding);
             Result += EBML_CodedSizeLength(Size,0,1) + Size;
             for (i=1;i<ARRAYCOUNT(Element->SizeList,int32_t)-1;++i)
             {
                 PrevSize = Size;
-                Size = GetBlockFrameSize(Element,i,Header, CompressionAlgo, CompressionScope);
+                Size = GetBlockFrameSize(Element,i,Encoding);
                 Result += Size + EBML_CodedSizeLengthSigned(Size - PrevSize,0);
             }
-            Result += GetBlockFrameSize(Element,i,Header, CompressionAlgo, CompressionScope);
+            Result += GetBlockFrameSize(Element,i,Encoding);
             Element->Base.Base.DataSize = Result;
         }
         else if (Element->Lacing == LACING_XIPH)
@@ -2024,10 +2381,10 @@ static filepos_t UpdateBlockSize(matroska_block *Element, bool_t bWithDefault, b
             filepos_t Result = GetBlockHeadSize(Element) + 1; // 1 for the number of frames
             for (i=0;i<ARRAYCOUNT(Element->SizeList,int32_t)-1;++i)
             {
-                Size = GetBlockFrameSize(Element,i,Header, CompressionAlgo, CompressionScope);
+                Size = GetBlockFrameSize(Element,i,Encoding);
                 Result += (Size / 0xFF + 1) + Size;
             }
-            Result += GetBlockFrameSize(Element,i,Header, CompressionAlgo, CompressionScope);
+            Result += GetBlockFrameSize(Element,i,Encoding);
             Element->Base.Base.DataSize = Result;
         }
         else if (Element->Lacing == LACING_FIXED)
@@ -2035,7 +2392,7 @@ static filepos_t UpdateBlockSize(matroska_block *Element, bool_t bWithDefault, b
             size_t i;
             filepos_t Result = GetBlockHeadSize(Element) + 1; // 1 for the number of frames
             for (i=0;i<ARRAYCOUNT(Element->SizeList,int32_t);++i)
-                Result += GetBlockFrameSize(Element,i,Header, CompressionAlgo, CompressionScope);
+                Result += GetBlockFrameSize(Element,i,Encoding);
             Element->Base.Base.DataSize = Result;
         }
 #ifdef TODO
@@ -2052,7 +2409,7 @@ static filepos_t UpdateBlockSize(matroska_block *Element, bool_t bWithDefault, b
             default:
                 Element->Base.Base.DataSize = 4 + 1; // 1 for the lacing head
                 if (Element->Lacing == LACING_AUTO)
-                    LacingHere = GetBestLacingType(Element,ForProfile);
+                    LacingHere = GetBestLacingType(Element);
                 else
                     LacingHere = Element->Lacing;
                 switch (LacingHere)
@@ -2213,6 +2570,9 @@ static bool_t ValidateSizeSegUID(const ebml_binary *p)
 static err_t CreateBlock(matroska_block *p)
 {
     p->GlobalTimestamp = INVALID_TIMESTAMP_T;
+#if defined(CONFIG_EBML_WRITING)
+    p->CopyLocation = INVALID_FILEPOS_T;
+#endif
     return ERR_NONE;
 }
 
@@ -2247,6 +2607,7 @@ static err_t ReadTrackEntry(matroska_trackentry *Element, struct stream *Input,
             }
         }
     }
+    ResolveTrackEncoding(Element); // before the blocks of the track are shared between threads
     return Result;
 }
 
@@ -2279,26 +2640,26 @@ static filepos_t UpdateDataSizeTrackEntry(matroska_trackentry *Element, bool_t b
         if (Element->CodecPrivateCompressionAlgo == MATROSKA_TRACK_ENCODING_COMP_NONE)
         {
             // compress the codec private
-            if (CodecPrivate)
+            const matroska_codec *Codec = MATROSKA_GetCodec(CompressionAlgo);
+            if (CodecPrivate && Codec)
             {
-                size_t CompressedSize = ARRAYCOUNT(CodecPrivate->Data,uint8_t);
-                uint8_t *Compressed = malloc(CompressedSize);
-                uint8_t *NewCompressed = Compressed;
-#if defined(CONFIG_ZLIB)
-                if (CompressionAlgo == MATROSKA_TRACK_ENCODING_COMP_ZLIB &&
-                    CompressFrameZLib(ARRAYBEGIN(CodecPrivate->Data,uint8_t), (size_t)CodecPrivate->Base.DataSize, &NewCompressed, &CompressedSize)==ERR_NONE)
+                size_t CompressedSize;
+                array Compressed;
+
+                ArrayInit(&Compressed);
+                if (AppendEncodedFrame(Codec, ARRAYBEGIN(CodecPrivate->Data,uint8_t), (size_t)CodecPrivate->Base.DataSize, &Compressed, &CompressedSize)==ERR_NONE)
                 {
-                    if (EBML_BinarySetData(CodecPrivate, NewCompressed, CompressedSize)==ERR_NONE)
-                        Element->CodecPrivateCompressionAlgo = MATROSKA_TRACK_ENCODING_COMP_ZLIB;
+                    if (EBML_BinarySetData(CodecPrivate, ARRAYBEGIN(Compressed,uint8_t), CompressedSize)==ERR_NONE)
+                        Element->CodecPrivateCompressionAlgo = CompressionAlgo;
                 }
-#endif
-                free(Compressed);
+                ArrayClear(&Compressed);
             }
             if (Element->CodecPrivateCompressionAlgo == MATROSKA_TRACK_ENCODING_COMP_NONE)
                 EBML_IntegerSetValue(Scope, EBML_IntegerValue(Scope) ^ MATROSKA_CONTENTENCODINGSCOPE_PRIVATE);
         }
         else
         {
+            const matroska_codec *Codec = MATROSKA_GetCodec(Element->CodecPrivateCompressionAlgo);
             if (CodecPrivate)
             {
                 size_t CompressedSize = ARRAYCOUNT(CodecPrivate->Data,uint8_t);
@@ -2306,14 +2667,11 @@ static filepos_t UpdateDataSizeTrackEntry(matroska_trackentry *Element, bool_t b
                 array Compressed;
 
                 ArrayInit(&Compressed);
-#if defined(CONFIG_ZLIB)
-                if (Element->CodecPrivateCompressionAlgo == MATROSKA_TRACK_ENCODING_COMP_ZLIB &&
-                    UnCompressFrameZLib(ARRAYBEGIN(CodecPrivate->Data,uint8_t), (size_t)CodecPrivate->Base.DataSize, &Compressed, &CompressedSize, &Offset)==ERR_NONE)
+                if (Codec && DecodeFrame(Codec, ARRAYBEGIN(CodecPrivate->Data,uint8_t), (size_t)CodecPrivate->Base.DataSize, &Compressed, &CompressedSize, &Offset)==ERR_NONE)
                 {
                     if (EBML_BinarySetData(CodecPrivate, ARRAYBEGIN(Compressed,uint8_t), CompressedSize)==ERR_NONE)
                         Element->CodecPrivateCompressionAlgo = MATROSKA_TRACK_ENCODING_COMP_NONE;
                 }
-#endif
                 ArrayClear(&Compressed);
             }
             else
@@ -2323,15 +2681,37 @@ static filepos_t UpdateDataSizeTrackEntry(matroska_trackentry *Element, bool_t b
                 // TODO: add in the Compression header that the header is still compressed
             }
         }
+        ResolveTrackEncoding(Element);
     }
     return INHERITED(Element,ebml_element_vmt,MATROSKA_TRACKENTRY_CLASS)->UpdateDataSize(Element, bWithDefault, bForceWithoutMandatory, ForProfile);
 }
 
+static void DeleteTrackEntry(matroska_trackentry *Element)
+{
+    if (Element->Decoder.State)
+        Element->Decoder.StateCodec->Close(Element->Decoder.State);
+}
+
+static void AddTrackEntryChild(matroska_trackentry *Element, ebml_element *Child, ebml_element *Before)
+{
+    AtomicStorePtr(&Element->Encoding.ResolvedFor, NULL);
+    INHERITED(Element,nodetree_vmt,MATROSKA_TRACKENTRY_CLASS)->AddChild(Element,Child,Before);
+}
+
+static void RemoveTrackEntryChild(matroska_trackentry *Element, ebml_element *Child)
+{
+    AtomicStorePtr(&Element->Encoding.ResolvedFor, NULL);
+    INHERITED(Element,nodetree_vmt,MATROSKA_TRACKENTRY_CLASS)->RemoveChild(Element,Child);
+}
+
 static matroska_trackentry *CopyTrackEntry(const matroska_trackentry *Element)
 {
     matroska_trackentry *Result = (matroska_trackentry*)INHERITED(Element,ebml_element_vmt,MATROSKA_TRACKENTRY_CLASS)->Copy(Element);
     if (Result)
+    {
         Result->CodecPrivateCompressionAlgo = Element->CodecPrivateCompressionAlgo;
+        Result->Encoding.ResolvedFor = NULL; // the stripped bytes belong to the source track
+    }
     return Result;
 }
 
@@ -2380,6 +2760,7 @@ bool_t MATROSKA_TrackSetCompressionAlgo(matroska_trackentry *TrackEntry, Matrosk
         Elt2 = EBML_MasterGetChild((ebml_master*)Elt,MATROSKA_getContextContentCompAlgo(), ForProfile);
         EBML_IntegerSetValue((ebml_integer*)Elt2, algo);
     }
+    ResolveTrackEncoding(TrackEntry);
     return HadEncoding;
 }
 
@@ -2405,17 +2786,19 @@ bool_t MATROSKA_TrackSetCompressionHeader(matroska_trackentry *TrackEntry, const
         Elt2 = EBML_MasterGetChild((ebml_master*)Elt,MATROSKA_getContextContentCompSettings(), ForProfile);
         EBML_BinarySetData((ebml_binary*)Elt2, Header, HeaderSize);
     }
+    ResolveTrackEncoding(TrackEntry);
     return HadEncoding;
 }
 
 bool_t MATROSKA_TrackSetCompressionNone(matroska_trackentry *TrackEntry)
 {
     ebml_element *Encodings = EBML_MasterFindChild(TrackEntry,MATROSKA_getContextContentEncodings());
+    bool_t HadEncoding = Encodings!=NULL;
     assert(Node_IsPartOf(TrackEntry, MATROSKA_TRACKENTRY_CLASS));
-    if (!Encodings)
-        return 0;
-    NodeDelete((node*)Encodings);
-    return 1;
+    if (HadEncoding)
+        NodeDelete((node*)Encodings);
+    ResolveTrackEncoding(TrackEntry); // even unchanged, a copied track needs it
+    return HadEncoding;
 }
 
 
@@ -2439,9 +2822,11 @@ META_PARAM(TYPE,MATROSKA_BLOCK_READ_SEGMENTINFO,TYPE_NODE)
 META_DATA_UPDATE_CMP(TYPE_NODE_REF,MATROSKA_BLOCK_READ_SEGMENTINFO,matroska_block,ReadSegInfo,BlockTrackChanged)
 #if defined(CONFIG_EBML_WRITING)
 META_PARAM(TYPE,MATROSKA_BLOCK_WRITE_TRACK,TYPE_NODE)
-META_DATA_UPDATE_CMP(TYPE_NODE_REF,MATROSKA_BLOCK_WRITE_TRACK,matroska_block,WriteTrack,BlockTrackChanged)
+META_DATA_UPDATE_CMP(TYPE_NODE_REF,MATROSKA_BLOCK_WRITE_TRACK,matroska_block,WriteTrack,BlockWriteTrackChanged)
 META_PARAM(TYPE,MATROSKA_BLOCK_WRITE_SEGMENTINFO,TYPE_NODE)
 META_DATA_UPDATE_CMP(TYPE_NODE_REF,MATROSKA_BLOCK_WRITE_SEGMENTINFO,matroska_block,WriteSegInfo,BlockTrackChanged)
+META_DATA(TYPE_ARRAY,0,matroska_block,Compressed)
+META_DATA(TYPE_ARRAY,0,matroska_block,CompressedSizeList)
 #endif
 META_END_CONTINUE(EBML_BINARY_CLASS)
 
@@ -2479,6 +2864,9 @@ META_END_CONTINUE(EBML_MASTER_CLASS)
 
 META_START_CONTINUE(MATROSKA_TRACKENTRY_CLASS)
 META_CLASS(SIZE,sizeof(matroska_trackentry))
+META_CLASS(DELETE,DeleteTrackEntry)
+META_VMT(TYPE_FUNC,nodetree_vmt,AddChild,AddTrackEntryChild)
+META_VMT(TYPE_FUNC,nodetree_vmt,RemoveChild,RemoveTrackEntryChild)
 META_VMT(TYPE_FUNC,ebml_element_vmt,ReadData,ReadTrackEntry)
 META_VMT(TYPE_FUNC,ebml_element_vmt,UpdateDataSize,UpdateDataSizeTrackEntry)
 META_VMT(TYPE_FUNC,ebml_element_vmt,Copy,CopyTrackEntry)
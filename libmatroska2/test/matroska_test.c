@@ -0,0 +1,1026 @@
+/*
+ * Copyright (c) 2026, Matroska (non-profit organisation)
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include "mkvgen.h"
+#include <corec/helpers/file/streams.h>
+#include <corec/helpers/parser/parser.h>
+#include <corec/str/str.h>
+
+#include <stdio.h>
+void DebugMessage(const tchar_t* Msg,...)
+{
+    va_list Args;
+    tchar_t Buffer[1024];
+
+    va_start(Args,Msg);
+    vstprintf_s(Buffer,TSIZEOF(Buffer), Msg, Args);
+    va_end(Args);
+    tcscat_s(Buffer,TSIZEOF(Buffer),T("\r\n"));
+
+#ifdef UNICODE
+    fprintf(stderr, "%ls", Buffer);
+#else
+    fprintf(stderr, "%s", Buffer);
+#endif
+}
+
+#define TEST_PROFILE  PROFILE_MATROSKA_V4
+
+static err_t Generate(parsercontext *p, const tchar_t *Path, const mkvgen_track *Tracks, size_t TrackCount, mkvgen_stats *Stats)
+{
+    mkvgen_config Config;
+    mkvgen_stats LocalStats;
+    struct stream *Output;
+    err_t Err;
+
+    memset(&Config, 0, sizeof(Config));
+    Config.Tracks = Tracks;
+    Config.TrackCount = TrackCount;
+    Config.Duration = 10000000000; // 10s
+    Config.ClusterDuration = 1000000000;
+    Config.Seed = 1234;
+
+    Output = StreamOpen(p,Path,SFLAG_WRONLY|SFLAG_CREATE|SFLAG_BUFFERED);
+    if (!Output)
+        return ERR_INVALID_PARAM;
+    Err = MKVGEN_Write((anynode*)p, Output, &Config, Stats ? Stats : &LocalStats);
+    StreamClose(Output);
+    return Err;
+}
+
+// all the decoded frames of the file one after the other, with their sizes in Sizes
+static err_t ReadFrames(parsercontext *p, const tchar_t *Path, array *Frames, array *Sizes)
+{
+    struct stream *Input;
+    ebml_element *Head = NULL, *Segment = NULL, *Level1, *Next, *Elt, *Block;
+    ebml_master *Info = NULL, *Tracks = NULL;
+    ebml_parser_context Context, SegmentContext;
+    matroska_frame Frame;
+    size_t FrameNum;
+    int UpperElement = 0;
+    err_t Err = ERR_INVALID_DATA;
+
+    ArrayClear(Frames);
+    ArrayClear(Sizes);
+    Input = StreamOpen(p,Path,SFLAG_RDONLY|SFLAG_BUFFERED);
+    if (!Input)
+        return ERR_INVALID_PARAM;
+
+    Context.Context = MATROSKA_getContextStream();
+    Context.EndPosition = INVALID_FILEPOS_T;
+    Context.UpContext = NULL;
+    Context.Profile = TEST_PROFILE;
+    Head = EBML_FindNextElement(Input, &Context, &UpperElement, 0);
+    if (!Head || EBML_ElementReadData(Head,Input,&Context,0,SCOPE_ALL_DATA,0)!=ERR_NONE)
+        goto exit;
+    Segment = EBML_FindNextElement(Input, &Context, &UpperElement, 1);
+    if (!Segment || !EBML_ElementIsType(Segment, MATROSKA_getContextSegment()))
+        goto exit;
+
+    SegmentContext.Context = MATROSKA_getContextSegment();
+    SegmentContext.EndPosition = EBML_ElementPositionEnd(Segment);
+    SegmentContext.UpContext = &Context;
+    SegmentContext.Profile = TEST_PROFILE;
+    Err = ERR_NONE;
+    Level1 = EBML_FindNextElement(Input, &SegmentContext, &UpperElement, 1);
+    while (Level1 && Err==ERR_NONE)
+    {
+        bool_t IsCluster = EBML_ElementIsType(Level1, MATROSKA_getContextCluster());
+        Err = EBML_ElementReadData(Level1,Input,&SegmentContext,1,IsCluster ? SCOPE_PARTIAL_DATA : SCOPE_ALL_DATA,0);
+        if (Err==ERR_NONE && IsCluster)
+        {
+            if (!Info || !Tracks)
+                Err = ERR_INVALID_DATA;
+            else
+                MATROSKA_LinkClusterBlocks((matroska_cluster*)Level1, Info, Tracks, 0, TEST_PROFILE);
+            for (Elt=EBML_MasterChildren(Level1);Err==ERR_NONE && Elt;Elt=EBML_MasterNext(Elt))
+            {
+                if (EBML_ElementIsType(Elt, MATROSKA_getContextBlockGroup()))
+                    Block = EBML_MasterFindChild(Elt, MATROSKA_getContextBlock());
+                else if (EBML_ElementIsType(Elt, MATROSKA_getContextSimpleBlock()))
+                    Block = Elt;
+                else
+                    continue;
+                Err = MATROSKA_BlockReadData((matroska_block*)Block, Input, TEST_PROFILE);
+                for (FrameNum=0;Err==ERR_NONE && FrameNum<MATROSKA_BlockGetFrameCount((matroska_block*)Block);++FrameNum)
+                {
+                    Err = MATROSKA_BlockGetFrame((matroska_block*)Block, FrameNum, &Frame, 1);
+                    if (Err==ERR_NONE && (!ArrayAppend(Frames,Frame.Data,Frame.Size,0) || !ArrayAppend(Sizes,&Frame.Size,sizeof(Frame.Size),0)))
+                        Err = ERR_OUT_OF_MEMORY;
+                }
+                MATROSKA_BlockReleaseData((matroska_block*)Block, 1);
+            }
+        }
+
+        Next = EBML_ElementSkipData(Level1, Input, &SegmentContext, NULL, 1);
+        if (!Info && EBML_ElementIsType(Level1, MATROSKA_getContextInfo()))
+            Info = (ebml_master*)Level1;
+        else if (!Tracks && EBML_ElementIsType(Level1, MATROSKA_getContextTracks()))
+            Tracks = (ebml_master*)Level1;
+        else
+            NodeDelete((node*)Level1);
+        Level1 = Next ? Next : EBML_FindNextElement(Input, &SegmentContext, &UpperElement, 1);
+    }
+    if (Level1)
+        NodeDelete((node*)Level1);
+    if (Err==ERR_NONE && ARRAYEMPTY(*Sizes))
+        Err = ERR_INVALID_DATA;
+
+exit:
+    if (Segment)
+        NodeDelete((node*)Segment);
+    if (Head)
+        NodeDelete((node*)Head);
+    if (Info)
+        NodeDelete((node*)Info);
+    if (Tracks)
+        NodeDelete((node*)Tracks);
+    StreamClose(Input);
+    return Err;
+}
+
+// the frames of a compressed file decode to the ones of the same file without compression
+static int TestCodec(parsercontext *p, const tchar_t *Path, MatroskaTrackEncodingCompAlgo Algo, const char *Name, bool_t Required)
+{
+    mkvgen_track Tracks[2] = {
+        {MATROSKA_TRACK_TYPE_VIDEO, "V_MPEG4/ISO/ASP", 40000000, 3000, 1000, 1, 25, MATROSKA_TRACK_ENCODING_COMP_NONE, 0, MKVGEN_SIZE_UNIFORM, 0},
+        {MATROSKA_TRACK_TYPE_AUDIO, "A_MPEG/L3", 24000000, 150, 100, 4, 0, MATROSKA_TRACK_ENCODING_COMP_NONE, 0, MKVGEN_SIZE_UNIFORM, 0},
+    };
+    mkvgen_stats Plain, Compressed;
+    array Frames, Sizes, RefFrames, RefSizes;
+    int Result = 1;
+
+    if (!MATROSKA_GetCodec(Algo))
+    {
+        if (Required)
+        {
+            fprintf(stderr, "%s is enabled but not available\r\n", Name);
+            return 1;
+        }
+        fprintf(stderr, "%s is not available, skipped\r\n", Name);
+        return 0;
+    }
+
+    ArrayInit(&Frames);
+    ArrayInit(&Sizes);
+    ArrayInit(&RefFrames);
+    ArrayInit(&RefSizes);
+    if (Generate(p, Path, Tracks, 2, &Plain)!=ERR_NONE || ReadFrames(p, Path, &RefFrames, &RefSizes)!=ERR_NONE)
+        goto exit;
+
+    Tracks[0].Compression = Algo;
+    Tracks[1].Compression = Algo;
+    if (Generate(p, Path, Tracks, 2, &Compressed)!=ERR_NONE || ReadFrames(p, Path, &Frames, &Sizes)!=ERR_NONE)
+        goto exit;
+    if (Compressed.Size >= Plain.Size)
+        goto exit;
+    if (ARRAYCOUNT(Sizes,uint8_t) != ARRAYCOUNT(RefSizes,uint8_t) || memcmp(ARRAYBEGIN(Sizes,uint8_t),ARRAYBEGIN(RefSizes,uint8_t),ARRAYCOUNT(Sizes,uint8_t))!=0)
+        goto exit;
+    if (ARRAYCOUNT(Frames,uint8_t) != ARRAYCOUNT(RefFrames,uint8_t) || memcmp(ARRAYBEGIN(Frames,uint8_t),ARRAYBEGIN(RefFrames,uint8_t),ARRAYCOUNT(Frames,uint8_t))!=0)
+        goto exit;
+    Result = 0;
+
+exit:
+    if (Result)
+        fprintf(stderr, "%s round trip failed\r\n", Name);
+    ArrayClear(&Frames);
+    ArrayClear(&Sizes);
+    ArrayClear(&RefFrames);
+    ArrayClear(&RefSizes);
+    return Result;
+}
+
+// the values cached for the blocks follow the edits of the track children
+static int TestTrackEdit(parsercontext *p)
+{
+    ebml_master *Track;
+    ebml_element *Elt, *Encoding;
+    matroska_block *Block = NULL;
+    int Result = 1;
+
+    Track = (ebml_master*)EBML_ElementCreate(p, MATROSKA_getContextTrackEntry(), 0, TEST_PROFILE);
+    if (!Track)
+        return 1;
+    EBML_IntegerSetValue((ebml_integer*)EBML_MasterGetChild(Track, MATROSKA_getContextTrackNumber(), TEST_PROFILE), 1);
+    MATROSKA_TrackSetDefaultDuration((matroska_trackentry*)Track, 40000000, TEST_PROFILE);
+    MATROSKA_TrackSetCompressionNone((matroska_trackentry*)Track);
+
+    Block = (matroska_block*)EBML_ElementCreate(p, MATROSKA_getContextSimpleBlock(), 0, TEST_PROFILE);
+    if (!Block || MATROSKA_LinkBlockReadTrack(Block, Track, 1, TEST_PROFILE)!=ERR_NONE)
+        goto exit;
+    if (MATROSKA_BlockDefaultDuration(Block) != 40000000)
+        goto exit;
+
+    MATROSKA_TrackSetDefaultDuration((matroska_trackentry*)Track, 20000000, TEST_PROFILE);
+    if (MATROSKA_BlockDefaultDuration(Block) != 20000000)
+        goto exit;
+
+    NodeDelete((node*)EBML_MasterFindChild(Track, MATROSKA_getContextDefaultDuration()));
+    if (MATROSKA_BlockDefaultDuration(Block) != INVALID_TIMESTAMP_T)
+        goto exit;
+
+    Elt = EBML_MasterAddElt(Track, MATROSKA_getContextDefaultDuration(), 0, TEST_PROFILE);
+    EBML_IntegerSetValue((ebml_integer*)Elt, 10000000);
+    if (MATROSKA_BlockDefaultDuration(Block) != 10000000)
+        goto exit;
+
+    // the ContentEncodings edited in place and signaled
+    MATROSKA_TrackSetCompressionAlgo((matroska_trackentry*)Track, MATROSKA_CONTENTENCODINGSCOPE_BLOCK, TEST_PROFILE, MATROSKA_TRACK_ENCODING_COMP_ZLIB);
+    if (!MATROSKA_BlockSizeNeedsData(Block))
+        goto exit;
+    Encoding = EBML_MasterFindChild(EBML_MasterFindChild(Track, MATROSKA_getContextContentEncodings()), MATROSKA_getContextContentEncoding());
+    Elt = EBML_MasterFindChild(EBML_MasterFindChild(Encoding, MATROSKA_getContextContentCompression()), MATROSKA_getContextContentCompAlgo());
+    if (!Elt)
+        goto exit;
+    EBML_IntegerSetValue((ebml_integer*)Elt, MATROSKA_TRACK_ENCODING_COMP_HEADERSTRIP); // without bytes to strip
+    MATROSKA_TrackEdited((matroska_trackentry*)Track);
+    if (MATROSKA_BlockSizeNeedsData(Block))
+        goto exit;
+    EBML_IntegerSetValue((ebml_integer*)Elt, MATROSKA_TRACK_ENCODING_COMP_ZLIB);
+    MATROSKA_TrackEdited((matroska_trackentry*)Track);
+    if (!MATROSKA_BlockSizeNeedsData(Block))
+        goto exit;
+    Elt = EBML_MasterGetChild((ebml_master*)Encoding, MATROSKA_getContextContentEncodingScope(), TEST_PROFILE);
+    EBML_IntegerSetValue((ebml_integer*)Elt, MATROSKA_CONTENTENCODINGSCOPE_PRIVATE);
+    MATROSKA_TrackEdited((matroska_trackentry*)Track);
+    if (MATROSKA_BlockSizeNeedsData(Block))
+        goto exit;
+    EBML_IntegerSetValue((ebml_integer*)Elt, MATROSKA_CONTENTENCODINGSCOPE_BLOCK);
+    MATROSKA_TrackEdited((matroska_trackentry*)Track);
+    if (!MATROSKA_BlockSizeNeedsData(Block))
+        goto exit;
+    NodeDelete((node*)Encoding);
+    MATROSKA_TrackEdited((matroska_trackentry*)Track);
+    if (MATROSKA_BlockSizeNeedsData(Block))
+        goto exit;
+    Result = 0;
+
+exit:
+    if (Result)
+        fprintf(stderr, "track edit not seen by the blocks\r\n");
+    if (Block)
+        NodeDelete((node*)Block);
+    NodeDelete((node*)Track);
+    return Result;
+}
+
+// the EBML header, the Segment and its Info, with the Cues if Cues isn't NULL, the Clusters are skipped
+static err_t LoadSegment(struct stream *Input, ebml_element **Head, ebml_element **Segment, ebml_master **Info, ebml_master **Cues)
+{
+    ebml_parser_context Context, SegmentContext;
+    ebml_element *Level1, *Next;
+    int UpperElement = 0;
+    err_t Err = ERR_NONE;
+
+    *Segment = NULL;
+    *Info = NULL;
+    if (Cues)
+        *Cues = NULL;
+    Context.Context = MATROSKA_getContextStream();
+    Context.EndPosition = INVALID_FILEPOS_T;
+    Context.UpContext = NULL;
+    Context.Profile = TEST_PROFILE;
+    *Head = EBML_FindNextElement(Input, &Context, &UpperElement, 0);
+    if (!*Head || EBML_ElementReadData(*Head,Input,&Context,0,SCOPE_ALL_DATA,0)!=ERR_NONE)
+        return ERR_INVALID_DATA;
+    *Segment = EBML_FindNextElement(Input, &Context, &UpperElement, 1);
+    if (!*Segment || !EBML_ElementIsType(*Segment, MATROSKA_getContextSegment()))
+        return ERR_INVALID_DATA;
+
+    SegmentContext.Context = MATROSKA_getContextSegment();
+    SegmentContext.EndPosition = EBML_ElementPositionEnd(*Segment);
+    SegmentContext.UpContext = &Context;
+    SegmentContext.Profile = TEST_PROFILE;
+    Level1 = EBML_FindNextElement(Input, &SegmentContext, &UpperElement, 1);
+    while (Level1 && Err==ERR_NONE)
+    {
+        Next = NULL;
+        if ((!*Info && EBML_ElementIsType(Level1, MATROSKA_getContextInfo())) ||
+            (Cues && !*Cues && EBML_ElementIsType(Level1, MATROSKA_getContextCues())))
+        {
+            Err = EBML_ElementReadData(Level1,Input,&SegmentContext,1,SCOPE_ALL_DATA,0);
+            if (EBML_ElementIsType(Level1, MATROSKA_getContextInfo()))
+                *Info = (ebml_master*)Level1;
+            else
+                *Cues = (ebml_master*)Level1;
+        }
+        else
+        {
+            Next = EBML_ElementSkipData(Level1, Input, &SegmentContext, NULL, 1);
+            NodeDelete((node*)Level1);
+        }
+        Level1 = Next ? Next : EBML_FindNextElement(Input, &SegmentContext, &UpperElement, 1);
+    }
+    if (Level1)
+        NodeDelete((node*)Level1);
+    if (Err==ERR_NONE && !*Info)
+        Err = ERR_INVALID_DATA;
+    return Err;
+}
+
+static void FreeSegment(ebml_element *Head, ebml_element *Segment, ebml_master *Info, ebml_master *Cues)
+{
+    if (Cues)
+        NodeDelete((node*)Cues);
+    if (Info)
+        NodeDelete((node*)Info);
+    if (Segment)
+        NodeDelete((node*)Segment);
+    if (Head)
+        NodeDelete((node*)Head);
+}
+
+static bool_t SameIndex(const matroska_index *a, const matroska_index *b)
+{
+    const matroska_index_cluster *ca, *cb;
+    const matroska_index_key *ka, *kb;
+    if (ARRAYCOUNT(a->Clusters,matroska_index_cluster) != ARRAYCOUNT(b->Clusters,matroska_index_cluster) ||
+        ARRAYCOUNT(a->Keys,matroska_index_key) != ARRAYCOUNT(b->Keys,matroska_index_key))
+        return 0;
+    for (ca=ARRAYBEGIN(a->Clusters,matroska_index_cluster), cb=ARRAYBEGIN(b->Clusters,matroska_index_cluster);ca!=ARRAYEND(a->Clusters,matroska_index_cluster);++ca, ++cb)
+        if (ca->Pos != cb->Pos || ca->Timestamp != cb->Timestamp || ca->FirstKey != cb->FirstKey)
+            return 0;
+    for (ka=ARRAYBEGIN(a->Keys,matroska_index_key), kb=ARRAYBEGIN(b->Keys,matroska_index_key);ka!=ARRAYEND(a->Keys,matroska_index_key);++ka, ++kb)
+        if (ka->Offset != kb->Offset || ka->TrackNum != kb->TrackNum)
+            return 0;
+    return 1;
+}
+
+// the Cluster index finds the keyframes of each track and survives its sidecar file
+static int TestIndex(parsercontext *p, const tchar_t *Path)
+{
+    // a video keyframe every other Cluster
+    static const mkvgen_track Tracks[2] = {
+        {MATROSKA_TRACK_TYPE_VIDEO, "V_MPEG4/ISO/ASP", 40000000, 3000, 1000, 1, 50, MATROSKA_TRACK_ENCODING_COMP_NONE, 0, MKVGEN_SIZE_UNIFORM, 0},
+        {MATROSKA_TRACK_TYPE_AUDIO, "A_MPEG/L3", 24000000, 150, 100, 4, 0, MATROSKA_TRACK_ENCODING_COMP_NONE, 0, MKVGEN_SIZE_UNIFORM, 0},
+    };
+    tchar_t SidecarPath[MAXPATHFULL];
+    mkvgen_stats Stats;
+    matroska_index Index, Loaded;
+    const matroska_index_cluster *Cluster;
+    struct stream *Input = NULL, *Sidecar;
+    ebml_element *Head = NULL, *Segment = NULL;
+    ebml_master *Info = NULL;
+    ebml_binary *UUID;
+    mkv_timestamp_t Timestamp;
+    array Data;
+    size_t Size;
+    const char *Failed = "the index can't be built";
+
+    ArrayInit(&Data);
+    MATROSKA_IndexInit(&Index);
+    MATROSKA_IndexInit(&Loaded);
+    tcscpy_s(SidecarPath, TSIZEOF(SidecarPath), Path);
+    tcscat_s(SidecarPath, TSIZEOF(SidecarPath), T(".idx"));
+
+    if (Generate(p, Path, Tracks, 2, &Stats)!=ERR_NONE)
+        goto exit;
+    Input = StreamOpen(p,Path,SFLAG_RDONLY|SFLAG_BUFFERED);
+    if (!Input || LoadSegment(Input, &Head, &Segment, &Info, NULL)!=ERR_NONE)
+        goto exit;
+    if (MATROSKA_IndexBuild(&Index, Input, Segment, Info, TEST_PROFILE)!=ERR_NONE)
+        goto exit;
+
+    Failed = "the index doesn't match the Clusters";
+    if (ARRAYCOUNT(Index.Clusters,matroska_index_cluster) != Stats.Clusters)
+        goto exit;
+    for (Cluster=ARRAYBEGIN(Index.Clusters,matroska_index_cluster);Cluster!=ARRAYEND(Index.Clusters,matroska_index_cluster);++Cluster)
+        if (!MATROSKA_IndexKeyframe(&Index, Cluster, 2) || (Cluster!=ARRAYBEGIN(Index.Clusters,matroska_index_cluster) && Cluster->Timestamp <= Cluster[-1].Timestamp))
+            goto exit;
+
+    Failed = "the index doesn't find the keyframes";
+    for (Timestamp=0;Timestamp<10000000000;Timestamp+=300000000)
+    {
+        // with 1s Clusters the video keyframes are in the even ones
+        Cluster = MATROSKA_IndexFind(&Index, Timestamp, 1);
+        if (!Cluster || !MATROSKA_IndexKeyframe(&Index, Cluster, 1) || Cluster->Timestamp != Timestamp / 2000000000 * 2000000000)
+            goto exit;
+        Cluster = MATROSKA_IndexFind(&Index, Timestamp, 0);
+        if (!Cluster || Cluster->Timestamp != Timestamp / 1000000000 * 1000000000)
+            goto exit;
+    }
+    if (MATROSKA_IndexFind(&Index, Timestamp, 3))
+        goto exit;
+
+    Failed = "the index sidecar doesn't load";
+    Index.FileSize = Stream_Seek(Input, 0, SEEK_END);
+    Index.FileDate = 1000;
+    Sidecar = StreamOpen(p,SidecarPath,SFLAG_WRONLY|SFLAG_CREATE|SFLAG_BUFFERED);
+    if (!Sidecar)
+        goto exit;
+    if (MATROSKA_IndexWrite(&Index, Sidecar)!=ERR_NONE)
+    {
+        StreamClose(Sidecar);
+        goto exit;
+    }
+    StreamClose(Sidecar);
+    Sidecar = StreamOpen(p,SidecarPath,SFLAG_RDONLY|SFLAG_BUFFERED);
+    if (!Sidecar)
+        goto exit;
+    if (MATROSKA_IndexRead(&Loaded, Sidecar)!=ERR_NONE)
+    {
+        StreamClose(Sidecar);
+        goto exit;
+    }
+    StreamClose(Sidecar);
+    UUID = (ebml_binary*)EBML_MasterFindChild(Info, MATROSKA_getContextSegmentUUID());
+    if (!SameIndex(&Index, &Loaded) || !UUID || !MATROSKA_IndexIsFor(&Loaded, EBML_BinaryGetData(UUID), Index.FileSize, 1000))
+        goto exit;
+    if (MATROSKA_IndexIsFor(&Loaded, EBML_BinaryGetData(UUID), Index.FileSize+1, 1000) || MATROSKA_IndexIsFor(&Loaded, EBML_BinaryGetData(UUID), Index.FileSize, 1001))
+        goto exit;
+
+    // a truncated sidecar is rejected
+    Failed = "a truncated index sidecar loads";
+    Sidecar = StreamOpen(p,SidecarPath,SFLAG_RDONLY|SFLAG_BUFFERED);
+    if (!Sidecar)
+        goto exit;
+    Size = (size_t)Stream_Seek(Sidecar, 0, SEEK_END);
+    Stream_Seek(Sidecar, 0, SEEK_SET);
+    if (!ArrayResize(&Data, Size, 0) || Stream_Read(Sidecar, ARRAYBEGIN(Data,uint8_t), Size, NULL)!=ERR_NONE)
+    {
+        StreamClose(Sidecar);
+        goto exit;
+    }
+    StreamClose(Sidecar);
+    Sidecar = (struct stream*)NodeCreate(p, MEMSTREAM_CLASS);
+    if (!Sidecar)
+        goto exit;
+    Node_Set(Sidecar, MEMSTREAM_DATA, ARRAYBEGIN(Data,uint8_t), Size-3);
+    if (MATROSKA_IndexRead(&Loaded, Sidecar)==ERR_NONE || !ARRAYEMPTY(Loaded.Clusters))
+    {
+        StreamClose(Sidecar);
+        goto exit;
+    }
+    StreamClose(Sidecar);
+
+    // so is one with more Clusters than it holds
+    Failed = "an index sidecar with a wrong count loads";
+    Sidecar = (struct stream*)NodeCreate(p, MEMSTREAM_CLASS);
+    if (!Sidecar)
+        goto exit;
+    memset(ARRAYBEGIN(Data,uint8_t)+40, 0xFF, 4);
+    Node_Set(Sidecar, MEMSTREAM_DATA, ARRAYBEGIN(Data,uint8_t), Size);
+    if (MATROSKA_IndexRead(&Loaded, Sidecar)!=ERR_INVALID_DATA || !ARRAYEMPTY(Loaded.Clusters))
+    {
+        StreamClose(Sidecar);
+        goto exit;
+    }
+    StreamClose(Sidecar);
+    Failed = NULL;
+
+exit:
+    if (Failed)
+        fprintf(stderr, "%s\r\n", Failed);
+    FreeSegment(Head, Segment, Info, NULL);
+    if (Input)
+        StreamClose(Input);
+    MATROSKA_IndexClear(&Index);
+    MATROSKA_IndexClear(&Loaded);
+    FileErase(SidecarPath, 1, 0);
+    ArrayClear(&Data);
+    return Failed != NULL;
+}
+
+typedef struct test_cue
+{
+    int64_t Time; // in ms
+    uint16_t Track;
+    filepos_t Pos;
+    uint16_t Track2; // a second CueTrackPositions when not 0
+    filepos_t Pos2;
+
+} test_cue;
+
+static bool_t FoundCue(const matroska_cue_entry *Entry, int64_t Time, uint16_t Track, filepos_t Pos)
+{
+    return Entry && Entry->Timestamp == Time * 1000000 && Entry->TrackNum == Track && Entry->ClusterPos == Pos;
+}
+
+// the Cues sorted per track in any order, the lookups per track and for all of them
+static int TestCueIndex(parsercontext *p)
+{
+    static const test_cue Points[] = {
+        {0,    1, 100, 2, 100},
+        {2000, 1, 300, 2, 300},
+        {1000, 2, 200, 0, 0},
+        {1000, 1, 250, 0, 0},
+        {3000, 2, 400, 0, 0},
+        {3000, 2, 380, 0, 0},
+        {500,  3, 150, 0, 0},
+    };
+    matroska_cue_index Index;
+    ebml_master *Info, *Cues, *Cue, *Position;
+    const matroska_cue_entry *Entry;
+    size_t i;
+    int Result = 1;
+
+    MATROSKA_CueIndexInit(&Index);
+    Info = (ebml_master*)EBML_ElementCreate(p, MATROSKA_getContextInfo(), 1, TEST_PROFILE);
+    Cues = (ebml_master*)EBML_ElementCreate(p, MATROSKA_getContextCues(), 0, TEST_PROFILE);
+    if (!Info || !Cues)
+        goto exit;
+    for (i=0;i<sizeof(Points)/sizeof(Points[0]);++i)
+    {
+        Cue = (ebml_master*)EBML_MasterAddElt(Cues, MATROSKA_getContextCuePoint(), 0, TEST_PROFILE);
+        if (!Cue)
+            goto exit;
+        MATROSKA_LinkCueSegmentInfo((matroska_cuepoint*)Cue, Info);
+        EBML_IntegerSetValue((ebml_integer*)EBML_MasterAddElt(Cue, MATROSKA_getContextCueTime(), 0, TEST_PROFILE), Points[i].Time);
+        Position = (ebml_master*)EBML_MasterAddElt(Cue, MATROSKA_getContextCueTrackPositions(), 0, TEST_PROFILE);
+        EBML_IntegerSetValue((ebml_integer*)EBML_MasterAddElt(Position, MATROSKA_getContextCueTrack(), 0, TEST_PROFILE), Points[i].Track);
+        EBML_IntegerSetValue((ebml_integer*)EBML_MasterAddElt(Position, MATROSKA_getContextCueClusterPosition(), 0, TEST_PROFILE), Points[i].Pos);
+        if (Points[i].Track2)
+        {
+            Position = (ebml_master*)EBML_MasterAddElt(Cue, MATROSKA_getContextCueTrackPositions(), 0, TEST_PROFILE);
+            EBML_IntegerSetValue((ebml_integer*)EBML_MasterAddElt(Position, MATROSKA_getContextCueTrack(), 0, TEST_PROFILE), Points[i].Track2);
+            EBML_IntegerSetValue((ebml_integer*)EBML_MasterAddElt(Position, MATROSKA_getContextCueClusterPosition(), 0, TEST_PROFILE), Points[i].Pos2);
+        }
+    }
+
+    if (MATROSKA_CueIndexBuild(&Index, Cues)!=ERR_NONE || ARRAYCOUNT(Index.Entries,matroska_cue_entry) != 9)
+        goto exit;
+    for (Entry=ARRAYBEGIN(Index.Entries,matroska_cue_entry);Entry+1<ARRAYEND(Index.Entries,matroska_cue_entry);++Entry)
+        if (Entry[0].TrackNum > Entry[1].TrackNum || (Entry[0].TrackNum == Entry[1].TrackNum && Entry[0].Timestamp > Entry[1].Timestamp))
+            goto exit;
+
+    if (!FoundCue(MATROSKA_CueIndexFind(&Index, 1500000000, 1), 1000, 1, 250) ||
+        !FoundCue(MATROSKA_CueIndexFind(&Index, 1500000000, 2), 1000, 2, 200) ||
+        !FoundCue(MATROSKA_CueIndexFind(&Index, 2000000000, 1), 2000, 1, 300) ||
+        !FoundCue(MATROSKA_CueIndexFind(&Index, 3500000000, 2), 3000, 2, 380) ||
+        !FoundCue(MATROSKA_CueIndexFind(&Index, 600000000, 3), 500, 3, 150) ||
+        MATROSKA_CueIndexFind(&Index, 400000000, 3) ||
+        MATROSKA_CueIndexFind(&Index, 1000000000, 4))
+        goto exit;
+    // any track, the latest entry before the timestamp and the first Cluster for equal ones
+    if (!FoundCue(MATROSKA_CueIndexFind(&Index, 2500000000, 0), 2000, 1, 300) ||
+        !FoundCue(MATROSKA_CueIndexFind(&Index, 700000000, 0), 500, 3, 150) ||
+        !FoundCue(MATROSKA_CueIndexFind(&Index, 1200000000, 0), 1000, 2, 200))
+        goto exit;
+    Result = 0;
+
+exit:
+    if (Result)
+        fprintf(stderr, "the Cue index doesn't match the Cues\r\n");
+    MATROSKA_CueIndexClear(&Index);
+    if (Cues)
+        NodeDelete((node*)Cues);
+    if (Info)
+        NodeDelete((node*)Info);
+    return Result;
+}
+
+#define TEST_CUE_POINTS  40000
+#define TEST_CUE_TRACKS  4
+
+// many Cues with all the tracks in each CuePoint, sorted in a time that doesn't grow with the square of their number
+static int TestCueIndexTracks(parsercontext *p)
+{
+    matroska_cue_index Index;
+    ebml_master *Info, *Cues, *Cue, *Position;
+    const matroska_cue_entry *Entry;
+    size_t i;
+    uint16_t Track;
+    int Result = 1;
+
+    MATROSKA_CueIndexInit(&Index);
+    Info = (ebml_master*)EBML_ElementCreate(p, MATROSKA_getContextInfo(), 1, TEST_PROFILE);
+    Cues = (ebml_master*)EBML_ElementCreate(p, MATROSKA_getContextCues(), 0, TEST_PROFILE);
+    if (!Info || !Cues)
+        goto exit;
+    // from the last one, each added in front to avoid walking the list
+    for (i=TEST_CUE_POINTS;i--;)
+    {
+        Cue = (ebml_master*)EBML_ElementCreate(Cues, MATROSKA_getContextCuePoint(), 0, TEST_PROFILE);
+        if (!Cue)
+            goto exit;
+        NodeTree_SetParent(Cue, Cues, EBML_MasterChildren(Cues));
+        MATROSKA_LinkCueSegmentInfo((matroska_cuepoint*)Cue, Info);
+        EBML_IntegerSetValue((ebml_integer*)EBML_MasterAddElt(Cue, MATROSKA_getContextCueTime(), 0, TEST_PROFILE), (int64_t)i*100);
+        for (Track=1;Track<=TEST_CUE_TRACKS;++Track)
+        {
+            Position = (ebml_master*)EBML_MasterAddElt(Cue, MATROSKA_getContextCueTrackPositions(), 0, TEST_PROFILE);
+            if (!Position)
+                goto exit;
+            EBML_IntegerSetValue((ebml_integer*)EBML_MasterAddElt(Position, MATROSKA_getContextCueTrack(), 0, TEST_PROFILE), Track);
+            EBML_IntegerSetValue((ebml_integer*)EBML_MasterAddElt(Position, MATROSKA_getContextCueClusterPosition(), 0, TEST_PROFILE), (int64_t)i*1000 + Track);
+        }
+    }
+
+    if (MATROSKA_CueIndexBuild(&Index, Cues)!=ERR_NONE || ARRAYCOUNT(Index.Entries,matroska_cue_entry) != TEST_CUE_POINTS*TEST_CUE_TRACKS)
+        goto exit;
+    for (Entry=ARRAYBEGIN(Index.Entries,matroska_cue_entry);Entry+1<ARRAYEND(Index.Entries,matroska_cue_entry);++Entry)
+        if (Entry[0].TrackNum > Entry[1].TrackNum || (Entry[0].TrackNum == Entry[1].TrackNum && Entry[0].Timestamp >= Entry[1].Timestamp))
+            goto exit;
+    for (Track=1;Track<=TEST_CUE_TRACKS;++Track)
+        if (!FoundCue(MATROSKA_CueIndexFind(&Index, 1234567890123, Track), 1234500, Track, 12345000 + Track))
+            goto exit;
+    Result = 0;
+
+exit:
+    if (Result)
+        fprintf(stderr, "the Cue index of several tracks doesn't match the Cues\r\n");
+    MATROSKA_CueIndexClear(&Index);
+    if (Cues)
+        NodeDelete((node*)Cues);
+    if (Info)
+        NodeDelete((node*)Info);
+    return Result;
+}
+
+#define TEST_COPY_FRAMES  4
+#define TEST_COPY_BUFFER  4096
+
+static ebml_master *CreateTrack(parsercontext *p, int Number)
+{
+    ebml_master *Track = (ebml_master*)EBML_ElementCreate(p, MATROSKA_getContextTrackEntry(), 0, TEST_PROFILE);
+    if (Track)
+    {
+        EBML_IntegerSetValue((ebml_integer*)EBML_MasterGetChild(Track, MATROSKA_getContextTrackNumber(), TEST_PROFILE), Number);
+        EBML_IntegerSetValue((ebml_integer*)EBML_MasterGetChild(Track, MATROSKA_getContextTrackType(), TEST_PROFILE), MATROSKA_TRACK_TYPE_AUDIO);
+        MATROSKA_TrackSetCompressionNone((matroska_trackentry*)Track);
+    }
+    return Track;
+}
+
+// the Block rendered in Buffer read back with its header only
+static matroska_block *ReadBlockHead(parsercontext *p, const uint8_t *Buffer, size_t Size, struct stream **Input)
+{
+    ebml_parser_context Context;
+    ebml_element *Block;
+    int UpperElement = 0;
+
+    *Input = (struct stream*)NodeCreate(p, MEMSTREAM_CLASS);
+    if (!*Input)
+        return NULL;
+    Node_Set(*Input, MEMSTREAM_DATA, Buffer, Size);
+    Context.Context = MATROSKA_getContextCluster();
+    Context.EndPosition = Size;
+    Context.UpContext = NULL;
+    Context.Profile = TEST_PROFILE;
+    Block = EBML_FindNextElement(*Input, &Context, &UpperElement, 0);
+    if (Block && (!EBML_ElementIsType(Block, MATROSKA_getContextSimpleBlock()) || EBML_ElementReadData(Block,*Input,&Context,0,SCOPE_PARTIAL_DATA,0)!=ERR_NONE))
+    {
+        NodeDelete((node*)Block);
+        Block = NULL;
+    }
+    return (matroska_block*)Block;
+}
+
+// the first frames of the Block, of 10, 20, 30... bytes from Frames
+static bool_t SameFrames(const matroska_block *Block, const uint8_t *Frames, size_t FrameCount)
+{
+    matroska_frame Frame;
+    size_t i;
+    if (MATROSKA_BlockGetFrameCount(Block) < FrameCount)
+        return 0;
+    for (i=0;i<FrameCount;++i)
+        if (MATROSKA_BlockGetFrame(Block, i, &Frame, 1)!=ERR_NONE || Frame.Size != 10+10*i || memcmp(Frame.Data, Frames + 10*i*(i+1)/2, Frame.Size)!=0)
+            return 0;
+    return 1;
+}
+
+static filepos_t RenderBlock(matroska_block *Block, uint8_t *Buffer, size_t Size)
+{
+    struct stream *Output = (struct stream*)NodeCreate(Block, MEMSTREAM_CLASS);
+    filepos_t Rendered = 0;
+    if (!Output)
+        return 0;
+    Node_Set(Output, MEMSTREAM_DATA, Buffer, Size);
+    if (EBML_ElementRender((ebml_element*)Block, Output, 0, 0, 1, TEST_PROFILE, &Rendered)!=ERR_NONE)
+        Rendered = 0;
+    StreamClose(Output);
+    return Rendered;
+}
+
+// a laced Block written as-is with a track number of another size keeps its frames
+static int TestBlockCopy(parsercontext *p)
+{
+    static uint8_t Frames[10*TEST_COPY_FRAMES*(TEST_COPY_FRAMES+1)/2];
+    static uint8_t Buffer[TEST_COPY_BUFFER], Copied[TEST_COPY_BUFFER];
+    ebml_master *Info, *ReadTrack, *WriteTrack;
+    matroska_block *Block = NULL, *Copy = NULL, *Check = NULL;
+    struct stream *Input = NULL, *CheckInput = NULL;
+    matroska_frame Frame;
+    filepos_t Size, CopiedSize;
+    size_t i;
+    const char *Failed = "the Block can't be created";
+
+    for (i=0;i<sizeof(Frames);++i)
+        Frames[i] = (uint8_t)(i * 7);
+    Info = (ebml_master*)EBML_ElementCreate(p, MATROSKA_getContextInfo(), 1, TEST_PROFILE);
+    ReadTrack = CreateTrack(p, 1);
+    WriteTrack = CreateTrack(p, 200);
+    if (!Info || !ReadTrack || !WriteTrack)
+        goto exit;
+
+    // frames of 10, 20, 30 and 40 bytes, with EBML lacing
+    Block = (matroska_block*)EBML_ElementCreate(p, MATROSKA_getContextSimpleBlock(), 0, TEST_PROFILE);
+    if (!Block || MATROSKA_LinkBlockReadTrack(Block, ReadTrack, 1, TEST_PROFILE)!=ERR_NONE || MATROSKA_LinkBlockReadSegmentInfo(Block, Info, 1)!=ERR_NONE)
+        goto exit;
+    MATROSKA_BlockSetKeyframe(Block, 1);
+    for (i=0;i<TEST_COPY_FRAMES;++i)
+    {
+        Frame.Data = Frames + 10*i*(i+1)/2;
+        Frame.Size = (uint32_t)(10+10*i);
+        Frame.Timestamp = i==0 ? 0 : INVALID_TIMESTAMP_T;
+        Frame.Duration = INVALID_TIMESTAMP_T;
+        if (MATROSKA_BlockAppendFrame(Block, &Frame, 0)!=ERR_NONE)
+            goto exit;
+    }
+    Size = RenderBlock(Block, Buffer, sizeof(Buffer));
+    if (!Size)
+        goto exit;
+
+    Failed = "the Block can't be copied";
+    Copy = ReadBlockHead(p, Buffer, (size_t)Size, &Input);
+    if (!Copy || MATROSKA_LinkBlockReadTrack(Copy, ReadTrack, 0, TEST_PROFILE)!=ERR_NONE || MATROSKA_LinkBlockReadSegmentInfo(Copy, Info, 1)!=ERR_NONE ||
+        MATROSKA_LinkBlockWriteTrack(Copy, WriteTrack, TEST_PROFILE)!=ERR_NONE)
+        goto exit;
+    if (!MATROSKA_BlockCopyData(Copy) || MATROSKA_BlockReadData(Copy, Input, TEST_PROFILE)!=ERR_NONE)
+        goto exit;
+    Failed = "the copied frames don't match";
+    if (MATROSKA_BlockGetFrameCount(Copy) != TEST_COPY_FRAMES || !SameFrames(Copy, Frames, TEST_COPY_FRAMES))
+        goto exit;
+
+    Failed = "the copied Block doesn't render the same frames";
+    CopiedSize = RenderBlock(Copy, Copied, sizeof(Copied));
+    if (CopiedSize != Size + 1) // one more byte for the track number
+        goto exit;
+    Check = ReadBlockHead(p, Copied, (size_t)CopiedSize, &CheckInput);
+    if (!Check || MATROSKA_BlockTrackNum(Check) != 200 || MATROSKA_LinkBlockReadTrack(Check, WriteTrack, 0, TEST_PROFILE)!=ERR_NONE ||
+        MATROSKA_BlockReadData(Check, CheckInput, TEST_PROFILE)!=ERR_NONE || MATROSKA_BlockGetFrameCount(Check) != TEST_COPY_FRAMES ||
+        !SameFrames(Check, Frames, TEST_COPY_FRAMES))
+        goto exit;
+
+    // a frame added to a copied Block is laced with the ones read
+    Failed = "a frame added to a copied Block doesn't match";
+    NodeDelete((node*)Copy);
+    StreamClose(Input);
+    Copy = ReadBlockHead(p, Buffer, (size_t)Size, &Input);
+    if (!Copy || MATROSKA_LinkBlockReadTrack(Copy, ReadTrack, 1, TEST_PROFILE)!=ERR_NONE || MATROSKA_LinkBlockReadSegmentInfo(Copy, Info, 1)!=ERR_NONE ||
+        !MATROSKA_BlockCopyData(Copy) || MATROSKA_BlockReadData(Copy, Input, TEST_PROFILE)!=ERR_NONE)
+        goto exit;
+    Frame.Data = Frames + sizeof(Frames) - 10*TEST_COPY_FRAMES;
+    Frame.Size = 10*TEST_COPY_FRAMES;
+    if (MATROSKA_BlockAppendFrame(Copy, &Frame, 0)!=ERR_NONE || MATROSKA_BlockGetFrameCount(Copy) != TEST_COPY_FRAMES+1 ||
+        !SameFrames(Copy, Frames, TEST_COPY_FRAMES))
+        goto exit;
+    if (MATROSKA_BlockGetFrame(Copy, TEST_COPY_FRAMES, &Frame, 1)!=ERR_NONE || Frame.Size != 10*TEST_COPY_FRAMES ||
+        memcmp(Frame.Data, Frames + sizeof(Frames) - 10*TEST_COPY_FRAMES, Frame.Size)!=0)
+        goto exit;
+    Failed = NULL;
+
+exit:
+    if (Failed)
+        fprintf(stderr, "%s\r\n", Failed);
+    if (Check)
+        NodeDelete((node*)Check);
+    if (CheckInput)
+        StreamClose(CheckInput);
+    if (Copy)
+        NodeDelete((node*)Copy);
+    if (Input)
+        StreamClose(Input);
+    if (Block)
+        NodeDelete((node*)Block);
+    if (WriteTrack)
+        NodeDelete((node*)WriteTrack);
+    if (ReadTrack)
+        NodeDelete((node*)ReadTrack);
+    if (Info)
+        NodeDelete((node*)Info);
+    return Failed != NULL;
+}
+
+#define TEST_DEFLATE_SIZE  (1024*1024)
+
+typedef struct test_frame
+{
+    size_t Offset;
+    uint32_t Size;
+
+} test_frame;
+
+// random data that grows when it's deflated followed by data that deflate well
+static const uint8_t *DeflateData(void)
+{
+    static uint8_t Data[TEST_DEFLATE_SIZE];
+    uint32_t Random = 1;
+    size_t i;
+    for (i=0;i<sizeof(Data)*3/4;++i)
+    {
+        Random = Random * 1103515245 + 12345;
+        Data[i] = (uint8_t)(Random >> 16);
+    }
+    for (;i<sizeof(Data);++i)
+        Data[i] = (uint8_t)(i % 13);
+    return Data;
+}
+
+static bool_t AppendFrames(matroska_block *Block, const uint8_t *Data, const test_frame *Frames, size_t Count)
+{
+    matroska_frame Frame;
+    size_t i;
+    for (i=0;i<Count;++i)
+    {
+        Frame.Data = (uint8_t*)Data + Frames[i].Offset;
+        Frame.Size = Frames[i].Size;
+        Frame.Timestamp = MATROSKA_BlockGetFrameCount(Block)==0 ? 0 : INVALID_TIMESTAMP_T;
+        Frame.Duration = INVALID_TIMESTAMP_T;
+        if (MATROSKA_BlockAppendFrame(Block, &Frame, 0)!=ERR_NONE)
+            return 0;
+    }
+    return 1;
+}
+
+// the Block rendered in Buffer decodes to the frames
+static bool_t RenderedFrames(parsercontext *p, ebml_master *Track, const uint8_t *Buffer, size_t Size, const uint8_t *Data, const test_frame *Frames, size_t Count)
+{
+    struct stream *Input = NULL;
+    matroska_block *Block = ReadBlockHead(p, Buffer, Size, &Input);
+    matroska_frame Frame;
+    bool_t Same = 0;
+    size_t i;
+
+    if (Block && MATROSKA_LinkBlockReadTrack(Block, Track, 0, TEST_PROFILE)==ERR_NONE &&
+        MATROSKA_BlockReadData(Block, Input, TEST_PROFILE)==ERR_NONE && MATROSKA_BlockGetFrameCount(Block)==Count)
+    {
+        for (i=0;i<Count;++i)
+            if (MATROSKA_BlockGetFrame(Block, i, &Frame, 1)!=ERR_NONE || Frame.Size != Frames[i].Size || memcmp(Frame.Data, Data + Frames[i].Offset, Frame.Size)!=0)
+                break;
+        Same = i==Count;
+    }
+    if (Block)
+        NodeDelete((node*)Block);
+    if (Input)
+        StreamClose(Input);
+    return Same;
+}
+
+// the frames deflated for the Block size are the ones written, also after a frame is added
+static int TestBlockDeflate(parsercontext *p)
+{
+    static const test_frame Frames[] = {
+        {0, 380000}, // grows by more than 100 bytes when it's deflated
+        {TEST_DEFLATE_SIZE*3/4, 3000},
+        {TEST_DEFLATE_SIZE*3/4 + 5000, 100000},
+    };
+    static uint8_t Buffer[TEST_DEFLATE_SIZE];
+    const uint8_t *Data = DeflateData();
+    ebml_master *Info, *Track;
+    matroska_block *Block = NULL;
+    filepos_t Size;
+    const char *Failed = "the zlib Block can't be created";
+
+    if (!MATROSKA_GetCodec(MATROSKA_TRACK_ENCODING_COMP_ZLIB))
+    {
+        fprintf(stderr, "zlib is not available, skipped\r\n");
+        return 0;
+    }
+
+    Info = (ebml_master*)EBML_ElementCreate(p, MATROSKA_getContextInfo(), 1, TEST_PROFILE);
+    Track = CreateTrack(p, 1);
+    if (!Info || !Track)
+        goto exit;
+    MATROSKA_TrackSetCompressionAlgo((matroska_trackentry*)Track, MATROSKA_CONTENTENCODINGSCOPE_BLOCK, TEST_PROFILE, MATROSKA_TRACK_ENCODING_COMP_ZLIB);
+    Block = (matroska_block*)EBML_ElementCreate(p, MATROSKA_getContextSimpleBlock(), 0, TEST_PROFILE);
+    if (!Block || MATROSKA_LinkBlockReadTrack(Block, Track, 1, TEST_PROFILE)!=ERR_NONE || MATROSKA_LinkBlockReadSegmentInfo(Block, Info, 1)!=ERR_NONE ||
+        MATROSKA_LinkBlockWriteTrack(Block, Track, TEST_PROFILE)!=ERR_NONE)
+        goto exit;
+    MATROSKA_BlockSetKeyframe(Block, 1);
+    if (!AppendFrames(Block, Data, Frames, 2))
+        goto exit;
+
+    Failed = "the zlib Block doesn't render its frames";
+    Size = RenderBlock(Block, Buffer, sizeof(Buffer));
+    if (!Size || Size != EBML_ElementFullSize((ebml_element*)Block, 0) || !RenderedFrames(p, Track, Buffer, (size_t)Size, Data, Frames, 2))
+        goto exit;
+
+    Failed = "the zlib Block doesn't render a frame added after it was written";
+    if (!AppendFrames(Block, Data, Frames+2, 1))
+        goto exit;
+    Size = RenderBlock(Block, Buffer, sizeof(Buffer));
+    if (!Size || Size != EBML_ElementFullSize((ebml_element*)Block, 0) || !RenderedFrames(p, Track, Buffer, (size_t)Size, Data, Frames, 3))
+        goto exit;
+    Failed = NULL;
+
+exit:
+    if (Failed)
+        fprintf(stderr, "%s\r\n", Failed);
+    if (Block)
+        NodeDelete((node*)Block);
+    if (Track)
+        NodeDelete((node*)Track);
+    if (Info)
+        NodeDelete((node*)Info);
+    return Failed != NULL;
+}
+
+// Blocks of frames that deflate differently decoded one after the other with the state of their track
+static int TestBlockInflate(parsercontext *p)
+{
+    static const test_frame Laced[] = {
+        {0, 50000},
+        {TEST_DEFLATE_SIZE*3/4, 250000}, // about 1000 times smaller when it's deflated
+        {1000, 1000},
+    };
+    static const test_frame Single[] = {
+        {TEST_DEFLATE_SIZE*3/4 + 7, 200000},
+    };
+    static const test_frame Random[] = {
+        {100000, 300000},
+    };
+    static const struct {
+        const test_frame *Frames;
+        size_t Count;
+    } Blocks[] = {
+        {Laced, sizeof(Laced)/sizeof(Laced[0])},
+        {Single, 1},
+        {Random, 1},
+    };
+    static uint8_t Buffer[3][TEST_DEFLATE_SIZE];
+    filepos_t Size[3];
+    const uint8_t *Data = DeflateData();
+    ebml_master *Info, *Track;
+    matroska_block *Block = NULL;
+    size_t i, Round;
+    const char *Failed = "the zlib Blocks can't be created";
+
+    if (!MATROSKA_GetCodec(MATROSKA_TRACK_ENCODING_COMP_ZLIB))
+        return 0;
+
+    Info = (ebml_master*)EBML_ElementCreate(p, MATROSKA_getContextInfo(), 1, TEST_PROFILE);
+    Track = CreateTrack(p, 1);
+    if (!Info || !Track)
+        goto exit;
+    MATROSKA_TrackSetCompressionAlgo((matroska_trackentry*)Track, MATROSKA_CONTENTENCODINGSCOPE_BLOCK, TEST_PROFILE, MATROSKA_TRACK_ENCODING_COMP_ZLIB);
+    for (i=0;i<3;++i)
+    {
+        Block = (matroska_block*)EBML_ElementCreate(p, MATROSKA_getContextSimpleBlock(), 0, TEST_PROFILE);
+        if (!Block || MATROSKA_LinkBlockReadTrack(Block, Track, 1, TEST_PROFILE)!=ERR_NONE || MATROSKA_LinkBlockReadSegmentInfo(Block, Info, 1)!=ERR_NONE ||
+            MATROSKA_LinkBlockWriteTrack(Block, Track, TEST_PROFILE)!=ERR_NONE)
+            goto exit;
+        MATROSKA_BlockSetKeyframe(Block, 1);
+        if (!AppendFrames(Block, Data, Blocks[i].Frames, Blocks[i].Count))
+            goto exit;
+        Size[i] = RenderBlock(Block, Buffer[i], sizeof(Buffer[i]));
+        if (!Size[i])
+            goto exit;
+        NodeDelete((node*)Block);
+        Block = NULL;
+    }
+
+    Failed = "the zlib Blocks don't decode to their frames";
+    for (Round=0;Round<2;++Round)
+        for (i=0;i<3;++i)
+            if (!RenderedFrames(p, Track, Buffer[i], (size_t)Size[i], Data, Blocks[i].Frames, Blocks[i].Count))
+                goto exit;
+    Failed = NULL;
+
+exit:
+    if (Failed)
+        fprintf(stderr, "%s\r\n", Failed);
+    if (Block)
+        NodeDelete((node*)Block);
+    if (Track)
+        NodeDelete((node*)Track);
+    if (Info)
+        NodeDelete((node*)Info);
+    return Failed != NULL;
+}
+
+int main(int argc, const char *argv[])
+{
+    parsercontext p;
+    tchar_t Path[MAXPATHFULL];
+    int Result = 0;
+
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: matroska_test <temp_file>\r\n");
+        return 1;
+    }
+
+    ParserContext_Init(&p,NULL,NULL,NULL);
+    MATROSKA_Init(&p);
+    Node_FromStr(&p,Path,TSIZEOF(Path),argv[1]);
+
+    Result |= TestCodec(&p, Path, MATROSKA_TRACK_ENCODING_COMP_ZLIB, "zlib", 0);
+#if defined(TEST_ZSTD)
+    Result |= TestCodec(&p, Path, MATROSKA_TRACK_ENCODING_COMP_ZSTD, "zstd", 1);
+#else
+    Result |= TestCodec(&p, Path, MATROSKA_TRACK_ENCODING_COMP_ZSTD, "zstd", 0);
+#endif
+    Result |= TestTrackEdit(&p);
+    Result |= TestIndex(&p, Path);
+    Result |= TestCueIndex(&p);
+    Result |= TestCueIndexTracks(&p);
+    Result |= TestBlockCopy(&p);
+    Result |= TestBlockDeflate(&p);
+    Result |= TestBlockInflate(&p);
+
+    MATROSKA_Done(&p);
+    ParserContext_Done(&p);
+    return Result;
+}
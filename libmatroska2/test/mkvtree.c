@@ -278,7 +278,7 @@ int main(int argc, const char *argv[])
 
     // open the file to parse
     Node_FromStr(&p,Path,TSIZEOF(Path),argv[argc-1]);
-    Input = StreamOpen(&p,Path,SFLAG_RDONLY/*|SFLAG_BUFFERED*/);
+    Input = StreamOpen(&p,Path,SFLAG_RDONLY|SFLAG_BUFFERED|SFLAG_MAPPED);
     if (Input == NULL)
         fprintf(stderr, "error: mkvtree cannot open file \"%s\"\r\n",argv[1]);
     else
@@ -288,6 +288,9 @@ int main(int argc, const char *argv[])
         StreamClose(Input);
     }
 
+    // EBML & Matroska ending
+    MATROSKA_Done(&p);
+
     // Core-C ending
     ParserContext_Done(&p);
 
@@ -12,6 +12,8 @@
 #include <corec/helpers/parser/strtypes.h>
 #include <corec/str/str.h>
 #include <corec/helpers/parser/parser.h>
+#include <corec/memheap.h>
+#include <corec/multithread.h>
 
 #if defined(CONFIG_CODEC_HELPER)
 #include "ivorbiscodec.h"
@@ -109,6 +111,8 @@ void DebugMessage(const tchar_t* Msg,...)
 #endif
 
 #define EXTRA_SEEK_SPACE       22
+#define STREAM_SEEK_RESERVE    ((filepos_t)0xFFFFFFFFFFFFFF) // biggest position for the elements written after the SeekHead with --stream
+#define OUTPUT_BUFFER_SIZE     (4*1024*1024) // the elements are written in big chunks, the SeekHead/Cues patches are done in memory when possible
 #define MARKER3D         (block_info*)1
 
 typedef struct block_info
@@ -166,7 +170,9 @@ static size_t ExtraSizeDiff = 0;
 static bool_t Quiet = 0;
 static bool_t Unsafe = 0;
 static bool_t Live = 0;
+static MatroskaTrackEncodingCompAlgo CompressAlgo = MATROSKA_TRACK_ENCODING_COMP_ZLIB; // used for the tracks that are compressed
 static int TotalPhases = 2;
+static int Jobs = 1;
 static int CurrentPhase = 1;
 
 static bool_t MasterError(void *cookie, int type, const tchar_t *ClassName, const ebml_element *i)
@@ -242,7 +248,20 @@ static void ReduceSize(ebml_element *Element)
     }
 }
 
-static bool_t ReadClusterData(ebml_master *Cluster, struct stream *Input)
+// remove MATROSKA_ContextPosition and MATROSKA_ContextPrevSize until supported
+static void RemoveClusterPositions(ebml_master *Cluster)
+{
+    ebml_element *Elt;
+    Elt = EBML_MasterFindChild(Cluster, MATROSKA_getContextPosition());
+    if (Elt)
+        NodeDelete((node*)Elt);
+    Elt = EBML_MasterFindChild(Cluster, MATROSKA_getContextPrevSize());
+    if (Elt)
+        NodeDelete((node*)Elt);
+}
+
+// SizeOnly only reads the Blocks needed to know the Cluster size
+static bool_t ReadClusterData(ebml_master *Cluster, struct stream *Input, bool_t SizeOnly)
 {
     bool_t Changed = 0;
     err_t Result = ERR_NONE;
@@ -257,7 +276,9 @@ static bool_t ReadClusterData(ebml_master *Cluster, struct stream *Input)
             {
                 if (EBML_ElementIsType(GBlock, MATROSKA_getContextBlock()))
                 {
-                    if ((Result = MATROSKA_BlockReadData((matroska_block*)GBlock, Input, SrcProfile))!=ERR_NONE)
+                    if (SizeOnly && !MATROSKA_BlockSizeNeedsData((matroska_block*)GBlock))
+                        break;
+                    if ((Result = MATROSKA_BlockMapData((matroska_block*)GBlock, Input, SrcProfile))!=ERR_NONE)
                     {
                         Changed = 1;
                         NodeDelete((node*)Block);
@@ -268,7 +289,9 @@ static bool_t ReadClusterData(ebml_master *Cluster, struct stream *Input)
         }
         else if (EBML_ElementIsType(Block, MATROSKA_getContextSimpleBlock()))
         {
-            if ((Result = MATROSKA_BlockReadData((matroska_block*)Block, Input, SrcProfile))!=ERR_NONE)
+            if (SizeOnly && !MATROSKA_BlockSizeNeedsData((matroska_block*)Block))
+                continue;
+            if ((Result = MATROSKA_BlockMapData((matroska_block*)Block, Input, SrcProfile))!=ERR_NONE)
             {
                 Changed = 1;
                 NodeDelete((node*)Block);
@@ -301,37 +324,297 @@ static err_t UnReadClusterData(ebml_master *Cluster, bool_t IncludingNotRead)
     return Result;
 }
 
-static void SetClusterPrevSize(array *Clusters, struct stream *Input)
+static cc_lock JobLock;
+
+#define CLUSTERS_PER_JOB  4
+#define MAX_JOBS_PER_CPU  2 // more threads than that only use more memory
+
+// reads the Clusters of a list in order, with --jobs the frames of the next Clusters
+// are encoded by workers while the current ones are processed
+typedef struct cluster_reader
+{
+    struct stream *Input;
+    ebml_master **Begin, **End;
+    ebml_master **Encoded; // the Clusters before are read and encoded
+    ebml_master **Queued;  // the Clusters before are read, the ones from Encoded are encoded by the workers
+    ebml_master **NextJob; // next Cluster for a worker
+    array Changed; // boolmem_t, the Clusters that lost Blocks when read
+    cc_thread *Threads;
+    int Started;
+    bool_t SizeOnly;
+
+} cluster_reader;
+
+static void EncodeClusterFrames(ebml_master *Cluster)
+{
+    ebml_element *Block, *GBlock;
+    for (Block = EBML_MasterChildren(Cluster);Block;Block=EBML_MasterNext(Block))
+    {
+        if (EBML_ElementIsType(Block, MATROSKA_getContextBlockGroup()))
+        {
+            for (GBlock = EBML_MasterChildren(Block);GBlock;GBlock=EBML_MasterNext(GBlock))
+            {
+                if (EBML_ElementIsType(GBlock, MATROSKA_getContextBlock()))
+                {
+                    MATROSKA_BlockEncodeFrames((matroska_block*)GBlock);
+                    break;
+                }
+            }
+        }
+        else if (EBML_ElementIsType(Block, MATROSKA_getContextSimpleBlock()))
+            MATROSKA_BlockEncodeFrames((matroska_block*)Block);
+    }
+}
+
+static void EncodeWorker(cluster_reader *Reader)
 {
     ebml_master **Cluster;
-    ebml_element *Elt, *Elt2;
-    filepos_t ClusterSize = INVALID_FILEPOS_T;
+    for (;;)
+    {
+        LockEnter(&JobLock);
+        Cluster = Reader->NextJob;
+        if (Cluster != Reader->Queued)
+            ++Reader->NextJob;
+        LockLeave(&JobLock);
+        if (Cluster == Reader->Queued)
+            break;
+        EncodeClusterFrames(*Cluster);
+    }
+}
 
-    // Write the Cluster PrevSize
-    for (Cluster = ARRAYBEGIN(*Clusters,ebml_master*);Cluster != ARRAYEND(*Clusters,ebml_master*); ++Cluster)
+static cc_thread_return THREAD_CALL EncodeThread(void *Param)
+{
+    cluster_reader *Reader = Param;
+    EncodeWorker(Reader);
+    MemHeap_ReleaseThread(Node_Context(*Reader->Begin)->NodeHeap);
+    return 0;
+}
+
+static void WaitEncoding(cluster_reader *Reader)
+{
+    int i;
+    for (i=0;i<Reader->Started;++i)
+        ThreadWait(Reader->Threads[i]);
+    Reader->Started = 0;
+    if (Reader->NextJob != Reader->Queued)
+        EncodeWorker(Reader); // no worker could start
+    Reader->Encoded = Reader->Queued;
+}
+
+static void InitClusterReader(cluster_reader *Reader, array *Clusters, struct stream *Input, bool_t SizeOnly)
+{
+    memset(Reader,0,sizeof(*Reader));
+    Reader->Input = Input;
+    Reader->SizeOnly = SizeOnly;
+    Reader->Begin = Reader->Encoded = Reader->Queued = Reader->NextJob = ARRAYBEGIN(*Clusters,ebml_master*);
+    Reader->End = ARRAYEND(*Clusters,ebml_master*);
+    ArrayInit(&Reader->Changed);
+    if (Jobs > 1 && Input)
     {
-        if (Input!=NULL)
-            ReadClusterData(*Cluster,Input);
+        Reader->Threads = calloc(Jobs, sizeof(cc_thread));
+        if (!Reader->Threads || !ArrayResize(&Reader->Changed, (Reader->End - Reader->Begin)*sizeof(boolmem_t), 0))
+        {
+            free(Reader->Threads);
+            Reader->Threads = NULL;
+        }
+        else
+        {
+            ArrayZero(&Reader->Changed);
+            LockInit(&JobLock);
+        }
+    }
+}
 
-        if (ClusterSize != INVALID_FILEPOS_T)
+static void DoneClusterReader(cluster_reader *Reader)
+{
+    if (Reader->Threads)
+    {
+        WaitEncoding(Reader);
+        LockDone(&JobLock);
+        free(Reader->Threads);
+    }
+    ArrayClear(&Reader->Changed);
+}
+
+// read the next Clusters and give them to the workers
+static void QueueClusters(cluster_reader *Reader)
+{
+    ebml_master **Ahead = Reader->Queued + MIN(Reader->End - Reader->Queued, Jobs * CLUSTERS_PER_JOB);
+    for (;Reader->Queued != Ahead; ++Reader->Queued)
+        ARRAYBEGIN(Reader->Changed,boolmem_t)[Reader->Queued - Reader->Begin] = ReadClusterData(*Reader->Queued, Reader->Input, Reader->SizeOnly);
+    while (Reader->NextJob != Reader->Queued && Reader->Started < Jobs && ThreadStart(&Reader->Threads[Reader->Started],EncodeThread,Reader))
+        ++Reader->Started;
+}
+
+// read the Cluster data, returns whether some Blocks were removed
+static bool_t ReadCluster(cluster_reader *Reader, ebml_master **Cluster)
+{
+    if (!Reader->Threads)
+        return ReadClusterData(*Cluster, Reader->Input, Reader->SizeOnly);
+
+    if (Cluster >= Reader->Queued)
+    {
+        // nothing read ahead for this one
+        WaitEncoding(Reader);
+        Reader->Encoded = Reader->Queued = Reader->NextJob = Cluster;
+        QueueClusters(Reader);
+    }
+    if (Cluster >= Reader->Encoded)
+        WaitEncoding(Reader);
+    if (Reader->Queued == Reader->Encoded)
+        QueueClusters(Reader); // encode the next ones while this one is processed
+    return ARRAYBEGIN(Reader->Changed,boolmem_t)[Cluster - Reader->Begin] != 0;
+}
+
+// with --stream the Clusters are read again from their position, a few at a time
+typedef struct cluster_window
+{
+    struct stream *Input;
+    ebml_parser_context *Context;
+    const filepos_t *Next, *End;
+    array Clusters; // ebml_master*, the ones in memory
+
+} cluster_window;
+
+static void InitClusterWindow(cluster_window *Window, const array *Positions, struct stream *Input, ebml_parser_context *Context)
+{
+    Window->Input = Input;
+    Window->Context = Context;
+    Window->Next = ARRAYBEGIN(*Positions,filepos_t);
+    Window->End = ARRAYEND(*Positions,filepos_t);
+    ArrayInit(&Window->Clusters);
+}
+
+static void ReleaseClusterWindow(cluster_window *Window)
+{
+    ebml_master **Cluster;
+    for (Cluster = ARRAYBEGIN(Window->Clusters,ebml_master*);Cluster != ARRAYEND(Window->Clusters,ebml_master*); ++Cluster)
+        NodeDelete((node*)*Cluster);
+    ArrayDrop(&Window->Clusters);
+}
+
+static void DoneClusterWindow(cluster_window *Window)
+{
+    ReleaseClusterWindow(Window);
+    ArrayClear(&Window->Clusters);
+}
+
+// replace the Clusters in memory with the next ones (without the Block data), returns 0 when all have been read
+static bool_t LoadClusterWindow(cluster_window *Window)
+{
+    ebml_master *Cluster;
+    int UpperElement;
+    size_t Count = Jobs * CLUSTERS_PER_JOB; // enough for the workers to encode while the first ones are written
+
+    ReleaseClusterWindow(Window);
+    for (;Window->Next != Window->End && Count; ++Window->Next)
+    {
+        UpperElement = 0;
+        Stream_Seek(Window->Input,*Window->Next,SEEK_SET);
+        Cluster = (ebml_master*)EBML_FindNextElement(Window->Input, Window->Context, &UpperElement, 1);
+        if (!Cluster)
+            continue;
+        if (!EBML_ElementIsType((ebml_element*)Cluster, MATROSKA_getContextCluster()) ||
+            EBML_ElementReadData((ebml_element*)Cluster,Window->Input,Window->Context,1,SCOPE_PARTIAL_DATA,0)!=ERR_NONE ||
+            !ArrayAppend(&Window->Clusters,&Cluster,sizeof(Cluster),64))
         {
-            Elt = EBML_MasterGetChild(*Cluster, MATROSKA_getContextPrevSize(), DstProfile);
-            if (Elt)
-            {
-                EBML_IntegerSetValue((ebml_integer*)Elt, ClusterSize);
-                Elt2 = EBML_MasterFindChild(*Cluster, MATROSKA_getContextTimestamp());
-                if (Elt2)
-                    NodeTree_SetParent(Elt,*Cluster,NodeTree_Next(Elt2));
-                ExtraSizeDiff += (size_t)EBML_ElementFullSize(Elt,0);
-                EBML_ElementUpdateSize(*Cluster,0,1,DstProfile);
-            }
-        } else EBML_ElementUpdateSize(*Cluster,0,1, DstProfile);
-        EBML_ElementSetInfiniteSize((ebml_element*)*Cluster,Live);
-        ClusterSize = EBML_ElementFullSize((ebml_element*)*Cluster,0);
+            NodeDelete((node*)Cluster);
+            continue;
+        }
+        RemoveClusterPositions(Cluster);
+        --Count;
+    }
+    return ARRAYCOUNT(Window->Clusters,ebml_master*) != 0;
+}
+
+// the part of a Cluster size that doesn't depend on its place in the file
+typedef struct cluster_layout
+{
+    ebml_master *Cluster;
+    ebml_integer *PrevSize; // NULL when the Cluster doesn't get the size of the previous one
+    filepos_t BodySize; // data size without the PrevSize
+
+} cluster_layout;
+
+// add the PrevSize element just after the ClusterTimestamp
+static ebml_integer *AddClusterPrevSize(ebml_master *Cluster)
+{
+    ebml_element *Elt;
+    ebml_integer *PrevSize = (ebml_integer*)EBML_MasterGetChild(Cluster, MATROSKA_getContextPrevSize(), DstProfile);
+    if (PrevSize)
+    {
+        EBML_IntegerSetValue(PrevSize, 0);
+        Elt = EBML_MasterFindChild(Cluster, MATROSKA_getContextTimestamp());
+        if (Elt)
+            NodeTree_SetParent(PrevSize,Cluster,NodeTree_Next(Elt));
+    }
+    return PrevSize;
+}
+
+// read the Blocks that need it once to get the size of each Cluster, the layout can then settle without the data
+// only the encoded sizes are kept, the frames are released and encoded again when the Cluster is written
+static err_t MeasureClusters(array *Layout, array *Clusters, bool_t WithPrevSize, struct stream *Input)
+{
+    ebml_master **Cluster;
+    cluster_layout *Item;
+    cluster_reader Reader;
+
+    ArrayInit(Layout);
+    if (!ArrayResize(Layout, ARRAYCOUNT(*Clusters,ebml_master*)*sizeof(cluster_layout), 0))
+        return ERR_OUT_OF_MEMORY;
+
+    InitClusterReader(&Reader, Clusters, Input, 1);
+    for (Cluster = ARRAYBEGIN(*Clusters,ebml_master*), Item = ARRAYBEGIN(*Layout,cluster_layout);Cluster != ARRAYEND(*Clusters,ebml_master*); ++Cluster, ++Item)
+    {
+        if (Input!=NULL)
+            ReadCluster(&Reader,Cluster);
+
+        Item->Cluster = *Cluster;
+        Item->PrevSize = NULL;
+        if (WithPrevSize && Cluster != ARRAYBEGIN(*Clusters,ebml_master*))
+            Item->PrevSize = AddClusterPrevSize(*Cluster);
+        Item->BodySize = EBML_ElementUpdateSize(*Cluster,0,1, DstProfile);
+        if (Item->PrevSize)
+            Item->BodySize -= EBML_ElementFullSize((ebml_element*)Item->PrevSize,0);
 
         if (Input!=NULL)
             UnReadClusterData(*Cluster, 0);
     }
+    DoneClusterReader(&Reader);
+    return ERR_NONE;
+}
+
+// set the size of the previous Cluster in the layout, returns the full size of the Cluster
+static filepos_t LayoutClusterSize(cluster_layout *Item, filepos_t PrevSize)
+{
+    filepos_t DataSize = Item->BodySize;
+    if (Item->PrevSize)
+    {
+        EBML_IntegerSetValue(Item->PrevSize, PrevSize);
+        EBML_ElementUpdateSize(Item->PrevSize,0,0, DstProfile);
+        ExtraSizeDiff += (size_t)EBML_ElementFullSize((ebml_element*)Item->PrevSize,0);
+        DataSize += EBML_ElementFullSize((ebml_element*)Item->PrevSize,0);
+    }
+    EBML_ElementForceDataSize((ebml_element*)Item->Cluster, DataSize);
+    return EBML_ElementFullSize((ebml_element*)Item->Cluster,0);
+}
+
+static err_t SetClusterPrevSize(array *Clusters, struct stream *Input)
+{
+    cluster_layout *Item;
+    filepos_t ClusterSize = INVALID_FILEPOS_T;
+    array Layout;
+
+    // Write the Cluster PrevSize
+    if (MeasureClusters(&Layout, Clusters, 1, Input)!=ERR_NONE)
+        return ERR_OUT_OF_MEMORY;
+    for (Item = ARRAYBEGIN(Layout,cluster_layout);Item != ARRAYEND(Layout,cluster_layout); ++Item)
+    {
+        EBML_ElementSetInfiniteSize((ebml_element*)Item->Cluster,Live);
+        ClusterSize = LayoutClusterSize(Item, ClusterSize);
+    }
+    ArrayClear(&Layout);
+    return ERR_NONE;
 }
 
 static void UpdateCues(ebml_master *Cues, ebml_master *Segment)
@@ -349,51 +632,34 @@ static void UpdateCues(ebml_master *Cues, ebml_master *Segment)
     }
 }
 
-static void SettleClustersWithCues(array *Clusters, filepos_t ClusterStart, ebml_master *Cues, ebml_master *Segment, bool_t SafeClusters, struct stream *Input)
+static err_t SettleClustersWithCues(array *Clusters, filepos_t ClusterStart, ebml_master *Cues, ebml_master *Segment, bool_t SafeClusters, struct stream *Input)
 {
-    ebml_element *Elt, *Elt2;
-    ebml_master **Cluster;
-    filepos_t OriginalSize = EBML_ElementDataSize((ebml_element*)Cues,0);
-    filepos_t ClusterPos = ClusterStart + EBML_ElementFullSize((ebml_element*)Cues,0);
-    filepos_t ClusterSize = INVALID_FILEPOS_T;
+    cluster_layout *Item;
+    filepos_t OriginalSize, ClusterPos, ClusterSize;
+    array Layout;
 
-    // reposition all the Clusters
-    for (Cluster=ARRAYBEGIN(*Clusters,ebml_master*);Cluster!=ARRAYEND(*Clusters,ebml_master*);++Cluster)
-    {
-        if (Input!=NULL)
-            ReadClusterData(*Cluster,Input);
+    if (MeasureClusters(&Layout, Clusters, SafeClusters, Input)!=ERR_NONE)
+        return ERR_OUT_OF_MEMORY;
 
-        EBML_ElementForcePosition((ebml_element*)*Cluster, ClusterPos);
-        if (SafeClusters)
+    // reposition all the Clusters until the Cues size doesn't change anymore
+    do
+    {
+        OriginalSize = EBML_ElementDataSize((ebml_element*)Cues,0);
+        ClusterPos = ClusterStart + EBML_ElementFullSize((ebml_element*)Cues,0);
+        ClusterSize = INVALID_FILEPOS_T;
+        for (Item = ARRAYBEGIN(Layout,cluster_layout);Item != ARRAYEND(Layout,cluster_layout); ++Item)
         {
-            Elt = NULL;
-            if (ClusterSize != INVALID_FILEPOS_T)
-            {
-                Elt = EBML_MasterGetChild(*Cluster, MATROSKA_getContextPrevSize(), DstProfile);
-                if (Elt)
-                {
-                    EBML_IntegerSetValue((ebml_integer*)Elt, ClusterSize);
-                    Elt2 = EBML_MasterFindChild(*Cluster, MATROSKA_getContextTimestamp());
-                    if (Elt2)
-                        NodeTree_SetParent(Elt,*Cluster,NodeTree_Next(Elt2)); // make sure the PrevSize is just after the ClusterTimestamp
-                    ExtraSizeDiff += (size_t)EBML_ElementFullSize(Elt,0);
-                }
-            }
+            EBML_ElementForcePosition((ebml_element*)Item->Cluster, ClusterPos);
+            ClusterSize = LayoutClusterSize(Item, ClusterSize);
+            ClusterPos += ClusterSize;
         }
-        EBML_ElementUpdateSize(*Cluster,0,0, DstProfile);
-        ClusterSize = EBML_ElementFullSize((ebml_element*)*Cluster,0);
-        ClusterPos += ClusterSize;
 
-        if (Input!=NULL)
-            UnReadClusterData(*Cluster, 0);
+        UpdateCues(Cues, Segment);
     }
+    while (EBML_ElementUpdateSize(Cues,0,0, DstProfile) != OriginalSize);
 
-    UpdateCues(Cues, Segment);
-
-    ClusterPos = EBML_ElementUpdateSize(Cues,0,0, DstProfile);
-    if (ClusterPos != OriginalSize)
-        SettleClustersWithCues(Clusters,ClusterStart,Cues,Segment, SafeClusters, Input);
-
+    ArrayClear(&Layout);
+    return ERR_NONE;
 }
 
 static void ShowProgress(const ebml_element *RCluster, filepos_t TotalSize)
@@ -408,40 +674,164 @@ static void EndProgress(void)
         TextPrintf(StdErr,T("Progress %d/%d: 100%%\r\n"), CurrentPhase, TotalPhases);
 }
 
-static matroska_cluster **LinkCueCluster(matroska_cuepoint *Cue, array *Clusters, matroska_cluster **StartCluster, filepos_t TotalSize)
+#define CUE_CLUSTER_BOOST  7 // number of Clusters after the previous Cue where the next one is usually found
+
+// a Block of a track, each track is sorted by timestamp and then by order in the file
+typedef struct block_entry
 {
-    matroska_cluster **Cluster;
+    mkv_timestamp_t Timestamp;
     matroska_block *Block;
-    uint16_t CueTrack;
-    mkv_timestamp_t CueTimestamp;
-    size_t StartBoost = 7;
+    size_t Cluster; // index in the Clusters
+    size_t Order;   // starts at 1 in the track
+    bool_t Keyframe;
 
-    CueTrack = MATROSKA_CueTrackNum(Cue);
-    CueTimestamp = MATROSKA_CueTimestamp(Cue);
-    ++CurrentPhase;
-    if (StartCluster)
+} block_entry;
+
+typedef struct track_blocks
+{
+    array Blocks; // block_entry
+    bool_t Indexed;
+
+} track_blocks;
+
+// the Blocks of each track, sorted by timestamp when the track is first looked up
+typedef struct block_index
+{
+    array *Clusters;
+    array Tracks; // track_blocks, by track number
+
+} block_index;
+
+static int BlockEntryCmp(const void* UNUSED_PARAM(Param), const void *va, const void *vb)
+{
+    const block_entry *a = va;
+    const block_entry *b = vb;
+    if (a->Timestamp != b->Timestamp)
+        return a->Timestamp > b->Timestamp ? 1 : -1;
+    if (a->Order != b->Order)
+        return a->Order > b->Order ? 1 : -1;
+    return 0;
+}
+
+// qsort() order, ArraySort() is quadratic for entries this big
+static int BlockEntrySort(const void *va, const void *vb)
+{
+    return BlockEntryCmp(NULL, va, vb);
+}
+
+static void InitBlockIndex(block_index *Index, array *Clusters)
+{
+    Index->Clusters = Clusters;
+    ArrayInit(&Index->Tracks);
+}
+
+static void DoneBlockIndex(block_index *Index)
+{
+    track_blocks *Track;
+    for (Track=ARRAYBEGIN(Index->Tracks,track_blocks);Track!=ARRAYEND(Index->Tracks,track_blocks);++Track)
+        ArrayClear(&Track->Blocks);
+    ArrayClear(&Index->Tracks);
+}
+
+static const array *TrackBlocks(block_index *Index, uint16_t TrackNum)
+{
+    track_blocks *Track;
+    ebml_element **Cluster, *Elt, *EltB, *BlockRef;
+    block_entry Entry;
+
+    if (TrackNum >= ARRAYCOUNT(Index->Tracks,track_blocks))
+    {
+        size_t Count = ARRAYCOUNT(Index->Tracks,track_blocks);
+        if (!ArrayResize(&Index->Tracks,sizeof(track_blocks)*(TrackNum+1),0))
+            return NULL;
+        memset(ARRAYBEGIN(Index->Tracks,track_blocks)+Count,0,sizeof(track_blocks)*(TrackNum+1-Count));
+    }
+    Track = ARRAYBEGIN(Index->Tracks,track_blocks) + TrackNum;
+    if (Track->Indexed)
+        return &Track->Blocks;
+
+    Entry.Order = 0;
+    for (Cluster = ARRAYBEGIN(*Index->Clusters,ebml_element*);Cluster != ARRAYEND(*Index->Clusters,ebml_element*); ++Cluster)
     {
-        for (Cluster=StartCluster;StartBoost && Cluster!=ARRAYEND(*Clusters,matroska_cluster*);++Cluster,--StartBoost)
+        Entry.Cluster = Cluster - ARRAYBEGIN(*Index->Clusters,ebml_element*);
+        for (Elt = EBML_MasterChildren(*Cluster); Elt; Elt = EBML_MasterNext(Elt))
         {
-            Block = MATROSKA_GetBlockForTimestamp(*Cluster, CueTimestamp, CueTrack);
-            if (Block)
+            Entry.Block = NULL;
+            if (EBML_ElementIsType(Elt, MATROSKA_getContextSimpleBlock()))
             {
-                MATROSKA_LinkCuePointBlock(Cue,Block);
-                ShowProgress((ebml_element*)(*Cluster),TotalSize);
-                return Cluster;
+                Entry.Block = (matroska_block*)Elt;
+                Entry.Keyframe = MATROSKA_BlockKeyframe(Entry.Block);
+            }
+            else if (EBML_ElementIsType(Elt, MATROSKA_getContextBlockGroup()))
+            {
+                BlockRef = NULL;
+                for (EltB = EBML_MasterChildren(Elt); EltB; EltB = EBML_MasterNext(EltB))
+                {
+                    if (EBML_ElementIsType(EltB, MATROSKA_getContextBlock()))
+                        Entry.Block = (matroska_block*)EltB;
+                    else if (EBML_ElementIsType(EltB, MATROSKA_getContextReferenceBlock()))
+                        BlockRef = EltB;
+                }
+                Entry.Keyframe = BlockRef==NULL;
+            }
+
+            if (Entry.Block && MATROSKA_BlockTrackNum(Entry.Block) == TrackNum)
+            {
+                Entry.Timestamp = MATROSKA_BlockTimestamp(Entry.Block);
+                ++Entry.Order;
+                if (!ArrayAppend(&Track->Blocks,&Entry,sizeof(Entry),1024))
+                    return NULL;
             }
         }
     }
+    qsort(ARRAYBEGIN(Track->Blocks,block_entry), ARRAYCOUNT(Track->Blocks,block_entry), sizeof(block_entry), BlockEntrySort);
+    Track->Indexed = 1;
+    return &Track->Blocks;
+}
 
-    for (Cluster=ARRAYBEGIN(*Clusters,matroska_cluster*);Cluster!=ARRAYEND(*Clusters,matroska_cluster*);++Cluster)
+// find the first Block with the timestamp, preferably in the CUE_CLUSTER_BOOST Clusters from StartCluster
+static const block_entry *FindTrackBlock(block_index *Index, uint16_t TrackNum, mkv_timestamp_t Timestamp, const matroska_cluster **StartCluster)
+{
+    const array *Blocks = TrackBlocks(Index, TrackNum);
+    const block_entry *Entry, *First;
+    block_entry Key;
+    size_t Start;
+    bool_t Found;
+
+    if (!Blocks)
+        return NULL;
+
+    Key.Timestamp = Timestamp;
+    Key.Order = 0; // before all the Blocks with that timestamp
+    First = ARRAYBEGIN(*Blocks,block_entry) + ArrayFind(Blocks,block_entry,&Key,BlockEntryCmp,NULL,&Found);
+    if (First == ARRAYEND(*Blocks,block_entry) || First->Timestamp != Timestamp)
+        return NULL;
+
+    if (StartCluster)
     {
-        Block = MATROSKA_GetBlockForTimestamp(*Cluster, CueTimestamp, CueTrack);
-        if (Block)
-        {
-            MATROSKA_LinkCuePointBlock(Cue,Block);
-            ShowProgress((ebml_element*)(*Cluster),TotalSize);
-            return Cluster;
-        }
+        Start = StartCluster - ARRAYBEGIN(*Index->Clusters,const matroska_cluster*);
+        for (Entry = First;Entry != ARRAYEND(*Blocks,block_entry) && Entry->Timestamp == Timestamp;++Entry)
+            if (Entry->Cluster >= Start && Entry->Cluster < Start + CUE_CLUSTER_BOOST)
+                return Entry;
+    }
+    return First;
+}
+
+static matroska_cluster **LinkCueCluster(matroska_cuepoint *Cue, block_index *Index, matroska_cluster **StartCluster, filepos_t TotalSize)
+{
+    matroska_cluster **Cluster;
+    const block_entry *Entry;
+    mkv_timestamp_t CueTimestamp;
+
+    CueTimestamp = MATROSKA_CueTimestamp(Cue);
+    ++CurrentPhase;
+    Entry = FindTrackBlock(Index, MATROSKA_CueTrackNum(Cue), CueTimestamp, (const matroska_cluster**)StartCluster);
+    if (Entry)
+    {
+        Cluster = ARRAYBEGIN(*Index->Clusters,matroska_cluster*) + Entry->Cluster;
+        MATROSKA_LinkCuePointBlock(Cue,Entry->Block);
+        ShowProgress((ebml_element*)(*Cluster),TotalSize);
+        return Cluster;
     }
 
     TextPrintf(StdErr,T("Could not find the matching block for timestamp %0.3f s\r\n"),CueTimestamp/1000000000.0);
@@ -528,10 +918,59 @@ static int LinkClusters(array *Clusters, ebml_master *RSegmentInfo, ebml_master
     return 0;
 }
 
-static void OptimizeCues(ebml_master *Cues, array *Clusters, ebml_master *RSegmentInfo, filepos_t StartPos, ebml_master *WSegment, filepos_t TotalSize, bool_t ReLink, bool_t SafeClusters, struct stream *Input)
+static void LinkClusterWriteTracks(ebml_master *Cluster, ebml_master *WTrackInfo, ebml_master *WSegmentInfo)
+{
+    ebml_element *Elt, *Elt2, *NextElt;
+    //EBML_MasterUseChecksum(Cluster,!Unsafe);
+    for (Elt = EBML_MasterChildren(Cluster);Elt;Elt=NextElt)
+    {
+        NextElt = EBML_MasterNext(Elt);
+        if (EBML_ElementIsType(Elt, MATROSKA_getContextBlockGroup()))
+        {
+            for (Elt2 = EBML_MasterChildren((ebml_master*)Elt);Elt2;Elt2=EBML_MasterNext((ebml_master*)Elt2))
+            {
+                if (EBML_ElementIsType(Elt2, MATROSKA_getContextBlock()))
+                {
+                    if (MATROSKA_LinkBlockWithWriteTracks((matroska_block*)Elt2,WTrackInfo,DstProfile)!=ERR_NONE)
+                        NodeDelete((node*)Elt);
+                    else if (MATROSKA_LinkBlockWriteSegmentInfo((matroska_block*)Elt2,WSegmentInfo)!=ERR_NONE)
+                        NodeDelete((node*)Elt);
+                    break;
+                }
+            }
+        }
+        else if (EBML_ElementIsType(Elt, MATROSKA_getContextSimpleBlock()))
+        {
+            if (MATROSKA_LinkBlockWithWriteTracks((matroska_block*)Elt,WTrackInfo,DstProfile)!=ERR_NONE)
+                NodeDelete((node*)Elt);
+            else if (MATROSKA_LinkBlockWriteSegmentInfo((matroska_block*)Elt,WSegmentInfo)!=ERR_NONE)
+                NodeDelete((node*)Elt);
+        }
+    }
+}
+
+// the Blocks stored the same way in the output are copied from the input without decoding their frames
+static void CopyClusterBlocks(ebml_master *Cluster)
+{
+    ebml_element *Block, *GBlock;
+    for (Block = EBML_MasterChildren(Cluster);Block;Block=EBML_MasterNext(Block))
+    {
+        if (EBML_ElementIsType(Block, MATROSKA_getContextBlockGroup()))
+        {
+            GBlock = EBML_MasterFindChild((ebml_master*)Block, MATROSKA_getContextBlock());
+            if (GBlock)
+                MATROSKA_BlockCopyData((matroska_block*)GBlock);
+        }
+        else if (EBML_ElementIsType(Block, MATROSKA_getContextSimpleBlock()))
+            MATROSKA_BlockCopyData((matroska_block*)Block);
+    }
+}
+
+static err_t OptimizeCues(ebml_master *Cues, array *Clusters, ebml_master *RSegmentInfo, filepos_t StartPos, ebml_master *WSegment, filepos_t TotalSize, bool_t ReLink, bool_t SafeClusters, struct stream *Input)
 {
     matroska_cluster **Cluster;
     matroska_cuepoint *Cue;
+    block_index Index;
 
     ReduceSize((ebml_element*)Cues);
 
@@ -542,16 +981,18 @@ static void OptimizeCues(ebml_master *Cues, array *Clusters, ebml_master *RSegme
             MATROSKA_LinkCueSegmentInfo(Cue,RSegmentInfo);
 
         // link each Cue entry to the corresponding Block/SimpleBlock in the Cluster
+        InitBlockIndex(&Index, Clusters);
         Cluster = NULL;
         for (Cue = (matroska_cuepoint*)EBML_MasterChildren(Cues);Cue;Cue=(matroska_cuepoint*)EBML_MasterNext(Cue))
-            Cluster = LinkCueCluster(Cue,Clusters,Cluster,TotalSize);
+            Cluster = LinkCueCluster(Cue,&Index,Cluster,TotalSize);
+        DoneBlockIndex(&Index);
         EndProgress();
     }
 
     // sort the Cues
     MATROSKA_CuesSort(Cues);
 
-    SettleClustersWithCues(Clusters,StartPos,Cues,WSegment,SafeClusters, Input);
+    return SettleClustersWithCues(Clusters,StartPos,Cues,WSegment,SafeClusters, Input);
 }
 
 static ebml_element *CheckMatroskaHead(const ebml_element *Head, const ebml_parser_context *Parser, struct stream *Input)
@@ -654,11 +1095,12 @@ static ebml_element *CheckMatroskaHead(const ebml_element *Head, const ebml_pars
     return NULL;
 }
 
-static bool_t WriteCluster(ebml_master *Cluster, struct stream *Output, struct stream *Input, filepos_t PrevSize, mkv_timestamp_t *PrevTimestamp)
+static bool_t WriteCluster(ebml_master **ClusterPos, struct stream *Output, cluster_reader *Reader, filepos_t PrevSize, mkv_timestamp_t *PrevTimestamp)
 {
+    ebml_master *Cluster = *ClusterPos;
     filepos_t IntendedPosition = EBML_ElementPosition((ebml_element*)Cluster);
     ebml_element *Elt;
-    bool_t CuesChanged = ReadClusterData(Cluster, Input);
+    bool_t CuesChanged = ReadCluster(Reader, ClusterPos);
 
     if (*PrevTimestamp != INVALID_TIMESTAMP_T)
     {
@@ -752,11 +1194,14 @@ static bool_t GenerateCueEntries(ebml_master *Cues, array *Clusters, ebml_master
 {
     ebml_master *Track;
     ebml_element *Elt;
-    matroska_block *Block;
     ebml_element **Cluster;
     matroska_cuepoint *CuePoint;
     int64_t TrackNum = INT64_MAX;
-    mkv_timestamp_t PrevTimestamp = INVALID_TIMESTAMP_T, BlockTimestamp;
+    mkv_timestamp_t PrevTimestamp = INVALID_TIMESTAMP_T;
+    block_index Index;
+    const array *Blocks;
+    const block_entry *Entry, **FirstKey;
+    array FirstKeys;
 
     Track = GetMainTrack(Tracks, NULL);
     if (!Track)
@@ -770,56 +1215,51 @@ static bool_t GenerateCueEntries(ebml_master *Cues, array *Clusters, ebml_master
     if (Elt)
         TrackNum = EBML_IntegerValue((ebml_integer*)Elt);
 
-    // find all the keyframes
+    // find the first keyframe of the track in each Cluster
+    InitBlockIndex(&Index, Clusters);
+    ArrayInit(&FirstKeys);
+    if (!ArrayResize(&FirstKeys, ARRAYCOUNT(*Clusters,ebml_element*)*sizeof(block_entry*), 0))
+    {
+        TextPrintf(StdErr,T("Failed to create a new CuePoint ! out of memory ?\r\n"));
+        return 0;
+    }
+    ArrayZero(&FirstKeys);
+    FirstKey = ARRAYBEGIN(FirstKeys,const block_entry*);
+    Blocks = (TrackNum >= 0 && TrackNum <= 0xFFFF) ? TrackBlocks(&Index, (uint16_t)TrackNum) : NULL;
+    if (Blocks)
+    {
+        for (Entry = ARRAYBEGIN(*Blocks,block_entry);Entry != ARRAYEND(*Blocks,block_entry); ++Entry)
+            if (Entry->Keyframe && (!FirstKey[Entry->Cluster] || Entry->Order < FirstKey[Entry->Cluster]->Order))
+                FirstKey[Entry->Cluster] = Entry;
+    }
+
     ++CurrentPhase;
-    for (Cluster = ARRAYBEGIN(*Clusters,ebml_element*);Cluster != ARRAYEND(*Clusters,ebml_element*); ++Cluster)
+    for (Cluster = ARRAYBEGIN(*Clusters,ebml_element*);Cluster != ARRAYEND(*Clusters,ebml_element*); ++Cluster, ++FirstKey)
     {
         ShowProgress((ebml_element*)(*Cluster), TotalSize);
         MATROSKA_LinkClusterWriteSegmentInfo((matroska_cluster*)*Cluster,WSegmentInfo);
-        for (Elt = EBML_MasterChildren(*Cluster); Elt; Elt = EBML_MasterNext(Elt))
-        {
-            Block = NULL;
-            if (EBML_ElementIsType(Elt, MATROSKA_getContextSimpleBlock()))
-            {
-                if (MATROSKA_BlockKeyframe((matroska_block*)Elt))
-                    Block = (matroska_block*)Elt;
-            }
-            else if (EBML_ElementIsType(Elt, MATROSKA_getContextBlockGroup()))
-            {
-                ebml_element *EltB, *BlockRef = NULL;
-                for (EltB = EBML_MasterChildren(Elt); EltB; EltB = EBML_MasterNext(EltB))
-                {
-                    if (EBML_ElementIsType(EltB, MATROSKA_getContextBlock()))
-                        Block = (matroska_block*)EltB;
-                    else if (EBML_ElementIsType(EltB, MATROSKA_getContextReferenceBlock()))
-                        BlockRef = EltB;
-                }
-                if (BlockRef && Block)
-                    Block = NULL; // not a keyframe
-            }
-
-            if (Block && MATROSKA_BlockTrackNum(Block) == TrackNum)
-            {
-                BlockTimestamp = MATROSKA_BlockTimestamp(Block);
-                if ((BlockTimestamp - PrevTimestamp) < 800000000 && PrevTimestamp != INVALID_TIMESTAMP_T)
-                    break; // no more than 1 Cue per Cluster and per 800 ms
-
-                CuePoint = (matroska_cuepoint*)EBML_MasterAddElt(Cues,MATROSKA_getContextCuePoint(),1,DstProfile);
-                if (!CuePoint)
-                {
-                    TextPrintf(StdErr,T("Failed to create a new CuePoint ! out of memory ?\r\n"));
-                    return 0;
-                }
-                MATROSKA_LinkCueSegmentInfo(CuePoint,WSegmentInfo);
-                MATROSKA_LinkCuePointBlock(CuePoint,Block);
-                MATROSKA_CuePointUpdate(CuePoint,RSegment, DstProfile);
-
-                PrevTimestamp = BlockTimestamp;
+        Entry = *FirstKey;
+        if (!Entry)
+            continue;
+        if ((Entry->Timestamp - PrevTimestamp) < 800000000 && PrevTimestamp != INVALID_TIMESTAMP_T)
+            continue; // no more than 1 Cue per Cluster and per 800 ms
 
-                break; // one Cues per Cluster is enough
-            }
+        CuePoint = (matroska_cuepoint*)EBML_MasterAddElt(Cues,MATROSKA_getContextCuePoint(),1,DstProfile);
+        if (!CuePoint)
+        {
+            TextPrintf(StdErr,T("Failed to create a new CuePoint ! out of memory ?\r\n"));
+            ArrayClear(&FirstKeys);
+            DoneBlockIndex(&Index);
+            return 0;
         }
+        MATROSKA_LinkCueSegmentInfo(CuePoint,WSegmentInfo);
+        MATROSKA_LinkCuePointBlock(CuePoint,Entry->Block);
+        MATROSKA_CuePointUpdate(CuePoint,RSegment, DstProfile);
+
+        PrevTimestamp = Entry->Timestamp;
     }
+    ArrayClear(&FirstKeys);
+    DoneBlockIndex(&Index);
     EndProgress();
 
     if (!EBML_MasterChildren(Cues))
@@ -832,6 +1272,50 @@ static bool_t GenerateCueEntries(ebml_master *Cues, array *Clusters, ebml_master
     return 1;
 }
 
+// with --stream, add the Cue of a Cluster once it's written, with the same rules as GenerateCueEntries()
+static void AddClusterCue(ebml_master *Cues, ebml_master *Cluster, int64_t TrackNum, ebml_master *WSegmentInfo, ebml_master *WSegment, mkv_timestamp_t *PrevTimestamp)
+{
+    ebml_element *Elt, *EltB;
+    matroska_block *Block = NULL;
+    matroska_cuepoint *CuePoint;
+    mkv_timestamp_t Timestamp;
+
+    // the first keyframe of the track in the Cluster
+    for (Elt = EBML_MasterChildren(Cluster); Elt && !Block; Elt = EBML_MasterNext(Elt))
+    {
+        if (EBML_ElementIsType(Elt, MATROSKA_getContextSimpleBlock()))
+        {
+            if (MATROSKA_BlockTrackNum((matroska_block*)Elt) == TrackNum && MATROSKA_BlockKeyframe((matroska_block*)Elt))
+                Block = (matroska_block*)Elt;
+        }
+        else if (EBML_ElementIsType(Elt, MATROSKA_getContextBlockGroup()) && !EBML_MasterFindChild(Elt, MATROSKA_getContextReferenceBlock()))
+        {
+            EltB = EBML_MasterFindChild(Elt, MATROSKA_getContextBlock());
+            if (EltB && MATROSKA_BlockTrackNum((matroska_block*)EltB) == TrackNum)
+                Block = (matroska_block*)EltB;
+        }
+    }
+    if (!Block)
+        return;
+
+    Timestamp = MATROSKA_BlockTimestamp(Block);
+    if ((Timestamp - *PrevTimestamp) < 800000000 && *PrevTimestamp != INVALID_TIMESTAMP_T)
+        return; // no more than 1 Cue per Cluster and per 800 ms
+
+    CuePoint = (matroska_cuepoint*)EBML_MasterAddElt(Cues,MATROSKA_getContextCuePoint(),1,DstProfile);
+    if (!CuePoint)
+        return;
+    MATROSKA_LinkCueSegmentInfo(CuePoint,WSegmentInfo);
+    MATROSKA_LinkCuePointBlock(CuePoint,Block);
+    if (MATROSKA_CuePointUpdate(CuePoint,(ebml_element*)WSegment, DstProfile)!=ERR_NONE)
+        NodeDelete((node*)CuePoint);
+    else
+    {
+        MATROSKA_LinkCuePointBlock(CuePoint,NULL); // the Cluster is not kept
+        *PrevTimestamp = Timestamp;
+    }
+}
+
 static int TimcodeCmp(const void* UNUSED_PARAM(Param), const void *va, const void *vb)
 {
     const mkv_timestamp_t *a = va;
@@ -1424,7 +1908,7 @@ static bool_t BlockIsCompressed(const matroska_block *Block)
                     return 1; // we don't support encryption
 
                 Elt = (ebml_master*)EBML_MasterGetChild(Elt, MATROSKA_getContextContentCompAlgo(), DstProfile);
-                if (Elt!=NULL && EBML_IntegerValue((ebml_integer*)Elt)==MATROSKA_TRACK_ENCODING_COMP_ZLIB)
+                if (Elt!=NULL && (EBML_IntegerValue((ebml_integer*)Elt)==MATROSKA_TRACK_ENCODING_COMP_ZLIB || EBML_IntegerValue((ebml_integer*)Elt)==MATROSKA_TRACK_ENCODING_COMP_ZSTD))
                     return 1;
             }
         }
@@ -1432,6 +1916,23 @@ static bool_t BlockIsCompressed(const matroska_block *Block)
     return 0;
 }
 
+// size of Data compressed with CompressAlgo, 0 if it can't be compressed
+static size_t CompressedDataSize(const uint8_t *Data, size_t Size)
+{
+    const matroska_codec *Codec = MATROSKA_GetCodec(CompressAlgo);
+    size_t OutSize;
+    uint8_t *Out;
+
+    if (!Codec || !Codec->Encode)
+        return 0;
+    OutSize = Codec->Bound(Size);
+    Out = malloc(OutSize);
+    if (!Out || Codec->Encode(Data, Size, Out, &OutSize)!=ERR_NONE)
+        OutSize = 0;
+    free(Out);
+    return OutSize;
+}
+
 static void ShrinkCommonHeader(array *TrackHeader, matroska_block *Block, struct stream *Input)
 {
     size_t Frame,FrameCount,EqualData;
@@ -1439,7 +1940,7 @@ static void ShrinkCommonHeader(array *TrackHeader, matroska_block *Block, struct
 
     if (TrackHeader->_Begin != TABLE_MARKER && ARRAYCOUNT(*TrackHeader,uint8_t)==0)
         return;
-    if (MATROSKA_BlockReadData(Block,Input,SrcProfile)!=ERR_NONE)
+    if (MATROSKA_BlockMapData(Block,Input,SrcProfile)!=ERR_NONE)
         return;
 
     if (BlockIsCompressed(Block))
@@ -1474,6 +1975,29 @@ static void ShrinkCommonHeader(array *TrackHeader, matroska_block *Block, struct
     MATROSKA_BlockReleaseData(Block,1);
 }
 
+static void ShrinkClusterHeaders(ebml_master *Cluster, array *TrackMaxHeader, struct stream *Input)
+{
+    ebml_element *Block, *GBlock;
+    int16_t BlockTrack;
+    for (Block = EBML_MasterChildren(Cluster);Block;Block=EBML_MasterNext(Block))
+    {
+        if (EBML_ElementIsType(Block, MATROSKA_getContextBlockGroup()))
+        {
+            GBlock = EBML_MasterFindChild((ebml_master*)Block, MATROSKA_getContextBlock());
+            if (GBlock)
+            {
+                BlockTrack = MATROSKA_BlockTrackNum((matroska_block*)GBlock);
+                ShrinkCommonHeader(ARRAYBEGIN(*TrackMaxHeader,array)+BlockTrack, (matroska_block*)GBlock, Input);
+            }
+        }
+        else if (EBML_ElementIsType(Block, MATROSKA_getContextSimpleBlock()))
+        {
+            BlockTrack = MATROSKA_BlockTrackNum((matroska_block *)Block);
+            ShrinkCommonHeader(ARRAYBEGIN(*TrackMaxHeader,array)+BlockTrack, (matroska_block*)Block, Input);
+        }
+    }
+}
+
 static void ClearCommonHeader(array *TrackHeader)
 {
     if (TrackHeader->_Begin == TABLE_MARKER)
@@ -1497,6 +2021,7 @@ int main(int argc, const char *argv[])
     int ShowUsage = 0;
     int ShowVersion = 0;
     parsercontext p;
+    cc_memheap *NodeHeap;
     textwriter _StdErr;
     struct stream *Input = NULL,*Output = NULL;
     tchar_t Path[MAXPATHFULL];
@@ -1516,16 +2041,23 @@ int main(int argc, const char *argv[])
     size_t ExtraVoidSize = 0;
     mkv_timestamp_t PrevTimestamp;
     bool_t CuesChanged;
-    bool_t KeepCues = 0, Remux = 0, CuesCreated = 0, Optimize = 0, OptimizeVideo = 1, UnOptimize = 0, ClustersNeedRead = 0, Regression = 0;
+    cluster_reader ClusterReader;
+    bool_t KeepCues = 0, Remux = 0, CuesCreated = 0, Optimize = 0, OptimizeVideo = 1, UnOptimize = 0, ClustersNeedRead = 0, Regression = 0, Stream = 0;
     int InputPathIndex = 1;
     int64_t TimestampScale = 0, OldTimestampScale;
     size_t MaxTrackNum = 0;
     array TrackMaxHeader; // array of uint8_t (max common header)
     filepos_t TotalSize;
     array Alternate3DTracks;
+    array ClusterPositions; // with --stream, the Clusters are not kept in memory
+    cluster_window ClusterWindow;
+    ebml_element *FirstCluster = NULL;
+    matroska_seekpoint *WCuesSeek = NULL;
+    int64_t CueTrack = -1;
 
     // Core-C init phase
-    ParserContext_Init(&p,NULL,NULL,NULL);
+    NodeHeap = MemHeap_CreateSlab(); // the default heap is used if it fails
+    ParserContext_Init(&p,NULL,NodeHeap,NULL);
     Node_SetData(&p.Base.Base.Base,NODECONTEXT_PROJECT_VENDOR,TYPE_STRING,"Matroska");
     Node_SetData(&p.Base.Base.Base,NODECONTEXT_PROJECT_VERSION,TYPE_STRING,PROJECT_VERSION);
     Node_SetData(&p.Base.Base.Base,NODECONTEXT_PROJECT_NAME,TYPE_STRING,PROJECT_NAME);
@@ -1538,6 +2070,8 @@ int main(int argc, const char *argv[])
     ArrayInit(&WTracks);
     ArrayInit(&TrackMaxHeader);
     ArrayInit(&Alternate3DTracks);
+    ArrayInit(&ClusterPositions);
+    ArrayInit(&ClusterWindow.Clusters);
     Clusters = &RClusters;
 
     StdErr = &_StdErr;
@@ -1562,6 +2096,7 @@ int main(int argc, const char *argv[])
         if (tcsisame_ascii(Path,T("--keep-cues"))) { KeepCues = 1; InputPathIndex = i+1; }
         else if (tcsisame_ascii(Path,T("--remux"))) { Remux = 1; InputPathIndex = i+1; }
         else if (tcsisame_ascii(Path,T("--live"))) { Live = 1; InputPathIndex = i+1; }
+        else if (tcsisame_ascii(Path,T("--stream"))) { Stream = 1; InputPathIndex = i+1; }
         else if (tcsisame_ascii(Path,T("--doctype")) && i+1<argc-1)
         {
 #if defined(TARGET_WIN) && defined(UNICODE)
@@ -1592,6 +2127,41 @@ int main(int argc, const char *argv[])
             }
             InputPathIndex = i+1;
         }
+        else if (tcsisame_ascii(Path,T("--compress")) && i+1<argc-1)
+        {
+#if defined(TARGET_WIN) && defined(UNICODE)
+            Node_FromWcs(&p,Path,TSIZEOF(Path),argv[++i]);
+#else
+            Node_FromStr(&p,Path,TSIZEOF(Path),argv[++i]);
+#endif
+            if (tcsisame_ascii(Path,T("zlib")))
+                CompressAlgo = MATROSKA_TRACK_ENCODING_COMP_ZLIB;
+            else if (tcsisame_ascii(Path,T("zstd")) && MATROSKA_GetCodec(MATROSKA_TRACK_ENCODING_COMP_ZSTD))
+                CompressAlgo = MATROSKA_TRACK_ENCODING_COMP_ZSTD;
+            else
+            {
+                TextPrintf(StdErr,T("Unknown compression %s\r\n"),Path);
+                Path[0] = 0;
+                Result = -8;
+                goto exit;
+            }
+            InputPathIndex = i+1;
+        }
+        else if (tcsisame_ascii(Path,T("--jobs")) && i+1<argc-1)
+        {
+#if defined(TARGET_WIN) && defined(UNICODE)
+            Node_FromWcs(&p,Path,TSIZEOF(Path),argv[++i]);
+#else
+            Node_FromStr(&p,Path,TSIZEOF(Path),argv[++i]);
+#endif
+            Jobs = MAX(1,StringToInt(Path,0));
+            if (Jobs > MAX_JOBS_PER_CPU * ThreadCPUCount())
+            {
+                TextPrintf(StdErr,T("--jobs %d is limited to %d threads on this computer\r\n"),Jobs,MAX_JOBS_PER_CPU * ThreadCPUCount());
+                Jobs = MAX_JOBS_PER_CPU * ThreadCPUCount();
+            }
+            InputPathIndex = i+1;
+        }
         else if (tcsisame_ascii(Path,T("--timecodescale")) && i+1<argc-1)
         {
 #if defined(TARGET_WIN) && defined(UNICODE)
@@ -1648,7 +2218,14 @@ int main(int argc, const char *argv[])
             TextWrite(StdErr,T("    5: 'matroska' v1 with DivX extensions\r\n"));
             TextWrite(StdErr,T("    6: 'matroska' v4\r\n"));
             TextWrite(StdErr,T("  --live        the output file resembles a live stream\r\n"));
+            TextWrite(StdErr,T("  --stream      write the Clusters as they are read, with the Cues at the end\r\n"));
+            TextWrite(StdErr,T("                (low memory use for big files, --keep-cues has no effect)\r\n"));
+            TextWrite(StdErr,T("  --compress <v> compression of the compressed tracks\r\n"));
+            TextWrite(StdErr,T("    zlib: the default\r\n"));
+            if (MATROSKA_GetCodec(MATROSKA_TRACK_ENCODING_COMP_ZSTD))
+                TextWrite(StdErr,T("    zstd: faster to decode but not in the Matroska specifications\r\n"));
             TextWrite(StdErr,T("  --timecodescale <v> force the global TimestampScale to <v> (1000000 is a good value)\r\n"));
+            TextWrite(StdErr,T("  --jobs <n>    encode the frames of the compressed tracks with <n> threads, at most twice the number of CPUs\r\n"));
             TextWrite(StdErr,T("  --unsafe      don't output elements that are used for file recovery (saves more space)\r\n"));
             TextWrite(StdErr,T("  --optimize    use all possible optimization for the output file\r\n"));
             TextWrite(StdErr,T("  --optimize_nv use all possible optimization for the output file, except video tracks\r\n"));
@@ -1664,12 +2241,20 @@ int main(int argc, const char *argv[])
         goto exit;
     }
 
+    if (Stream && (Remux || ARRAYCOUNT(Alternate3DTracks, block_info*)))
+    {
+        TextWrite(StdErr,T("--stream can't be used to remux the Clusters\r\n"));
+        Path[0] = 0;
+        Result = -9;
+        goto exit;
+    }
+
 #if defined(TARGET_WIN) && defined(UNICODE)
     Node_FromWcs(&p,Path,TSIZEOF(Path),argv[InputPathIndex]);
 #else
     Node_FromUTF8(&p,Path,TSIZEOF(Path),argv[InputPathIndex]);
 #endif
-    Input = StreamOpen(&p,Path,SFLAG_RDONLY/*|SFLAG_BUFFERED*/);
+    Input = StreamOpen(&p,Path,SFLAG_RDONLY|SFLAG_BUFFERED|SFLAG_MAPPED);
     if (!Input)
     {
         TextPrintf(StdErr,T("Could not open file \"%s\" for reading\r\n"),Path);
@@ -1703,13 +2288,18 @@ int main(int argc, const char *argv[])
 #else
         Node_FromStr(&p,Path,TSIZEOF(Path),argv[argc-1]);
 #endif
-    Output = StreamOpen(&p,Path,SFLAG_WRONLY|SFLAG_CREATE);
+    Output = StreamOpen(&p,Path,SFLAG_WRONLY|SFLAG_CREATE|SFLAG_BUFFERED);
     if (!Output)
     {
         TextPrintf(StdErr,T("Could not open file \"%s\" for writing\r\n"),Path);
         Result = -3;
         goto exit;
     }
+    else
+    {
+        size_t BufferSize = OUTPUT_BUFFER_SIZE;
+        Node_SET(Output,BUFSTREAM_SIZE,&BufferSize);
+    }
 
     // parse the source file to determine if it's a Matroska file and determine the location of the key parts
     RContext.Context = MATROSKA_getContextStream();
@@ -1755,6 +2345,8 @@ int main(int argc, const char *argv[])
         ++TotalPhases;
     if (!Live)
         ++TotalPhases;
+    if (Stream)
+        TotalPhases = (Optimize && !UnOptimize) ? 4 : 3; // read, link, common headers, write
 
     if (EBML_ElementPositionEnd((ebml_element*)RSegment) != INVALID_FILEPOS_T)
         TotalSize = EBML_ElementPositionEnd((ebml_element*)RSegment);
@@ -1792,7 +2384,7 @@ int main(int argc, const char *argv[])
             if (EBML_ElementReadData(RLevel1,Input,&RSegmentContext,1,SCOPE_ALL_DATA,0)==ERR_NONE)
                 RTags = RLevel1;
         }
-        else if (!Live && EBML_ElementIsType((ebml_element*)RLevel1, MATROSKA_getContextCues()) && KeepCues)
+        else if (!Live && EBML_ElementIsType((ebml_element*)RLevel1, MATROSKA_getContextCues()) && KeepCues && !Stream)
         {
             if (EBML_ElementReadData(RLevel1,Input,&RSegmentContext,1,SCOPE_ALL_DATA,0)==ERR_NONE)
                 RCues = RLevel1;
@@ -1802,20 +2394,26 @@ int main(int argc, const char *argv[])
             if (EBML_ElementReadData(RLevel1,Input,&RSegmentContext,1,SCOPE_ALL_DATA,0)==ERR_NONE)
                 RAttachments = RLevel1;
         }
+        else if (Stream && EBML_ElementIsType((ebml_element*)RLevel1, MATROSKA_getContextCluster()))
+        {
+            // only keep the position, the Cluster is read again when it's needed
+            filepos_t ClusterStart = EBML_ElementPosition((ebml_element*)RLevel1);
+            if (EBML_ElementIsFiniteSize((ebml_element*)RLevel1) || EBML_ElementReadData((ebml_element*)RLevel1,Input,&RSegmentContext,1,SCOPE_PARTIAL_DATA,0)==ERR_NONE)
+                ArrayAppend(&ClusterPositions,&ClusterStart,sizeof(ClusterStart),256);
+            EbmlHead = (ebml_master*)EBML_ElementSkipData((ebml_element*)RLevel1, Input, &RSegmentContext, NULL, 1);
+            NodeDelete((node*)RLevel1);
+            RLevel1 = EbmlHead;
+            EbmlHead = NULL;
+            if (RLevel1 != NULL)
+                continue;
+        }
         else if (EBML_ElementIsType((ebml_element*)RLevel1, MATROSKA_getContextCluster()))
         {
             // only partially read the Cluster data (not the data inside the blocks)
             if (EBML_ElementReadData((ebml_element*)RLevel1,Input,&RSegmentContext,!Remux,SCOPE_PARTIAL_DATA,0)==ERR_NONE)
             {
                 ArrayAppend(&RClusters,&RLevel1,sizeof(RLevel1),256);
-                // remove MATROSKA_ContextPosition and MATROSKA_ContextPrevSize until supported
-                EbmlHead = (ebml_master*)EBML_MasterFindChild(RLevel1, MATROSKA_getContextPosition());
-                if (EbmlHead)
-                    NodeDelete((node*)EbmlHead);
-                EbmlHead = (ebml_master*)EBML_MasterFindChild(RLevel1, MATROSKA_getContextPrevSize());
-                if (EbmlHead)
-                    NodeDelete((node*)EbmlHead);
-                EbmlHead = NULL;
+                RemoveClusterPositions(RLevel1);
                 RLevel1 = (ebml_master*)EBML_ElementSkipData((ebml_element*)RLevel1, Input, &RSegmentContext, NULL, 1);
                 if (RLevel1 != NULL)
                     continue;
@@ -1885,7 +2483,7 @@ int main(int argc, const char *argv[])
     if (Elt)
         NodeTree_SetParent(Elt,WSegmentInfo,Elt2);
 
-    if (!RTrackInfo && ARRAYCOUNT(RClusters,ebml_element*))
+    if (!RTrackInfo && (ARRAYCOUNT(RClusters,ebml_element*) || ARRAYCOUNT(ClusterPositions,filepos_t)))
     {
         TextWrite(StdErr,T("The source Segment has no Track Info section\r\n"));
         Result = -7;
@@ -2183,42 +2781,28 @@ int main(int argc, const char *argv[])
     if (Result!=0)
         goto exit;
 
-    // use the output track settings for each block
-    for (Cluster = ARRAYBEGIN(*Clusters,ebml_master*);Cluster != ARRAYEND(*Clusters,ebml_master*); ++Cluster)
+    if (Stream)
     {
-        //EBML_MasterUseChecksum((ebml_master*)*Cluster,!Unsafe);
-        for (Elt = EBML_MasterChildren(*Cluster);Elt;Elt=(ebml_element*)RLevel1)
+        // go through the Clusters once to know the tracks that use lacing
+        ++CurrentPhase;
+        InitClusterWindow(&ClusterWindow, &ClusterPositions, Input, &RSegmentContext);
+        while (Result==0 && LoadClusterWindow(&ClusterWindow))
         {
-            RLevel1 = (ebml_master*)EBML_MasterNext((ebml_master*)Elt);
-            if (EBML_ElementIsType(Elt, MATROSKA_getContextBlockGroup()))
-            {
-                for (Elt2 = EBML_MasterChildren((ebml_master*)Elt);Elt2;Elt2=EBML_MasterNext((ebml_master*)Elt2))
-                {
-                    if (EBML_ElementIsType(Elt2, MATROSKA_getContextBlock()))
-                    {
-                        if (MATROSKA_LinkBlockWithWriteTracks((matroska_block*)Elt2,WTrackInfo,DstProfile)!=ERR_NONE)
-                            NodeDelete((node*)Elt);
-                        else if (MATROSKA_LinkBlockWriteSegmentInfo((matroska_block*)Elt2,WSegmentInfo)!=ERR_NONE)
-                            NodeDelete((node*)Elt);
-                        break;
-                    }
-                }
-            }
-            else if (EBML_ElementIsType(Elt, MATROSKA_getContextSimpleBlock()))
-            {
-                if (MATROSKA_LinkBlockWithWriteTracks((matroska_block*)Elt,WTrackInfo,DstProfile)!=ERR_NONE)
-                    NodeDelete((node*)Elt);
-                else if (MATROSKA_LinkBlockWriteSegmentInfo((matroska_block*)Elt,WSegmentInfo)!=ERR_NONE)
-                    NodeDelete((node*)Elt);
-            }
+            ShowProgress(ARRAYBEGIN(ClusterWindow.Clusters,ebml_element*)[0], TotalSize);
+            Result = LinkClusters(&ClusterWindow.Clusters,RSegmentInfo,RTrackInfo,DstProfile, &WTracks, INVALID_TIMESTAMP_T);
         }
-        //EBML_ElementUpdateSize(*Cluster, 0, 0);
+        DoneClusterWindow(&ClusterWindow);
+        if (Result!=0)
+            goto exit;
+        EndProgress();
     }
 
+    // use the output track settings for each block
+    for (Cluster = ARRAYBEGIN(*Clusters,ebml_master*);Cluster != ARRAYEND(*Clusters,ebml_master*); ++Cluster)
+        LinkClusterWriteTracks(*Cluster, WTrackInfo, WSegmentInfo);
+
     if (Optimize && !UnOptimize)
     {
-        int16_t BlockTrack;
-        ebml_element *Block, *GBlock;
         matroska_cluster **ClusterR;
 
         if (!Quiet) TextWrite(StdErr,T("Optimizing...\r\n"));
@@ -2238,8 +2822,7 @@ int main(int argc, const char *argv[])
                     Elt = EBML_MasterFindChild(Track,MATROSKA_getContextTrackType());
                     if (EBML_IntegerValue((ebml_integer*)Elt) == MATROSKA_TRACK_TYPE_VIDEO)
                     {
-                        Elt = EBML_MasterFindChild(Track,MATROSKA_getContextContentEncodings());
-                        NodeDelete((node*)Elt);
+                        MATROSKA_TrackSetCompressionNone((matroska_trackentry*)Track);
                         OptimizeTrack = 0;
                     }
                     break;
@@ -2250,24 +2833,28 @@ int main(int argc, const char *argv[])
         }
 
         for (ClusterR=ARRAYBEGIN(RClusters,matroska_cluster*);ClusterR!=ARRAYEND(RClusters,matroska_cluster*);++ClusterR)
+            ShrinkClusterHeaders((ebml_master*)*ClusterR, &TrackMaxHeader, Input);
+
+        if (Stream)
         {
-            for (Block = EBML_MasterChildren(*ClusterR);Block;Block=EBML_MasterNext(Block))
+            ++CurrentPhase;
+            InitClusterWindow(&ClusterWindow, &ClusterPositions, Input, &RSegmentContext);
+            while (Result==0 && LoadClusterWindow(&ClusterWindow))
             {
-                if (EBML_ElementIsType(Block, MATROSKA_getContextBlockGroup()))
-                {
-                    GBlock = EBML_MasterFindChild((ebml_master*)Block, MATROSKA_getContextBlock());
-                    if (GBlock)
-                    {
-                        BlockTrack = MATROSKA_BlockTrackNum((matroska_block*)GBlock);
-                        ShrinkCommonHeader(ARRAYBEGIN(TrackMaxHeader,array)+BlockTrack, (matroska_block*)GBlock, Input);
-                    }
-                }
-                else if (EBML_ElementIsType(Block, MATROSKA_getContextSimpleBlock()))
-                {
-                    BlockTrack = MATROSKA_BlockTrackNum((matroska_block *)Block);
-                    ShrinkCommonHeader(ARRAYBEGIN(TrackMaxHeader,array)+BlockTrack, (matroska_block*)Block, Input);
-                }
+                ShowProgress(ARRAYBEGIN(ClusterWindow.Clusters,ebml_element*)[0], TotalSize);
+                Result = LinkClusters(&ClusterWindow.Clusters,RSegmentInfo,RTrackInfo,DstProfile, &WTracks, INVALID_TIMESTAMP_T);
+                if (Result==0)
+                    for (ClusterR=ARRAYBEGIN(ClusterWindow.Clusters,matroska_cluster*);ClusterR!=ARRAYEND(ClusterWindow.Clusters,matroska_cluster*);++ClusterR)
+                        ShrinkClusterHeaders((ebml_master*)*ClusterR, &TrackMaxHeader, Input);
             }
+            DoneClusterWindow(&ClusterWindow);
+            if (Result!=0)
+            {
+                for (i=0;(size_t)i<=MaxTrackNum;++i)
+                    ClearCommonHeader(ARRAYBEGIN(TrackMaxHeader,array)+i);
+                goto exit;
+            }
+            EndProgress();
         }
 
         for (i=0;(size_t)i<=MaxTrackNum;++i)
@@ -2550,7 +3137,7 @@ int main(int argc, const char *argv[])
                         {
                             // relacing
                             //TextPrintf(StdErr,T("\rRelacing block track %d at %") TPRId64 T(" ends %") TPRId64 T(" next cluster at %") TPRId64 T("\r\n"),*pTrackOrder,pBlockInfo->DecodeTime,BlockEnd,MasterEndTimestamp);
-                            if (MATROSKA_BlockReadData(pBlockInfo->Block,Input,SrcProfile)==ERR_NONE)
+                            if (MATROSKA_BlockMapData(pBlockInfo->Block,Input,SrcProfile)==ERR_NONE)
                             {
                                 bool_t HasDuration = MATROSKA_BlockProcessFrameDurations(pBlockInfo->Block,Input,SrcProfile)==ERR_NONE;
                                 RemuxErr = ERR_NONE;
@@ -2645,7 +3232,7 @@ int main(int argc, const char *argv[])
                                 }
                                 else
                                 {
-                                    RemuxErr = MATROSKA_BlockReadData(prevBlock->Block,Input,SrcProfile);
+                                    RemuxErr = MATROSKA_BlockMapData(prevBlock->Block,Input,SrcProfile);
                                 }
                             }
 
@@ -2654,7 +3241,7 @@ int main(int argc, const char *argv[])
                                 // add the first frame into the previous Block
                                 if (RemuxErr==ERR_NONE)
                                 {
-                                    RemuxErr = MATROSKA_BlockReadData(pBlockInfo->Block,Input,SrcProfile);
+                                    RemuxErr = MATROSKA_BlockMapData(pBlockInfo->Block,Input,SrcProfile);
                                     if (EBML_ElementIsType((ebml_element*)pBlockInfo->Block, MATROSKA_getContextSimpleBlock()))
                                     {
                                         Block1 = (matroska_block*)pBlockInfo->Block;
@@ -2774,7 +3361,7 @@ int main(int argc, const char *argv[])
                     EBML_StringGet((ebml_string*)Elt,CodecID,TSIZEOF(CodecID));
                     if (tcsisame_ascii(CodecID,T("S_USF")) || tcsisame_ascii(CodecID,T("S_VOBSUB")) || tcsisame_ascii(CodecID,T("S_HDMV/PGS")) || tcsisame_ascii(CodecID,T("B_VOBBTN"))
                         || tcsisame_ascii(CodecID,T("V_UNCOMPRESSED"))|| tcsstr(CodecID,T("A_PCM"))==CodecID)
-                        encoding = MATROSKA_TRACK_ENCODING_COMP_ZLIB;
+                        encoding = CompressAlgo;
                     else
                     {
                         // don't keep the zlib compression on compressed codecs
@@ -2809,25 +3396,23 @@ int main(int argc, const char *argv[])
                     if (CodecPrivate!=NULL)
                     {
                         size_t ExtraCompHeaderBytes = (encoding == MATROSKA_TRACK_ENCODING_COMP_NONE) ? 13 : 3; // extra bytes needed to add the comp header to the track
-                        size_t CompressedSize = (size_t)EBML_ElementDataSize((ebml_element*)CodecPrivate, 1);
-                        size_t origCompressedSize = CompressedSize;
-                        uint8_t *Compressed = malloc(CompressedSize);
-                        if (CompressFrameZLib(EBML_BinaryGetData(CodecPrivate), origCompressedSize, &Compressed, &CompressedSize)==ERR_NONE
-                            && (CompressedSize + ExtraCompHeaderBytes) < origCompressedSize)
+                        size_t origCompressedSize = (size_t)EBML_ElementDataSize((ebml_element*)CodecPrivate, 1);
+                        size_t CompressedSize = CompressedDataSize(EBML_BinaryGetData(CodecPrivate), origCompressedSize);
+                        if (CompressedSize && (CompressedSize + ExtraCompHeaderBytes) < origCompressedSize)
                         {
-                            encoding = MATROSKA_TRACK_ENCODING_COMP_ZLIB;
+                            encoding = CompressAlgo;
                             compress_scope |= MATROSKA_CONTENTENCODINGSCOPE_PRIVATE;
                         }
-                        free(Compressed);
                     }
                 }
 
-                switch (encoding)
+                switch ((int)encoding) // zstd is not part of the enum
                 {
                 case MATROSKA_TRACK_ENCODING_COMP_ZLIB:
-                case MATROSKA_TRACK_ENCODING_COMP_BZLIB: // transform bzlib into zlib
-                case MATROSKA_TRACK_ENCODING_COMP_LZO1X: // transform lzo1x into zlib
-                    if (MATROSKA_TrackSetCompressionAlgo((matroska_trackentry*)RLevel1, compress_scope,DstProfile, MATROSKA_TRACK_ENCODING_COMP_ZLIB))
+                case MATROSKA_TRACK_ENCODING_COMP_ZSTD:
+                case MATROSKA_TRACK_ENCODING_COMP_BZLIB: // transform bzlib into CompressAlgo
+                case MATROSKA_TRACK_ENCODING_COMP_LZO1X: // transform lzo1x into CompressAlgo
+                    if (MATROSKA_TrackSetCompressionAlgo((matroska_trackentry*)RLevel1, compress_scope,DstProfile, CompressAlgo))
                         ClustersNeedRead = 1;
                     break;
                 case MATROSKA_TRACK_ENCODING_COMP_HEADERSTRIP:
@@ -2859,10 +3444,29 @@ int main(int argc, const char *argv[])
         }
     }
 
+    for (Cluster = ARRAYBEGIN(*Clusters,ebml_master*);Cluster != ARRAYEND(*Clusters,ebml_master*); ++Cluster)
+        CopyClusterBlocks(*Cluster);
+
     if (!Live)
     {
         // cues
-        if (ARRAYCOUNT(*Clusters,ebml_element*) < 2)
+        if (Stream)
+        {
+            // the Cues are generated while the Clusters are written and go after them
+            if (WTrackInfo && ARRAYCOUNT(ClusterPositions,filepos_t) > 1)
+            {
+                Elt = (ebml_element*)GetMainTrack(WTrackInfo, NULL);
+                if (Elt)
+                    Elt = EBML_MasterFindChild((ebml_master*)Elt,MATROSKA_getContextTrackNumber());
+                if (Elt)
+                {
+                    CueTrack = EBML_IntegerValue((ebml_integer*)Elt);
+                    RCues = (ebml_master*)EBML_ElementCreate(&p,MATROSKA_getContextCues(),0, DstProfile);
+                    EBML_MasterUseChecksum(RCues,!Unsafe);
+                }
+            }
+        }
+        else if (ARRAYCOUNT(*Clusters,ebml_element*) < 2)
         {
             NodeDelete((node*)RCues);
             RCues = NULL;
@@ -2896,11 +3500,14 @@ int main(int argc, const char *argv[])
 
         if (RCues)
         {
-            WSeekPoint = (matroska_seekpoint*)EBML_MasterAddElt(WMetaSeek,MATROSKA_getContextSeek(),0, DstProfile);
-            EBML_MasterUseChecksum((ebml_master*)WSeekPoint,!Unsafe);
-            EBML_ElementForcePosition((ebml_element*)RCues, NextPos);
+            WCuesSeek = (matroska_seekpoint*)EBML_MasterAddElt(WMetaSeek,MATROSKA_getContextSeek(),0, DstProfile);
+            EBML_MasterUseChecksum((ebml_master*)WCuesSeek,!Unsafe);
+            if (Stream)
+                EBML_ElementForcePosition((ebml_element*)RCues, EBML_ElementPositionData((ebml_element*)WSegment) + STREAM_SEEK_RESERVE);
+            else
+                EBML_ElementForcePosition((ebml_element*)RCues, NextPos);
             NextPos += EBML_ElementFullSize((ebml_element*)RCues,0);
-            MATROSKA_LinkMetaSeekElement(WSeekPoint,(ebml_element*)RCues);
+            MATROSKA_LinkMetaSeekElement(WCuesSeek,(ebml_element*)RCues);
         }
 
         ExtraVoidSize = 2 * EXTRA_SEEK_SPACE; // leave room for 2 unknown level1 elements
@@ -2914,7 +3521,16 @@ int main(int argc, const char *argv[])
             ExtraVoidSize += EXTRA_SEEK_SPACE;
 
         // first cluster
-        if (ARRAYCOUNT(RClusters,matroska_cluster*))
+        if (Stream && ARRAYCOUNT(ClusterPositions,filepos_t))
+        {
+            // the Clusters are not kept, this one only holds the position of the first one written
+            FirstCluster = EBML_ElementCreate(&p,MATROSKA_getContextCluster(),0,DstProfile);
+            W1stClusterSeek = (matroska_seekpoint*)EBML_MasterAddElt(WMetaSeek,MATROSKA_getContextSeek(),0, DstProfile);
+            EBML_MasterUseChecksum((ebml_master*)W1stClusterSeek,!Unsafe);
+            EBML_ElementForcePosition(FirstCluster, EBML_ElementPositionData((ebml_element*)WSegment) + STREAM_SEEK_RESERVE);
+            MATROSKA_LinkMetaSeekElement(W1stClusterSeek,FirstCluster);
+        }
+        else if (ARRAYCOUNT(RClusters,matroska_cluster*))
         {
             W1stClusterSeek = (matroska_seekpoint*)EBML_MasterAddElt(WMetaSeek,MATROSKA_getContextSeek(),0, DstProfile);
             EBML_MasterUseChecksum((ebml_master*)W1stClusterSeek,!Unsafe);
@@ -2977,9 +3593,14 @@ int main(int argc, const char *argv[])
         NextPos += EBML_ElementFullSize((ebml_element*)WMetaSeek,0) - MetaSeekBefore;
 
         //  Compute the Cues size
-        if (WTrackInfo && RCues)
+        if (WTrackInfo && RCues && !Stream)
         {
-            OptimizeCues(RCues,Clusters,WSegmentInfo,NextPos, WSegment, TotalSize, !CuesCreated, !Unsafe, ClustersNeedRead?Input:NULL);
+            if (OptimizeCues(RCues,Clusters,WSegmentInfo,NextPos, WSegment, TotalSize, !CuesCreated, !Unsafe, ClustersNeedRead?Input:NULL)!=ERR_NONE)
+            {
+                TextWrite(StdErr,T("Failed to measure the Clusters, out of memory ?\r\n"));
+                Result = -47;
+                goto exit;
+            }
             EBML_ElementForcePosition((ebml_element*)RCues, NextPos);
             NextPos += EBML_ElementFullSize((ebml_element*)RCues,0);
         }
@@ -3012,8 +3633,12 @@ int main(int argc, const char *argv[])
         NodeDelete((node*)Void);
         SegmentSize += ClusterSize;
     }
-    else if (!Unsafe)
-        SetClusterPrevSize(Clusters, ClustersNeedRead?Input:NULL);
+    else if (!Unsafe && !Stream && SetClusterPrevSize(Clusters, ClustersNeedRead?Input:NULL)!=ERR_NONE)
+    {
+        TextWrite(StdErr,T("Failed to measure the Clusters, out of memory ?\r\n"));
+        Result = -47;
+        goto exit;
+    }
 
     if (EBML_ElementRender((ebml_element*)WSegmentInfo,Output,0,0,1,DstProfile,&ClusterSize)!=ERR_NONE)
     {
@@ -3067,7 +3692,7 @@ int main(int argc, const char *argv[])
         SegmentSize += ClusterSize;
     }
 
-    if (!Live && RCues)
+    if (!Live && RCues && !Stream)
     {
         if (EBML_ElementRender((ebml_element*)RCues,Output,0,0,1,DstProfile,&CuesSize)!=ERR_NONE)
         {
@@ -3083,16 +3708,97 @@ int main(int argc, const char *argv[])
     PrevTimestamp = INVALID_TIMESTAMP_T;
     CuesChanged = 0;
     CurrentPhase = TotalPhases;
+    InitClusterReader(&ClusterReader, Clusters, Input, 0);
     for (Cluster = ARRAYBEGIN(*Clusters,ebml_master*);Cluster != ARRAYEND(*Clusters,ebml_master*); ++Cluster)
     {
         ShowProgress((ebml_element*)*Cluster, TotalSize);
-        CuesChanged = WriteCluster(*Cluster,Output,Input, ClusterSize, &PrevTimestamp) || CuesChanged;
+        CuesChanged = WriteCluster(Cluster,Output,&ClusterReader, ClusterSize, &PrevTimestamp) || CuesChanged;
         if (!Unsafe)
             ClusterSize = EBML_ElementFullSize((ebml_element*)*Cluster,0);
         SegmentSize += EBML_ElementFullSize((ebml_element*)*Cluster,0);
     }
+    DoneClusterReader(&ClusterReader);
+
+    if (Stream)
+    {
+        // only a few Clusters are in memory at once, their place is known once the previous ones are written
+        mkv_timestamp_t PrevCueTimestamp = INVALID_TIMESTAMP_T;
+        InitClusterWindow(&ClusterWindow, &ClusterPositions, Input, &RSegmentContext);
+        while (Result==0 && LoadClusterWindow(&ClusterWindow))
+        {
+            Result = LinkClusters(&ClusterWindow.Clusters,RSegmentInfo,RTrackInfo,DstProfile, &WTracks, Live?12345:INVALID_TIMESTAMP_T);
+            if (Result!=0)
+                break;
+            for (Cluster = ARRAYBEGIN(ClusterWindow.Clusters,ebml_master*);Cluster != ARRAYEND(ClusterWindow.Clusters,ebml_master*); ++Cluster)
+            {
+                LinkClusterWriteTracks(*Cluster, WTrackInfo, WSegmentInfo);
+                if (RCues)
+                    MATROSKA_LinkClusterWriteSegmentInfo((matroska_cluster*)*Cluster,WSegmentInfo);
+                CopyClusterBlocks(*Cluster);
+            }
+            InitClusterReader(&ClusterReader, &ClusterWindow.Clusters, Input, 0);
+            for (Cluster = ARRAYBEGIN(ClusterWindow.Clusters,ebml_master*);Cluster != ARRAYEND(ClusterWindow.Clusters,ebml_master*); ++Cluster)
+            {
+                ShowProgress((ebml_element*)*Cluster, TotalSize);
+                if (!Unsafe)
+                {
+                    if (Live)
+                        EBML_ElementSetInfiniteSize((ebml_element*)*Cluster,1);
+                    if (ClusterSize != INVALID_FILEPOS_T)
+                    {
+                        Elt = (ebml_element*)AddClusterPrevSize(*Cluster);
+                        if (Elt)
+                        {
+                            EBML_IntegerSetValue((ebml_integer*)Elt, ClusterSize);
+                            EBML_ElementUpdateSize(Elt,0,0, DstProfile);
+                            ExtraSizeDiff += (size_t)EBML_ElementFullSize(Elt,0);
+                        }
+                    }
+                }
+                EBML_ElementForcePosition((ebml_element*)*Cluster, Stream_Seek(Output,0,SEEK_CUR));
+                if (FirstCluster && EBML_ElementPosition(FirstCluster) > EBML_ElementPosition((ebml_element*)*Cluster))
+                    EBML_ElementForcePosition(FirstCluster, EBML_ElementPosition((ebml_element*)*Cluster)); // the first one written
+
+                WriteCluster(Cluster,Output,&ClusterReader, ClusterSize, &PrevTimestamp);
+                if (RCues)
+                    AddClusterCue(RCues, *Cluster, CueTrack, WSegmentInfo, WSegment, &PrevCueTimestamp);
+                if (!Unsafe)
+                    ClusterSize = EBML_ElementFullSize((ebml_element*)*Cluster,0);
+                SegmentSize += EBML_ElementFullSize((ebml_element*)*Cluster,0);
+            }
+            DoneClusterReader(&ClusterReader);
+        }
+        DoneClusterWindow(&ClusterWindow);
+        if (Result!=0)
+            goto exit;
+    }
     EndProgress();
 
+    if (Stream && RCues)
+    {
+        if (EBML_MasterChildren(RCues))
+        {
+            if (EBML_ElementRender((ebml_element*)RCues,Output,0,0,1,DstProfile,&CuesSize)!=ERR_NONE)
+            {
+                TextWrite(StdErr,T("Failed to write the Cues\r\n"));
+                Result = -15;
+                goto exit;
+            }
+            SegmentSize += CuesSize;
+        }
+        else
+        {
+            NodeDelete((node*)WCuesSeek);
+            WCuesSeek = NULL;
+        }
+    }
+    if (FirstCluster && EBML_ElementPosition(FirstCluster) == EBML_ElementPositionData((ebml_element*)WSegment) + STREAM_SEEK_RESERVE)
+    {
+        // no Cluster written
+        NodeDelete((node*)W1stClusterSeek);
+        W1stClusterSeek = NULL;
+    }
+
     if (CuesChanged && !Live && RCues)
     {
         filepos_t PosBefore = Stream_Seek(Output,0,SEEK_CUR);
@@ -3160,7 +3866,15 @@ int main(int argc, const char *argv[])
             Result = -22;
             goto exit;
         }
-        if (MetaSeekBefore != MetaSeekAfter)
+        if (Stream && MetaSeekAfter < MetaSeekBefore)
+        {
+            // the room reserved for the positions not known before is given back to the Void
+            ebml_element *Void = EBML_ElementCreate(WMetaSeek,EBML_getContextEbmlVoid(),1,DstProfile);
+            EBML_VoidSetFullSize(Void, ExtraVoidSize + MetaSeekBefore - MetaSeekAfter);
+            EBML_ElementRender(Void,Output,0,0,1,DstProfile,NULL);
+            NodeDelete((node*)Void);
+        }
+        else if (MetaSeekBefore != MetaSeekAfter)
         {
             TextPrintf(StdErr,T("The final Meta Seek size has changed %") TPRId64 T(" vs %") TPRId64 T(" !\r\n"),MetaSeekBefore,MetaSeekAfter);
             Result = -23;
@@ -3172,6 +3886,9 @@ int main(int argc, const char *argv[])
 
 exit:
     NodeDelete((node*)WSegment);
+    NodeDelete((node*)FirstCluster);
+    DoneClusterWindow(&ClusterWindow);
+    ArrayClear(&ClusterPositions);
 
     for (Cluster = ARRAYBEGIN(RClusters,ebml_master*);Cluster != ARRAYEND(RClusters,ebml_master*); ++Cluster)
         NodeDelete((node*)*Cluster);
@@ -3203,9 +3920,15 @@ exit:
     if (Result<0 && Path[0])
         FileErase(Path,1,0);
 
+    // EBML & Matroska ending
+    MATROSKA_Done(&p);
+
     // Core-C ending
     if (!Regression) // until all the memory leaks are fixed
-    ParserContext_Done(&p);
+    {
+        ParserContext_Done(&p);
+        MemHeap_DestroySlab(NodeHeap);
+    }
 
     return Result;
 }
@@ -197,7 +197,7 @@ int main(int argc, const char *argv[])
     }
 
     Node_FromStr(&p,Path,TSIZEOF(Path),argv[argc-1]);
-    Input = StreamOpen(&p,Path,SFLAG_RDONLY/*|SFLAG_BUFFERED*/);
+    Input = StreamOpen(&p,Path,SFLAG_RDONLY|SFLAG_BUFFERED|SFLAG_MAPPED);
     if (!Input)
     {
         TextPrintf(StdErr,T("Could not open file \"%s\" for reading\r\n"),Path);
@@ -329,6 +329,9 @@ exit:
     if (Output)
         StreamClose(Output);
 
+    // EBML & Matroska ending
+    MATROSKA_Done(&p);
+
     // Core-C ending
     ParserContext_Done(&p);
 
@@ -0,0 +1,21 @@
+# run mkvalidator on the same file with a single thread and with --jobs, the messages must be the same
+# cmake -DMKVALIDATOR=<exe> -DINPUT=<file> -DJOBS=<n> -DOUTPUT=<prefix> -P compare_jobs.cmake
+foreach(jobs 1 ${JOBS})
+  if (jobs EQUAL 1)
+    set(options --streaming)
+  else()
+    set(options --jobs ${jobs})
+  endif()
+  execute_process(COMMAND "${MKVALIDATOR}" --quiet ${options} "${INPUT}"
+    RESULT_VARIABLE result_${jobs} ERROR_FILE "${OUTPUT}${jobs}.txt")
+endforeach()
+if (result_1 EQUAL 0)
+  message(FATAL_ERROR "\"${INPUT}\" is not found invalid")
+endif()
+if (NOT result_1 STREQUAL result_${JOBS})
+  message(FATAL_ERROR "mkvalidator returned ${result_1} with a single thread and ${result_${JOBS}} with ${JOBS} jobs")
+endif()
+execute_process(COMMAND "${CMAKE_COMMAND}" -E compare_files "${OUTPUT}1.txt" "${OUTPUT}${JOBS}.txt" RESULT_VARIABLE different)
+if (different)
+  message(FATAL_ERROR "the messages with ${JOBS} jobs in \"${OUTPUT}${JOBS}.txt\" differ from \"${OUTPUT}1.txt\"")
+endif()
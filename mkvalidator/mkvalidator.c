@@ -7,8 +7,11 @@
 #include "matroska2/matroska_sem.h"
 #include "mkvalidator_project.h"
 #include <corec/helpers/file/streams.h>
+#include <corec/helpers/parser/strtypes.h>
 #include <corec/str/str.h>
 #include <corec/helpers/parser/parser.h>
+#include <corec/memheap.h>
+#include <corec/multithread.h>
 
 /*!
  * \todo verify the track timestamp scale is not null
@@ -20,18 +23,30 @@
  */
 
 static textwriter *StdErr = NULL;
-static ebml_master *RSegmentInfo = NULL, *RTrackInfo = NULL, *RChapters = NULL, *RTags = NULL, *RCues = NULL, *RAttachments = NULL, *RSeekHead = NULL, *RSeekHead2 = NULL;
+static ebml_master *RChapters = NULL, *RTags = NULL, *RCues = NULL, *RAttachments = NULL, *RSeekHead = NULL, *RSeekHead2 = NULL;
 static array RClusters;
-static array Tracks;
-static size_t TrackMax=0;
+static array ClusterPos;
+static array ClusterChecks;
+static array CueKeys;
+static size_t NextCluster = 0;
+static int Jobs = 1;
 static bool_t Warnings = 1;
 static bool_t Live = 0;
 static bool_t Details = 0;
 static bool_t DivX = 0;
 static bool_t Quiet = 0;
 static bool_t QuickExit = 0;
-static mkv_timestamp_t MinTime = INVALID_TIMESTAMP_T, MaxTime = INVALID_TIMESTAMP_T;
-static mkv_timestamp_t ClusterTime = INVALID_TIMESTAMP_T;
+static bool_t Streaming = 0;
+static bool_t CueKeysFromCues = 0;
+
+// each --jobs worker has its own copy
+static THREAD_LOCAL ebml_master *RSegmentInfo = NULL, *RTrackInfo = NULL;
+static THREAD_LOCAL array Tracks;
+static THREAD_LOCAL size_t TrackMax=0;
+static THREAD_LOCAL mkv_timestamp_t MinTime = INVALID_TIMESTAMP_T, MaxTime = INVALID_TIMESTAMP_T;
+static THREAD_LOCAL mkv_timestamp_t ClusterTime = INVALID_TIMESTAMP_T;
+static THREAD_LOCAL filepos_t PrevClusterPos = INVALID_FILEPOS_T;
+static THREAD_LOCAL array *Capture = NULL; // the messages are kept there rather than written
 
 // some macros for code readability
 #define EL_Pos(elt)         EBML_ElementPosition((const ebml_element*)elt)
@@ -45,9 +60,32 @@ typedef struct track_info
     int Kind;
     filepos_t DataLength;
     ebml_string *CodecID;
+    ebml_master *Entry;
 
 } track_info;
 
+// the Cues entries, marked when their Block is found in streaming mode
+typedef struct cue_key
+{
+    mkv_timestamp_t Timestamp;
+    int TrackNum;
+    bool_t Found;
+
+} cue_key;
+
+// the messages and values of a Cluster checked by a --jobs worker
+typedef struct cluster_check
+{
+    array Output; // null terminated messages
+    array After; // the messages of the scan found after the Cluster
+    size_t TimestampMark; // where the timestamp warning goes in Output
+    mkv_timestamp_t Timestamp;
+    filepos_t VoidAmount;
+    int Result;
+    bool_t Failed;
+
+} cluster_check;
+
 #ifdef TARGET_WIN
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
@@ -111,6 +149,25 @@ void DebugMessage(const tchar_t* Msg,...)
 }
 #endif
 
+static cc_lock JobLock;
+
+typedef struct cluster_job
+{
+    struct stream *Input;
+    ebml_parser_context Context;
+    const ebml_element *Segment;
+    filepos_t SegmentInfoPos;
+    filepos_t TrackInfoPos;
+    int Profile;
+    bool_t HasVideo;
+    cc_thread Thread;
+    bool_t Started;
+    // what the worker adds to the Tracks and the timestamps range
+    array Tracks;
+    mkv_timestamp_t MinTime, MaxTime;
+
+} cluster_job;
+
 static const tchar_t *GetProfileName(size_t ProfileNum)
 {
 static const tchar_t *Profile[8] = {T("unknown"), T("matroska v1"), T("matroska v2"), T("matroska v3"), T("webm"), T("matroska+DivX"), T("matroska v4"), T("matroska v5")};
@@ -127,6 +184,13 @@ static const tchar_t *Profile[8] = {T("unknown"), T("matroska v1"), T("matroska
     }
 }
 
+static void OutputCapture(const tchar_t *Kind, int ErrCode, const tchar_t *Msg)
+{
+    tchar_t Buffer[MAXLINE+16];
+    stprintf_s(Buffer,TSIZEOF(Buffer),T("\r%s%03X: %s\r\n"),Kind,ErrCode,Msg);
+    ArrayAppend(Capture,Buffer,(tcslen(Buffer)+1)*sizeof(tchar_t),256);
+}
+
 static int OutputError(int ErrCode, const tchar_t *ErrString, ...)
 {
     tchar_t Buffer[MAXLINE];
@@ -134,7 +198,10 @@ static int OutputError(int ErrCode, const tchar_t *ErrString, ...)
     va_start(Args,ErrString);
     vstprintf_s(Buffer,TSIZEOF(Buffer), ErrString, Args);
     va_end(Args);
-    TextPrintf(StdErr,T("\rERR%03X: %s\r\n"),ErrCode,Buffer);
+    if (Capture)
+        OutputCapture(T("ERR"),ErrCode,Buffer);
+    else
+        TextPrintf(StdErr,T("\rERR%03X: %s\r\n"),ErrCode,Buffer);
     if (QuickExit)
         exit(-ErrCode);
     return -ErrCode;
@@ -149,7 +216,10 @@ static void OutputWarning(int ErrCode, const tchar_t *ErrString, ...)
         va_start(Args,ErrString);
         vstprintf_s(Buffer,TSIZEOF(Buffer), ErrString, Args);
         va_end(Args);
-        TextPrintf(StdErr,T("\rWRN%03X: %s\r\n"),ErrCode,Buffer);
+        if (Capture)
+            OutputCapture(T("WRN"),ErrCode,Buffer);
+        else
+            TextPrintf(StdErr,T("\rWRN%03X: %s\r\n"),ErrCode,Buffer);
         if (QuickExit)
             exit(-ErrCode);
     }
@@ -322,6 +392,23 @@ static int CheckTracks(ebml_master *TrackEntries, int ProfileNum)
                 if (tcslen(String)<3 || String[1]!='_' || (String[0]!='A' && String[0]!='V' && String[0]!='S' && String[0]!='B'))
                     OutputWarning(0x308,T("Track #%d codec '%s' doesn't appear to be valid"),(int)EL_Int(TrackNum),String);
 
+                // zstd is a libmatroska2 extension, other readers won't decode it
+                Elt = EBML_MasterFindChild(Track, MATROSKA_getContextContentEncodings());
+                for (Elt2=Elt?EBML_MasterFindChild(Elt, MATROSKA_getContextContentEncoding()):NULL;Elt2;Elt2=EBML_MasterNextChild(Elt, Elt2))
+                {
+                    ebml_element *Algo = EBML_MasterFindChild(Elt2, MATROSKA_getContextContentCompression());
+                    if (Algo)
+                        Algo = EBML_MasterFindChild(Algo, MATROSKA_getContextContentCompAlgo());
+                    if (!Algo || EL_Int(Algo) < MATROSKA_TRACK_ENCODING_COMP_ZSTD)
+                        continue;
+                    if (EL_Int(Algo) != MATROSKA_TRACK_ENCODING_COMP_ZSTD)
+                        Result |= OutputError(0x30B,T("Track #%d has an invalid compression algorithm %d"),(int)EL_Int(TrackNum),(int)EL_Int(Algo));
+                    else if (!MATROSKA_GetCodec(MATROSKA_TRACK_ENCODING_COMP_ZSTD))
+                        Result |= OutputError(0x30B,T("Track #%d uses the zstd compression which is not supported"),(int)EL_Int(TrackNum));
+                    else
+                        OutputWarning(0x30C,T("Track #%d uses the zstd compression which is not in the Matroska specifications"),(int)EL_Int(TrackNum));
+                }
+
                 // check that the audio frequencies are not 0
                 if (EL_Int(TrackType) == MATROSKA_TRACK_TYPE_AUDIO)
                 {
@@ -446,6 +533,13 @@ static int CheckProfileViolation(ebml_element *Elt, int ProfileMask)
     return Result;
 }
 
+static int FilePosCmp(const void* UNUSED_PARAM(Param), const filepos_t *a, const filepos_t *b)
+{
+    if (*a == *b)
+        return 0;
+    return (*a > *b) ? 1 : -1;
+}
+
 static int CheckSeekHead(ebml_master *SeekHead)
 {
     int Result = 0;
@@ -525,13 +619,9 @@ static int CheckSeekHead(ebml_master *SeekHead)
         }
         else if (MATROSKA_MetaSeekIsClass(RLevel1, MATROSKA_getContextCluster()))
         {
-            ebml_element **Cluster;
-            for (Cluster = ARRAYBEGIN(RClusters,ebml_element*);Cluster != ARRAYEND(RClusters,ebml_element*); ++Cluster)
-            {
-                if (EL_Pos(*Cluster) == Pos)
-                    break;
-            }
-            if (Cluster == ARRAYEND(RClusters,ebml_element*) && Cluster != ARRAYBEGIN(RClusters,ebml_element*))
+            bool_t Found;
+            ArrayFind(&ClusterPos,filepos_t,&Pos,(arraycmp)FilePosCmp,NULL,&Found);
+            if (!Found && !ARRAYEMPTY(ClusterPos))
                 Result |= OutputError(0x71,T("The SeekPoint at %") TPRId64 T(" references a Cluster not found at %") TPRId64,EL_Pos(RLevel1),Pos);
         }
         else
@@ -558,6 +648,45 @@ static int CheckSeekHead(ebml_master *SeekHead)
     return Result;
 }
 
+static void ListTracks(ebml_master *TrackInfo)
+{
+    size_t TrackCount;
+    ebml_master *Elt;
+    ebml_element *Value;
+
+    Elt = (ebml_master*)EBML_MasterFindChild(TrackInfo,MATROSKA_getContextTrackEntry());
+    TrackCount = 0;
+    while (Elt)
+    {
+        Elt = (ebml_master*)EBML_MasterNextChild(TrackInfo,Elt);
+        ++TrackCount;
+    }
+
+    ArrayResize(&Tracks,TrackCount*sizeof(track_info),256);
+    ArrayZero(&Tracks);
+
+    Elt = (ebml_master*)EBML_MasterFindChild(TrackInfo,MATROSKA_getContextTrackEntry());
+    TrackCount = 0;
+    while (Elt)
+    {
+        ARRAYBEGIN(Tracks,track_info)[TrackCount].Entry = Elt;
+        Value = EBML_MasterFindChild(Elt,MATROSKA_getContextTrackNumber());
+        assert(Value!=NULL);
+        if (Value)
+        {
+            TrackMax = MAX(TrackMax,(size_t)EL_Int(Value));
+            ARRAYBEGIN(Tracks,track_info)[TrackCount].Num = (int)EL_Int(Value);
+        }
+        Value = EBML_MasterFindChild(Elt,MATROSKA_getContextTrackType());
+        assert(Value!=NULL);
+        if (Value)
+            ARRAYBEGIN(Tracks,track_info)[TrackCount].Kind = (int)EL_Int(Value);
+        ARRAYBEGIN(Tracks,track_info)[TrackCount].CodecID = (ebml_string*)EBML_MasterFindChild(Elt,MATROSKA_getContextCodecID());
+        Elt = (ebml_master*)EBML_MasterNextChild(TrackInfo,Elt);
+        ++TrackCount;
+    }
+}
+
 static void LinkClusterBlocks(int ProfileNum)
 {
     matroska_cluster **Cluster;
@@ -630,180 +759,188 @@ static bool_t TrackNeedsKeyframe(int16_t TrackNum, int ProfileNum)
     return 0;
 }
 
-static int CheckVideoStart(int ProfileNum)
+static int CheckClusterVideoStart(ebml_master *Cluster, int ProfileNum)
 {
     int Result = 0;
-    ebml_master **Cluster;
     ebml_element *Block, *GBlock;
     uint16_t BlockNum;
     mkv_timestamp_t ClusterTimestamp;
     array TrackKeyframe;
     array TrackFirstKeyframePos;
 
-    for (Cluster=ARRAYBEGIN(RClusters,ebml_master*);Cluster!=ARRAYEND(RClusters,ebml_master*);++Cluster)
+    ArrayInit(&TrackKeyframe);
+    ArrayResize(&TrackKeyframe,sizeof(bool_t)*(TrackMax+1),256);
+    ArrayZero(&TrackKeyframe);
+    ArrayInit(&TrackFirstKeyframePos);
+    ArrayResize(&TrackFirstKeyframePos,sizeof(filepos_t)*(TrackMax+1),256);
+    ArrayZero(&TrackFirstKeyframePos);
+
+    ClusterTimestamp = MATROSKA_ClusterTimestamp((matroska_cluster*)Cluster);
+    if (ClusterTimestamp==INVALID_TIMESTAMP_T)
+        Result |= OutputError(0xC1,T("The Cluster at %") TPRId64 T(" has no timestamp"),EL_Pos(Cluster));
+    else if (ClusterTime!=INVALID_TIMESTAMP_T && ClusterTime >= ClusterTimestamp)
+        OutputWarning(0xC2,T("The timestamp of the Cluster at %") TPRId64 T(" is not incrementing (may be intentional)"),EL_Pos(Cluster));
+    ClusterTime = ClusterTimestamp;
+
+    for (Block = EBML_MasterChildren(Cluster);Block;Block=EBML_MasterNext(Block))
     {
-        ArrayInit(&TrackKeyframe);
-        ArrayResize(&TrackKeyframe,sizeof(bool_t)*(TrackMax+1),256);
-        ArrayZero(&TrackKeyframe);
-        ArrayInit(&TrackFirstKeyframePos);
-        ArrayResize(&TrackFirstKeyframePos,sizeof(filepos_t)*(TrackMax+1),256);
-        ArrayZero(&TrackFirstKeyframePos);
-
-        ClusterTimestamp = MATROSKA_ClusterTimestamp((matroska_cluster*)*Cluster);
-        if (ClusterTimestamp==INVALID_TIMESTAMP_T)
-            Result |= OutputError(0xC1,T("The Cluster at %") TPRId64 T(" has no timestamp"),EL_Pos(*Cluster));
-        else if (ClusterTime!=INVALID_TIMESTAMP_T && ClusterTime >= ClusterTimestamp)
-            OutputWarning(0xC2,T("The timestamp of the Cluster at %") TPRId64 T(" is not incrementing (may be intentional)"),EL_Pos(*Cluster));
-        ClusterTime = ClusterTimestamp;
-
-        for (Block = EBML_MasterChildren(*Cluster);Block;Block=EBML_MasterNext(Block))
+        if (EL_Type(Block, MATROSKA_getContextBlockGroup()))
         {
-            if (EL_Type(Block, MATROSKA_getContextBlockGroup()))
+            for (GBlock = EBML_MasterChildren(Block);GBlock;GBlock=EBML_MasterNext(GBlock))
             {
-                for (GBlock = EBML_MasterChildren(Block);GBlock;GBlock=EBML_MasterNext(GBlock))
+                if (EL_Type(GBlock, MATROSKA_getContextBlock()))
                 {
-                    if (EL_Type(GBlock, MATROSKA_getContextBlock()))
+                    BlockNum = MATROSKA_BlockTrackNum((matroska_block*)GBlock);
+                    if (BlockNum > ARRAYCOUNT(TrackKeyframe,bool_t))
+                        OutputError(0xC3,T("Unknown track #%d in Cluster at %") TPRId64 T(" in Block at %") TPRId64,(int)BlockNum,EL_Pos(Cluster),EL_Pos(GBlock));
+                    else if (TrackIsVideo(BlockNum, ProfileNum))
                     {
-                        BlockNum = MATROSKA_BlockTrackNum((matroska_block*)GBlock);
-                        if (BlockNum > ARRAYCOUNT(TrackKeyframe,bool_t))
-                            OutputError(0xC3,T("Unknown track #%d in Cluster at %") TPRId64 T(" in Block at %") TPRId64,(int)BlockNum,EL_Pos(*Cluster),EL_Pos(GBlock));
-                        else if (TrackIsVideo(BlockNum, ProfileNum))
-                        {
-                            if (!ARRAYBEGIN(TrackKeyframe,bool_t)[BlockNum] && MATROSKA_BlockKeyframe((matroska_block*)GBlock))
-                                ARRAYBEGIN(TrackKeyframe,bool_t)[BlockNum] = 1;
-                            if (!ARRAYBEGIN(TrackKeyframe,bool_t)[BlockNum] && ARRAYBEGIN(TrackFirstKeyframePos,filepos_t)[BlockNum]==0)
-                                ARRAYBEGIN(TrackFirstKeyframePos,filepos_t)[BlockNum] = EL_Pos(*Cluster);
-                        }
-                        break;
+                        if (!ARRAYBEGIN(TrackKeyframe,bool_t)[BlockNum] && MATROSKA_BlockKeyframe((matroska_block*)GBlock))
+                            ARRAYBEGIN(TrackKeyframe,bool_t)[BlockNum] = 1;
+                        if (!ARRAYBEGIN(TrackKeyframe,bool_t)[BlockNum] && ARRAYBEGIN(TrackFirstKeyframePos,filepos_t)[BlockNum]==0)
+                            ARRAYBEGIN(TrackFirstKeyframePos,filepos_t)[BlockNum] = EL_Pos(Cluster);
                     }
-                }
-            }
-            else if (EL_Type(Block, MATROSKA_getContextSimpleBlock()))
-            {
-                BlockNum = MATROSKA_BlockTrackNum((matroska_block*)Block);
-                if (BlockNum > ARRAYCOUNT(TrackKeyframe,bool_t))
-                    OutputError(0xC3,T("Unknown track #%d in Cluster at %") TPRId64 T(" in SimpleBlock at %") TPRId64,(int)BlockNum,EL_Pos(*Cluster),EL_Pos(Block));
-                else if (TrackIsVideo(BlockNum, ProfileNum))
-                {
-                    if (!ARRAYBEGIN(TrackKeyframe,bool_t)[BlockNum] && MATROSKA_BlockKeyframe((matroska_block*)Block))
-                        ARRAYBEGIN(TrackKeyframe,bool_t)[BlockNum] = 1;
-                    if (!ARRAYBEGIN(TrackKeyframe,bool_t)[BlockNum] && ARRAYBEGIN(TrackFirstKeyframePos,filepos_t)[BlockNum]==0)
-                        ARRAYBEGIN(TrackFirstKeyframePos,filepos_t)[BlockNum] = EL_Pos(*Cluster);
+                    break;
                 }
             }
         }
-        for (BlockNum=0;BlockNum<ARRAYCOUNT(TrackKeyframe,bool_t);++BlockNum)
+        else if (EL_Type(Block, MATROSKA_getContextSimpleBlock()))
         {
-            if (ARRAYBEGIN(TrackKeyframe,bool_t)[BlockNum] && ARRAYBEGIN(TrackFirstKeyframePos,filepos_t)[BlockNum]!=0)
-                OutputWarning(0xC0,T("First Block for video track #%d in Cluster at %") TPRId64 T(" is not a keyframe"),(int)BlockNum,ARRAYBEGIN(TrackFirstKeyframePos,filepos_t)[BlockNum]);
+            BlockNum = MATROSKA_BlockTrackNum((matroska_block*)Block);
+            if (BlockNum > ARRAYCOUNT(TrackKeyframe,bool_t))
+                OutputError(0xC3,T("Unknown track #%d in Cluster at %") TPRId64 T(" in SimpleBlock at %") TPRId64,(int)BlockNum,EL_Pos(Cluster),EL_Pos(Block));
+            else if (TrackIsVideo(BlockNum, ProfileNum))
+            {
+                if (!ARRAYBEGIN(TrackKeyframe,bool_t)[BlockNum] && MATROSKA_BlockKeyframe((matroska_block*)Block))
+                    ARRAYBEGIN(TrackKeyframe,bool_t)[BlockNum] = 1;
+                if (!ARRAYBEGIN(TrackKeyframe,bool_t)[BlockNum] && ARRAYBEGIN(TrackFirstKeyframePos,filepos_t)[BlockNum]==0)
+                    ARRAYBEGIN(TrackFirstKeyframePos,filepos_t)[BlockNum] = EL_Pos(Cluster);
+            }
         }
-        ArrayClear(&TrackKeyframe);
-        ArrayClear(&TrackFirstKeyframePos);
     }
+    for (BlockNum=0;BlockNum<ARRAYCOUNT(TrackKeyframe,bool_t);++BlockNum)
+    {
+        if (ARRAYBEGIN(TrackKeyframe,bool_t)[BlockNum] && ARRAYBEGIN(TrackFirstKeyframePos,filepos_t)[BlockNum]!=0)
+            OutputWarning(0xC0,T("First Block for video track #%d in Cluster at %") TPRId64 T(" is not a keyframe"),(int)BlockNum,ARRAYBEGIN(TrackFirstKeyframePos,filepos_t)[BlockNum]);
+    }
+    ArrayClear(&TrackKeyframe);
+    ArrayClear(&TrackFirstKeyframePos);
     return Result;
 }
 
-static int CheckPosSize(const ebml_element *RSegment)
+static int CheckVideoStart(int ProfileNum)
+{
+    int Result = 0;
+    ebml_master **Cluster;
+
+    for (Cluster=ARRAYBEGIN(RClusters,ebml_master*);Cluster!=ARRAYEND(RClusters,ebml_master*);++Cluster)
+        Result |= CheckClusterVideoStart(*Cluster, ProfileNum);
+    return Result;
+}
+
+static int CheckClusterPosSize(const ebml_element *Cluster, const ebml_element *RSegment)
 {
     int Result = 0;
-    ebml_element **Cluster,*PrevCluster=NULL;
     ebml_element *Elt;
 
-    for (Cluster=ARRAYBEGIN(RClusters,ebml_element*);Cluster!=ARRAYEND(RClusters,ebml_element*);++Cluster)
+    Elt = EBML_MasterFindChild((ebml_master*)Cluster,MATROSKA_getContextPrevSize());
+    if (Elt)
     {
-        Elt = EBML_MasterFindChild((ebml_master*)*Cluster,MATROSKA_getContextPrevSize());
-        if (Elt)
-        {
-            if (PrevCluster==NULL)
-                Result |= OutputError(0xA0,T("The PrevSize %") TPRId64 T(" was set on the first Cluster at %") TPRId64,EL_Int(Elt),EL_Pos(Elt));
-            else if (EL_Int(Elt) != EL_Pos(*Cluster) - EL_Pos(PrevCluster))
-                Result |= OutputError(0xA1,T("The Cluster PrevSize %") TPRId64 T(" at %") TPRId64 T(" should be %") TPRId64,EL_Int(Elt),EL_Pos(Elt),EL_Pos(*Cluster) - EL_Pos(PrevCluster));
-        }
-        Elt = EBML_MasterFindChild((ebml_master*)*Cluster,MATROSKA_getContextPosition());
-        if (Elt)
-        {
-            if (EL_Int(Elt) != EL_Pos(*Cluster) - EBML_ElementPositionData(RSegment))
-                Result |= OutputError(0xA2,T("The Cluster position %") TPRId64 T(" at %") TPRId64 T(" should be %") TPRId64,EL_Int(Elt),EL_Pos(Elt),EL_Pos(*Cluster) - EBML_ElementPositionData(RSegment));
-        }
-        PrevCluster = *Cluster;
+        if (PrevClusterPos==INVALID_FILEPOS_T)
+            Result |= OutputError(0xA0,T("The PrevSize %") TPRId64 T(" was set on the first Cluster at %") TPRId64,EL_Int(Elt),EL_Pos(Elt));
+        else if (EL_Int(Elt) != EL_Pos(Cluster) - PrevClusterPos)
+            Result |= OutputError(0xA1,T("The Cluster PrevSize %") TPRId64 T(" at %") TPRId64 T(" should be %") TPRId64,EL_Int(Elt),EL_Pos(Elt),EL_Pos(Cluster) - PrevClusterPos);
+    }
+    Elt = EBML_MasterFindChild((ebml_master*)Cluster,MATROSKA_getContextPosition());
+    if (Elt)
+    {
+        if (EL_Int(Elt) != EL_Pos(Cluster) - EBML_ElementPositionData(RSegment))
+            Result |= OutputError(0xA2,T("The Cluster position %") TPRId64 T(" at %") TPRId64 T(" should be %") TPRId64,EL_Int(Elt),EL_Pos(Elt),EL_Pos(Cluster) - EBML_ElementPositionData(RSegment));
     }
+    PrevClusterPos = EL_Pos(Cluster);
     return Result;
 }
 
-static int CheckLacingKeyframe(int ProfileNum)
+static int CheckPosSize(const ebml_element *RSegment)
+{
+    int Result = 0;
+    ebml_element **Cluster;
+
+    for (Cluster=ARRAYBEGIN(RClusters,ebml_element*);Cluster!=ARRAYEND(RClusters,ebml_element*);++Cluster)
+        Result |= CheckClusterPosSize(*Cluster, RSegment);
+    return Result;
+}
+
+static int CheckClusterLacingKeyframe(matroska_cluster *Cluster, int ProfileNum)
 {
     int Result = 0;
-    matroska_cluster **Cluster;
     ebml_element *Block, *GBlock;
     int16_t BlockNum;
     mkv_timestamp_t BlockTime;
     size_t Frame,TrackIdx;
 
-    for (Cluster=ARRAYBEGIN(RClusters,matroska_cluster*);Cluster!=ARRAYEND(RClusters,matroska_cluster*);++Cluster)
+    for (Block = EBML_MasterChildren(Cluster);Block;Block=EBML_MasterNext(Block))
     {
-        for (Block = EBML_MasterChildren(*Cluster);Block;Block=EBML_MasterNext(Block))
+        if (EL_Type(Block, MATROSKA_getContextBlockGroup()))
         {
-            if (EL_Type(Block, MATROSKA_getContextBlockGroup()))
+            for (GBlock = EBML_MasterChildren(Block);GBlock;GBlock=EBML_MasterNext(GBlock))
             {
-                for (GBlock = EBML_MasterChildren(Block);GBlock;GBlock=EBML_MasterNext(GBlock))
+                if (EL_Type(GBlock, MATROSKA_getContextBlock()))
                 {
-                    if (EL_Type(GBlock, MATROSKA_getContextBlock()))
+                    //MATROSKA_ContextFlagLacing
+                    BlockNum = MATROSKA_BlockTrackNum((matroska_block*)GBlock);
+                    for (TrackIdx=0; TrackIdx<ARRAYCOUNT(Tracks,track_info); ++TrackIdx)
+                        if (ARRAYBEGIN(Tracks,track_info)[TrackIdx].Num == BlockNum)
+                            break;
+
+                    if (TrackIdx==ARRAYCOUNT(Tracks,track_info))
+                        Result |= OutputError(0xB2,T("Block at %") TPRId64 T(" is using an unknown track #%d"),EL_Pos(GBlock),(int)BlockNum);
+                    else
                     {
-                        //MATROSKA_ContextFlagLacing
-                        BlockNum = MATROSKA_BlockTrackNum((matroska_block*)GBlock);
-                        for (TrackIdx=0; TrackIdx<ARRAYCOUNT(Tracks,track_info); ++TrackIdx)
-                            if (ARRAYBEGIN(Tracks,track_info)[TrackIdx].Num == BlockNum)
-                                break;
-
-                        if (TrackIdx==ARRAYCOUNT(Tracks,track_info))
-                            Result |= OutputError(0xB2,T("Block at %") TPRId64 T(" is using an unknown track #%d"),EL_Pos(GBlock),(int)BlockNum);
-                        else
+                        if (MATROSKA_BlockLaced((matroska_block*)GBlock) && !TrackIsLaced(BlockNum, ProfileNum))
+                            Result |= OutputError(0xB0,T("Block at %") TPRId64 T(" track #%d is laced but the track is not"),EL_Pos(GBlock),(int)BlockNum);
+                        if (!MATROSKA_BlockKeyframe((matroska_block*)GBlock) && TrackNeedsKeyframe(BlockNum, ProfileNum))
+                            Result |= OutputError(0xB1,T("Block at %") TPRId64 T(" track #%d is not a keyframe"),EL_Pos(GBlock),(int)BlockNum);
+
+                        for (Frame=0; Frame<MATROSKA_BlockGetFrameCount((matroska_block*)GBlock); ++Frame)
+                            ARRAYBEGIN(Tracks,track_info)[TrackIdx].DataLength += MATROSKA_BlockGetLength((matroska_block*)GBlock,Frame);
+                        if (Details)
                         {
-                            if (MATROSKA_BlockLaced((matroska_block*)GBlock) && !TrackIsLaced(BlockNum, ProfileNum))
-                                Result |= OutputError(0xB0,T("Block at %") TPRId64 T(" track #%d is laced but the track is not"),EL_Pos(GBlock),(int)BlockNum);
-                            if (!MATROSKA_BlockKeyframe((matroska_block*)GBlock) && TrackNeedsKeyframe(BlockNum, ProfileNum))
-                                Result |= OutputError(0xB1,T("Block at %") TPRId64 T(" track #%d is not a keyframe"),EL_Pos(GBlock),(int)BlockNum);
-
-                            for (Frame=0; Frame<MATROSKA_BlockGetFrameCount((matroska_block*)GBlock); ++Frame)
-                                ARRAYBEGIN(Tracks,track_info)[TrackIdx].DataLength += MATROSKA_BlockGetLength((matroska_block*)GBlock,Frame);
-                            if (Details)
-                            {
-                                BlockTime = MATROSKA_BlockTimestamp((matroska_block*)GBlock);
-                                if (MinTime==INVALID_TIMESTAMP_T || MinTime>BlockTime)
-                                    MinTime = BlockTime;
-                                if (MaxTime==INVALID_TIMESTAMP_T || MaxTime<BlockTime)
-                                    MaxTime = BlockTime;
-                            }
+                            BlockTime = MATROSKA_BlockTimestamp((matroska_block*)GBlock);
+                            if (MinTime==INVALID_TIMESTAMP_T || MinTime>BlockTime)
+                                MinTime = BlockTime;
+                            if (MaxTime==INVALID_TIMESTAMP_T || MaxTime<BlockTime)
+                                MaxTime = BlockTime;
                         }
-                        break;
                     }
+                    break;
                 }
             }
-            else if (EL_Type(Block, MATROSKA_getContextSimpleBlock()))
-            {
-                BlockNum = MATROSKA_BlockTrackNum((matroska_block*)Block);
-                for (TrackIdx=0; TrackIdx<ARRAYCOUNT(Tracks,track_info); ++TrackIdx)
-                    if (ARRAYBEGIN(Tracks,track_info)[TrackIdx].Num == BlockNum)
-                        break;
+        }
+        else if (EL_Type(Block, MATROSKA_getContextSimpleBlock()))
+        {
+            BlockNum = MATROSKA_BlockTrackNum((matroska_block*)Block);
+            for (TrackIdx=0; TrackIdx<ARRAYCOUNT(Tracks,track_info); ++TrackIdx)
+                if (ARRAYBEGIN(Tracks,track_info)[TrackIdx].Num == BlockNum)
+                    break;
 
-                if (TrackIdx==ARRAYCOUNT(Tracks,track_info))
-                    Result |= OutputError(0xB2,T("Block at %") TPRId64 T(" is using an unknown track #%d"),EL_Pos(Block),(int)BlockNum);
-                else
+            if (TrackIdx==ARRAYCOUNT(Tracks,track_info))
+                Result |= OutputError(0xB2,T("Block at %") TPRId64 T(" is using an unknown track #%d"),EL_Pos(Block),(int)BlockNum);
+            else
+            {
+                if (MATROSKA_BlockLaced((matroska_block*)Block) && !TrackIsLaced(BlockNum, ProfileNum))
+                    Result |= OutputError(0xB0,T("SimpleBlock at %") TPRId64 T(" track #%d is laced but the track is not"),EL_Pos(Block),(int)BlockNum);
+                if (!MATROSKA_BlockKeyframe((matroska_block*)Block) && TrackNeedsKeyframe(BlockNum, ProfileNum))
+                    Result |= OutputError(0xB1,T("SimpleBlock at %") TPRId64 T(" track #%d is not a keyframe"),EL_Pos(Block),(int)BlockNum);
+                for (Frame=0; Frame<MATROSKA_BlockGetFrameCount((matroska_block*)Block); ++Frame)
+                    ARRAYBEGIN(Tracks,track_info)[TrackIdx].DataLength += MATROSKA_BlockGetLength((matroska_block*)Block,Frame);
+                if (Details)
                 {
-                    if (MATROSKA_BlockLaced((matroska_block*)Block) && !TrackIsLaced(BlockNum, ProfileNum))
-                        Result |= OutputError(0xB0,T("SimpleBlock at %") TPRId64 T(" track #%d is laced but the track is not"),EL_Pos(Block),(int)BlockNum);
-                    if (!MATROSKA_BlockKeyframe((matroska_block*)Block) && TrackNeedsKeyframe(BlockNum, ProfileNum))
-                        Result |= OutputError(0xB1,T("SimpleBlock at %") TPRId64 T(" track #%d is not a keyframe"),EL_Pos(Block),(int)BlockNum);
-                    for (Frame=0; Frame<MATROSKA_BlockGetFrameCount((matroska_block*)Block); ++Frame)
-                        ARRAYBEGIN(Tracks,track_info)[TrackIdx].DataLength += MATROSKA_BlockGetLength((matroska_block*)Block,Frame);
-                    if (Details)
-                    {
-                        BlockTime = MATROSKA_BlockTimestamp((matroska_block*)Block);
-                        if (MinTime==INVALID_TIMESTAMP_T || MinTime>BlockTime)
-                            MinTime = BlockTime;
-                        if (MaxTime==INVALID_TIMESTAMP_T || MaxTime<BlockTime)
-                            MaxTime = BlockTime;
-                    }
+                    BlockTime = MATROSKA_BlockTimestamp((matroska_block*)Block);
+                    if (MinTime==INVALID_TIMESTAMP_T || MinTime>BlockTime)
+                        MinTime = BlockTime;
+                    if (MaxTime==INVALID_TIMESTAMP_T || MaxTime<BlockTime)
+                        MaxTime = BlockTime;
                 }
             }
         }
@@ -811,18 +948,149 @@ static int CheckLacingKeyframe(int ProfileNum)
     return Result;
 }
 
+static int CheckLacingKeyframe(int ProfileNum)
+{
+    int Result = 0;
+    matroska_cluster **Cluster;
+
+    for (Cluster=ARRAYBEGIN(RClusters,matroska_cluster*);Cluster!=ARRAYEND(RClusters,matroska_cluster*);++Cluster)
+        Result |= CheckClusterLacingKeyframe(*Cluster, ProfileNum);
+    return Result;
+}
+
+static int CueKeyCmp(const void* UNUSED_PARAM(Param), const cue_key *a, const cue_key *b)
+{
+    if (a->Timestamp != b->Timestamp)
+        return (a->Timestamp > b->Timestamp) ? 1 : -1;
+    return a->TrackNum - b->TrackNum;
+}
+
+static int SortCueKey(const void *a, const void *b)
+{
+    return CueKeyCmp(NULL, (const cue_key*)a, (const cue_key*)b);
+}
+
+static void SortCueKeys(void)
+{
+    cue_key *Key, *Last;
+
+    if (ARRAYEMPTY(CueKeys))
+        return;
+    qsort(ARRAYBEGIN(CueKeys,cue_key), ARRAYCOUNT(CueKeys,cue_key), sizeof(cue_key), SortCueKey);
+
+    // only keep one entry per track/timestamp
+    Last = ARRAYBEGIN(CueKeys,cue_key);
+    for (Key=Last+1; Key!=ARRAYEND(CueKeys,cue_key); ++Key)
+    {
+        if (CueKeyCmp(NULL, Key, Last) != 0)
+            *(++Last) = *Key;
+        else
+            Last->Found |= Key->Found;
+    }
+    ArrayShrink(&CueKeys, (ARRAYEND(CueKeys,cue_key) - (Last+1)) * sizeof(cue_key));
+}
+
+static void IndexCueEntries(ebml_master *Cues)
+{
+    cue_key Key;
+    matroska_cuepoint *CuePoint = (matroska_cuepoint*)EBML_MasterFindChild(Cues, MATROSKA_getContextCuePoint());
+
+    Key.Found = 0;
+    while (CuePoint)
+    {
+        MATROSKA_LinkCueSegmentInfo(CuePoint,RSegmentInfo);
+        Key.Timestamp = MATROSKA_CueTimestamp(CuePoint);
+        Key.TrackNum = MATROSKA_CueTrackNum(CuePoint);
+        ArrayAppend(&CueKeys,&Key,sizeof(Key),4096);
+        CuePoint = (matroska_cuepoint*)EBML_MasterNextChild(Cues, CuePoint);
+    }
+    SortCueKeys();
+    CueKeysFromCues = 1;
+}
+
+static void AddCueBlock(array *Keys, matroska_block *Block)
+{
+    cue_key Key;
+    Key.Timestamp = MATROSKA_BlockTimestamp(Block);
+    Key.TrackNum = MATROSKA_BlockTrackNum(Block);
+    Key.Found = 1;
+    ArrayAppend(Keys,&Key,sizeof(Key),4096);
+}
+
+// list the Blocks of the Cluster that the Cues may reference
+static void ClusterCueKeys(matroska_cluster *Cluster, array *Keys)
+{
+    ebml_element *Block, *GBlock;
+    for (Block = EBML_MasterChildren(Cluster);Block;Block=EBML_MasterNext(Block))
+    {
+        if (EL_Type(Block, MATROSKA_getContextBlockGroup()))
+        {
+            for (GBlock = EBML_MasterChildren(Block);GBlock;GBlock=EBML_MasterNext(GBlock))
+            {
+                if (EL_Type(GBlock, MATROSKA_getContextBlock()))
+                {
+                    AddCueBlock(Keys, (matroska_block*)GBlock);
+                    break;
+                }
+            }
+        }
+        else if (EL_Type(Block, MATROSKA_getContextSimpleBlock()))
+            AddCueBlock(Keys, (matroska_block*)Block);
+    }
+}
+
+static void AddCueKeys(const array *Keys)
+{
+    const cue_key *Key;
+    bool_t Found;
+    intptr_t Pos;
+
+    for (Key=ARRAYBEGIN(*Keys,cue_key); Key!=ARRAYEND(*Keys,cue_key); ++Key)
+    {
+        Pos = ArrayFind(&CueKeys,cue_key,Key,(arraycmp)CueKeyCmp,NULL,&Found);
+        if (Found)
+            ARRAYBEGIN(CueKeys,cue_key)[Pos].Found = 1;
+    }
+}
+
+static bool_t CueBlockFound(mkv_timestamp_t Timestamp, int16_t TrackNum)
+{
+    matroska_cluster **Cluster;
+    cue_key Key;
+    bool_t Found;
+    intptr_t Pos;
+
+    if (Streaming)
+    {
+        Key.Timestamp = Timestamp;
+        Key.TrackNum = TrackNum;
+        Pos = ArrayFind(&CueKeys,cue_key,&Key,(arraycmp)CueKeyCmp,NULL,&Found);
+        return Found && ARRAYBEGIN(CueKeys,cue_key)[Pos].Found;
+    }
+
+    for (Cluster = ARRAYBEGIN(RClusters,matroska_cluster*);Cluster != ARRAYEND(RClusters,matroska_cluster*); ++Cluster)
+    {
+        if (MATROSKA_GetBlockForTimestamp(*Cluster, Timestamp, TrackNum))
+            return 1;
+    }
+    return 0;
+}
+
 static int CheckCueEntries(ebml_master *Cues)
 {
     int Result = 0;
     mkv_timestamp_t TimestampEntry, PrevTimestamp = INVALID_TIMESTAMP_T;
     uint16_t TrackNumEntry;
-    matroska_cluster **Cluster;
-    matroska_block *Block;
     int ClustNum = 0;
 
     if (!RSegmentInfo)
         Result |= OutputError(0x310,T("A Cues (index) is defined but no SegmentInfo was found"));
-    else if (ARRAYCOUNT(RClusters,matroska_cluster*))
+    else if (Streaming && !CueKeysFromCues)
+    {
+        // the Blocks are not kept until the Cues are found
+        OutputWarning(0x313,T("The Cues were not found before the Clusters, their entries are not checked in streaming mode"));
+    }
+    else if (!ARRAYEMPTY(ClusterPos))
     {
         matroska_cuepoint *CuePoint = (matroska_cuepoint*)EBML_MasterFindChild(Cues, MATROSKA_getContextCuePoint());
         while (CuePoint)
@@ -836,14 +1104,7 @@ static int CheckCueEntries(ebml_master *Cues)
             if (TimestampEntry < PrevTimestamp && PrevTimestamp != INVALID_TIMESTAMP_T)
                 OutputWarning(0x311,T("The Cues entry for timestamp %") TPRId64 T(" ms is listed after entry %") TPRId64 T(" ms"),Scale64(TimestampEntry,1,1000000),Scale64(PrevTimestamp,1,1000000));
 
-            // find a matching Block
-            for (Cluster = ARRAYBEGIN(RClusters,matroska_cluster*);Cluster != ARRAYEND(RClusters,matroska_cluster*); ++Cluster)
-            {
-                Block = MATROSKA_GetBlockForTimestamp(*Cluster, TimestampEntry, TrackNumEntry);
-                if (Block)
-                    break;
-            }
-            if (Cluster == ARRAYEND(RClusters,matroska_cluster*))
+            if (!CueBlockFound(TimestampEntry, TrackNumEntry))
                 Result |= OutputError(0x312,T("CueEntry Track #%d and timestamp %") TPRId64 T(" ms not found"),(int)TrackNumEntry,Scale64(TimestampEntry,1,1000000));
             PrevTimestamp = TimestampEntry;
             CuePoint = (matroska_cuepoint*)EBML_MasterNextChild(Cues, CuePoint);
@@ -852,6 +1113,253 @@ static int CheckCueEntries(ebml_master *Cues)
     return Result;
 }
 
+// read the element of the given type starting at Pos
+static ebml_master *ReadElementAt(struct stream *Input, ebml_parser_context *Context, filepos_t Pos, const ebml_context *Type, bool_t AllowDummy, int Scope, size_t DepthCheckCRC)
+{
+    ebml_master *Elt;
+    int UpperElement = 0;
+
+    if (Pos == INVALID_FILEPOS_T || Stream_Seek(Input,Pos,SEEK_SET) != Pos)
+        return NULL;
+    Elt = (ebml_master*)EBML_FindNextElement(Input, Context, &UpperElement, 0);
+    if (Elt && (!EL_Type(Elt, Type) || EL_Pos(Elt) != Pos ||
+        EBML_ElementReadData(Elt,Input,Context,AllowDummy,Scope,DepthCheckCRC)!=ERR_NONE))
+    {
+        NodeDelete((node*)Elt);
+        Elt = NULL;
+    }
+    return Elt;
+}
+
+// read the Cues referenced in the SeekHead before the Clusters, so we don't need to keep them
+static ebml_master *ReadSeekHeadCues(struct stream *Input, ebml_parser_context *Context)
+{
+    matroska_seekpoint *SeekPoint;
+    ebml_master *Cues;
+    filepos_t CurrentPos;
+
+    if (!RSeekHead)
+        return NULL;
+    SeekPoint = (matroska_seekpoint*)EBML_MasterFindChild(RSeekHead, MATROSKA_getContextSeek());
+    while (SeekPoint && !MATROSKA_MetaSeekIsClass(SeekPoint, MATROSKA_getContextCues()))
+        SeekPoint = (matroska_seekpoint*)EBML_MasterNextChild(RSeekHead, SeekPoint);
+    if (!SeekPoint)
+        return NULL;
+
+    CurrentPos = Stream_Seek(Input,0,SEEK_CUR);
+    if (CurrentPos == INVALID_FILEPOS_T)
+        return NULL;
+    Cues = ReadElementAt(Input, Context, MATROSKA_MetaSeekAbsolutePos(SeekPoint), MATROSKA_getContextCues(), 1, SCOPE_ALL_DATA, 3);
+    Stream_Seek(Input,CurrentPos,SEEK_SET);
+    return Cues;
+}
+
+static void CheckClusterJob(cluster_job *Job, size_t Index, array *Keys)
+{
+    cluster_check *Check = ARRAYBEGIN(ClusterChecks,cluster_check) + Index;
+    filepos_t Pos = ARRAYBEGIN(ClusterPos,filepos_t)[Index];
+    ebml_master *Cluster;
+    int UpperElement = 0;
+
+    Capture = &Check->Output;
+    Cluster = NULL;
+    if (Stream_Seek(Job->Input,Pos,SEEK_SET) == Pos)
+        Cluster = (ebml_master*)EBML_FindNextElement(Job->Input, &Job->Context, &UpperElement, 0);
+    if (!Cluster || !EL_Type(Cluster, MATROSKA_getContextCluster()) || EL_Pos(Cluster) != Pos ||
+        EBML_ElementReadData(Cluster,Job->Input,&Job->Context,0,SCOPE_PARTIAL_DATA,4)!=ERR_NONE)
+    {
+        Check->Result = OutputError(0x180,T("Failed to read the Cluster at %") TPRId64 T(" size %") TPRId64,Pos,Cluster?EL_DataSize(Cluster):0);
+        Check->Failed = 1;
+    }
+    else
+    {
+        Check->VoidAmount = CheckUnknownElements((ebml_element*)Cluster);
+        Check->Result |= CheckProfileViolation((ebml_element*)Cluster, Job->Profile);
+        MATROSKA_LinkClusterBlocks((matroska_cluster*)Cluster, RSegmentInfo, RTrackInfo, 1, Job->Profile);
+        if (Job->HasVideo)
+        {
+            // the timestamp is compared with the previous Cluster when merging
+            Check->TimestampMark = ARRAYCOUNT(Check->Output,uint8_t);
+            Check->Timestamp = MATROSKA_ClusterTimestamp((matroska_cluster*)Cluster);
+            ClusterTime = INVALID_TIMESTAMP_T;
+            Check->Result |= CheckClusterVideoStart(Cluster, Job->Profile);
+        }
+        Check->Result |= CheckClusterLacingKeyframe((matroska_cluster*)Cluster, Job->Profile);
+        PrevClusterPos = Index ? ARRAYBEGIN(ClusterPos,filepos_t)[Index-1] : INVALID_FILEPOS_T;
+        Check->Result |= CheckClusterPosSize((ebml_element*)Cluster, Job->Segment);
+        if (CueKeysFromCues)
+        {
+            ClusterCueKeys((matroska_cluster*)Cluster, Keys);
+            LockEnter(&JobLock);
+            AddCueKeys(Keys);
+            LockLeave(&JobLock);
+            ArrayDrop(Keys);
+        }
+    }
+    Capture = NULL;
+    if (Cluster)
+        NodeDelete((node*)Cluster);
+}
+
+static void RunClusterJobs(cluster_job *Job)
+{
+    size_t Index;
+    array Keys;
+
+    ArrayInit(&Keys);
+    for (;;)
+    {
+        LockEnter(&JobLock);
+        Index = NextCluster++;
+        LockLeave(&JobLock);
+        if (Index >= ARRAYCOUNT(ClusterPos,filepos_t))
+            break;
+        CheckClusterJob(Job, Index, &Keys);
+    }
+    ArrayClear(&Keys);
+}
+
+static cc_thread_return THREAD_CALL ClusterWorker(void *Param)
+{
+    cluster_job *Job = Param;
+
+    RSegmentInfo = ReadElementAt(Job->Input, &Job->Context, Job->SegmentInfoPos, MATROSKA_getContextInfo(), 1, SCOPE_ALL_DATA, 1);
+    RTrackInfo = ReadElementAt(Job->Input, &Job->Context, Job->TrackInfoPos, MATROSKA_getContextTracks(), 1, SCOPE_ALL_DATA, 4);
+    if (RSegmentInfo && RTrackInfo)
+    {
+        ListTracks(RTrackInfo);
+        RunClusterJobs(Job);
+    }
+    // the other threads (and the main one) do the work if this one couldn't start
+    Job->Tracks = Tracks;
+    Job->MinTime = MinTime;
+    Job->MaxTime = MaxTime;
+
+    if (RTrackInfo)
+        NodeDelete((node*)RTrackInfo);
+    if (RSegmentInfo)
+        NodeDelete((node*)RSegmentInfo);
+    MemHeap_ReleaseThread(Node_Context(Job->Segment)->NodeHeap);
+    return 0;
+}
+
+// check the Clusters with the main thread and Jobs-1 workers, each with its own file handle
+static int CheckClustersJobs(struct stream *Input, const tchar_t *Path, ebml_parser_context *SegmentContext, const ebml_element *Segment, int ProfileNum, bool_t HasVideo, filepos_t *VoidAmount, bool_t *Failed)
+{
+    int Result = 0;
+    cluster_job *Workers, Main, *Job;
+    cluster_check *Check;
+    const tchar_t *Msg;
+    size_t Index;
+    int i;
+
+    NextCluster = 0;
+
+    Workers = calloc(Jobs-1, sizeof(cluster_job));
+    LockInit(&JobLock);
+    for (i=0, Job=Workers; Workers && i<Jobs-1; ++i, ++Job)
+    {
+        Job->Input = StreamOpen(Input,Path,SFLAG_RDONLY|SFLAG_BUFFERED|SFLAG_MAPPED);
+        Job->Context = *SegmentContext;
+        Job->Segment = Segment;
+        Job->SegmentInfoPos = EL_Pos(RSegmentInfo);
+        Job->TrackInfoPos = EL_Pos(RTrackInfo);
+        Job->Profile = ProfileNum;
+        Job->HasVideo = HasVideo;
+        if (Job->Input)
+            Job->Started = ThreadStart(&Job->Thread,ClusterWorker,Job);
+    }
+
+    memset(&Main,0,sizeof(Main));
+    Main.Input = Input;
+    Main.Context = *SegmentContext;
+    Main.Segment = Segment;
+    Main.Profile = ProfileNum;
+    Main.HasVideo = HasVideo;
+    RunClusterJobs(&Main);
+
+    for (i=0, Job=Workers; Workers && i<Jobs-1; ++i, ++Job)
+    {
+        if (Job->Started)
+        {
+            ThreadWait(Job->Thread);
+            for (Index=0;Index<ARRAYCOUNT(Job->Tracks,track_info) && Index<ARRAYCOUNT(Tracks,track_info);++Index)
+                ARRAYBEGIN(Tracks,track_info)[Index].DataLength += ARRAYBEGIN(Job->Tracks,track_info)[Index].DataLength;
+            if (Job->MinTime!=INVALID_TIMESTAMP_T && (MinTime==INVALID_TIMESTAMP_T || MinTime>Job->MinTime))
+                MinTime = Job->MinTime;
+            if (Job->MaxTime!=INVALID_TIMESTAMP_T && (MaxTime==INVALID_TIMESTAMP_T || MaxTime<Job->MaxTime))
+                MaxTime = Job->MaxTime;
+            ArrayClear(&Job->Tracks);
+        }
+        if (Job->Input)
+            StreamClose(Job->Input);
+    }
+    LockDone(&JobLock);
+    free(Workers);
+
+    // output in the file order
+    ClusterTime = INVALID_TIMESTAMP_T;
+    for (Check=ARRAYBEGIN(ClusterChecks,cluster_check); Check!=ARRAYEND(ClusterChecks,cluster_check); ++Check)
+    {
+        for (Msg=ARRAYBEGIN(Check->Output,tchar_t); Msg!=ARRAYEND(Check->Output,tchar_t); Msg+=tcslen(Msg)+1)
+        {
+            if (HasVideo && !Check->Failed && (const uint8_t*)Msg == ARRAYBEGIN(Check->Output,uint8_t) + Check->TimestampMark)
+                break;
+            TextWrite(StdErr,Msg);
+        }
+        if (HasVideo && !Check->Failed)
+        {
+            if (Check->Timestamp!=INVALID_TIMESTAMP_T && ClusterTime!=INVALID_TIMESTAMP_T && ClusterTime >= Check->Timestamp)
+                OutputWarning(0xC2,T("The timestamp of the Cluster at %") TPRId64 T(" is not incrementing (may be intentional)"),ARRAYBEGIN(ClusterPos,filepos_t)[Check - ARRAYBEGIN(ClusterChecks,cluster_check)]);
+            ClusterTime = Check->Timestamp;
+            for (; Msg!=ARRAYEND(Check->Output,tchar_t); Msg+=tcslen(Msg)+1)
+                TextWrite(StdErr,Msg);
+        }
+        *VoidAmount += Check->VoidAmount;
+        if (Check->Failed)
+        {
+            *Failed = 1;
+            Result = Check->Result;
+            break;
+        }
+        Result |= Check->Result;
+        for (Msg=ARRAYBEGIN(Check->After,tchar_t); Msg!=ARRAYEND(Check->After,tchar_t); Msg+=tcslen(Msg)+1)
+            TextWrite(StdErr,Msg);
+    }
+    return Result;
+}
+
+// check the Clusters found during the scan, their messages are output before the ones of the scan found after them
+static int CheckScannedClusters(struct stream *Input, const tchar_t *Path, ebml_parser_context *SegmentContext, const ebml_element *Segment, int ProfileNum, bool_t HasVideo, filepos_t *VoidAmount, bool_t *Failed)
+{
+    int Result = 0;
+    cluster_check *Check;
+    const tchar_t *Msg;
+
+    Capture = NULL;
+    if (RSegmentInfo && RTrackInfo)
+    {
+        if (RCues && !Live && !CueKeysFromCues)
+            IndexCueEntries(RCues);
+        Result = CheckClustersJobs(Input, Path, SegmentContext, Segment, ProfileNum, HasVideo, VoidAmount, Failed);
+    }
+    else
+    {
+        // the Clusters can't be checked
+        for (Check=ARRAYBEGIN(ClusterChecks,cluster_check); Check!=ARRAYEND(ClusterChecks,cluster_check); ++Check)
+            for (Msg=ARRAYBEGIN(Check->After,tchar_t); Msg!=ARRAYEND(Check->After,tchar_t); Msg+=tcslen(Msg)+1)
+                TextWrite(StdErr,Msg);
+    }
+
+    for (Check=ARRAYBEGIN(ClusterChecks,cluster_check); Check!=ARRAYEND(ClusterChecks,cluster_check); ++Check)
+    {
+        ArrayClear(&Check->Output);
+        ArrayClear(&Check->After);
+    }
+    ArrayClear(&ClusterChecks);
+    return Result;
+}
+
 #if defined(TARGET_WIN) && defined(UNICODE)
 int wmain(int argc, const wchar_t *argv[])
 #else
@@ -862,11 +1370,12 @@ int main(int argc, const char *argv[])
     int ShowUsage = 0;
     int ShowVersion = 0;
     parsercontext p;
+    cc_memheap *NodeHeap;
     textwriter _StdErr;
     struct stream *Input = NULL;
     tchar_t Path[MAXPATHFULL];
     tchar_t String[MAXLINE];
-    ebml_master *EbmlHead = NULL, *RSegment = NULL, *RLevel1 = NULL, *Prev, *RLevelX, **Cluster;
+    ebml_master *EbmlHead = NULL, *RSegment = NULL, *RLevel1 = NULL, *RLevelX, **Cluster;
     ebml_element *EbmlDocVer, *EbmlReadDocVer;
     ebml_string *LibName, *AppName;
     ebml_parser_context RContext;
@@ -874,12 +1383,17 @@ int main(int argc, const char *argv[])
     int i,UpperElement;
     int MatroskaProfile = 0;
     bool_t HasVideo = 0;
+    bool_t HasPrev, JobFailed = 0;
+    filepos_t PrevEnd = INVALID_FILEPOS_T;
     int DotCount;
     track_info *TI;
     filepos_t VoidAmount = 0;
+    cluster_check Check;
+    array Keys;
 
     // Core-C init phase
-    ParserContext_Init(&p,NULL,NULL,NULL);
+    NodeHeap = MemHeap_CreateSlab(); // the default heap is used if it fails
+    ParserContext_Init(&p,NULL,NodeHeap,NULL);
     Node_SetData(&p.Base.Base.Base,NODECONTEXT_PROJECT_VENDOR,TYPE_STRING,"Matroska");
     Node_SetData(&p.Base.Base.Base,NODECONTEXT_PROJECT_VERSION,TYPE_STRING,PROJECT_VERSION);
     Node_SetData(&p.Base.Base.Base,NODECONTEXT_PROJECT_NAME,TYPE_STRING,PROJECT_NAME);
@@ -888,6 +1402,9 @@ int main(int argc, const char *argv[])
     MATROSKA_Init(&p);
 
     ArrayInit(&RClusters);
+    ArrayInit(&ClusterPos);
+    ArrayInit(&CueKeys);
+    ArrayInit(&Keys);
     ArrayInit(&Tracks);
 
     StdErr = &_StdErr;
@@ -909,6 +1426,16 @@ int main(int argc, const char *argv[])
         else if (tcsisame_ascii(Path,T("--version"))) ShowVersion = 1;
         else if (tcsisame_ascii(Path,T("--quiet"))) Quiet = 1;
         else if (tcsisame_ascii(Path,T("--quick"))) QuickExit = 1;
+        else if (tcsisame_ascii(Path,T("--streaming"))) Streaming = 1;
+        else if (tcsisame_ascii(Path,T("--jobs")) && i+1<argc-1)
+        {
+#if defined(TARGET_WIN) && defined(UNICODE)
+            Node_FromWcs(&p,Path,TSIZEOF(Path),argv[++i]);
+#else
+            Node_FromStr(&p,Path,TSIZEOF(Path),argv[++i]);
+#endif
+            Jobs = MAX(1,StringToInt(Path,0));
+        }
         else if (tcsisame_ascii(Path,T("--help"))) {ShowVersion = 1; ShowUsage = 1;}
         else if (i<argc-1) TextPrintf(StdErr,T("Unknown parameter '%s'\r\n"),Path);
     }
@@ -926,18 +1453,25 @@ int main(int argc, const char *argv[])
             TextWrite(StdErr,T("  --divx      assume the file is using DivX specific extensions\r\n"));
             TextWrite(StdErr,T("  --quick     exit after the first error or warning\r\n"));
             TextWrite(StdErr,T("  --quiet     don't ouput progress and file info\r\n"));
+            TextWrite(StdErr,T("  --streaming check each Cluster as it's read and don't keep it in memory\r\n"));
+            TextWrite(StdErr,T("  --jobs <n>  check the Clusters with <n> threads, implies --streaming\r\n"));
             TextWrite(StdErr,T("  --version   show the version of ") PROJECT_NAME T("\r\n"));
             TextWrite(StdErr,T("  --help      show this screen\r\n"));
         }
         goto exit;
     }
 
+    if (QuickExit)
+        Jobs = 1; // the first message has to be found in order
+    if (Jobs > 1)
+        Streaming = 1;
+
 #if defined(TARGET_WIN) && defined(UNICODE)
     Node_FromWcs(&p,Path,TSIZEOF(Path),argv[argc-1]);
 #else
     Node_FromStr(&p,Path,TSIZEOF(Path),argv[argc-1]);
 #endif
-    Input = StreamOpen(&p,Path,SFLAG_RDONLY/*|SFLAG_BUFFERED*/);
+    Input = StreamOpen(&p,Path,SFLAG_RDONLY|SFLAG_BUFFERED|SFLAG_MAPPED);
     if (!Input)
     {
         TextPrintf(StdErr,T("Could not open file \"%s\" for reading\r\n"),Path);
@@ -1036,19 +1570,83 @@ int main(int argc, const char *argv[])
 
     UpperElement = 0;
     DotCount = 0;
-    Prev = NULL;
+    HasPrev = 0;
     RLevel1 = (ebml_master*)EBML_FindNextElement(Input, &RSegmentContext, &UpperElement, 1);
     while (RLevel1)
     {
         RLevelX = NULL;
-        if (EL_Type(RLevel1, MATROSKA_getContextCluster()))
+        if (Streaming && ARRAYEMPTY(ClusterPos) && EL_Type(RLevel1, MATROSKA_getContextCluster()))
+        {
+            if (!RSegmentInfo || !RTrackInfo)
+            {
+                // the --jobs workers only need them once the whole Segment is known
+                if (Jobs == 1)
+                {
+                    TextWrite(StdErr,T("\rThe Cluster is found before the SegmentInfo/TrackInfo, streaming disabled\r\n"));
+                    Streaming = 0;
+                }
+            }
+            else if (!Live)
+            {
+                if (!RCues && (RCues = ReadSeekHeadCues(Input, &RSegmentContext)) != NULL)
+                {
+                    NodeTree_SetParent(RCues, RSegment, NULL);
+                    VoidAmount += CheckUnknownElements((ebml_element*)RCues);
+                    Result |= CheckProfileViolation((ebml_element*)RCues, MatroskaProfile);
+                }
+                if (RCues)
+                    IndexCueEntries(RCues);
+            }
+        }
+
+        if (EL_Type(RLevel1, MATROSKA_getContextCluster()) && Jobs > 1)
+        {
+            filepos_t Pos = EL_Pos(RLevel1);
+            // the end of an unknown sized Cluster is only found by reading it
+            if (!EBML_ElementIsFiniteSize((ebml_element*)RLevel1) &&
+                EBML_ElementReadData(RLevel1,Input,&RSegmentContext,0,SCOPE_PARTIAL_DATA,0)!=ERR_NONE)
+            {
+                Result = OutputError(0x180,T("Failed to read the Cluster at %") TPRId64 T(" size %") TPRId64,EL_Pos(RLevel1),EL_DataSize(RLevel1));
+                goto exit;
+            }
+            RLevelX = (ebml_master*)EBML_ElementSkipData((ebml_element*)RLevel1, Input, &RSegmentContext, NULL, 1);
+
+            // checked by the workers once the whole Segment is known,
+            // the messages until the next Cluster are output after the ones of this Cluster
+            memset(&Check,0,sizeof(Check));
+            if (!ArrayAppend(&ClusterChecks,&Check,sizeof(Check),256))
+            {
+                Result = OutputError(0x180,T("Not enough memory to check %d Clusters"),(int)ARRAYCOUNT(ClusterChecks,cluster_check)+1);
+                goto exit;
+            }
+            ArrayAppend(&ClusterPos,&Pos,sizeof(Pos),4096);
+            Capture = &(ARRAYEND(ClusterChecks,cluster_check)-1)->After;
+        }
+        else if (EL_Type(RLevel1, MATROSKA_getContextCluster()))
         {
             if (EBML_ElementReadData(RLevel1,Input,&RSegmentContext,0,SCOPE_PARTIAL_DATA,4)==ERR_NONE)
             {
-                ArrayAppend(&RClusters,&RLevel1,sizeof(RLevel1),256);
+                filepos_t Pos = EL_Pos(RLevel1);
+                ArrayAppend(&ClusterPos,&Pos,sizeof(Pos),4096);
                 NodeTree_SetParent(RLevel1, RSegment, NULL);
                 VoidAmount += CheckUnknownElements((ebml_element*)RLevel1);
                 Result |= CheckProfileViolation((ebml_element*)RLevel1, MatroskaProfile);
+                if (!Streaming)
+                    ArrayAppend(&RClusters,&RLevel1,sizeof(RLevel1),256);
+                else
+                {
+                    MATROSKA_LinkClusterBlocks((matroska_cluster*)RLevel1, RSegmentInfo, RTrackInfo, 1, MatroskaProfile);
+                    if (HasVideo)
+                        Result |= CheckClusterVideoStart(RLevel1, MatroskaProfile);
+                    Result |= CheckClusterLacingKeyframe((matroska_cluster*)RLevel1, MatroskaProfile);
+                    Result |= CheckClusterPosSize((ebml_element*)RLevel1, (ebml_element*)RSegment);
+                    if (CueKeysFromCues)
+                    {
+                        ClusterCueKeys((matroska_cluster*)RLevel1, &Keys);
+                        AddCueKeys(&Keys);
+                        ArrayDrop(&Keys);
+                    }
+                }
                 RLevelX = (ebml_master*)EBML_ElementSkipData((ebml_element*)RLevel1, Input, &RSegmentContext, NULL, 1);
             }
             else
@@ -1122,53 +1720,20 @@ int main(int argc, const char *argv[])
                     OutputWarning(0x120,T("Extra TrackInfo found at %") TPRId64 T(" (size %") TPRId64 T(")"),EL_Pos(RLevel1),EL_DataSize(RLevel1));
                 else
                 {
-                    size_t TrackCount;
-                    ebml_master *Elt;
-
                     RTrackInfo = RLevel1;
                     NodeTree_SetParent(RLevel1, RSegment, NULL);
                     VoidAmount += CheckUnknownElements((ebml_element*)RLevel1);
                     Result |= CheckProfileViolation((ebml_element*)RLevel1, MatroskaProfile);
 
-                    Elt = (ebml_master*)EBML_MasterFindChild(RTrackInfo,MATROSKA_getContextTrackEntry());
-                    TrackCount = 0;
-                    while (Elt)
-                    {
-                        Elt = (ebml_master*)EBML_MasterNextChild(RTrackInfo,Elt);
-                        ++TrackCount;
-                    }
-
-                    ArrayResize(&Tracks,TrackCount*sizeof(track_info),256);
-                    ArrayZero(&Tracks);
-
-                    Elt = (ebml_master*)EBML_MasterFindChild(RTrackInfo,MATROSKA_getContextTrackEntry());
-                    TrackCount = 0;
-                    while (Elt)
+                    ListTracks(RTrackInfo);
+                    for (TI=ARRAYBEGIN(Tracks,track_info); TI!=ARRAYEND(Tracks,track_info); ++TI)
                     {
-                        EbmlDocVer = EBML_MasterFindChild(Elt,MATROSKA_getContextTrackNumber());
-                        assert(EbmlDocVer!=NULL);
-                        if (EbmlDocVer)
+                        if (TI->Kind==MATROSKA_TRACK_TYPE_VIDEO)
                         {
-                            TrackMax = MAX(TrackMax,(size_t)EL_Int(EbmlDocVer));
-                            ARRAYBEGIN(Tracks,track_info)[TrackCount].Num = (int)EL_Int(EbmlDocVer);
+                            Result |= CheckVideoTrack(TI->Entry, TI->Num, MatroskaProfile);
+                            HasVideo = 1;
                         }
-                        EbmlDocVer = EBML_MasterFindChild(Elt,MATROSKA_getContextTrackType());
-                        assert(EbmlDocVer!=NULL);
-                        if (EbmlDocVer)
-                        {
-                            if (EL_Int(EbmlDocVer)==MATROSKA_TRACK_TYPE_VIDEO)
-                            {
-                                Result |= CheckVideoTrack(Elt, ARRAYBEGIN(Tracks,track_info)[TrackCount].Num, MatroskaProfile);
-                                HasVideo = 1;
-                            }
-                            ARRAYBEGIN(Tracks,track_info)[TrackCount].Kind = (int)EL_Int(EbmlDocVer);
-                        }
-                        ARRAYBEGIN(Tracks,track_info)[TrackCount].CodecID = (ebml_string*)EBML_MasterFindChild(Elt,MATROSKA_getContextCodecID());
-                        Elt = (ebml_master*)EBML_MasterNextChild(RTrackInfo,Elt);
-                        ++TrackCount;
                     }
-                    EbmlDocVer = NULL;
-                    Elt = NULL;
                 }
             }
             else
@@ -1179,7 +1744,14 @@ int main(int argc, const char *argv[])
         }
         else if (EL_Type(RLevel1, MATROSKA_getContextCues()))
         {
-            if (Live)
+            if (RCues && EL_Pos(RCues) == EL_Pos(RLevel1))
+            {
+                // already read in streaming mode
+                RLevelX = (ebml_master*)EBML_ElementSkipData((ebml_element*)RLevel1, Input, &RSegmentContext, NULL, 1);
+                NodeDelete((node*)RLevel1);
+                RLevel1 = NULL;
+            }
+            else if (Live)
             {
                 OutputWarning(0x171,T("The live stream has Cues at %") TPRId64,EL_Pos(RLevel1));
                 RLevelX = (ebml_master*)EBML_ElementSkipData((ebml_element*)RLevel1, Input, &RSegmentContext, NULL, 1);
@@ -1300,23 +1872,39 @@ int main(int argc, const char *argv[])
                 TextWrite(StdErr,T("\r                                                              \r"));
         }
 
-        Prev = RLevel1;
+        HasPrev = RLevel1 != NULL;
+        if (RLevel1)
+        {
+            PrevEnd = EBML_ElementPositionEnd((ebml_element*)RLevel1);
+            if (Streaming && EL_Type(RLevel1, MATROSKA_getContextCluster()))
+            {
+                NodeDelete((node*)RLevel1);
+                RLevel1 = NULL;
+            }
+        }
         if (RLevelX)
             RLevel1 = RLevelX;
         else
             RLevel1 = (ebml_master*)EBML_FindNextElement(Input, &RSegmentContext, &UpperElement, 1);
     }
 
+    if (Jobs > 1 && !ARRAYEMPTY(ClusterPos))
+    {
+        Result |= CheckScannedClusters(Input, Path, &RSegmentContext, (ebml_element*)RSegment, MatroskaProfile, HasVideo, &VoidAmount, &JobFailed);
+        if (JobFailed)
+            goto exit;
+    }
+
     if (!RSegmentInfo)
     {
         Result = OutputError(0x40,T("The segment is missing a SegmentInfo"));
         goto exit;
     }
 
-    if (Prev)
+    if (HasPrev)
     {
-        if (EBML_ElementPositionEnd((ebml_element*)RSegment)!=INVALID_FILEPOS_T && EBML_ElementPositionEnd((ebml_element*)RSegment)!=EBML_ElementPositionEnd((ebml_element*)Prev))
-            Result |= OutputError(0x42,T("The segment's size %") TPRId64 T(" doesn't match the position where it ends %") TPRId64,EBML_ElementPositionEnd((ebml_element*)RSegment),EBML_ElementPositionEnd((ebml_element*)Prev));
+        if (EBML_ElementPositionEnd((ebml_element*)RSegment)!=INVALID_FILEPOS_T && EBML_ElementPositionEnd((ebml_element*)RSegment)!=PrevEnd)
+            Result |= OutputError(0x42,T("The segment's size %") TPRId64 T(" doesn't match the position where it ends %") TPRId64,EBML_ElementPositionEnd((ebml_element*)RSegment),PrevEnd);
     }
 
     if (!RSeekHead)
@@ -1329,18 +1917,21 @@ int main(int argc, const char *argv[])
     if (RSeekHead2)
         Result |= CheckSeekHead(RSeekHead2);
 
-    if (ARRAYCOUNT(RClusters,ebml_element*))
+    if (!ARRAYEMPTY(ClusterPos))
     {
         if (!Quiet) TextWrite(StdErr,T("."));
-        LinkClusterBlocks(MatroskaProfile);
+        if (!Streaming)
+        {
+            LinkClusterBlocks(MatroskaProfile);
 
-        if (HasVideo)
-            Result |= CheckVideoStart(MatroskaProfile);
-        Result |= CheckLacingKeyframe(MatroskaProfile);
-        Result |= CheckPosSize((ebml_element*)RSegment);
+            if (HasVideo)
+                Result |= CheckVideoStart(MatroskaProfile);
+            Result |= CheckLacingKeyframe(MatroskaProfile);
+            Result |= CheckPosSize((ebml_element*)RSegment);
+        }
         if (!RCues)
         {
-            if (!Live && ARRAYCOUNT(RClusters,ebml_element*)>1)
+            if (!Live && ARRAYCOUNT(ClusterPos,filepos_t)>1)
                 OutputWarning(0x800,T("The segment has Clusters but no Cues section (bad for seeking)"));
         }
         else
@@ -1379,6 +1970,11 @@ int main(int argc, const char *argv[])
     }
 
 exit:
+    if (Capture)
+    {
+        // the scan failed, the Clusters found before are still checked
+        CheckScannedClusters(Input, Path, &RSegmentContext, (ebml_element*)RSegment, MatroskaProfile, HasVideo, &VoidAmount, &JobFailed);
+    }
     if (!Quiet)
     {
         TextPrintf(StdErr, T("\r\tfile \"%s\"\r\n"), Path);
@@ -1409,6 +2005,9 @@ exit:
     for (Cluster = ARRAYBEGIN(RClusters,ebml_master*);Cluster != ARRAYEND(RClusters,ebml_master*); ++Cluster)
         NodeDelete((node*)*Cluster);
     ArrayClear(&RClusters);
+    ArrayClear(&ClusterPos);
+    ArrayClear(&CueKeys);
+    ArrayClear(&Keys);
     if (RAttachments)
         NodeDelete((node*)RAttachments);
     if (RTags)
@@ -1431,8 +2030,12 @@ exit:
     if (Input)
         StreamClose(Input);
 
+    // EBML & Matroska ending
+    MATROSKA_Done(&p);
+
     // Core-C ending
     ParserContext_Done(&p);
+    MemHeap_DestroySlab(NodeHeap);
 
     return Result;
 }
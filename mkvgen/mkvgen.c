@@ -0,0 +1,531 @@
+/*
+ * Copyright (c) 2026, Matroska (non-profit organisation)
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#define EBML2_UGLY_HACKS_API // the Segment size is only known at the end
+#include "mkvgen.h"
+#include <corec/helpers/file/streams.h>
+#include <corec/array/array.h>
+#include <corec/str/str.h>
+
+#ifndef CONFIG_EBML_WRITING
+#error libebml2 was not built with writing support!
+#endif
+
+#define MKVGEN_PROFILE          PROFILE_MATROSKA_V4
+#define MKVGEN_DOCTYPE_VERSION  4
+#define MKVGEN_TIMESTAMP_SCALE  1000000 // 1 ms
+#define MKVGEN_POOL_SIZE        (1024*1024)
+#define MKVGEN_SEEKHEAD_ROOM    96
+#define MKVGEN_MAX_STRIP        16
+
+typedef struct gen_track
+{
+    const mkvgen_track *Config;
+    ebml_master *Track;
+    mkv_timestamp_t NextTimestamp;
+    mkv_timestamp_t PrevBlockTimestamp;
+    size_t FrameCount;
+    uint8_t Header[MKVGEN_MAX_STRIP];
+
+} gen_track;
+
+typedef struct mkvgen
+{
+    const mkvgen_config *Config;
+    uint32_t Random;
+    array Tracks; // gen_track
+    array Pool; // uint8_t, where the frame payloads are picked from
+    array Frame; // uint8_t, a frame with its stripped header
+    array CueBlocks; // matroska_block*, the Blocks of the current Cluster to add in the Cues
+    size_t MaxFrameSize;
+    mkv_timestamp_t NextCue;
+    ebml_master *Info;
+    mkvgen_stats *Stats;
+
+} mkvgen;
+
+// xorshift32, deterministic for a given seed on all platforms
+static uint32_t NextRandom(mkvgen *Gen)
+{
+    uint32_t x = Gen->Random;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    Gen->Random = x;
+    return x;
+}
+
+static size_t FrameSize(mkvgen *Gen, const gen_track *Track, bool_t Keyframe)
+{
+    const mkvgen_track *Config = Track->Config;
+    size_t Size = Config->FrameSize;
+    int64_t Sum;
+    uint32_t Mantissa;
+    int i;
+
+    if (Keyframe && Config->Type == MATROSKA_TRACK_TYPE_VIDEO && Config->KeyframeInterval)
+        Size *= 4;
+    switch (Config->SizeDistribution)
+    {
+    case MKVGEN_SIZE_NORMAL:
+        // Irwin-Hall, the sum of 12 uniform values in [0,1[ minus 6 has a standard deviation of 1
+        for (i=0, Sum=0; i<12; ++i)
+            Sum += NextRandom(Gen) & 0xFFFF;
+        Sum = (int64_t)Size + (Sum - 6*0x10000) * (int64_t)Config->FrameSizeJitter / 0x10000;
+        Size = Sum > 0 ? (size_t)Sum : 0;
+        break;
+    case MKVGEN_SIZE_EXPONENTIAL:
+        // -ln(U) = -ln(M*2^-i) = ln(2)*(i - log2(M)), with -log2(M) ~ 2*(1-M) for the mantissa M in [0.5,1[
+        Mantissa = NextRandom(Gen) | 1;
+        for (i=0; !(Mantissa & 0x80000000); ++i)
+            Mantissa <<= 1;
+        Size = (size_t)(((uint64_t)Size * (((uint64_t)i << 16) + ((0x100000000 - Mantissa) >> 15)) * 45426) >> 32); // ln(2) = 45426/65536
+        break;
+    default:
+        if (Config->FrameSizeJitter)
+            Size = Size + (NextRandom(Gen) % (2*Config->FrameSizeJitter + 1)) - MIN(Size,Config->FrameSizeJitter);
+        break;
+    }
+    if (Size <= Config->StripSize)
+        Size = Config->StripSize + 1;
+    return MIN(Size, Gen->MaxFrameSize);
+}
+
+static size_t MaxFrameSize(const mkvgen_track *Track)
+{
+    size_t Size = Track->FrameSize*4; // video keyframes
+    if (Track->SizeDistribution == MKVGEN_SIZE_NORMAL)
+        Size += 6*Track->FrameSizeJitter;
+    else if (Track->SizeDistribution == MKVGEN_SIZE_EXPONENTIAL)
+        Size *= 22; // -ln(2^-32)
+    else
+        Size += Track->FrameSizeJitter;
+    return Size + Track->StripSize + 1;
+}
+
+static err_t InitPool(mkvgen *Gen)
+{
+    const mkvgen_track *Track;
+    uint8_t *Data;
+    size_t i;
+
+    Gen->MaxFrameSize = 0;
+    for (Track=Gen->Config->Tracks; Track!=Gen->Config->Tracks+Gen->Config->TrackCount; ++Track)
+        Gen->MaxFrameSize = MAX(Gen->MaxFrameSize, MaxFrameSize(Track));
+
+    if (!ArrayResize(&Gen->Pool, MKVGEN_POOL_SIZE + Gen->MaxFrameSize, 0) || !ArrayResize(&Gen->Frame, Gen->MaxFrameSize, 0))
+        return ERR_OUT_OF_MEMORY;
+
+    // half random bytes, half text-like bytes so the compressed tracks actually shrink
+    Data = ARRAYBEGIN(Gen->Pool, uint8_t);
+    for (i=0; i<ARRAYCOUNT(Gen->Pool, uint8_t); ++i)
+    {
+        if (i & 0x100)
+            Data[i] = (uint8_t)NextRandom(Gen);
+        else
+            Data[i] = (uint8_t)('a' + (NextRandom(Gen) & 0x0F));
+    }
+    return ERR_NONE;
+}
+
+static ebml_master *AddTrack(mkvgen *Gen, ebml_master *Tracks, gen_track *Track, size_t TrackNum)
+{
+    ebml_element *Elt;
+    ebml_master *Entry = (ebml_master*)EBML_MasterAddElt(Tracks, MATROSKA_getContextTrackEntry(), 1, MKVGEN_PROFILE);
+    if (!Entry)
+        return NULL;
+
+    EBML_IntegerSetValue((ebml_integer*)EBML_MasterGetChild(Entry, MATROSKA_getContextTrackNumber(), MKVGEN_PROFILE), TrackNum);
+    EBML_IntegerSetValue((ebml_integer*)EBML_MasterGetChild(Entry, MATROSKA_getContextTrackUID(), MKVGEN_PROFILE), (NextRandom(Gen) | 1));
+    EBML_IntegerSetValue((ebml_integer*)EBML_MasterGetChild(Entry, MATROSKA_getContextTrackType(), MKVGEN_PROFILE), Track->Config->Type);
+    EBML_StringSetValue((ebml_string*)EBML_MasterGetChild(Entry, MATROSKA_getContextCodecID(), MKVGEN_PROFILE), Track->Config->CodecID);
+    if (Track->Config->FrameDuration)
+        EBML_IntegerSetValue((ebml_integer*)EBML_MasterGetChild(Entry, MATROSKA_getContextDefaultDuration(), MKVGEN_PROFILE), Track->Config->FrameDuration);
+
+    if (Track->Config->Type == MATROSKA_TRACK_TYPE_VIDEO)
+    {
+        Elt = EBML_MasterGetChild(Entry, MATROSKA_getContextVideo(), MKVGEN_PROFILE);
+        EBML_IntegerSetValue((ebml_integer*)EBML_MasterGetChild((ebml_master*)Elt, MATROSKA_getContextPixelWidth(), MKVGEN_PROFILE), 1280);
+        EBML_IntegerSetValue((ebml_integer*)EBML_MasterGetChild((ebml_master*)Elt, MATROSKA_getContextPixelHeight(), MKVGEN_PROFILE), 720);
+    }
+    else if (Track->Config->Type == MATROSKA_TRACK_TYPE_AUDIO)
+    {
+        Elt = EBML_MasterGetChild(Entry, MATROSKA_getContextAudio(), MKVGEN_PROFILE);
+        EBML_FloatSetValue((ebml_float*)EBML_MasterGetChild((ebml_master*)Elt, MATROSKA_getContextSamplingFrequency(), MKVGEN_PROFILE), 48000.0);
+        EBML_IntegerSetValue((ebml_integer*)EBML_MasterGetChild((ebml_master*)Elt, MATROSKA_getContextChannels(), MKVGEN_PROFILE), 2);
+    }
+
+    if (Track->Config->Compression == MATROSKA_TRACK_ENCODING_COMP_HEADERSTRIP)
+    {
+        size_t i;
+        for (i=0; i<Track->Config->StripSize; ++i)
+            Track->Header[i] = (uint8_t)NextRandom(Gen);
+        MATROSKA_TrackSetCompressionHeader((matroska_trackentry*)Entry, Track->Header, Track->Config->StripSize, MKVGEN_PROFILE);
+    }
+    else if (Track->Config->Compression != MATROSKA_TRACK_ENCODING_COMP_NONE)
+        MATROSKA_TrackSetCompressionAlgo((matroska_trackentry*)Entry, MATROSKA_CONTENTENCODINGSCOPE_BLOCK, MKVGEN_PROFILE, Track->Config->Compression);
+    else
+        MATROSKA_TrackSetCompressionNone((matroska_trackentry*)Entry);
+
+    return Entry;
+}
+
+static matroska_block *AddBlock(mkvgen *Gen, matroska_cluster *Cluster, gen_track *Track, mkv_timestamp_t ClusterTimestamp, mkv_timestamp_t ClusterEnd)
+{
+    matroska_frame Frame;
+    size_t FrameNum;
+    bool_t Keyframe;
+    ebml_element *Elt;
+    ebml_master *Group = NULL;
+    matroska_block *Block;
+    mkv_timestamp_t BlockTimestamp = Track->NextTimestamp;
+
+    if (Track->Config->UseBlockGroups)
+    {
+        Group = (ebml_master*)EBML_MasterAddElt((ebml_master*)Cluster, MATROSKA_getContextBlockGroup(), 0, MKVGEN_PROFILE);
+        if (!Group)
+            return NULL;
+        Block = (matroska_block*)EBML_MasterAddElt(Group, MATROSKA_getContextBlock(), 0, MKVGEN_PROFILE);
+    }
+    else
+        Block = (matroska_block*)EBML_MasterAddElt((ebml_master*)Cluster, MATROSKA_getContextSimpleBlock(), 0, MKVGEN_PROFILE);
+    if (!Block ||
+        MATROSKA_LinkBlockReadTrack(Block, Track->Track, 1, MKVGEN_PROFILE)!=ERR_NONE ||
+        MATROSKA_LinkBlockReadSegmentInfo(Block, Gen->Info, 1)!=ERR_NONE)
+        goto failed;
+
+    Keyframe = !Track->Config->KeyframeInterval || (Track->FrameCount % Track->Config->KeyframeInterval)==0;
+    MATROSKA_BlockSetKeyframe(Block, Keyframe);
+    for (FrameNum=0; FrameNum < MAX(1,Track->Config->FramesPerBlock) && Track->NextTimestamp < ClusterEnd; ++FrameNum)
+    {
+        size_t Size = FrameSize(Gen, Track, Keyframe && FrameNum==0);
+        Frame.Data = ARRAYBEGIN(Gen->Pool, uint8_t) + NextRandom(Gen) % MKVGEN_POOL_SIZE;
+        if (Track->Config->Compression == MATROSKA_TRACK_ENCODING_COMP_HEADERSTRIP)
+        {
+            // all the frames start with the stripped header
+            memcpy(ARRAYBEGIN(Gen->Frame, uint8_t), Track->Header, Track->Config->StripSize);
+            memcpy(ARRAYBEGIN(Gen->Frame, uint8_t) + Track->Config->StripSize, Frame.Data, Size - Track->Config->StripSize);
+            Frame.Data = ARRAYBEGIN(Gen->Frame, uint8_t);
+        }
+        Frame.Size = (uint32_t)Size;
+        Frame.Timestamp = FrameNum==0 ? Track->NextTimestamp : INVALID_TIMESTAMP_T;
+        Frame.Duration = Track->Config->FrameDuration;
+        if (MATROSKA_BlockAppendFrame(Block, &Frame, ClusterTimestamp)!=ERR_NONE)
+            goto failed;
+        Track->NextTimestamp += Track->Config->FrameDuration;
+        Track->FrameCount++;
+        Gen->Stats->Frames++;
+    }
+
+    if (Group)
+    {
+        // the keyframes are the Blocks without references
+        if (!Keyframe)
+        {
+            Elt = EBML_MasterAddElt(Group, MATROSKA_getContextReferenceBlock(), 0, MKVGEN_PROFILE);
+            if (!Elt)
+                goto failed;
+            EBML_IntegerSetValue((ebml_integer*)Elt, Scale64(Track->PrevBlockTimestamp,1,MKVGEN_TIMESTAMP_SCALE) - Scale64(BlockTimestamp,1,MKVGEN_TIMESTAMP_SCALE));
+        }
+        if (Track->Config->Type == MATROSKA_TRACK_TYPE_SUBTITLE)
+        {
+            Elt = EBML_MasterAddElt(Group, MATROSKA_getContextBlockDuration(), 0, MKVGEN_PROFILE);
+            if (!Elt)
+                goto failed;
+            EBML_IntegerSetValue((ebml_integer*)Elt, Scale64(Track->NextTimestamp - BlockTimestamp,1,MKVGEN_TIMESTAMP_SCALE));
+        }
+    }
+    Track->PrevBlockTimestamp = BlockTimestamp;
+    Gen->Stats->Blocks++;
+    return Block;
+
+failed:
+    if (Group)
+        NodeDelete((node*)Group);
+    else if (Block)
+        NodeDelete((node*)Block);
+    return NULL;
+}
+
+static err_t WriteCluster(mkvgen *Gen, struct stream *Output, ebml_element *Segment, ebml_master *Cues, mkv_timestamp_t ClusterTimestamp, mkv_timestamp_t ClusterEnd)
+{
+    gen_track *Track, *Next;
+    matroska_block *Block, **CueBlock;
+    err_t Err = ERR_NONE;
+    matroska_cluster *Cluster = (matroska_cluster*)EBML_ElementCreate(Segment, MATROSKA_getContextCluster(), 0, MKVGEN_PROFILE);
+    if (!Cluster)
+        return ERR_OUT_OF_MEMORY;
+    MATROSKA_LinkClusterReadSegmentInfo(Cluster, Gen->Info, 1);
+    MATROSKA_ClusterSetTimestamp(Cluster, ClusterTimestamp);
+    EBML_MasterUseChecksum((ebml_master*)Cluster, Gen->Config->UseCRC);
+    EBML_ElementSetInfiniteSize((ebml_element*)Cluster, Gen->Config->Live);
+    ArrayDrop(&Gen->CueBlocks);
+
+    // interleave the Blocks of all the tracks in timestamp order
+    for (;;)
+    {
+        Next = NULL;
+        for (Track=ARRAYBEGIN(Gen->Tracks,gen_track); Track!=ARRAYEND(Gen->Tracks,gen_track); ++Track)
+            if (Track->NextTimestamp < ClusterEnd && (!Next || Track->NextTimestamp < Next->NextTimestamp))
+                Next = Track;
+        if (!Next)
+            break;
+        Block = AddBlock(Gen, Cluster, Next, ClusterTimestamp, ClusterEnd);
+        if (!Block)
+        {
+            NodeDelete((node*)Cluster);
+            return ERR_OUT_OF_MEMORY;
+        }
+        // the Cues point to keyframes of the first track
+        if (Cues && Next==ARRAYBEGIN(Gen->Tracks,gen_track) && MATROSKA_BlockKeyframe(Block) && MATROSKA_BlockTimestamp(Block) >= Gen->NextCue)
+        {
+            if (!ArrayAppend(&Gen->CueBlocks, &Block, sizeof(Block), 64))
+            {
+                NodeDelete((node*)Cluster);
+                return ERR_OUT_OF_MEMORY;
+            }
+            Gen->NextCue = Gen->Config->CueInterval ? MATROSKA_BlockTimestamp(Block) + Gen->Config->CueInterval : ClusterEnd;
+        }
+    }
+
+    Err = EBML_ElementRender((ebml_element*)Cluster, Output, 0, 0, 1, MKVGEN_PROFILE, NULL);
+    for (CueBlock=ARRAYBEGIN(Gen->CueBlocks,matroska_block*); Err==ERR_NONE && CueBlock!=ARRAYEND(Gen->CueBlocks,matroska_block*); ++CueBlock)
+    {
+        matroska_cuepoint *Cue = (matroska_cuepoint*)EBML_MasterAddElt(Cues, MATROSKA_getContextCuePoint(), 1, MKVGEN_PROFILE);
+        if (!Cue)
+            Err = ERR_OUT_OF_MEMORY;
+        else
+        {
+            MATROSKA_LinkCueSegmentInfo(Cue, Gen->Info);
+            MATROSKA_LinkCuePointBlock(Cue, *CueBlock);
+            Err = MATROSKA_CuePointUpdate(Cue, Segment, MKVGEN_PROFILE);
+            MATROSKA_LinkCuePointBlock(Cue, NULL); // the Cluster is not kept
+            Gen->Stats->CuePoints++;
+        }
+    }
+    Gen->Stats->Clusters++;
+    NodeDelete((node*)Cluster);
+    return Err;
+}
+
+static err_t WriteHead(anynode *Any, struct stream *Output, bool_t UseCRC)
+{
+    err_t Err;
+    ebml_master *Head = (ebml_master*)EBML_ElementCreate(Any, EBML_getContextHead(), 1, MKVGEN_PROFILE);
+    if (!Head)
+        return ERR_OUT_OF_MEMORY;
+    EBML_MasterUseChecksum(Head, UseCRC);
+    EBML_StringSetValue((ebml_string*)EBML_MasterGetChild(Head, EBML_getContextDocType(), MKVGEN_PROFILE), "matroska");
+    EBML_IntegerSetValue((ebml_integer*)EBML_MasterGetChild(Head, EBML_getContextDocTypeVersion(), MKVGEN_PROFILE), MKVGEN_DOCTYPE_VERSION);
+    EBML_IntegerSetValue((ebml_integer*)EBML_MasterGetChild(Head, EBML_getContextDocTypeReadVersion(), MKVGEN_PROFILE), 2);
+    Err = EBML_ElementRender((ebml_element*)Head, Output, 1, 0, 1, MKVGEN_PROFILE, NULL);
+    NodeDelete((node*)Head);
+    return Err;
+}
+
+static err_t WriteSeekHead(ebml_master *Segment, ebml_element *Void, struct stream *Output, ebml_element *Level1[], size_t Count, bool_t UseCRC)
+{
+    size_t i;
+    matroska_seekpoint *Seek;
+    ebml_master *SeekHead = (ebml_master*)EBML_MasterAddElt(Segment, MATROSKA_getContextSeekHead(), 0, MKVGEN_PROFILE);
+    if (!SeekHead)
+        return ERR_OUT_OF_MEMORY;
+    EBML_MasterUseChecksum(SeekHead, UseCRC);
+    for (i=0; i<Count; ++i)
+    {
+        if (!Level1[i])
+            continue;
+        Seek = (matroska_seekpoint*)EBML_MasterAddElt(SeekHead, MATROSKA_getContextSeek(), 0, MKVGEN_PROFILE);
+        if (!Seek)
+            return ERR_OUT_OF_MEMORY;
+        MATROSKA_LinkMetaSeekElement(Seek, Level1[i]);
+        MATROSKA_MetaSeekUpdate(Seek);
+    }
+    EBML_ElementUpdateSize(SeekHead, 0, 0, MKVGEN_PROFILE);
+    if (EBML_VoidReplaceWith(Void, (ebml_element*)SeekHead, Output, 1, 0) == INVALID_FILEPOS_T)
+        return ERR_INVALID_DATA;
+    return ERR_NONE;
+}
+
+err_t MKVGEN_Write(anynode *Any, struct stream *Output, const mkvgen_config *Config, mkvgen_stats *Stats)
+{
+    mkvgen Gen;
+    mkvgen_stats _Stats;
+    gen_track *Track;
+    ebml_master *Segment = NULL, *Tracks, *Cues = NULL;
+    ebml_element *Void = NULL, *Level1[3];
+    mkv_timestamp_t ClusterTimestamp;
+    filepos_t EndPos;
+    uint8_t UUID[16];
+    size_t i;
+    err_t Err;
+
+    if (!Config->TrackCount || Config->ClusterDuration <= 0 || Config->ClusterDuration > 30000000000)
+        return ERR_INVALID_PARAM;
+
+    memset(&Gen, 0, sizeof(Gen));
+    Gen.Config = Config;
+    Gen.Random = Config->Seed ? Config->Seed : 0x6D6B7667;
+    Gen.Stats = Stats ? Stats : &_Stats;
+    memset(Gen.Stats, 0, sizeof(*Gen.Stats));
+    ArrayInit(&Gen.Tracks);
+    ArrayInit(&Gen.Pool);
+    ArrayInit(&Gen.Frame);
+    ArrayInit(&Gen.CueBlocks);
+
+    Err = InitPool(&Gen);
+    if (Err!=ERR_NONE)
+        goto exit;
+    if (!ArrayResize(&Gen.Tracks, sizeof(gen_track)*Config->TrackCount, 0))
+    {
+        Err = ERR_OUT_OF_MEMORY;
+        goto exit;
+    }
+    ArrayZero(&Gen.Tracks);
+
+    Err = WriteHead(Any, Output, Config->UseCRC);
+    if (Err!=ERR_NONE)
+        goto exit;
+
+    // the Segment size is written once everything is written
+    Segment = (ebml_master*)EBML_ElementCreate(Any, MATROSKA_getContextSegment(), 0, MKVGEN_PROFILE);
+    if (!Segment)
+    {
+        Err = ERR_OUT_OF_MEMORY;
+        goto exit;
+    }
+    if (Config->Live)
+        EBML_ElementSetInfiniteSize((ebml_element*)Segment, 1);
+    else
+        EBML_ElementSetSizeLength((ebml_element*)Segment, EBML_MAX_SIZE);
+    Err = EBML_ElementRenderHead((ebml_element*)Segment, Output, 0, NULL);
+    if (Err!=ERR_NONE)
+        goto exit;
+
+    if (!Config->Live)
+    {
+        // room for the SeekHead
+        Void = EBML_ElementCreate(Segment, EBML_getContextEbmlVoid(), 1, MKVGEN_PROFILE);
+        if (!Void)
+        {
+            Err = ERR_OUT_OF_MEMORY;
+            goto exit;
+        }
+        EBML_VoidSetFullSize(Void, MKVGEN_SEEKHEAD_ROOM);
+        Err = EBML_ElementRender(Void, Output, 0, 0, 1, MKVGEN_PROFILE, NULL);
+        if (Err!=ERR_NONE)
+            goto exit;
+    }
+
+    // Segment Info
+    Gen.Info = (ebml_master*)EBML_MasterAddElt(Segment, MATROSKA_getContextInfo(), 1, MKVGEN_PROFILE);
+    if (!Gen.Info)
+    {
+        Err = ERR_OUT_OF_MEMORY;
+        goto exit;
+    }
+    EBML_MasterUseChecksum(Gen.Info, Config->UseCRC);
+    EBML_IntegerSetValue((ebml_integer*)EBML_MasterGetChild(Gen.Info, MATROSKA_getContextTimestampScale(), MKVGEN_PROFILE), MKVGEN_TIMESTAMP_SCALE);
+    if (!Config->Live)
+        EBML_FloatSetValue((ebml_float*)EBML_MasterGetChild(Gen.Info, MATROSKA_getContextDuration(), MKVGEN_PROFILE), (double)Config->Duration / MKVGEN_TIMESTAMP_SCALE);
+    EBML_UniStringSetValue((ebml_string*)EBML_MasterGetChild(Gen.Info, MATROSKA_getContextMuxingApp(), MKVGEN_PROFILE), T("libmatroska2 mkvgen"));
+    EBML_UniStringSetValue((ebml_string*)EBML_MasterGetChild(Gen.Info, MATROSKA_getContextWritingApp(), MKVGEN_PROFILE), T("libmatroska2 mkvgen"));
+    for (i=0; i<sizeof(UUID); ++i)
+        UUID[i] = (uint8_t)NextRandom(&Gen);
+    EBML_BinarySetData((ebml_binary*)EBML_MasterGetChild(Gen.Info, MATROSKA_getContextSegmentUUID(), MKVGEN_PROFILE), UUID, sizeof(UUID));
+    Err = EBML_ElementRender((ebml_element*)Gen.Info, Output, 0, 0, 1, MKVGEN_PROFILE, NULL);
+    if (Err!=ERR_NONE)
+        goto exit;
+
+    // Tracks
+    Tracks = (ebml_master*)EBML_MasterAddElt(Segment, MATROSKA_getContextTracks(), 0, MKVGEN_PROFILE);
+    if (!Tracks)
+    {
+        Err = ERR_OUT_OF_MEMORY;
+        goto exit;
+    }
+    EBML_MasterUseChecksum(Tracks, Config->UseCRC);
+    for (i=0, Track=ARRAYBEGIN(Gen.Tracks,gen_track); Track!=ARRAYEND(Gen.Tracks,gen_track); ++Track, ++i)
+    {
+        Track->Config = Config->Tracks + i;
+        if (Track->Config->StripSize > MKVGEN_MAX_STRIP || (Track->Config->Compression == MATROSKA_TRACK_ENCODING_COMP_HEADERSTRIP && !Track->Config->StripSize))
+        {
+            Err = ERR_INVALID_PARAM;
+            goto exit;
+        }
+        Track->Track = AddTrack(&Gen, Tracks, Track, i+1);
+        if (!Track->Track)
+        {
+            Err = ERR_OUT_OF_MEMORY;
+            goto exit;
+        }
+    }
+    Err = EBML_ElementRender((ebml_element*)Tracks, Output, 0, 0, 1, MKVGEN_PROFILE, NULL);
+    if (Err!=ERR_NONE)
+        goto exit;
+
+    // Clusters
+    if (!Config->Live && Config->CueInterval != MKVGEN_NO_CUES)
+    {
+        Cues = (ebml_master*)EBML_MasterAddElt(Segment, MATROSKA_getContextCues(), 0, MKVGEN_PROFILE);
+        if (!Cues)
+        {
+            Err = ERR_OUT_OF_MEMORY;
+            goto exit;
+        }
+        EBML_MasterUseChecksum(Cues, Config->UseCRC);
+    }
+    for (ClusterTimestamp=0; ClusterTimestamp < Config->Duration; ClusterTimestamp += Config->ClusterDuration)
+    {
+        Err = WriteCluster(&Gen, Output, (ebml_element*)Segment, Cues, ClusterTimestamp, MIN(ClusterTimestamp + Config->ClusterDuration, Config->Duration));
+        if (Err!=ERR_NONE)
+            goto exit;
+    }
+
+    if (Config->Live)
+    {
+        // nothing to write back
+        Gen.Stats->Size = Stream_Seek(Output, 0, SEEK_CUR);
+        goto exit;
+    }
+
+    // Cues
+    if (Cues && EBML_MasterCount(Cues))
+    {
+        Err = EBML_ElementRender((ebml_element*)Cues, Output, 0, 0, 1, MKVGEN_PROFILE, NULL);
+        if (Err!=ERR_NONE)
+            goto exit;
+    }
+
+    EndPos = Stream_Seek(Output, 0, SEEK_CUR);
+    Level1[0] = (ebml_element*)Gen.Info;
+    Level1[1] = (ebml_element*)Tracks;
+    Level1[2] = (Cues && EBML_MasterCount(Cues)) ? (ebml_element*)Cues : NULL;
+    Err = WriteSeekHead(Segment, Void, Output, Level1, 3, Config->UseCRC);
+    if (Err!=ERR_NONE)
+        goto exit;
+
+    EBML_ElementForceDataSize((ebml_element*)Segment, EndPos - EBML_ElementPositionData((ebml_element*)Segment));
+    if (Stream_Seek(Output, EBML_ElementPosition((ebml_element*)Segment), SEEK_SET) != EBML_ElementPosition((ebml_element*)Segment))
+    {
+        Err = ERR_NOT_SUPPORTED;
+        goto exit;
+    }
+    Err = EBML_ElementRenderHead((ebml_element*)Segment, Output, 0, NULL);
+    if (Err!=ERR_NONE)
+        goto exit;
+    Stream_Seek(Output, EndPos, SEEK_SET);
+    Gen.Stats->Size = EndPos;
+
+exit:
+    if (Void)
+        NodeDelete((node*)Void);
+    if (Segment)
+        NodeDelete((node*)Segment);
+    ArrayClear(&Gen.Tracks);
+    ArrayClear(&Gen.Pool);
+    ArrayClear(&Gen.Frame);
+    ArrayClear(&Gen.CueBlocks);
+    return Err;
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2026, Matroska (non-profit organisation)
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#ifndef MKVGEN_H
+#define MKVGEN_H
+
+#include "matroska2/matroska.h"
+#include "matroska2/matroska_sem.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// synthetic Matroska files, the same configuration always gives the same bytes
+
+typedef enum mkvgen_size_distribution
+{
+    MKVGEN_SIZE_UNIFORM,     // FrameSize +/- FrameSizeJitter, 0 jitter for fixed sizes
+    MKVGEN_SIZE_NORMAL,      // mean FrameSize, standard deviation FrameSizeJitter
+    MKVGEN_SIZE_EXPONENTIAL, // mean FrameSize, mostly small frames with a few big ones, FrameSizeJitter is not used
+
+} mkvgen_size_distribution;
+
+typedef struct mkvgen_track
+{
+    MatroskaTrackType Type;
+    const char *CodecID;
+    mkv_timestamp_t FrameDuration; // in ns
+    size_t FrameSize; // average size of a frame, keyframes of video tracks are 4 times bigger
+    size_t FrameSizeJitter; // how much the frame sizes vary, see mkvgen_size_distribution
+    size_t FramesPerBlock; // more than 1 to use lacing, fixed/Xiph/EBML depending on the sizes
+    size_t KeyframeInterval; // number of frames between keyframes, 0 when all frames are keyframes
+    MatroskaTrackEncodingCompAlgo Compression; // MATROSKA_TRACK_ENCODING_COMP_NONE, _ZLIB or _HEADERSTRIP
+    size_t StripSize; // size of the header common to all frames with MATROSKA_TRACK_ENCODING_COMP_HEADERSTRIP
+    mkvgen_size_distribution SizeDistribution;
+    bool_t UseBlockGroups; // BlockGroups with a ReferenceBlock on non keyframes rather than SimpleBlocks
+
+} mkvgen_track;
+
+#define MKVGEN_NO_CUES  INVALID_TIMESTAMP_T
+
+typedef struct mkvgen_config
+{
+    const mkvgen_track *Tracks;
+    size_t TrackCount;
+    mkv_timestamp_t Duration; // in ns
+    mkv_timestamp_t ClusterDuration; // in ns, no more than 30s
+    mkv_timestamp_t CueInterval; // minimum time between CuePoints on the first track keyframes, 0 for one per Cluster, MKVGEN_NO_CUES for none
+    bool_t UseCRC;
+    bool_t Live; // unknown size Segment and Clusters without SeekHead, Cues or Duration, the Output doesn't need to be seekable
+    uint32_t Seed;
+
+} mkvgen_config;
+
+typedef struct mkvgen_stats
+{
+    filepos_t Size;
+    size_t Clusters;
+    size_t Blocks;
+    size_t Frames;
+    size_t CuePoints;
+
+} mkvgen_stats;
+
+// writes a whole Segment in Output, one Cluster at a time
+err_t MKVGEN_Write(anynode *Any, struct stream *Output, const mkvgen_config *Config, mkvgen_stats *Stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MKVGEN_H */
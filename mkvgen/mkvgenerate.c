@@ -0,0 +1,357 @@
+/*
+ * Copyright (c) 2026, Matroska (non-profit organisation)
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include <stdlib.h>
+
+#include "mkvgen.h"
+#include "mkvgen_project.h"
+#include <corec/helpers/file/streams.h>
+#include <corec/helpers/date/date.h>
+#include <corec/str/str.h>
+#include <corec/helpers/parser/parser.h>
+
+#define MAX_TRACKS  64
+
+static textwriter *StdErr = NULL;
+
+#ifdef TARGET_WIN
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+void DebugMessage(const tchar_t* Msg,...)
+{
+#if !defined(NDEBUG) || defined(LOGFILE) || defined(LOGTIME)
+	va_list Args;
+	tchar_t Buffer[1024],*s=Buffer;
+
+	va_start(Args,Msg);
+	vstprintf_s(Buffer,TSIZEOF(Buffer), Msg, Args);
+	va_end(Args);
+	tcscat_s(Buffer,TSIZEOF(Buffer),T("\r\n"));
+#endif
+
+#ifdef LOGTIME
+    {
+        tchar_t timed[1024];
+        SysTickToString(timed,TSIZEOF(timed),GetTimeTick(),1);
+        stcatprintf_s(timed,TSIZEOF(timed),T(" %s"),s);
+        s = timed;
+    }
+#endif
+
+#if !defined(NDEBUG)
+	OutputDebugString(s);
+#endif
+
+#if defined(LOGFILE)
+{
+    static FILE* f=NULL;
+    static char s8[1024];
+    size_t i;
+    if (!f)
+        f=fopen("\\corelog.txt","a+b");
+    for (i=0;s[i];++i)
+        s8[i]=(char)s[i];
+    s8[i]=0;
+    fputs(s8,f);
+    fflush(f);
+}
+#endif
+}
+#else
+#include <stdio.h>
+void DebugMessage(const tchar_t* Msg,...)
+{
+    va_list Args;
+    tchar_t Buffer[1024];
+
+    va_start(Args,Msg);
+    vstprintf_s(Buffer,TSIZEOF(Buffer), Msg, Args);
+    va_end(Args);
+    tcscat_s(Buffer,TSIZEOF(Buffer),T("\r\n"));
+
+#ifdef UNICODE
+    fprintf(stderr, "%ls", Buffer);
+#else
+    fprintf(stderr, "%s", Buffer);
+#endif
+}
+#endif
+
+static int OutputError(int ErrCode, const tchar_t *ErrString, ...)
+{
+	tchar_t Buffer[MAXLINE];
+	va_list Args;
+	va_start(Args,ErrString);
+	vstprintf_s(Buffer,TSIZEOF(Buffer), ErrString, Args);
+	va_end(Args);
+	TextPrintf(StdErr,T("\rERR%03X: %s\r\n"),ErrCode,Buffer);
+	return -ErrCode;
+}
+
+int main(int argc, const char *argv[])
+{
+    int Result = 0;
+    int ShowUsage = 0;
+    int ShowVersion = 0;
+    bool_t Quiet = 0;
+    parsercontext p;
+    textwriter _StdErr;
+    struct stream *Output = NULL;
+    tchar_t Path[MAXPATHFULL];
+    tchar_t String[MAXLINE];
+    mkvgen_track Tracks[MAX_TRACKS], *Track;
+    mkvgen_config Config;
+    mkvgen_stats Stats;
+    mkvgen_size_distribution Sizes = MKVGEN_SIZE_UNIFORM;
+    MatroskaTrackEncodingCompAlgo Compression = MATROSKA_TRACK_ENCODING_COMP_NONE;
+    int VideoCount = 1, AudioCount = 1, SubtitleCount = 0;
+    size_t VideoSize = 20000, AudioSize = 400;
+    int Lacing = 0; // 0: none, 1: fixed, 2: Xiph, 3: EBML
+    bool_t BlockGroups = 0, ToStdOut = 0, Pcm = 0;
+    int Damage = 0;
+    systick_t Start;
+    double Seconds;
+    int i;
+
+    // Core-C init phase
+    ParserContext_Init(&p,NULL,NULL,NULL);
+    Node_SetData(&p.Base.Base.Base,NODECONTEXT_PROJECT_VENDOR,TYPE_STRING,"Matroska");
+    Node_SetData(&p.Base.Base.Base,NODECONTEXT_PROJECT_VERSION,TYPE_STRING,PROJECT_VERSION);
+    Node_SetData(&p.Base.Base.Base,NODECONTEXT_PROJECT_NAME,TYPE_STRING,PROJECT_NAME);
+
+    // EBML & Matroska Init
+    MATROSKA_Init(&p);
+
+    StdErr = &_StdErr;
+    memset(StdErr,0,sizeof(_StdErr));
+    StdErr->Stream = (struct stream*)NodeSingleton(&p,STDERR_ID);
+    assert(StdErr->Stream!=NULL);
+
+    memset(&Config,0,sizeof(Config));
+    Config.Duration = 60*(mkv_timestamp_t)1000000000;
+    Config.ClusterDuration = 5*(mkv_timestamp_t)1000000000;
+
+    for (i=1;i<argc;++i)
+    {
+        Node_FromStr(&p,Path,TSIZEOF(Path),argv[i]);
+        if (tcsisame_ascii(Path,T("--duration")) && i+1<argc-1) Config.Duration = (mkv_timestamp_t)atoi(argv[++i]) * 1000000000;
+        else if (tcsisame_ascii(Path,T("--cluster")) && i+1<argc-1) Config.ClusterDuration = (mkv_timestamp_t)atoi(argv[++i]) * 1000000;
+        else if (tcsisame_ascii(Path,T("--video")) && i+1<argc-1) VideoCount = atoi(argv[++i]);
+        else if (tcsisame_ascii(Path,T("--audio")) && i+1<argc-1) AudioCount = atoi(argv[++i]);
+        else if (tcsisame_ascii(Path,T("--subtitle")) && i+1<argc-1) SubtitleCount = atoi(argv[++i]);
+        else if (tcsisame_ascii(Path,T("--video-size")) && i+1<argc-1) VideoSize = (size_t)atoi(argv[++i]);
+        else if (tcsisame_ascii(Path,T("--audio-size")) && i+1<argc-1) AudioSize = (size_t)atoi(argv[++i]);
+        else if (tcsisame_ascii(Path,T("--sizes")) && i+1<argc-1)
+        {
+            Node_FromStr(&p,String,TSIZEOF(String),argv[++i]);
+            if (tcsisame_ascii(String,T("uniform"))) Sizes = MKVGEN_SIZE_UNIFORM;
+            else if (tcsisame_ascii(String,T("normal"))) Sizes = MKVGEN_SIZE_NORMAL;
+            else if (tcsisame_ascii(String,T("exponential"))) Sizes = MKVGEN_SIZE_EXPONENTIAL;
+            else TextPrintf(StdErr,T("Unknown frame size distribution '%s'\r\n"),String);
+        }
+        else if (tcsisame_ascii(Path,T("--lacing")) && i+1<argc-1)
+        {
+            Node_FromStr(&p,String,TSIZEOF(String),argv[++i]);
+            if (tcsisame_ascii(String,T("none"))) Lacing = 0;
+            else if (tcsisame_ascii(String,T("fixed"))) Lacing = 1;
+            else if (tcsisame_ascii(String,T("xiph"))) Lacing = 2;
+            else if (tcsisame_ascii(String,T("ebml"))) Lacing = 3;
+            else TextPrintf(StdErr,T("Unknown lacing '%s'\r\n"),String);
+        }
+        else if (tcsisame_ascii(Path,T("--compression")) && i+1<argc-1)
+        {
+            Node_FromStr(&p,String,TSIZEOF(String),argv[++i]);
+            if (tcsisame_ascii(String,T("none"))) Compression = MATROSKA_TRACK_ENCODING_COMP_NONE;
+            else if (tcsisame_ascii(String,T("zlib"))) Compression = MATROSKA_TRACK_ENCODING_COMP_ZLIB;
+            else if (tcsisame_ascii(String,T("strip"))) Compression = MATROSKA_TRACK_ENCODING_COMP_HEADERSTRIP;
+            else TextPrintf(StdErr,T("Unknown compression '%s'\r\n"),String);
+        }
+        else if (tcsisame_ascii(Path,T("--cues")) && i+1<argc-1)
+        {
+            Node_FromStr(&p,String,TSIZEOF(String),argv[++i]);
+            if (tcsisame_ascii(String,T("none")))
+                Config.CueInterval = MKVGEN_NO_CUES;
+            else
+                Config.CueInterval = (mkv_timestamp_t)atoi(argv[i]) * 1000000;
+        }
+        else if (tcsisame_ascii(Path,T("--seed")) && i+1<argc-1) Config.Seed = (uint32_t)strtoul(argv[++i],NULL,0);
+        else if (tcsisame_ascii(Path,T("--block-groups"))) BlockGroups = 1;
+        else if (tcsisame_ascii(Path,T("--pcm"))) Pcm = 1;
+        else if (tcsisame_ascii(Path,T("--crc"))) Config.UseCRC = 1;
+        else if (tcsisame_ascii(Path,T("--live"))) Config.Live = 1;
+        else if (tcsisame_ascii(Path,T("--damage")) && i+1<argc-1) Damage = atoi(argv[++i]);
+        else if (tcsisame_ascii(Path,T("--quiet"))) Quiet = 1;
+        else if (tcsisame_ascii(Path,T("--version"))) ShowVersion = 1;
+        else if (tcsisame_ascii(Path,T("--help"))) {ShowVersion = 1; ShowUsage = 1;}
+        else if (i<argc-1) TextPrintf(StdErr,T("Unknown parameter '%s'\r\n"),Path);
+    }
+
+    if (argc < 2 || ShowVersion)
+    {
+        TextWrite(StdErr,PROJECT_NAME T(" v") PROJECT_VERSION T(", Copyright (c) 2026 Matroska Foundation\r\n"));
+        if (argc < 2 || ShowUsage)
+        {
+            Result = OutputError(1,T("Usage: ") PROJECT_NAME T(" [options] <matroska_dst>"));
+            TextWrite(StdErr,T("Generates a Matroska file with synthetic frames, the same options always give the same file\r\n"));
+            TextWrite(StdErr,T("Options:\r\n"));
+            TextWrite(StdErr,T("  --duration <s>      duration of the file (60 s)\r\n"));
+            TextWrite(StdErr,T("  --cluster <ms>      duration of each Cluster (5000 ms)\r\n"));
+            TextWrite(StdErr,T("  --video <n>         number of video tracks (1)\r\n"));
+            TextWrite(StdErr,T("  --audio <n>         number of audio tracks (1)\r\n"));
+            TextWrite(StdErr,T("  --subtitle <n>      number of subtitle tracks (0)\r\n"));
+            TextWrite(StdErr,T("  --video-size <n>    average size of video frames, keyframes are 4 times bigger (20000)\r\n"));
+            TextWrite(StdErr,T("  --audio-size <n>    average size of audio frames (400)\r\n"));
+            TextWrite(StdErr,T("  --sizes <dist>      distribution of the frame sizes: uniform (default), normal, exponential\r\n"));
+            TextWrite(StdErr,T("  --lacing <type>     audio lacing: none (default), fixed, xiph (small frames), ebml (big frames)\r\n"));
+            TextWrite(StdErr,T("  --compression <c>   compression of all tracks: none (default), zlib, strip\r\n"));
+            TextWrite(StdErr,T("  --block-groups      use BlockGroups rather than SimpleBlocks\r\n"));
+            TextWrite(StdErr,T("  --pcm               uncompressed PCM audio tracks rather than AC-3\r\n"));
+            TextWrite(StdErr,T("  --cues <ms>         minimum time between CuePoints, 0 for one per Cluster (default), none for no Cues\r\n"));
+            TextWrite(StdErr,T("  --crc               add a CRC-32 to the level 1 elements\r\n"));
+            TextWrite(StdErr,T("  --live              unknown size Segment and Clusters, use - to write on the standard output\r\n"));
+            TextWrite(StdErr,T("  --seed <n>          seed of the generated data (1)\r\n"));
+            TextWrite(StdErr,T("  --damage <n>        overwrite <n> places of the file with garbage, to check the tools on invalid files\r\n"));
+            TextWrite(StdErr,T("  --quiet             don't output the file statistics\r\n"));
+            TextWrite(StdErr,T("  --version           show the version of ") PROJECT_NAME T("\r\n"));
+            TextWrite(StdErr,T("  --help              show this screen\r\n"));
+        }
+        goto exit;
+    }
+
+    if (VideoCount < 0 || AudioCount < 0 || SubtitleCount < 0 || VideoCount + AudioCount + SubtitleCount == 0 || VideoCount + AudioCount + SubtitleCount > MAX_TRACKS)
+    {
+        Result = OutputError(2,T("Between 1 and %d tracks can be generated"),MAX_TRACKS);
+        goto exit;
+    }
+
+    // the first track is the one used in the Cues
+    memset(Tracks,0,sizeof(Tracks));
+    Track = Tracks;
+    for (i=0; i<VideoCount; ++i, ++Track)
+    {
+        Track->Type = MATROSKA_TRACK_TYPE_VIDEO;
+        Track->CodecID = "V_MPEG4/ISO/ASP";
+        Track->FrameDuration = 40000000;
+        Track->FrameSize = VideoSize;
+        Track->FrameSizeJitter = VideoSize / 3;
+        Track->FramesPerBlock = 1;
+        Track->KeyframeInterval = 25;
+        Track->SizeDistribution = Sizes;
+    }
+    for (i=0; i<AudioCount; ++i, ++Track)
+    {
+        Track->Type = MATROSKA_TRACK_TYPE_AUDIO;
+        Track->CodecID = Pcm ? "A_PCM/INT/LIT" : "A_AC3";
+        Track->FrameDuration = 32000000;
+        Track->FrameSize = AudioSize;
+        Track->FrameSizeJitter = AudioSize / 4;
+        Track->FramesPerBlock = 1;
+        Track->SizeDistribution = Sizes;
+        // libmatroska2 picks the lacing from the frame sizes
+        switch (Lacing)
+        {
+        case 1:
+            Track->FramesPerBlock = 8;
+            Track->FrameSizeJitter = 0;
+            Track->SizeDistribution = MKVGEN_SIZE_UNIFORM;
+            break;
+        case 2:
+            Track->FramesPerBlock = 8;
+            Track->FrameSize = MIN(AudioSize, 150);
+            Track->FrameSizeJitter = Track->FrameSize * 2 / 3;
+            Track->SizeDistribution = MKVGEN_SIZE_UNIFORM;
+            break;
+        case 3:
+            Track->FramesPerBlock = 4;
+            Track->FrameSize = MAX(AudioSize, 2000);
+            Track->FrameSizeJitter = Track->FrameSize / 6;
+            Track->SizeDistribution = MKVGEN_SIZE_UNIFORM;
+            break;
+        }
+    }
+    for (i=0; i<SubtitleCount; ++i, ++Track)
+    {
+        Track->Type = MATROSKA_TRACK_TYPE_SUBTITLE;
+        Track->CodecID = "S_TEXT/UTF8";
+        Track->FrameDuration = 2000000000;
+        Track->FrameSize = 40;
+        Track->FrameSizeJitter = 20;
+        Track->FramesPerBlock = 1;
+        Track->SizeDistribution = Sizes;
+    }
+    for (Track=Tracks; Track!=Tracks + VideoCount + AudioCount + SubtitleCount; ++Track)
+    {
+        Track->Compression = Compression;
+        Track->StripSize = Compression==MATROSKA_TRACK_ENCODING_COMP_HEADERSTRIP ? 4 : 0;
+        Track->UseBlockGroups = BlockGroups;
+    }
+    Config.Tracks = Tracks;
+    Config.TrackCount = VideoCount + AudioCount + SubtitleCount;
+    if (!Config.Seed)
+        Config.Seed = 1;
+
+    Node_FromStr(&p,Path,TSIZEOF(Path),argv[argc-1]);
+    if (Config.Live && tcsisame_ascii(Path,T("-")))
+    {
+        Output = (struct stream*)NodeSingleton(&p,STDOUT_ID);
+        ToStdOut = 1;
+    }
+    else
+        Output = StreamOpen(&p,Path,SFLAG_WRONLY|SFLAG_CREATE|SFLAG_BUFFERED);
+    if (!Output)
+    {
+        Result = OutputError(3,T("Could not open file \"%s\" for writing"),Path);
+        goto exit;
+    }
+
+    Start = GetTimeTick();
+    if (MKVGEN_Write(&p, Output, &Config, &Stats)!=ERR_NONE)
+    {
+        Result = OutputError(4,T("Failed to generate \"%s\""),Path);
+        goto exit;
+    }
+    if (Damage > 0 && !ToStdOut && Stats.Size != INVALID_FILEPOS_T)
+    {
+        // the same garbage spread evenly in the file
+        uint8_t Garbage[16];
+        uint32_t Random = Config.Seed;
+        for (i=0; i<(int)sizeof(Garbage); ++i)
+        {
+            Random = Random * 1103515245 + 12345;
+            Garbage[i] = (uint8_t)(Random >> 16);
+        }
+        for (i=1; i<=Damage; ++i)
+        {
+            filepos_t Pos = Stats.Size * i / (Damage + 1);
+            if (Stream_Seek(Output,Pos,SEEK_SET)!=Pos || Stream_Write(Output,Garbage,sizeof(Garbage),NULL)!=ERR_NONE)
+            {
+                Result = OutputError(4,T("Failed to damage \"%s\""),Path);
+                goto exit;
+            }
+        }
+    }
+    if (ToStdOut)
+        Stream_Flush(Output);
+    Seconds = (double)(GetTimeTick() - Start) / GetTimeFreq();
+
+    if (!Quiet)
+    {
+        TextPrintf(StdErr,T("%s: %") TPRId64 T(" bytes, %d Clusters, %d Blocks, %d frames, %d CuePoints\r\n"),Path,Stats.Size,
+            (int)Stats.Clusters,(int)Stats.Blocks,(int)Stats.Frames,(int)Stats.CuePoints);
+        if (Seconds > 0 && Stats.Size != INVALID_FILEPOS_T)
+            TextPrintf(StdErr,T("written in %d ms, %d MB/s\r\n"),(int)(Seconds*1000),(int)(Stats.Size / Seconds / (1024*1024)));
+    }
+
+exit:
+    if (Output && !ToStdOut)
+        StreamClose(Output);
+
+    // EBML & Matroska ending
+    MATROSKA_Done(&p);
+
+    // Core-C ending
+    ParserContext_Done(&p);
+
+    return Result;
+}